@@ -0,0 +1,32 @@
+# !/bin/bash
+
+# compare the kd-tree and the hash-voxel map for scan-to-map matching on one sequence
+# bash replay_map_method.sh config.yaml /data/sequence/ /tmp/replay/ [extra flags of mloam_replay_benchmark]
+# the two runs see the same frames with the same seeds (-gf_method=wo_gf removes the time budget of
+# the good feature selection), the reports are written to $result_path/kdtree/ and $result_path/voxel/
+
+export config_file=$1
+export data_path=$2
+export result_path=$3
+shift 3
+
+for map_method in kdtree voxel
+do
+    mkdir -p $result_path/$map_method
+    rosrun mloam mloam_replay_benchmark \
+        -config_file=$config_file \
+        -data_path=$data_path \
+        -output_path=$result_path/$map_method/ \
+        -gf_method=wo_gf \
+        -map_method=$map_method \
+        "$@"
+done
+
+################# ATE of the mapping and the time per mapped frame (replay_frames.csv has the time of every frame)
+for map_method in kdtree voxel
+do
+    python3 -c "import json, sys; s = json.load(open(sys.argv[1])); \
+print('%-6s ate_map: %.4fm (%d poses), map_mean_ms: %.2f, fps: %.2f' % \
+(s['map_method'], s['ate_map']['rmse'], s['ate_map']['num'], s['map_mean_ms'], s['fps']))" \
+        $result_path/$map_method/replay_summary.json
+done
@@ -13,6 +13,20 @@ roslaunch mloam mloam_realvehicle_kitti.launch \
     output_path:=$result_path
 # sleep 5
 
+################# M-LOAM with the hash-voxel map instead of the kd-tree for scan-to-map matching
+# roslaunch mloam mloam_realvehicle_kitti.launch \
+#     run_mloam:=true \
+#     run_mloam_mapping:=true \
+#     with_ua:=false \
+#     run_aloam:=false \
+#     gf_method:=wo_gf \
+#     gf_ratio_ini:=1.0 \
+#     map_method:=voxel \
+#     result_save:=true \
+#     bag_file:=$data_path \
+#     output_path:=$result_path
+# sleep 5
+
 # roslaunch mloam mloam_realvehicle_kitti.launch \
 #     run_mloam:=true \
 #     run_mloam_mapping:=true \
@@ -39,6 +39,9 @@ void Estimator::setParameter()
 {
     m_process_.lock();
 
+    // the odometry should keep up with the sweeps
+    common::timing::Timing::SetDeadline(TIMING_HANDLE("odom_process"), SCAN_PERIOD);
+
     pose_rlt_.resize(NUM_OF_LASER);
     pose_laser_cur_.resize(NUM_OF_LASER);
     for (size_t i = 0; i < NUM_OF_LASER; i++)
@@ -97,7 +100,10 @@ void Estimator::setParameter()
     if (MULTIPLE_THREAD && !init_thread_flag_)
     {
         init_thread_flag_ = true;
-        process_thread_ = std::thread(&Estimator::processMeasurements, this);
+        process_thread_ = std::thread([this]() {
+            common::timing::Trace::SetThreadName("odometry");
+            processMeasurements();
+        });
     }
 
     para_pose_ = new double *[OPT_WINDOW_SIZE + 1];
@@ -214,7 +220,8 @@ void Estimator::inputCloud(const double &t, const std::vector<PointCloud> &v_las
 {
     assert(v_laser_cloud_in.size() == NUM_OF_LASER);
  
-    common::timing::Timer mea_pre_timer("odom_mea_pre");
+    common::timing::Trace::SetFrame(t);
+    common::timing::Timer mea_pre_timer(TIMING_HANDLE("odom_mea_pre"));
     std::vector<cloudFeature> feature_frame(NUM_OF_LASER);
 
     if (NUM_OF_LASER == 1)
@@ -225,9 +232,13 @@ void Estimator::inputCloud(const double &t, const std::vector<PointCloud> &v_las
         PointICloud laser_cloud_segment, laser_cloud_outlier;
         ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
         if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
+        common::timing::Timer segment_timer(TIMING_HANDLE("odom_segment"));
         img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+        segment_timer.Stop();
 
+        common::timing::Timer extract_timer(TIMING_HANDLE("odom_extract"));
         f_extract_.extractCloud(laser_cloud_segment, scan_info, feature_frame[0]);
+        extract_timer.Stop();
         feature_frame[0].insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
         total_corner_feature_ += feature_frame[0]["corner_points_less_sharp"].size();
         total_surf_feature_ += feature_frame[0]["surf_points_less_flat"].size();
@@ -249,16 +260,21 @@ void Estimator::inputCloud(const double &t, const std::vector<PointCloud> &v_las
         #pragma omp parallel for num_threads(NUM_OF_LASER)
         for (size_t i = 0; i < v_laser_cloud_in.size(); i++)
         {
+            common::timing::Trace::SetFrame(t);
             PointICloud laser_cloud;
             f_extract_.calTimestamp(v_laser_cloud_in[i], laser_cloud);
 
             PointICloud laser_cloud_segment, laser_cloud_outlier;
             ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
             if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
+            common::timing::Timer segment_timer(TIMING_HANDLE("odom_segment"));
             img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+            segment_timer.Stop();
 
             feature_frame_ptr[i] = new cloudFeature;
+            common::timing::Timer extract_timer(TIMING_HANDLE("odom_extract"));
             f_extract_.extractCloud(laser_cloud_segment, scan_info, *feature_frame_ptr[i]);
+            extract_timer.Stop();
             feature_frame_ptr[i]->insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
         }
 
@@ -284,7 +300,8 @@ void Estimator::inputCloud(const double &t, const std::vector<PointITimeCloud> &
 {
     assert(v_laser_cloud_in.size() == NUM_OF_LASER);
 
-    common::timing::Timer mea_pre_timer("odom_mea_pre");
+    common::timing::Trace::SetFrame(t);
+    common::timing::Timer mea_pre_timer(TIMING_HANDLE("odom_mea_pre"));
     std::vector<cloudFeature> feature_frame(NUM_OF_LASER);
 
     if (NUM_OF_LASER == 1)
@@ -295,9 +312,13 @@ void Estimator::inputCloud(const double &t, const std::vector<PointITimeCloud> &
         PointICloud laser_cloud_segment, laser_cloud_outlier;
         ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
         if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
+        common::timing::Timer segment_timer(TIMING_HANDLE("odom_segment"));
         img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+        segment_timer.Stop();
 
+        common::timing::Timer extract_timer(TIMING_HANDLE("odom_extract"));
         f_extract_.extractCloud(laser_cloud_segment, scan_info, feature_frame[0]);
+        extract_timer.Stop();
         feature_frame[0].insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
         total_corner_feature_ += feature_frame[0]["corner_points_less_sharp"].size();
         total_surf_feature_ += feature_frame[0]["surf_points_less_flat"].size();
@@ -308,16 +329,21 @@ void Estimator::inputCloud(const double &t, const std::vector<PointITimeCloud> &
         #pragma omp parallel for num_threads(NUM_OF_LASER)
         for (size_t i = 0; i < v_laser_cloud_in.size(); i++)
         {
+            common::timing::Trace::SetFrame(t);
             PointICloud laser_cloud;
             f_extract_.calTimestamp(v_laser_cloud_in[i], laser_cloud);
 
             PointICloud laser_cloud_segment, laser_cloud_outlier;
             ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
             if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
+            common::timing::Timer segment_timer(TIMING_HANDLE("odom_segment"));
             img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+            segment_timer.Stop();
 
             feature_frame_ptr[i] = new cloudFeature;
+            common::timing::Timer extract_timer(TIMING_HANDLE("odom_extract"));
             f_extract_.extractCloud(laser_cloud_segment, scan_info, *feature_frame_ptr[i]);
+            extract_timer.Stop();
             feature_frame_ptr[i]->insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
         }
 
@@ -355,7 +381,8 @@ void Estimator::processMeasurements()
             m_buf_.unlock();
 
             m_process_.lock();
-            common::timing::Timer odom_process_timer("odom_process");
+            common::timing::Trace::SetFrame(cur_feature_.first);
+            common::timing::Timer odom_process_timer(TIMING_HANDLE("odom_process"));
             process();
             double time_process = odom_process_timer.Stop() * 1000;
             std::cout << common::RED << "frame: " << frame_cnt_
@@ -363,8 +390,22 @@ void Estimator::processMeasurements()
             LOG_EVERY_N(INFO, 20) << "odom process time: " << time_process << "ms";
 
             // printStatistics(*this, 0);
-            pubOdometry(*this, cur_time_);
-            if (frame_cnt_ % SKIP_NUM_ODOM_PUB == 0) pubPointCloud(*this, cur_time_); 
+            if (frame_callback_)
+            {
+                Pose pose_laser_cur = getOdometryPose();
+                odom_traj_writer_.addPose(cur_time_, pose_laser_cur.q_, pose_laser_cur.t_);
+                if (frame_cnt_ % SKIP_NUM_ODOM_PUB == 0)
+                {
+                    OdometryFrame::Ptr frame(new OdometryFrame());
+                    getOdometryFrame(cur_time_, *frame);
+                    frame_callback_(frame);
+                }
+            }
+            else
+            {
+                pubOdometry(*this, cur_time_);
+                if (frame_cnt_ % SKIP_NUM_ODOM_PUB == 0) pubPointCloud(*this, cur_time_); 
+            }
             frame_cnt_++;
             m_process_.unlock();
         }
@@ -373,6 +414,40 @@ void Estimator::processMeasurements()
     }
 }
 
+// the pose of the reference laser in the world of odometry
+Pose Estimator::getOdometryPose() const
+{
+    if (solver_flag_ == INITIAL)
+        return pose_laser_cur_[IDX_REF];
+    else
+        return Pose(Qs_[cir_buf_cnt_ - 1], Ts_[cir_buf_cnt_ - 1]);
+}
+
+void Estimator::getOdometryFrame(const double &time, OdometryFrame &frame) const
+{
+    frame.time_ = time;
+    for (size_t n = 0; n < NUM_OF_LASER; n++)
+    {
+        Pose pose_ext = Pose(qbl_[n], tbl_[n]);
+        cloudFeature cloud_feature_trans = transformCloudFeature(cur_feature_.second[n], pose_ext.T_.cast<float>(), n);
+        frame.laser_cloud_ += cloud_feature_trans["laser_cloud"];
+        if ((ESTIMATE_EXTRINSIC == 0) || (n == IDX_REF))
+        {
+            frame.laser_cloud_outlier_ += cloud_feature_trans["laser_cloud_outlier"];
+            frame.corner_points_less_sharp_ += cloud_feature_trans["corner_points_less_sharp"];
+            frame.surf_points_less_flat_ += cloud_feature_trans["surf_points_less_flat"];
+        }
+    }
+    frame.pose_wodom_curr_ = getOdometryPose();
+    frame.ext_status_ = ESTIMATE_EXTRINSIC;
+    frame.pose_ext_.resize(NUM_OF_LASER);
+    for (size_t n = 0; n < NUM_OF_LASER; n++)
+    {
+        frame.pose_ext_[n] = Pose(qbl_[n], tbl_[n]);
+        frame.pose_ext_[n].cov_ = covbl_[n];
+    }
+}
+
 void Estimator::undistortMeasurements(const std::vector<Pose> &pose_undist)
 {
     for (size_t n = 0; n < NUM_OF_LASER; n++)
@@ -415,7 +490,7 @@ void Estimator::process()
         printf("System initialization finished \n");
     } else
     {
-        common::timing::Timer tracker_timer("odom_tracker");
+        common::timing::Timer tracker_timer(TIMING_HANDLE("odom_tracker"));
         // -----------------
         // tracker and initialization
         if (ESTIMATE_EXTRINSIC == 2)
@@ -848,7 +923,7 @@ void Estimator::optimizeMap()
     }
     
     // *******************************
-    common::timing::Timer eval_deg_timer("odom_eval_residual");
+    common::timing::Timer eval_deg_timer(TIMING_HANDLE("odom_eval_residual"));
     evalResidual(problem,
                  local_param_ids,
                  para_ids,
@@ -857,7 +932,7 @@ void Estimator::optimizeMap()
                  res_ids_marg);
     printf("evaluate residual: %fms\n", eval_deg_timer.Stop() * 1000);
 
-    common::timing::Timer solver_timer("odom_solver");
+    common::timing::Timer solver_timer(TIMING_HANDLE("odom_solver"));
     ceres::Solve(options, &problem, &summary);
     std::cout << summary.BriefReport() << std::endl;
     // std::cout << summary.FullReport() << std::endl;
@@ -870,7 +945,7 @@ void Estimator::optimizeMap()
     // prepare all the residuals, jacobians, and dropped parameter blocks to construct marginalization prior 
     if (MARGINALIZATION_FACTOR)
     {
-        common::timing::Timer marg_timer("odom_marg");
+        common::timing::Timer marg_timer(TIMING_HANDLE("odom_marg"));
         MarginalizationInfo *marginalization_info = new MarginalizationInfo();
         vector2Double();
         // indicate the prior error
@@ -1066,7 +1141,7 @@ void Estimator::optimizeMap()
 /****************************************************************************************/
 void Estimator::buildCalibMap()
 {
-    common::timing::Timer build_map_timer("odom_build_calib_map");
+    common::timing::Timer build_map_timer(TIMING_HANDLE("odom_build_calib_map"));
     int pivot_idx = WINDOW_SIZE - OPT_WINDOW_SIZE;
     Pose pose_pivot(Qs_[pivot_idx], Ts_[pivot_idx]);
 
@@ -1158,7 +1233,7 @@ void Estimator::buildCalibMap()
 /****************************************************************************************/
 void Estimator::buildLocalMap()
 {
-    common::timing::Timer build_map_timer("odom_build_local_map");
+    common::timing::Timer build_map_timer(TIMING_HANDLE("odom_build_local_map"));
     int pivot_idx = WINDOW_SIZE - OPT_WINDOW_SIZE;
     Pose pose_pivot(Qs_[pivot_idx], Ts_[pivot_idx]);
 
@@ -1370,7 +1445,7 @@ void Estimator::goodFeatureMatching(const pcl::KdTreeFLANN<PointI>::Ptr &kdtree_
     size_t size_rnd_subset = static_cast<size_t>(1.0 * num_all_features / num_use_features);
     Eigen::Matrix<double, 6, 6> sub_mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
     size_t num_sel_features = 0;
-    common::timing::Timer gfm_timer("odom_match_feat");
+    common::timing::Timer gfm_timer(TIMING_HANDLE("odom_match_feat"));
 
     size_t n_neigh = 5;
     bool b_match;  
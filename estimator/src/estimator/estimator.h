@@ -17,6 +17,8 @@
 #include <mutex>
 #include <unordered_map>
 #include <queue>
+#include <memory>
+#include <functional>
 
 #include <omp.h>
 #include <time.h>
@@ -51,6 +53,7 @@
 #include "../utility/cloud_visualizer.h"
 #include "../utility/tic_toc.h"
 #include "../utility/CircularBuffer.h"
+#include "../utility/trajectory_writer.h"
 #include "../factor/lidar_online_calib_factor.hpp"
 #include "../factor/lidar_pure_odom_factor.hpp"
 #include "../factor/pose_local_parameterization.h"
@@ -62,6 +65,22 @@
 #define MAX_FEATURE_SELECT_TIME 7 // 7ms
 #define MAX_RANDOM_QUEUE_TIME 10
 
+// the output of odometry consumed by the mapper in the same process, carrying what pubOdometry and pubPointCloud publish
+struct OdometryFrame
+{
+    typedef std::shared_ptr<OdometryFrame> Ptr;
+
+    double time_;
+    // clouds of all lasers in the frame of the reference laser
+    common::PointICloud laser_cloud_, laser_cloud_outlier_;
+    common::PointICloud corner_points_less_sharp_, surf_points_less_flat_;
+    Pose pose_wodom_curr_;
+    std::vector<Pose> pose_ext_;
+    int ext_status_; // ESTIMATE_EXTRINSIC, the extrinsics are not used by the mapper until the calibration converges
+};
+
+typedef std::function<void(const OdometryFrame::Ptr &)> OdometryFrameCallback;
+
 class Estimator
 {
   public:
@@ -71,6 +90,11 @@ class Estimator
     void clearState();
     void setParameter();
 
+    // hand the frames to callback instead of publishing them, at the rate of pubPointCloud
+    void setFrameCallback(const OdometryFrameCallback &callback) { frame_callback_ = callback; }
+    Pose getOdometryPose() const;
+    void getOdometryFrame(const double &time, OdometryFrame &frame) const;
+
     void inputCloud(const double &t, const std::vector<common::PointCloud> &v_laser_cloud_in);
     void inputCloud(const double &t, const std::vector<common::PointITimeCloud> &v_laser_cloud_in);
     void inputCloud(const double &t, const common::PointCloud &laser_cloud_in);
@@ -223,11 +247,14 @@ class Estimator
       total_solver_time_, total_marginalization_time_, total_whole_odom_time_;
     int total_corner_feature_, total_surf_feature_;
 
-    std::vector<nav_msgs::Path> v_laser_path_;
+    std::vector<nav_msgs::Path> v_laser_path_; // the newest PATH_WINDOW_SIZE poses for publishing
+    TrajectoryWriter odom_traj_writer_; // the whole odometry of IDX_REF, opened by the node if the results are saved
 
     pcl::PCDWriter pcd_writer_;
 
     common::RandomGeneratorInt<size_t> rgi_;
+
+    OdometryFrameCallback frame_callback_;
 };
 
 
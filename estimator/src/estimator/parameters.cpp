@@ -13,6 +13,8 @@
 
 #include "parameters.h"
 
+#include <omp.h>
+
 int MLOAM_RESULT_SAVE;
 std::string OUTPUT_FOLDER;
 std::string MLOAM_ODOM_PATH;
@@ -85,6 +87,7 @@ int N_CALIB;
 float ODOM_GF_RATIO;
 
 int SKIP_NUM_ODOM_PUB;
+int PATH_WINDOW_SIZE;
 int LM_OPT_ENABLE;
 
 // mapping
@@ -103,6 +106,7 @@ float UCT_EXT_RATIO;
 std::vector<Eigen::Matrix<double, 6, 6> > COV_EXT;
 Eigen::Matrix<double, 3, 3> COV_MEASUREMENT;
 double TRACE_THRESHOLD_MAPPING;
+int UCT_THREAD_NUM;
 
 template <typename T>
 T readParam(ros::NodeHandle &n, std::string name)
@@ -253,6 +257,10 @@ void readParameters(std::string config_file)
     SKIP_NUM_ODOM_PUB = fsSettings["skip_num_odom_pub"];
     if (SKIP_NUM_ODOM_PUB == 0) SKIP_NUM_ODOM_PUB = 1;
 
+    // the poses kept in the published paths, the whole trajectory is written by TrajectoryWriter
+    PATH_WINDOW_SIZE = fsSettings["path_window_size"];
+    if (PATH_WINDOW_SIZE <= 0) PATH_WINDOW_SIZE = 2000;
+
     LM_OPT_ENABLE = fsSettings["lm_opt_enable"];
 
     // mapping 
@@ -289,6 +297,8 @@ void readParameters(std::string config_file)
     COV_MEASUREMENT = vec_uct_measurement.asDiagonal();
 
     TRACE_THRESHOLD_MAPPING = fsSettings["trace_threshold_mapping"];
+    UCT_THREAD_NUM = fsSettings["uct_thread_num"];
+    if (UCT_THREAD_NUM <= 0) UCT_THREAD_NUM = omp_get_max_threads();
 
     fsSettings.release();
 }
@@ -113,6 +113,7 @@ extern int N_CALIB;
 extern float ODOM_GF_RATIO;
 
 extern int SKIP_NUM_ODOM_PUB;
+extern int PATH_WINDOW_SIZE;
 extern int LM_OPT_ENABLE;
 
 // mapping
@@ -131,6 +132,7 @@ extern float UCT_EXT_RATIO;
 extern std::vector<Eigen::Matrix<double, 6, 6> > COV_EXT;
 extern Eigen::Matrix<double, 3, 3> COV_MEASUREMENT;
 extern double TRACE_THRESHOLD_MAPPING;
+extern int UCT_THREAD_NUM;
 
 void readParameters(std::string config_file);
 
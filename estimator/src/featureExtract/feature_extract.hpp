@@ -107,8 +107,10 @@ public:
                           const size_t &N_NEIGH = 5,
                           const bool &CHECK_FOV = true);
 
-    template <typename PointType>
-    bool matchCornerPointFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_corner_from_map,
+    // KdTreePtr: pcl::KdTreeFLANN<PointType>::Ptr or pcl::IKdTree<PointType>::Ptr,
+    // the search indices refer to the points of cloud_map
+    template <typename PointType, typename KdTreePtr>
+    bool matchCornerPointFromMap(const KdTreePtr &kdtree_corner_from_map,
                                  const typename pcl::PointCloud<PointType> &cloud_map,
                                  const PointType &point_ori,
                                  const Pose &pose_local,
@@ -117,8 +119,10 @@ public:
                                  const size_t &N_NEIGH = 5,
                                  const bool &CHECK_FOV = true);
 
-    template <typename PointType>
-    bool matchSurfPointFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_surf_from_map,
+    // KdTreePtr: pcl::KdTreeFLANN<PointType>::Ptr or pcl::IKdTree<PointType>::Ptr,
+    // the search indices refer to the points of cloud_map
+    template <typename PointType, typename KdTreePtr>
+    bool matchSurfPointFromMap(const KdTreePtr &kdtree_surf_from_map,
                                const typename pcl::PointCloud<PointType> &cloud_map,
                                const PointType &point_ori,
                                const Pose &pose_local,
@@ -642,8 +646,8 @@ void FeatureExtract::matchSurfFromMap(const typename pcl::KdTreeFLANN<PointType>
     features.resize(cloud_cnt);
 }
 
-template <typename PointType>
-bool FeatureExtract::matchCornerPointFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_corner_from_map,
+template <typename PointType, typename KdTreePtr>
+bool FeatureExtract::matchCornerPointFromMap(const KdTreePtr &kdtree_corner_from_map,
                                              const typename pcl::PointCloud<PointType> &cloud_map,
                                              const PointType &point_ori,
                                              const Pose &pose_local,
@@ -663,7 +667,8 @@ bool FeatureExtract::matchCornerPointFromMap(const typename pcl::KdTreeFLANN<Poi
 
     PointType point_sel;
     pointAssociateToMap(point_ori, point_sel, pose_local);
-    kdtree_corner_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis);
+    if (kdtree_corner_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis) < num_neighbors)
+        return false;
     if (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS)
     {
         // calculate the coefficients of edge points
@@ -787,8 +792,8 @@ bool FeatureExtract::matchCornerPointFromMap(const typename pcl::KdTreeFLANN<Poi
     return false;
 }
 
-template <typename PointType>
-bool FeatureExtract::matchSurfPointFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_surf_from_map,
+template <typename PointType, typename KdTreePtr>
+bool FeatureExtract::matchSurfPointFromMap(const KdTreePtr &kdtree_surf_from_map,
                                            const typename pcl::PointCloud<PointType> &cloud_map,
                                            const PointType &point_ori,
                                            const Pose &pose_local,
@@ -810,7 +815,8 @@ bool FeatureExtract::matchSurfPointFromMap(const typename pcl::KdTreeFLANN<Point
 
     PointType point_sel;
     pointAssociateToMap(point_ori, point_sel, pose_local);
-    kdtree_surf_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis);
+    if (kdtree_surf_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis) < num_neighbors)
+        return false;
     if (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS)
     {
         std::vector<bool> point_select(num_neighbors, true);
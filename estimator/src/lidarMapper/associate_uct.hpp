@@ -1,6 +1,12 @@
 #pragma once
 
+#include <vector>
+#include <omp.h>
+
 #include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/StdVector>
+
+#include "mloam_pcl/point_with_cov.hpp"
 
 #include "../utility/utility.h"
 #include "../estimator/pose.h"
@@ -216,3 +222,105 @@ inline void evalPointUncertainty(const PointType &pi, Eigen::Matrix3d &cov_point
 
 
 
+// ****************** batched uncertainty propagation
+// with q = T * p the point in the output frame, evalPointUncertainty reduces to
+//   cov = A + R * COV_MEASUREMENT * R^T + B * [q]x - [q]x * B^T - [q]x * C * [q]x
+// where [A, B; B^T, C] is the (translation, rotation) covariance of the LiDAR pose and R its rotation,
+// so the point-independent blocks are computed only once per LiDAR
+class PointUncertaintyBlock
+{
+public:
+    PointUncertaintyBlock() {}
+
+    PointUncertaintyBlock(const Pose &pose)
+    {
+        const Eigen::Matrix3d R = pose.q_.toRotationMatrix();
+        cov_const_ = pose.cov_.topLeftCorner<3, 3>() + R * COV_MEASUREMENT * R.transpose();
+        cov_tr_ = pose.cov_.topRightCorner<3, 3>();
+        cov_rr_ = pose.cov_.bottomRightCorner<3, 3>();
+    }
+
+    // q: the point in the output frame
+    inline void eval(const Eigen::Vector3d &q, Eigen::Matrix3d &cov_point) const
+    {
+        const Eigen::Matrix3d S = Utility::skewSymmetric(q);
+        const Eigen::Matrix3d BS = cov_tr_ * S;
+        cov_point = cov_const_ + BS + BS.transpose() - S * cov_rr_ * S; // -[q]x * B^T = ([B * [q]x])^T
+    }
+
+    Eigen::Matrix3d cov_const_;
+    Eigen::Matrix3d cov_tr_;
+    Eigen::Matrix3d cov_rr_;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/*
+ * transform cloud_in by pose_out and attach the propagated uncertainty of each point,
+ * the same as calling pointAssociateToMap, evalPointUncertainty and updateCov point by point
+ * cloud_in: points in the reference LiDAR frame, intensity indicates the LiDAR id
+ * pose_uct: the pose (with covariance) that maps the points of each LiDAR into the output frame
+ * points with the trace of covariance larger than trace_threshold are removed (only with_ua)
+ */
+template <typename PointType>
+inline void evalPointUncertaintyBatch(const pcl::PointCloud<PointType> &cloud_in,
+                                      common::PointICovCloud &cloud_out,
+                                      const Pose &pose_out,
+                                      const std::vector<Pose> &pose_uct,
+                                      const bool &with_ua,
+                                      const double &trace_threshold,
+                                      const int &num_threads = 1)
+{
+    const size_t BLOCK_SIZE = 256;
+    std::vector<PointUncertaintyBlock, Eigen::aligned_allocator<PointUncertaintyBlock> > uct_block;
+    uct_block.reserve(pose_uct.size());
+    for (const Pose &pose : pose_uct) uct_block.push_back(PointUncertaintyBlock(pose));
+    const Eigen::Matrix3d R_out = pose_out.q_.toRotationMatrix();
+    const Eigen::Vector3d t_out = pose_out.t_;
+
+    const size_t cloud_size = cloud_in.size();
+    const int num_blocks = static_cast<int>((cloud_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    cloud_out.resize(cloud_size);
+    std::vector<uint8_t> point_valid(cloud_size, 0);
+
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (int b = 0; b < num_blocks; b++)
+    {
+        const size_t begin = b * BLOCK_SIZE;
+        const size_t end = std::min(begin + BLOCK_SIZE, cloud_size);
+        // transform the block at once (SoA)
+        Eigen::Matrix<double, 3, Eigen::Dynamic> points(3, end - begin);
+        for (size_t i = begin; i < end; i++)
+            points.col(i - begin) << cloud_in.points[i].x, cloud_in.points[i].y, cloud_in.points[i].z;
+        points = (R_out * points).colwise() + t_out;
+
+        Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
+        for (size_t i = begin; i < end; i++)
+        {
+            const Eigen::Vector3d q = points.col(i - begin);
+            const PointType &point_ori = cloud_in.points[i];
+            if (with_ua)
+            {
+                uct_block[int(point_ori.intensity)].eval(q, cov_point);
+                if (cov_point.trace() > trace_threshold) continue;
+            }
+            common::PointIWithCov &point_cov = cloud_out.points[i];
+            point_cov.x = q.x();
+            point_cov.y = q.y();
+            point_cov.z = q.z();
+            point_cov.intensity = point_ori.intensity;
+            common::updateCov(point_cov, cov_point);
+            point_valid[i] = 1;
+        }
+    }
+
+    // keep the order of the input points
+    size_t num_valid = 0;
+    for (size_t i = 0; i < cloud_size; i++)
+    {
+        if (!point_valid[i]) continue;
+        if (num_valid != i) cloud_out.points[num_valid] = cloud_out.points[i];
+        num_valid++;
+    }
+    cloud_out.resize(num_valid);
+}
@@ -0,0 +1,401 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/StdVector>
+
+#include "common/types/type.h"
+#include "mloam_pcl/point_with_cov.hpp"
+
+// pack the (i, j, k) index of a voxel into a single 64-bit key (21 bits per axis)
+inline int64_t voxelKey(const int &i, const int &j, const int &k)
+{
+    const int64_t mask = (1 << 21) - 1;
+    return ((int64_t(i) & mask) << 42) | ((int64_t(j) & mask) << 21) | (int64_t(k) & mask);
+}
+
+template <typename PointType>
+inline int64_t voxelKey(const PointType &p, const float &inv_leaf_size)
+{
+    return voxelKey(static_cast<int>(floor(p.x * inv_leaf_size)),
+                    static_cast<int>(floor(p.y * inv_leaf_size)),
+                    static_cast<int>(floor(p.z * inv_leaf_size)));
+}
+
+// ****************** hash grid of keyframe positions for radius search without kd-tree rebuild
+class KeyframePositionGrid
+{
+public:
+    KeyframePositionGrid() : inv_cell_size_(0.1f) {}
+
+    void setCellSize(const float &cell_size) { inv_cell_size_ = 1.0f / cell_size; }
+
+    void clear() { grid_.clear(); }
+
+    // pose_3d.intensity stores the keyframe id
+    void insert(const common::PointI &pose_3d)
+    {
+        grid_[voxelKey(pose_3d, inv_cell_size_)].push_back(pose_3d);
+    }
+
+    // the cell size should be no smaller than the radius, so that the 27 neighboring cells cover the query ball
+    void radiusSearch(const common::PointI &point, const float &radius, std::vector<int> &keyframe_id) const
+    {
+        keyframe_id.clear();
+        const float sq_radius = radius * radius;
+        const int ci = static_cast<int>(floor(point.x * inv_cell_size_));
+        const int cj = static_cast<int>(floor(point.y * inv_cell_size_));
+        const int ck = static_cast<int>(floor(point.z * inv_cell_size_));
+        for (int di = -1; di <= 1; di++)
+            for (int dj = -1; dj <= 1; dj++)
+                for (int dk = -1; dk <= 1; dk++)
+                {
+                    auto it = grid_.find(voxelKey(ci + di, cj + dj, ck + dk));
+                    if (it == grid_.end()) continue;
+                    for (const common::PointI &p : it->second)
+                    {
+                        float sq_dis = (p.x - point.x) * (p.x - point.x) +
+                                       (p.y - point.y) * (p.y - point.y) +
+                                       (p.z - point.z) * (p.z - point.z);
+                        if (sq_dis <= sq_radius) keyframe_id.push_back(int(p.intensity));
+                    }
+                }
+    }
+
+private:
+    float inv_cell_size_;
+    std::unordered_map<int64_t, std::vector<common::PointI> > grid_;
+};
+
+// ****************** persistent voxel-hashed submap built from keyframe clouds
+// each voxel keeps the running sums of the covariance-weighted fusion used in VoxelGridCovarianceMLOAM:
+// w = trace_threshold - trace(cov), mu = sum(w * p) / sum(w), cov = sum(w^2 * cov) / sum(w)^2
+// so that a keyframe can be inserted or removed without refiltering the whole submap
+class KeyframeSubmap
+{
+public:
+    // the most certain point of a keyframe in a voxel
+    struct KeyframeBest
+    {
+        int key_ind_;
+        float w_;
+        float intensity_;
+    };
+
+    struct Voxel
+    {
+        Voxel() : weight_(0), intensity_(0), w_max_(0), cnt_(0)
+        {
+            sum_point_.setZero();
+            sum_cov_.setZero();
+        }
+
+        Eigen::Vector3d sum_point_;
+        Eigen::Matrix<double, 6, 1> sum_cov_; // cxx, cxy, cxz, cyy, cyz, czz
+        Eigen::Vector3i ijk_;
+        double weight_;
+        float intensity_; // of the most certain point among best_
+        float w_max_;
+        int cnt_;
+        std::vector<KeyframeBest> best_; // so that intensity_ and w_max_ can be restored when a keyframe is removed
+    };
+
+    KeyframeSubmap() : inv_leaf_size_(1.0f), trace_threshold_(2.0), rebuild_ratio_(0.3f) {}
+
+    void setLeafSize(const float &leaf_size) { inv_leaf_size_ = 1.0f / leaf_size; }
+
+    void setTraceThreshold(const double &trace_threshold) { trace_threshold_ = trace_threshold; }
+
+    // updateTree rebuilds the tree instead of updating it if more than rebuild_ratio of the voxels changed
+    void setRebuildRatio(const float &rebuild_ratio) { rebuild_ratio_ = rebuild_ratio; }
+
+    void clear()
+    {
+        voxels_.clear();
+        keyframes_.clear();
+        dirty_voxels_.clear();
+    }
+
+    bool hasKeyframe(const int &key_ind) const { return keyframes_.find(key_ind) != keyframes_.end(); }
+
+    std::vector<int> getKeyframeIndices() const
+    {
+        std::vector<int> key_inds;
+        key_inds.reserve(keyframes_.size());
+        for (const auto &kf : keyframes_) key_inds.push_back(kf.first);
+        return key_inds;
+    }
+
+    size_t keyframeSize() const { return keyframes_.size(); }
+
+    size_t size() const { return voxels_.size(); }
+
+    // cloud: the keyframe cloud in the world frame
+    void insertKeyframe(const int &key_ind, const common::PointICovCloudPtr &cloud)
+    {
+        if (hasKeyframe(key_ind)) return;
+        keyframes_[key_ind] = cloud;
+        for (const common::PointIWithCov &point : *cloud) updateVoxel(key_ind, point, 1);
+    }
+
+    void removeKeyframe(const int &key_ind)
+    {
+        auto it = keyframes_.find(key_ind);
+        if (it == keyframes_.end()) return;
+        for (const common::PointIWithCov &point : *(it->second)) updateVoxel(key_ind, point, -1);
+        keyframes_.erase(it);
+    }
+
+    // output one fused point per voxel
+    void getCloud(common::PointICovCloud &cloud) const
+    {
+        cloud.clear();
+        cloud.reserve(voxels_.size());
+        for (const auto &v : voxels_)
+        {
+            if (v.second.weight_ <= 0) continue;
+            cloud.push_back(fusePoint(v.second));
+        }
+    }
+
+    /** \brief Apply the voxels changed since the last call to a search tree holding the fused points
+      * (e.g. pcl::IKdTree): the old points of the changed voxels are deleted by their voxel boxes in one batch
+      * and the new ones inserted. An empty tree, or one with more than rebuild_ratio of the voxels changed,
+      * is built from the whole submap at once.
+      */
+    template <typename TreeT>
+    void updateTree(TreeT &tree)
+    {
+        const float leaf_size = 1.0f / inv_leaf_size_;
+        if ((tree.size() == 0) || (dirty_voxels_.size() > rebuild_ratio_ * voxels_.size()))
+        {
+            common::PointICovCloud cloud;
+            cloud.reserve(voxels_.size());
+            for (const auto &v : voxels_)
+            {
+                if (v.second.weight_ <= 0) continue;
+                const Eigen::Vector3f box_min = v.second.ijk_.cast<float>() * leaf_size;
+                cloud.push_back(fusePoint(v.second, &box_min));
+            }
+            tree.build(cloud);
+            dirty_voxels_.clear();
+            return;
+        }
+
+        std::vector<std::pair<Eigen::Vector3f, Eigen::Vector3f> > boxes;
+        boxes.reserve(dirty_voxels_.size());
+        common::PointICovCloud cloud_insert;
+        for (const auto &d : dirty_voxels_)
+        {
+            const Eigen::Vector3f box_min = d.second.cast<float>() * leaf_size;
+            boxes.emplace_back(box_min, box_min + Eigen::Vector3f::Constant(leaf_size));
+            auto it = voxels_.find(d.first);
+            if ((it != voxels_.end()) && (it->second.weight_ > 0))
+                cloud_insert.push_back(fusePoint(it->second, &box_min));
+        }
+        tree.deleteBoxes(boxes);
+        tree.addPoints(cloud_insert);
+        dirty_voxels_.clear();
+    }
+
+private:
+    // box_min: if given, keep the fused point strictly inside its voxel box so that updateTree can delete it by box
+    common::PointIWithCov fusePoint(const Voxel &voxel, const Eigen::Vector3f *box_min = nullptr) const
+    {
+        const double sq_weight = voxel.weight_ * voxel.weight_;
+        Eigen::Vector3f mu = (voxel.sum_point_ / voxel.weight_).cast<float>();
+        const Eigen::Matrix<double, 6, 1> cov = voxel.sum_cov_ / sq_weight;
+        if (box_min)
+        {
+            const float margin = 1e-3f / inv_leaf_size_;
+            const float leaf_size = 1.0f / inv_leaf_size_;
+            for (size_t i = 0; i < 3; i++)
+                mu(i) = std::min(std::max(mu(i), (*box_min)(i) + margin), (*box_min)(i) + leaf_size - margin);
+        }
+        return common::PointIWithCov(mu.x(), mu.y(), mu.z(), voxel.intensity_,
+                                     cov(0), cov(1), cov(2), cov(3), cov(4), cov(5));
+    }
+
+    // sign: 1 to add the point of the keyframe key_ind, -1 to remove it
+    void updateVoxel(const int &key_ind, const common::PointIWithCov &point, const int &sign)
+    {
+        const float trace = point.cov_vec[0] + point.cov_vec[3] + point.cov_vec[5];
+        if (fabs(trace) >= trace_threshold_) return; // the same rejection as VoxelGridCovarianceMLOAM
+        const float w = trace_threshold_ - trace;
+
+        const Eigen::Vector3i ijk(static_cast<int>(floor(point.x * inv_leaf_size_)),
+                                  static_cast<int>(floor(point.y * inv_leaf_size_)),
+                                  static_cast<int>(floor(point.z * inv_leaf_size_)));
+        const int64_t key = voxelKey(ijk(0), ijk(1), ijk(2));
+        dirty_voxels_[key] = ijk;
+        if (sign < 0)
+        {
+            auto it = voxels_.find(key);
+            if (it == voxels_.end()) return;
+            Voxel &voxel = it->second;
+            if (--voxel.cnt_ <= 0)
+            {
+                voxels_.erase(it);
+                return;
+            }
+            voxel.weight_ -= w;
+            voxel.sum_point_ -= w * Eigen::Vector3d(point.x, point.y, point.z);
+            for (size_t i = 0; i < 6; i++) voxel.sum_cov_(i) -= w * w * point.cov_vec[i];
+            // the first point of the keyframe in this voxel drops its entry, the intensity and the weight are
+            // then taken from the most certain point of the remaining keyframes
+            auto it_best = std::find_if(voxel.best_.begin(), voxel.best_.end(),
+                                        [&key_ind](const KeyframeBest &best) { return best.key_ind_ == key_ind; });
+            if (it_best == voxel.best_.end()) return;
+            voxel.best_.erase(it_best);
+            voxel.w_max_ = 0;
+            voxel.intensity_ = 0;
+            for (const KeyframeBest &best : voxel.best_)
+            {
+                if (best.w_ > voxel.w_max_)
+                {
+                    voxel.w_max_ = best.w_;
+                    voxel.intensity_ = best.intensity_;
+                }
+            }
+        }
+        else
+        {
+            Voxel &voxel = voxels_[key];
+            voxel.ijk_ = ijk;
+            voxel.cnt_++;
+            voxel.weight_ += w;
+            voxel.sum_point_ += w * Eigen::Vector3d(point.x, point.y, point.z);
+            for (size_t i = 0; i < 6; i++) voxel.sum_cov_(i) += w * w * point.cov_vec[i];
+            auto it_best = std::find_if(voxel.best_.begin(), voxel.best_.end(),
+                                        [&key_ind](const KeyframeBest &best) { return best.key_ind_ == key_ind; });
+            if (it_best == voxel.best_.end())
+                voxel.best_.push_back(KeyframeBest{key_ind, w, point.intensity});
+            else if (w > it_best->w_)
+                *it_best = KeyframeBest{key_ind, w, point.intensity};
+            if (w > voxel.w_max_) // keep the intensity of the most certain point
+            {
+                voxel.w_max_ = w;
+                voxel.intensity_ = point.intensity;
+            }
+        }
+    }
+
+    float inv_leaf_size_;
+    double trace_threshold_;
+    float rebuild_ratio_;
+    std::unordered_map<int64_t, Voxel, std::hash<int64_t>, std::equal_to<int64_t>,
+                       Eigen::aligned_allocator<std::pair<const int64_t, Voxel> > > voxels_;
+    std::unordered_map<int, common::PointICovCloudPtr> keyframes_;
+    std::unordered_map<int64_t, Eigen::Vector3i> dirty_voxels_; // changed since the last updateTree
+};
+
+// ****************** LRU cache of the keyframe clouds transformed into the world frame (with propagated covariance)
+// an entry is valid only for the pose version it was built with, the version is bumped whenever the keyframe pose changes
+class KeyframeCloudCache
+{
+public:
+    struct Entry
+    {
+        int key_ind_;
+        int version_;
+        common::PointICovCloudPtr surf_cloud_;
+        common::PointICovCloudPtr corner_cloud_;
+        size_t bytes_;
+    };
+
+    KeyframeCloudCache() : max_bytes_(0), bytes_(0), num_hit_(0), num_miss_(0) {}
+
+    void setMemoryBudget(const size_t &max_bytes) { max_bytes_ = max_bytes; }
+
+    void clear()
+    {
+        entries_.clear();
+        index_.clear();
+        bytes_ = 0;
+    }
+
+    bool get(const int &key_ind, const int &version,
+             common::PointICovCloudPtr &surf_cloud, common::PointICovCloudPtr &corner_cloud)
+    {
+        auto it = index_.find(key_ind);
+        if ((it == index_.end()) || (it->second->version_ != version))
+        {
+            if (it != index_.end()) invalidate(key_ind);
+            num_miss_++;
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second); // move to the most recently used
+        surf_cloud = it->second->surf_cloud_;
+        corner_cloud = it->second->corner_cloud_;
+        num_hit_++;
+        return true;
+    }
+
+    void put(const int &key_ind, const int &version,
+             const common::PointICovCloudPtr &surf_cloud, const common::PointICovCloudPtr &corner_cloud)
+    {
+        invalidate(key_ind);
+        Entry entry;
+        entry.key_ind_ = key_ind;
+        entry.version_ = version;
+        entry.surf_cloud_ = surf_cloud;
+        entry.corner_cloud_ = corner_cloud;
+        entry.bytes_ = (surf_cloud->size() + corner_cloud->size()) * sizeof(common::PointIWithCov);
+        if (entry.bytes_ > max_bytes_) return;
+        entries_.push_front(entry);
+        index_[key_ind] = entries_.begin();
+        bytes_ += entry.bytes_;
+        while (bytes_ > max_bytes_) // evict the least recently used
+        {
+            bytes_ -= entries_.back().bytes_;
+            index_.erase(entries_.back().key_ind_);
+            entries_.pop_back();
+        }
+    }
+
+    void invalidate(const int &key_ind)
+    {
+        auto it = index_.find(key_ind);
+        if (it == index_.end()) return;
+        bytes_ -= it->second->bytes_;
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+
+    size_t size() const { return entries_.size(); }
+
+    size_t bytes() const { return bytes_; }
+
+    size_t numHit() const { return num_hit_; }
+
+    size_t numMiss() const { return num_miss_; }
+
+private:
+    size_t max_bytes_;
+    size_t bytes_;
+    size_t num_hit_, num_miss_;
+    std::list<Entry> entries_;
+    std::unordered_map<int, std::list<Entry>::iterator> index_;
+};
+
+//
@@ -27,6 +27,7 @@
 #include <iomanip>
 #include <vector>
 #include <map>
+#include <unordered_set>
 #include <cassert>
 #include <algorithm>
 #include <utility>
@@ -65,9 +66,11 @@
 #include "mloam_pcl/point_with_cov.hpp"
 #include "mloam_pcl/voxel_grid_covariance_mloam.h"
 #include "mloam_pcl/voxel_grid_covariance_mloam_impl.hpp"
+#include "mloam_pcl/ikd_tree.hpp"
 
 #include "../save_statistics.hpp"
 #include "../utility/tic_toc.h"
+#include "../utility/trajectory_writer.h"
 #include "../utility/utility.h"
 #include "../estimator/pose.h"
 #include "../estimator/parameters.h"
@@ -77,6 +80,8 @@
 #include "../factor/impl_loss_function.hpp"
 #include "../factor/impl_callback.hpp"
 #include "associate_uct.hpp"
+#include "keyframe_submap.hpp"
+#include "voxel_feature_map.hpp"
 
 #define GLOBALMAP_KF_RADIUS 1000.0
 #define MAX_FEATURE_SELECT_TIME 20  // 10ms
@@ -88,6 +93,11 @@ DEFINE_string(output_path, "", "the path ouf saving results");
 DEFINE_bool(with_ua, true, "with or without the awareness of uncertainty");
 DEFINE_string(gf_method, "wo-gf", "good feature selection method: rnd, fps, gd-float, gd-fix");
 DEFINE_double(gf_ratio_ini, 1.0, "with or without the good features selection");
+DEFINE_string(map_method, "kdtree", "map representation for scan-to-map matching: kdtree, voxel");
+DEFINE_double(voxel_map_size, 1.0, "the voxel size of the hash-voxel map");
+DEFINE_double(keyframe_cache_mb, 512.0, "memory budget of the cache of transformed keyframe clouds (MB)");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
+DEFINE_int32(random_seed, -1, "the seed of the random feature sampling, nondeterministic if negative");
 
 FeatureExtract f_extract;
 
@@ -114,6 +124,17 @@ void pubOdometry();
 
 void saveGlobalMap();
 
+void mapCurrentScan();
+
+void updateMappedPath();
+
+// ****************** entries shared by the node and the offline runner (see lidar_mapper_offline.h)
+void initMapping();
+
+bool processMapping(const OdometryFrame &frame, Pose &pose_keyframe);
+
+void saveMapping();
+
 // ****************** other operation
 void cloudUCTAssociateToMap(const PointICovCloud &cloud_local, PointICovCloud &cloud_global,
                             const Pose &pose_global, const vector<Pose> &pose_ext);
@@ -173,7 +194,9 @@ public:
         delete[] param;
     }
 
-    void evalFullHessian(const pcl::KdTreeFLANN<PointIWithCov>::Ptr &kdtree_from_map,
+    // MapPtr: a kd-tree over laser_map or VoxelFeatureMap::Ptr (see matchFeatureFromMap)
+    template <typename MapPtr>
+    void evalFullHessian(const MapPtr &kdtree_from_map,
                          const PointICovCloud &laser_map,
                          const PointICovCloud &laser_cloud,
                          const Pose &pose_local,
@@ -187,28 +210,8 @@ public:
         for (size_t i = 0; i < num_all_features; i++) 
         {
             size_t n_neigh = 5;
-            bool b_match = true;
-            if (feature_type == 's')
-            {
-                b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                          laser_map,
-                                                          laser_cloud.points[i],
-                                                          pose_local,
-                                                          all_features[i],
-                                                          i,
-                                                          n_neigh,
-                                                          false);
-            } else if (feature_type == 'c')
-            {
-                b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                            laser_map,
-                                                            laser_cloud.points[i],
-                                                            pose_local,
-                                                            all_features[i],
-                                                            i,
-                                                            n_neigh,
-                                                            false);
-            }
+            bool b_match = matchFeatureFromMap(kdtree_from_map, laser_map, laser_cloud.points[i], pose_local,
+                                               all_features[i], i, n_neigh, feature_type);
             if (!b_match) continue;
             Eigen::Matrix3d cov_matrix;
             extractCov(laser_cloud.points[i], cov_matrix);
@@ -226,7 +229,9 @@ public:
         // fout.close();
     }
 
-    void goodFeatureMatching(const pcl::KdTreeFLANN<PointIWithCov>::Ptr &kdtree_from_map,
+    // MapPtr: a kd-tree over laser_map or VoxelFeatureMap::Ptr (see matchFeatureFromMap)
+    template <typename MapPtr>
+    void goodFeatureMatching(const MapPtr &kdtree_from_map,
                              const PointICovCloud &laser_map,
                              const PointICovCloud &laser_cloud,
                              const Pose &pose_local,
@@ -259,29 +264,8 @@ public:
             for (size_t j = 0; j < all_feature_idx.size(); j++)
             {
                 size_t que_idx = all_feature_idx[j];
-                b_match = false;
-                if (feature_type == 's')
-                {
-                    b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                              laser_map,
-                                                              laser_cloud.points[que_idx],
-                                                              pose_local,
-                                                              all_features[que_idx],
-                                                              que_idx,
-                                                              n_neigh,
-                                                              false);
-                }
-                else if (feature_type == 'c')
-                {
-                    b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                                laser_map,
-                                                                laser_cloud.points[que_idx],
-                                                                pose_local,
-                                                                all_features[que_idx],
-                                                                que_idx,
-                                                                n_neigh,
-                                                                false);
-                }
+                b_match = matchFeatureFromMap(kdtree_from_map, laser_map, laser_cloud.points[que_idx], pose_local,
+                                              all_features[que_idx], que_idx, n_neigh, feature_type);
                 if (b_match)
                 {
                     Eigen::Matrix3d cov_matrix;
@@ -311,29 +295,8 @@ public:
                     
                 size_t j = rgi_.geneRandUniform(0, all_feature_idx.size() - 1);
                 size_t que_idx = all_feature_idx[j];
-                b_match = false;
-                if (feature_type == 's')
-                {
-                    b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                              laser_map,
-                                                              laser_cloud.points[que_idx],
-                                                              pose_local,
-                                                              all_features[que_idx],
-                                                              que_idx,
-                                                              n_neigh,
-                                                              false);
-                }
-                else if (feature_type == 'c')
-                {
-                    b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                                laser_map,
-                                                                laser_cloud.points[que_idx],
-                                                                pose_local,
-                                                                all_features[que_idx],
-                                                                que_idx,
-                                                                n_neigh,
-                                                                false);
-                }
+                b_match = matchFeatureFromMap(kdtree_from_map, laser_map, laser_cloud.points[que_idx], pose_local,
+                                              all_features[que_idx], que_idx, n_neigh, feature_type);
                 if (b_match)
                 {
                     Eigen::Matrix3d cov_matrix;
@@ -357,29 +320,8 @@ public:
             feature_visited[k] = 1;
             size_t cnt_visited = 1;
             PointIWithCov point_old = laser_cloud.points[k]; 
-            b_match = false;
-            if (feature_type == 's')
-            {            
-                b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                          laser_map,
-                                                          point_old,
-                                                          pose_local,
-                                                          all_features[k],
-                                                          k,
-                                                          n_neigh,
-                                                          false);
-            }
-            else if (feature_type == 'c')
-            {
-                b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                            laser_map,
-                                                            point_old,
-                                                            pose_local,
-                                                            all_features[k],
-                                                            k,
-                                                            n_neigh,
-                                                            false);
-            }
+            b_match = matchFeatureFromMap(kdtree_from_map, laser_map, point_old, pose_local,
+                                          all_features[k], k, n_neigh, feature_type);
             if (b_match)
             {
                 sel_feature_idx[num_sel_features] = k;
@@ -417,29 +359,8 @@ public:
                 feature_visited[que_idx] = 1;
                 cnt_visited++;
 
-                b_match = false;
-                if (feature_type == 's')
-                {
-                    b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                              laser_map,
-                                                              point_old,
-                                                              pose_local,
-                                                              all_features[que_idx],
-                                                              que_idx,
-                                                              n_neigh,
-                                                              false);
-                }
-                else if (feature_type == 'c')
-                {
-                    b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                                laser_map,
-                                                                point_old,
-                                                                pose_local,
-                                                                all_features[que_idx],
-                                                                que_idx,
-                                                                n_neigh,
-                                                                false);
-                }
+                b_match = matchFeatureFromMap(kdtree_from_map, laser_map, point_old, pose_local,
+                                              all_features[que_idx], que_idx, n_neigh, feature_type);
                 if (b_match)
                 {
                     Eigen::Matrix3d cov_matrix;
@@ -496,29 +417,8 @@ public:
                     size_t que_idx = all_feature_idx[j];
                     if (all_features[que_idx].type_ == 'n')
                     {
-                        b_match = false;
-                        if (feature_type == 's')
-                        {
-                            b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                                      laser_map,
-                                                                      laser_cloud.points[que_idx],
-                                                                      pose_local,
-                                                                      all_features[que_idx],
-                                                                      que_idx,
-                                                                      n_neigh,
-                                                                      false);
-                        } 
-                        else if (feature_type == 'c')
-                        {
-                            b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                                        laser_map,
-                                                                        laser_cloud.points[que_idx],
-                                                                        pose_local,
-                                                                        all_features[que_idx],
-                                                                        que_idx,
-                                                                        n_neigh,
-                                                                        false);
-                        }
+                        b_match = matchFeatureFromMap(kdtree_from_map, laser_map, laser_cloud.points[que_idx], pose_local,
+                                                      all_features[que_idx], que_idx, n_neigh, feature_type);
                         if (b_match) 
                         {
                             Eigen::Matrix3d cov_matrix;
@@ -628,6 +528,38 @@ public:
     ceres::LossFunction *loss_function_;
     common::RandomGeneratorInt<size_t> rgi_;
 
+private:
+    // kNN matching on a kd-tree built over laser_map
+    template <typename KdTreePtr>
+    bool matchFeatureFromMap(const KdTreePtr &kdtree_from_map,
+                             const PointICovCloud &laser_map,
+                             const PointIWithCov &point_ori,
+                             const Pose &pose_local,
+                             PointPlaneFeature &feature,
+                             const size_t &idx,
+                             const size_t &n_neigh,
+                             const char feature_type)
+    {
+        if (feature_type == 's')
+            return f_extract.matchSurfPointFromMap(kdtree_from_map, laser_map, point_ori, pose_local, feature, idx, n_neigh, false);
+        else if (feature_type == 'c')
+            return f_extract.matchCornerPointFromMap(kdtree_from_map, laser_map, point_ori, pose_local, feature, idx, n_neigh, false);
+        return false;
+    }
+
+    // matching on the cached features of the hash voxels around the point, laser_map and n_neigh are not used
+    bool matchFeatureFromMap(const VoxelFeatureMap::Ptr &voxel_map,
+                             const PointICovCloud &laser_map,
+                             const PointIWithCov &point_ori,
+                             const Pose &pose_local,
+                             PointPlaneFeature &feature,
+                             const size_t &idx,
+                             const size_t &n_neigh,
+                             const char feature_type)
+    {
+        return voxel_map->matchPoint(point_ori, pose_local, feature, idx);
+    }
+
 };
 
 //
@@ -47,8 +47,6 @@ PointICloud::Ptr laser_cloud_full_res(new PointICloud());
 PointICloud::Ptr laser_cloud_outlier(new PointICloud());
 PointICloud::Ptr laser_cloud_outlier_ds(new PointICloud());
 
-PointICovCloud::Ptr laser_cloud_surf_from_map_cov(new PointICovCloud());
-PointICovCloud::Ptr laser_cloud_corner_from_map_cov(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_surf_from_map_cov_ds(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_corner_from_map_cov_ds(new PointICovCloud());
 
@@ -56,21 +54,24 @@ PointICovCloud::Ptr laser_cloud_surf_cov(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_corner_cov(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_outlier_cov(new PointICovCloud());
 
-pcl::KdTreeFLANN<PointI>::Ptr kdtree_surrounding_keyframes(new pcl::KdTreeFLANN<PointI>());
 pcl::KdTreeFLANN<PointI>::Ptr kdtree_global_map_keyframes(new pcl::KdTreeFLANN<PointI>());
-pcl::KdTreeFLANN<PointIWithCov>::Ptr kdtree_surf_from_map(new pcl::KdTreeFLANN<PointIWithCov>());
-pcl::KdTreeFLANN<PointIWithCov>::Ptr kdtree_corner_from_map(new pcl::KdTreeFLANN<PointIWithCov>());
+// updated incrementally from the changed submap voxels instead of being rebuilt every frame
+pcl::IKdTree<PointIWithCov>::Ptr kdtree_surf_from_map(new pcl::IKdTree<PointIWithCov>());
+pcl::IKdTree<PointIWithCov>::Ptr kdtree_corner_from_map(new pcl::IKdTree<PointIWithCov>());
+// used instead of the kd-trees if FLAGS_map_method == "voxel"
+VoxelFeatureMap::Ptr surf_voxel_map(new VoxelFeatureMap('s'));
+VoxelFeatureMap::Ptr corner_voxel_map(new VoxelFeatureMap('c'));
+bool voxel_map_flag;
 
 bool save_new_keyframe;
-PointICloud::Ptr surrounding_keyframes(new PointICloud());
-PointICloud::Ptr surrounding_keyframes_ds(new PointICloud());
+KeyframePositionGrid grid_surrounding_keyframes;
+KeyframeSubmap surf_submap, corner_submap;
+KeyframeCloudCache keyframe_cloud_cache;
+std::vector<int> pose_keyframes_version; // to be bumped whenever a keyframe pose changes, keys the cached clouds
 
 PointICloud::Ptr global_map_keyframes(new PointICloud());
 PointICloud::Ptr global_map_keyframes_ds(new PointICloud());
 
-std::vector<int> surrounding_existing_keyframes_id;
-std::vector<PointICovCloud::Ptr> surrounding_surf_cloud_keyframes;
-std::vector<PointICovCloud::Ptr> surrounding_corner_cloud_keyframes;
 std::vector<PointICovCloud::Ptr> surf_cloud_keyframes_cov;
 std::vector<PointICovCloud::Ptr> corner_cloud_keyframes_cov;
 std::vector<PointICovCloud::Ptr> outlier_cloud_keyframes_cov;
@@ -79,10 +80,7 @@ std::vector<PointICovCloud::Ptr> outlier_cloud_keyframes_cov;
 pcl::VoxelGridCovarianceMLOAM<PointI> down_size_filter_surf;
 pcl::VoxelGridCovarianceMLOAM<PointI> down_size_filter_corner;
 pcl::VoxelGridCovarianceMLOAM<PointI> down_size_filter_outlier;
-pcl::VoxelGridCovarianceMLOAM<PointI> down_size_filter_surrounding_keyframes;
 pcl::VoxelGridCovarianceMLOAM<PointI> down_size_filter_global_map_keyframes;
-pcl::VoxelGridCovarianceMLOAM<PointIWithCov> down_size_filter_surf_map_cov;
-pcl::VoxelGridCovarianceMLOAM<PointIWithCov> down_size_filter_corner_map_cov;
 pcl::VoxelGridCovarianceMLOAM<PointIWithCov> down_size_filter_outlier_map_cov;
 pcl::VoxelGridCovarianceMLOAM<PointIWithCov> down_size_filter_global_map_cov;
 
@@ -109,7 +107,8 @@ ros::Publisher pub_good_surf_feature;
 ros::Publisher pub_odom_aft_mapped, pub_odom_aft_mapped_high_frec, pub_laser_after_mapped_path;
 ros::Publisher pub_keyframes, pub_keyframes_6d;
 
-nav_msgs::Path laser_after_mapped_path;
+nav_msgs::Path laser_after_mapped_path; // the newest PATH_WINDOW_SIZE poses for publishing
+TrajectoryWriter map_traj_writer; // the whole mapped trajectory if the results are saved
 
 // extrinsics
 mloam_msgs::Extrinsics extrinsics;
@@ -265,92 +264,87 @@ void extractSurroundingKeyFrames()
     pose_point_cur.y = pose_wmap_curr.t_[1];
     pose_point_cur.z = pose_wmap_curr.t_[2];
 
-    surrounding_keyframes->clear();
-    kdtree_surrounding_keyframes->setInputCloud(pose_keyframes_3d);
-    kdtree_surrounding_keyframes->radiusSearch(pose_point_cur, SURROUNDING_KF_RADIUS, point_search_ind, point_search_sq_dis, 0);
-    for (size_t i = 0; i < point_search_ind.size(); i++)
-        surrounding_keyframes->push_back(pose_keyframes_3d->points[point_search_ind[i]]);
-    
-    for (int i = 0; i < surrounding_existing_keyframes_id.size(); i++) // existing keyframes id
+    std::vector<int> surrounding_keyframes_id;
+    grid_surrounding_keyframes.radiusSearch(pose_point_cur, SURROUNDING_KF_RADIUS, surrounding_keyframes_id);
+    std::unordered_set<int> surrounding_keyframes_set(surrounding_keyframes_id.begin(), surrounding_keyframes_id.end());
+
+    // remove the keyframes which leave the surrounding area
+    // the voxel maps replace the submaps and their kd-trees, only one of them is kept up to date
+    size_t num_remove = 0, num_insert = 0;
+    std::vector<int> submap_keyframes_id = voxel_map_flag ? surf_voxel_map->getKeyframeIndices()
+                                                          : surf_submap.getKeyframeIndices();
+    for (const int &key_ind : submap_keyframes_id)
     {
-        bool existing_flag = false;
-        for (int j = 0; j < surrounding_keyframes->size(); j++) // current surrounding keyframes id
+        if (surrounding_keyframes_set.count(key_ind)) continue;
+        if (voxel_map_flag)
         {
-            if (surrounding_existing_keyframes_id[i] == (int)surrounding_keyframes->points[j].intensity)
-            {
-                existing_flag = true;
-                break;
-            }
+            surf_voxel_map->removeKeyframe(key_ind);
+            corner_voxel_map->removeKeyframe(key_ind);
         }
-        if (!existing_flag)
+        else
         {
-            surrounding_existing_keyframes_id.erase(surrounding_existing_keyframes_id.begin() + i);
-            surrounding_surf_cloud_keyframes.erase(surrounding_surf_cloud_keyframes.begin() + i);
-            surrounding_corner_cloud_keyframes.erase(surrounding_corner_cloud_keyframes.begin() + i);
-            i--;
+            surf_submap.removeKeyframe(key_ind);
+            corner_submap.removeKeyframe(key_ind);
         }
+        num_remove++;
     }
 
-    for (int i = 0; i < surrounding_keyframes->size(); i++)
+    // insert the keyframes which newly enter the surrounding area
+    for (const int &key_ind : surrounding_keyframes_id)
     {
-        bool existing_flag = false;
-        for (int j = 0; j < surrounding_existing_keyframes_id.size(); j++)
+        if (voxel_map_flag ? surf_voxel_map->hasKeyframe(key_ind) : surf_submap.hasKeyframe(key_ind)) continue;
+        PointICovCloud::Ptr surf_trans, corner_trans;
+        if (!keyframe_cloud_cache.get(key_ind, pose_keyframes_version[key_ind], surf_trans, corner_trans))
         {
-            if (surrounding_existing_keyframes_id[j] == (int)surrounding_keyframes->points[i].intensity)
-            {
-                existing_flag = true;
-                break;
-            }
+            const Pose &pose_local = pose_keyframes_6d[key_ind].second;
+            surf_trans.reset(new PointICovCloud());
+            cloudUCTAssociateToMap(*surf_cloud_keyframes_cov[key_ind], *surf_trans, pose_local, pose_ext);
+            corner_trans.reset(new PointICovCloud());
+            cloudUCTAssociateToMap(*corner_cloud_keyframes_cov[key_ind], *corner_trans, pose_local, pose_ext);
+            keyframe_cloud_cache.put(key_ind, pose_keyframes_version[key_ind], surf_trans, corner_trans);
         }
-        if (existing_flag)
+        if (voxel_map_flag)
         {
-            continue;
+            surf_voxel_map->insertKeyframe(key_ind, surf_trans);
+            corner_voxel_map->insertKeyframe(key_ind, corner_trans);
         }
         else
         {
-            int key_ind = (int)surrounding_keyframes->points[i].intensity;
-            surrounding_existing_keyframes_id.push_back(key_ind);
-            const Pose &pose_local = pose_keyframes_6d[key_ind].second;
-
-            PointICovCloud::Ptr surf_trans(new PointICovCloud());
-            cloudUCTAssociateToMap(*surf_cloud_keyframes_cov[key_ind], *surf_trans, pose_local, pose_ext);
-            surrounding_surf_cloud_keyframes.push_back(surf_trans);
-
-            PointICovCloud::Ptr corner_trans(new PointICovCloud());
-            cloudUCTAssociateToMap(*corner_cloud_keyframes_cov[key_ind], *corner_trans, pose_local, pose_ext);
-            surrounding_corner_cloud_keyframes.push_back(corner_trans);
+            surf_submap.insertKeyframe(key_ind, surf_trans);
+            corner_submap.insertKeyframe(key_ind, corner_trans);
         }
+        num_insert++;
     }
+    printf("keyframe cache: %lu clouds, %.1fMB, hit/miss: %lu/%lu\n", keyframe_cloud_cache.size(),
+           keyframe_cloud_cache.bytes() / 1048576.0, keyframe_cloud_cache.numHit(), keyframe_cloud_cache.numMiss());
 
-    PointICloud::Ptr surrounding_existing_keyframes(new PointICloud());
-    PointICloud::Ptr surrounding_existing_keyframes_ds(new PointICloud());
-    for (int i = 0; i < surrounding_existing_keyframes_id.size(); i++)
+    if (voxel_map_flag)
     {
-        int key_ind = surrounding_existing_keyframes_id[i];
-        PointI point = pose_keyframes_3d->points[key_ind];
-        point.intensity = i;
-        surrounding_existing_keyframes->push_back(point);
+        // the voxel maps are matched directly, laser_cloud_surf/corner_from_map_cov_ds stay empty
+        printf("submap keyframes: %lu (insert: %lu, remove: %lu); corner/surf voxels: %lu, %lu\n",
+               surf_voxel_map->keyframeSize(), num_insert, num_remove, corner_voxel_map->size(), surf_voxel_map->size());
+        common::timing::Timer t_timer(TIMING_HANDLE("mapping_voxel_map"));
+        surf_voxel_map->updateFeatures();
+        corner_voxel_map->updateFeatures();
+        printf("voxel map update time %fms, corner/surf valid voxels: %lu, %lu\n", t_timer.Stop() * 1000,
+               corner_voxel_map->validSize(), surf_voxel_map->validSize());
     }
-    down_size_filter_surrounding_keyframes.setInputCloud(surrounding_existing_keyframes);
-    down_size_filter_surrounding_keyframes.filter(*surrounding_existing_keyframes_ds);
-    for (int i = 0; i < surrounding_existing_keyframes_ds->size(); i++)
+    else
     {
-        int j = (int)surrounding_existing_keyframes_ds->points[i].intensity;
-        *laser_cloud_surf_from_map_cov += *surrounding_surf_cloud_keyframes[j];
-        *laser_cloud_corner_from_map_cov += *surrounding_corner_cloud_keyframes[j];
+        common::timing::Timer filter_timer(TIMING_HANDLE("mapping_filter"));
+        surf_submap.getCloud(*laser_cloud_surf_from_map_cov_ds);
+        corner_submap.getCloud(*laser_cloud_corner_from_map_cov_ds);
+        printf("submap keyframes: %lu (insert: %lu, remove: %lu); corner/surf voxels: %lu, %lu\n", 
+               surf_submap.keyframeSize(), num_insert, num_remove,
+               laser_cloud_corner_from_map_cov_ds->size(), laser_cloud_surf_from_map_cov_ds->size());
+        printf("filter time: %fms\n", filter_timer.Stop() * 1000);
+
+        common::timing::Timer t_timer(TIMING_HANDLE("mapping_kdtree"));
+        surf_submap.updateTree(*kdtree_surf_from_map);
+        corner_submap.updateTree(*kdtree_corner_from_map);
+        printf("kdtree update time %fms, corner/surf tree size: %lu, %lu\n", t_timer.Stop() * 1000,
+               kdtree_corner_from_map->size(), kdtree_surf_from_map->size());
     }
-
-    common::timing::Timer filter_timer("mapping_filter");
-    down_size_filter_surf_map_cov.setInputCloud(laser_cloud_surf_from_map_cov);
-    down_size_filter_surf_map_cov.filter(*laser_cloud_surf_from_map_cov_ds);
-    down_size_filter_corner_map_cov.setInputCloud(laser_cloud_corner_from_map_cov);
-    down_size_filter_corner_map_cov.filter(*laser_cloud_corner_from_map_cov_ds);
-    // laser_cloud_surf_from_map_cov_ds = laser_cloud_surf_from_map_cov;
-    // laser_cloud_corner_from_map_cov_ds = laser_cloud_corner_from_map_cov;
-    printf("corner/surf: before ds: %lu, %lu; after ds: %lu, %lu\n", 
-           laser_cloud_corner_from_map_cov->size(), laser_cloud_surf_from_map_cov->size(),
-           laser_cloud_corner_from_map_cov_ds->size(), laser_cloud_surf_from_map_cov_ds->size());
-    printf("filter time: %fms\n", filter_timer.Stop() * 1000); // 10ms
 }
 
 void downsampleCurrentScan()
@@ -368,54 +362,14 @@ void downsampleCurrentScan()
     down_size_filter_outlier.filter(*laser_cloud_outlier_ds);
 
     // propagate the extrinsic uncertainty on points
-    laser_cloud_surf_cov->clear();
-    laser_cloud_corner_cov->clear();
-    laser_cloud_outlier_cov->clear();
-
-    for (PointI &point_ori : *laser_cloud_surf_last_ds)
-    {
-        int idx = int(point_ori.intensity); // indicate the lidar id
-        PointI point_sel;
-        Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
-        if (with_ua_flag)
-        {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[idx].inverse());
-            evalPointUncertainty(point_sel, cov_point, pose_ext[idx]);
-            if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
-        }
-        PointIWithCov point_cov(point_ori, cov_point.cast<float>());
-        laser_cloud_surf_cov->push_back(point_cov);
-    }
-
-    for (PointI &point_ori : *laser_cloud_corner_last_ds)
-    {
-        int idx = int(point_ori.intensity); // indicate the lidar id
-        PointI point_sel;
-        Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
-        if (with_ua_flag)
-        {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[idx].inverse());
-            evalPointUncertainty(point_sel, cov_point, pose_ext[idx]);
-            if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
-        }
-        PointIWithCov point_cov(point_ori, cov_point.cast<float>());
-        laser_cloud_corner_cov->push_back(point_cov);
-    }
-
-    for (PointI &point_ori : *laser_cloud_outlier_ds)
-    {
-        int idx = int(point_ori.intensity); // indicate the lidar id
-        PointI point_sel;
-        Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
-        if (with_ua_flag)
-        {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[idx].inverse());
-            evalPointUncertainty(point_sel, cov_point, pose_ext[idx]);
-            if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
-        }
-        PointIWithCov point_cov(point_ori, cov_point.cast<float>());
-        laser_cloud_outlier_cov->push_back(point_cov);
-    }
+    common::timing::Timer uct_timer(TIMING_HANDLE("mapping_uct"));
+    evalPointUncertaintyBatch(*laser_cloud_surf_last_ds, *laser_cloud_surf_cov, Pose(), pose_ext,
+                              with_ua_flag, TRACE_THRESHOLD_MAPPING, UCT_THREAD_NUM);
+    evalPointUncertaintyBatch(*laser_cloud_corner_last_ds, *laser_cloud_corner_cov, Pose(), pose_ext,
+                              with_ua_flag, TRACE_THRESHOLD_MAPPING, UCT_THREAD_NUM);
+    evalPointUncertaintyBatch(*laser_cloud_outlier_ds, *laser_cloud_outlier_cov, Pose(), pose_ext,
+                              with_ua_flag, TRACE_THRESHOLD_MAPPING, UCT_THREAD_NUM);
+    uct_timer.Stop();
     std::cout << "input surf num: " << laser_cloud_surf_cov->size()
               << " corner num: " << laser_cloud_corner_cov->size() << std::endl;
 }
@@ -423,16 +377,12 @@ void downsampleCurrentScan()
 void scan2MapOptimization()
 {
     // step 4: perform scan-to-map optimization
-    size_t laser_cloud_surf_from_map_num = laser_cloud_surf_from_map_cov_ds->size();
-    size_t laser_cloud_corner_from_map_num = laser_cloud_corner_from_map_cov_ds->size();
+    size_t laser_cloud_surf_from_map_num = voxel_map_flag ? surf_voxel_map->validSize() : laser_cloud_surf_from_map_cov_ds->size();
+    size_t laser_cloud_corner_from_map_num = voxel_map_flag ? corner_voxel_map->validSize() : laser_cloud_corner_from_map_cov_ds->size();
     printf("map surf num: %lu, corner num: %lu\n", laser_cloud_surf_from_map_num, laser_cloud_corner_from_map_num);
     if ((laser_cloud_surf_from_map_num > 50) && (laser_cloud_corner_from_map_num > 10))
     {
         // pose_wmap_prev = pose_wmap_curr;
-        common::timing::Timer t_timer("mapping_kdtree");
-        kdtree_surf_from_map->setInputCloud(laser_cloud_surf_from_map_cov_ds);
-        kdtree_corner_from_map->setInputCloud(laser_cloud_corner_from_map_cov_ds);
-        printf("build time %fms\n", t_timer.Stop() * 1000);
         printf("********************************\n");
 
         // int max_iter = pose_keyframes_6d.size() <= 5 ? 5 : 2; // should have more iterations at the initial stage
@@ -460,11 +410,23 @@ void scan2MapOptimization()
                     int total_feat_num = 0;
                     Eigen::Matrix<double, 6, 6> mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
                     if (POINT_PLANE_FACTOR)
-                        afs.evalFullHessian(kdtree_surf_from_map, *laser_cloud_surf_from_map_cov_ds,
-                                            *laser_cloud_surf_cov, pose_wmap_curr, 's', mat_H, total_feat_num);
+                    {
+                        if (voxel_map_flag)
+                            afs.evalFullHessian(surf_voxel_map, *laser_cloud_surf_from_map_cov_ds,
+                                                *laser_cloud_surf_cov, pose_wmap_curr, 's', mat_H, total_feat_num);
+                        else
+                            afs.evalFullHessian(kdtree_surf_from_map, kdtree_surf_from_map->getCloud(),
+                                                *laser_cloud_surf_cov, pose_wmap_curr, 's', mat_H, total_feat_num);
+                    }
                     if (POINT_EDGE_FACTOR)
-                        afs.evalFullHessian(kdtree_corner_from_map, *laser_cloud_corner_from_map_cov_ds,
-                                            *laser_cloud_corner_cov, pose_wmap_curr, 'c', mat_H, total_feat_num);
+                    {
+                        if (voxel_map_flag)
+                            afs.evalFullHessian(corner_voxel_map, *laser_cloud_corner_from_map_cov_ds,
+                                                *laser_cloud_corner_cov, pose_wmap_curr, 'c', mat_H, total_feat_num);
+                        else
+                            afs.evalFullHessian(kdtree_corner_from_map, kdtree_corner_from_map->getCloud(),
+                                                *laser_cloud_corner_cov, pose_wmap_curr, 'c', mat_H, total_feat_num);
+                    }
                     // std::cout << mat_H << std::endl;
                     // std::cout << common::logDet(mat_H, true) << std::endl;
                     // std::cout << total_feat_num << " " << std::log(1.0 * total_feat_num) << std::endl;
@@ -498,36 +460,60 @@ void scan2MapOptimization()
             std::vector<PointPlaneFeature> all_surf_features, all_corner_features;
             std::vector<size_t> sel_surf_feature_idx, sel_corner_feature_idx;
             size_t surf_num = 0, corner_num = 0;
-            common::timing::Timer gfs_timer("mapping_match_feat");
+            common::timing::Timer gfs_timer(TIMING_HANDLE("mapping_match_feat"));
             Eigen::Matrix<double, 6, 6> sub_mat_H;
             if (POINT_EDGE_FACTOR)
             {
                 sub_mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
-                afs.goodFeatureMatching(kdtree_corner_from_map,
-                                        *laser_cloud_corner_from_map_cov_ds,
-                                        *laser_cloud_corner_cov,
-                                        pose_wmap_curr,
-                                        all_corner_features,
-                                        sel_corner_feature_idx,
-                                        'c',
-                                        FLAGS_gf_method,
-                                        gf_ratio_cur, 
-                                        sub_mat_H);
+                if (voxel_map_flag)
+                    afs.goodFeatureMatching(corner_voxel_map,
+                                            *laser_cloud_corner_from_map_cov_ds,
+                                            *laser_cloud_corner_cov,
+                                            pose_wmap_curr,
+                                            all_corner_features,
+                                            sel_corner_feature_idx,
+                                            'c',
+                                            FLAGS_gf_method,
+                                            gf_ratio_cur,
+                                            sub_mat_H);
+                else
+                    afs.goodFeatureMatching(kdtree_corner_from_map,
+                                            kdtree_corner_from_map->getCloud(),
+                                            *laser_cloud_corner_cov,
+                                            pose_wmap_curr,
+                                            all_corner_features,
+                                            sel_corner_feature_idx,
+                                            'c',
+                                            FLAGS_gf_method,
+                                            gf_ratio_cur,
+                                            sub_mat_H);
                 corner_num = sel_corner_feature_idx.size();
             }
             if (POINT_PLANE_FACTOR)
             {
                 sub_mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
-                afs.goodFeatureMatching(kdtree_surf_from_map,
-                                        *laser_cloud_surf_from_map_cov_ds,
-                                        *laser_cloud_surf_cov,
-                                        pose_wmap_curr,
-                                        all_surf_features,
-                                        sel_surf_feature_idx,
-                                        's',
-                                        FLAGS_gf_method,
-                                        gf_ratio_cur, 
-                                        sub_mat_H);
+                if (voxel_map_flag)
+                    afs.goodFeatureMatching(surf_voxel_map,
+                                            *laser_cloud_surf_from_map_cov_ds,
+                                            *laser_cloud_surf_cov,
+                                            pose_wmap_curr,
+                                            all_surf_features,
+                                            sel_surf_feature_idx,
+                                            's',
+                                            FLAGS_gf_method,
+                                            gf_ratio_cur,
+                                            sub_mat_H);
+                else
+                    afs.goodFeatureMatching(kdtree_surf_from_map,
+                                            kdtree_surf_from_map->getCloud(),
+                                            *laser_cloud_surf_cov,
+                                            pose_wmap_curr,
+                                            all_surf_features,
+                                            sel_surf_feature_idx,
+                                            's',
+                                            FLAGS_gf_method,
+                                            gf_ratio_cur,
+                                            sub_mat_H);
                 surf_num = sel_surf_feature_idx.size();
             }
             gf_logdet_H_list.push_back(common::logDet(sub_mat_H, true));
@@ -583,7 +569,7 @@ void scan2MapOptimization()
             // evalDegenracy(mat_H / 25, local_parameterization); // the hessian matrix is already normized to evaluate degeneracy
 
             // *********************************************************
-            common::timing::Timer solver_timer("mapping_solver");
+            common::timing::Timer solver_timer(TIMING_HANDLE("mapping_solver"));
             ceres::Solver::Summary summary;
             ceres::Solver::Options options;
             options.linear_solver_type = ceres::DENSE_SCHUR;
@@ -601,7 +587,7 @@ void scan2MapOptimization()
             {
                 if (with_ua_flag)
                 {
-                    common::timing::Timer eval_deg_timer("mapping_eval_deg");
+                    common::timing::Timer eval_deg_timer(TIMING_HANDLE("mapping_eval_deg"));
                     problem.Evaluate(e_option, nullptr, nullptr, nullptr, &jaco);
                     evalHessian(jaco, mat_H);
                     if (pose_keyframes_6d.size() <= 10)
@@ -666,7 +652,9 @@ void saveKeyframe()
     pose_3d.intensity = pose_keyframes_3d->size();
 
     pose_keyframes_3d->push_back(pose_3d);
+    grid_surrounding_keyframes.insert(pose_3d);
     pose_keyframes_6d.push_back(std::make_pair(time_laser_odometry, pose_wmap_curr));
+    pose_keyframes_version.push_back(0);
 
     PointICovCloud::Ptr surf_keyframe_cov(new PointICovCloud());
     PointICovCloud::Ptr corner_keyframe_cov(new PointICovCloud());
@@ -685,6 +673,8 @@ void saveKeyframe()
 void updateKeyframe()
 {
     std::cout << common::YELLOW << "received loop info, need to update all keyframes" << common::RESET << std::endl;  
+    // the corrected poses are not applied to pose_keyframes_6d yet, so the cached clouds stay valid.
+    // applying them should bump pose_keyframes_version only of the keyframes whose pose changed
 }
 
 void pubPointCloud()
@@ -732,14 +722,7 @@ void pubOdometry()
             odom_aft_mapped.pose.covariance[i * 6 + j] = float(pose_wmap_curr.cov_(i, j));
     pub_odom_aft_mapped.publish(odom_aft_mapped);
 
-    geometry_msgs::PoseStamped laser_after_mapped_pose;
-    laser_after_mapped_pose.header = odom_aft_mapped.header;
-    laser_after_mapped_pose.header.stamp = ros::Time().fromSec(time_laser_odometry);
-    laser_after_mapped_pose.pose = odom_aft_mapped.pose.pose;
-
-    laser_after_mapped_path.header.stamp = ros::Time().fromSec(time_laser_odometry);
-    laser_after_mapped_path.header.frame_id = "/world";
-    laser_after_mapped_path.poses.push_back(laser_after_mapped_pose);
+    updateMappedPath();
     pub_laser_after_mapped_path.publish(laser_after_mapped_path);
     publishTF(odom_aft_mapped);
 
@@ -755,6 +738,28 @@ void pubOdometry()
 
     // publish 6d keyframes with covariance
     // if (pub_keyframes_6d.getNumSubscribers() != 0 && save_new_keyframe)
+    if (save_new_keyframe)
+    {
+        pub_keyframes_6d.publish(laser_keyframes_6d);
+    }
+}
+
+// record the mapped pose and the new 6d keyframe with covariance
+void updateMappedPath()
+{
+    geometry_msgs::PoseStamped laser_after_mapped_pose;
+    laser_after_mapped_pose.header.stamp = ros::Time().fromSec(time_laser_odometry);
+    laser_after_mapped_pose.header.frame_id = "/world";
+    laser_after_mapped_pose.pose.orientation.x = pose_wmap_curr.q_.x();
+    laser_after_mapped_pose.pose.orientation.y = pose_wmap_curr.q_.y();
+    laser_after_mapped_pose.pose.orientation.z = pose_wmap_curr.q_.z();
+    laser_after_mapped_pose.pose.orientation.w = pose_wmap_curr.q_.w();
+    laser_after_mapped_pose.pose.position.x = pose_wmap_curr.t_.x();
+    laser_after_mapped_pose.pose.position.y = pose_wmap_curr.t_.y();
+    laser_after_mapped_pose.pose.position.z = pose_wmap_curr.t_.z();
+    pushPathWindow(laser_after_mapped_path, laser_after_mapped_pose, PATH_WINDOW_SIZE);
+    map_traj_writer.addPose(time_laser_odometry, pose_wmap_curr.q_, pose_wmap_curr.t_);
+
     if (save_new_keyframe)
     {
         const std::pair<double, Pose> &pkf = pose_keyframes_6d.back();
@@ -773,7 +778,6 @@ void pubOdometry()
                 laser_keyframes_pose.pose.covariance[i * 6 + j] = float(pkf.second.cov_(i, j));
         laser_keyframes_6d.poses.push_back(laser_keyframes_pose);
         laser_keyframes_6d.header = laser_keyframes_pose.header;
-        pub_keyframes_6d.publish(laser_keyframes_6d);
     }
 }
 
@@ -920,14 +924,37 @@ void saveGlobalMap()
 
 void clearCloud()
 {
-    laser_cloud_surf_from_map_cov->clear();
-    laser_cloud_corner_from_map_cov->clear();
     laser_cloud_surf_from_map_cov_ds->clear();
     laser_cloud_corner_from_map_cov_ds->clear();
 }
 
+// register the current scan to the map and save it as a keyframe if needed
+void mapCurrentScan()
+{
+    transformAssociateToMap();
+
+    common::timing::Timer extract_kf_timer(TIMING_HANDLE("mapping_extract_kf"));
+    extractSurroundingKeyFrames();
+    printf("extract surrounding keyframes: %fms\n", extract_kf_timer.Stop() * 1000);
+
+    common::timing::Timer dscs_timer(TIMING_HANDLE("mapping_dscs"));
+    downsampleCurrentScan();
+    // printf("downsample current scan time: %fms\n", t_dscs.toc());
+
+    common::timing::Timer opti_timer(TIMING_HANDLE("mapping_opti"));
+    scan2MapOptimization();
+    printf("optimization time: %fms\n", opti_timer.Stop() * 1000);
+
+    transformUpdate();
+
+    common::timing::Timer skf_timer(TIMING_HANDLE("mapping_save_kf"));
+    saveKeyframe();
+    printf("save keyframes time: %fms\n", skf_timer.Stop() * 1000);
+}
+
 void process()
 {
+	common::timing::Trace::SetThreadName("mapping");
 	while (1)
 	{
 		if (!ros::ok()) break;
@@ -1057,27 +1084,10 @@ void process()
             std::lock_guard<std::mutex> lock(m_process);
 
 			frame_cnt++;
-			common::timing::Timer process_timer("mapping_process");
-
-			transformAssociateToMap();
-
-            common::timing::Timer extract_kf_timer("mapping_extract_kf");
-            extractSurroundingKeyFrames();
-            printf("extract surrounding keyframes: %fms\n", extract_kf_timer.Stop() * 1000);
-
-            common::timing::Timer dscs_timer("mapping_dscs");
-            downsampleCurrentScan();
-            // printf("downsample current scan time: %fms\n", t_dscs.toc());
+			common::timing::Trace::SetFrame(time_laser_odometry);
+			common::timing::Timer process_timer(TIMING_HANDLE("mapping_process"));
 
-            common::timing::Timer opti_timer("mapping_opti");
-            scan2MapOptimization();
-            printf("optimization time: %fms\n", opti_timer.Stop() * 1000);
-
-			transformUpdate();
-
-            common::timing::Timer skf_timer("mapping_save_kf");
-            saveKeyframe();
-            printf("save keyframes time: %fms\n", skf_timer.Stop() * 1000);
+            mapCurrentScan();
 
             // TODO: using loop info to update keyframes
             if (!loop_info_buf.empty())
@@ -1135,26 +1145,8 @@ void cloudUCTAssociateToMap(const PointICovCloud &cloud_local,
     }
     // exit(EXIT_FAILURE);
 
-    cloud_global.clear();
-    cloud_global.resize(cloud_local.size());
-    size_t cloud_size = 0;
-    for (const PointIWithCov &point_ori : cloud_local)
-    {
-        int ind = (int)point_ori.intensity;
-        PointIWithCov point_sel, point_cov;
-        Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
-        if (with_ua_flag)
-        {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[ind].inverse());
-            evalPointUncertainty(point_sel, cov_point, pose_compound[ind]); // TODO
-            if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
-        }
-        pointAssociateToMap(point_ori, point_cov, pose_global);
-        updateCov(point_cov, cov_point);
-        cloud_global[cloud_size] = point_cov;
-        cloud_size++;
-    }
-    cloud_global.resize(cloud_size);
+    evalPointUncertaintyBatch(cloud_local, cloud_global, pose_global, pose_compound,
+                              with_ua_flag, TRACE_THRESHOLD_MAPPING, UCT_THREAD_NUM);
 }
 
 void evalHessian(const ceres::CRSMatrix &jaco, Eigen::Matrix<double, 6, 6> &mat_H)
@@ -1203,27 +1195,133 @@ void evalDegenracy(const Eigen::Matrix<double, 6, 6> &mat_H, PoseLocalParameteri
 	}
 }
 
-void sigintHandler(int sig)
+void saveMapping()
 {
-    printf("[lidar_mapper] press ctrl-c\n");
-    std::cout << common::YELLOW << "mapping drop frame: " << frame_drop_cnt << common::RESET << std::endl;
     if (MLOAM_RESULT_SAVE)
     {
         save_statistics.saveMapStatistics(MLOAM_MAP_PATH,
                                           OUTPUT_FOLDER + "others/mapping_gf_deg_factor_" + FLAGS_gf_method + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".txt",
                                           OUTPUT_FOLDER + "others/mapping_gf_logdet_H_" + FLAGS_gf_method + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".txt",
-                                          laser_after_mapped_path,
+                                          map_traj_writer,
                                           gf_deg_factor_list,
                                           gf_logdet_H_list);
+        std::string map_method_tag = voxel_map_flag ? "voxel_" : "";
         if (with_ua_flag)                                          
-            save_statistics.saveMapTimeStatistics(OUTPUT_FOLDER + "time/time_mloam_mapping_" + FLAGS_gf_method + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".txt");
+            save_statistics.saveMapTimeStatistics(OUTPUT_FOLDER + "time/time_mloam_mapping_" + map_method_tag + FLAGS_gf_method + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".txt");
         else
-            save_statistics.saveMapTimeStatistics(OUTPUT_FOLDER + "time/time_mloam_mapping_wo_ua_" + FLAGS_gf_method + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".txt");
+            save_statistics.saveMapTimeStatistics(OUTPUT_FOLDER + "time/time_mloam_mapping_wo_ua_" + map_method_tag + FLAGS_gf_method + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".txt");
     }
     saveGlobalMap();
+}
+
+void sigintHandler(int sig)
+{
+    printf("[lidar_mapper] press ctrl-c\n");
+    std::cout << common::YELLOW << "mapping drop frame: " << frame_drop_cnt << common::RESET << std::endl;
+    saveMapping();
+    common::timing::Trace::Stop();
     ros::shutdown();
 }
 
+// called after readParameters, MLOAM_RESULT_SAVE and OUTPUT_FOLDER are set
+void initMapping()
+{
+	with_ua_flag = FLAGS_with_ua;
+    printf("save result (0/1): %d to %s\n", MLOAM_RESULT_SAVE, OUTPUT_FOLDER.c_str());
+	printf("with the awareness of uncertainty (0/1): %d\n", with_ua_flag);
+    printf("gf method: %s, gf ratio: %f\n", FLAGS_gf_method.c_str(), FLAGS_gf_ratio_ini);
+    gf_ratio_cur = std::min(1.0, FLAGS_gf_ratio_ini);
+    voxel_map_flag = (FLAGS_map_method == "voxel");
+    printf("map method: %s, voxel size: %f\n", FLAGS_map_method.c_str(), FLAGS_voxel_map_size);
+    std::string map_method_tag = voxel_map_flag ? "voxel_" : "";
+	if (with_ua_flag)
+        MLOAM_MAP_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_map_" + map_method_tag + "estimate_" + FLAGS_gf_method + "_" + to_string(FLAGS_gf_ratio_ini) + ".txt";
+    else
+        MLOAM_MAP_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_map_wo_ua_" + map_method_tag + "estimate_" + FLAGS_gf_method + "_" + to_string(FLAGS_gf_ratio_ini) + ".txt";
+	printf("Mapping as %fhz\n", 1.0 / (SCAN_PERIOD * SKIP_NUM_ODOM_PUB));
+    common::timing::Timing::SetDeadline(TIMING_HANDLE("mapping_process"), SCAN_PERIOD * SKIP_NUM_ODOM_PUB);
+    if (MLOAM_RESULT_SAVE) map_traj_writer.open(getTrajectoryBinPath(MLOAM_MAP_PATH));
+    if (FLAGS_random_seed >= 0) afs.rgi_.setSeed(FLAGS_random_seed);
+
+    down_size_filter_surf.setLeafSize(MAP_SURF_RES, MAP_SURF_RES, MAP_SURF_RES);
+    down_size_filter_surf.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    down_size_filter_corner.setLeafSize(MAP_CORNER_RES, MAP_CORNER_RES, MAP_CORNER_RES);
+    down_size_filter_corner.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    down_size_filter_outlier.setLeafSize(MAP_OUTLIER_RES, MAP_OUTLIER_RES, MAP_OUTLIER_RES);
+    down_size_filter_outlier.setTraceThreshold(TRACE_THRESHOLD_MAPPING);    
+
+    surf_submap.setLeafSize(MAP_SURF_RES);
+    surf_submap.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    corner_submap.setLeafSize(MAP_CORNER_RES);
+    corner_submap.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    down_size_filter_outlier_map_cov.setLeafSize(MAP_OUTLIER_RES, MAP_OUTLIER_RES, MAP_OUTLIER_RES);
+    down_size_filter_outlier_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    grid_surrounding_keyframes.setCellSize(SURROUNDING_KF_RADIUS);
+    keyframe_cloud_cache.setMemoryBudget(static_cast<size_t>(FLAGS_keyframe_cache_mb * 1024 * 1024));
+    surf_voxel_map->setVoxelSize(FLAGS_voxel_map_size);
+    surf_voxel_map->setPlaneThreshold(0.5 * MIN_PLANE_DIS);
+    surf_voxel_map->setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    corner_voxel_map->setVoxelSize(FLAGS_voxel_map_size);
+    corner_voxel_map->setTraceThreshold(TRACE_THRESHOLD_MAPPING);
+    down_size_filter_global_map_keyframes.setLeafSize(10, 10, 10);
+
+    cov_mapping.setZero();
+
+    pose_ext.resize(NUM_OF_LASER);
+
+    pose_point_prev.x = 0.0;
+    pose_point_prev.y = 0.0;
+    pose_point_prev.z = 0.0;
+    q_ori_prev.setIdentity();
+
+    pose_point_cur.x = 0.0;
+    pose_point_cur.y = 0.0;
+    pose_point_cur.z = 0.0;
+    q_ori_cur.setIdentity();
+
+    pose_keyframes_6d.clear();
+    pose_keyframes_3d->clear();
+    laser_keyframes_6d.poses.clear();
+}
+
+// the frame is taken from the odometry in the same process instead of the synchronized topics, nothing is published
+bool processMapping(const OdometryFrame &frame, Pose &pose_keyframe)
+{
+    std::lock_guard<std::mutex> lock(m_process);
+    time_laser_odometry = frame.time_;
+    *laser_cloud_surf_last = frame.surf_points_less_flat_;
+    *laser_cloud_corner_last = frame.corner_points_less_sharp_;
+    *laser_cloud_full_res = frame.laser_cloud_;
+    *laser_cloud_outlier = frame.laser_cloud_outlier_;
+    pose_wodom_curr = frame.pose_wodom_curr_;
+    if (!frame.ext_status_) pose_ext = frame.pose_ext_;
+
+    frame_cnt++;
+    common::timing::Trace::SetFrame(time_laser_odometry);
+    common::timing::Timer process_timer(TIMING_HANDLE("mapping_process"));
+
+    mapCurrentScan();
+    updateMappedPath();
+    if (save_new_keyframe)
+    {
+        pose_keyframe = pose_keyframes_6d.back().second;
+        clearCloud();
+    }
+
+    double process_time = process_timer.Stop() * 1000;
+    std::cout << common::RED << "frame: " << frame_cnt
+              << ", whole mapping time: " << process_time << "ms" << common::RESET << std::endl;
+    LOG_EVERY_N(INFO, 20) << "whole mapping time " << process_time << "ms";
+    return save_new_keyframe;
+}
+
+Pose getMappingPose()
+{
+    std::lock_guard<std::mutex> lock(m_process);
+    return pose_wmap_curr;
+}
+
+#ifndef MLOAM_OFFLINE
 int main(int argc, char **argv)
 {
 	// if (argc < 5)
@@ -1241,19 +1339,10 @@ int main(int argc, char **argv)
 
     MLOAM_RESULT_SAVE = FLAGS_result_save;
     OUTPUT_FOLDER = FLAGS_output_path;
-	with_ua_flag = FLAGS_with_ua;
-    printf("save result (0/1): %d to %s\n", MLOAM_RESULT_SAVE, OUTPUT_FOLDER.c_str());
-	printf("with the awareness of uncertainty (0/1): %d\n", with_ua_flag);
-    printf("gf method: %s, gf ratio: %f\n", FLAGS_gf_method.c_str(), FLAGS_gf_ratio_ini);
-    gf_ratio_cur = std::min(1.0, FLAGS_gf_ratio_ini);
-	if (with_ua_flag)
-        MLOAM_MAP_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_map_estimate_" + FLAGS_gf_method + "_" + to_string(FLAGS_gf_ratio_ini) + ".txt";
-    else
-        MLOAM_MAP_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_map_wo_ua_estimate_" + FLAGS_gf_method + "_" + to_string(FLAGS_gf_ratio_ini) + ".txt";
 
     std::cout << "config file: " << FLAGS_config_file << std::endl;
 	readParameters(FLAGS_config_file);
-	printf("Mapping as %fhz\n", 1.0 / (SCAN_PERIOD * SKIP_NUM_ODOM_PUB));
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
 
 	ros::Subscriber sub_laser_cloud_full_res = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud", 10, laserCloudFullResHandler);
     ros::Subscriber sub_laser_cloud_outlier = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_outlier", 10, laserCloudOutlierResHandler);
@@ -1276,39 +1365,7 @@ int main(int argc, char **argv)
     pub_keyframes = nh.advertise<sensor_msgs::PointCloud2>("/laser_map_keyframes", 5);
     pub_keyframes_6d = nh.advertise<mloam_msgs::Keyframes>("/laser_map_keyframes_6d", 5);
 
-    down_size_filter_surf.setLeafSize(MAP_SURF_RES, MAP_SURF_RES, MAP_SURF_RES);
-    down_size_filter_surf.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-    down_size_filter_corner.setLeafSize(MAP_CORNER_RES, MAP_CORNER_RES, MAP_CORNER_RES);
-    down_size_filter_corner.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-    down_size_filter_outlier.setLeafSize(MAP_OUTLIER_RES, MAP_OUTLIER_RES, MAP_OUTLIER_RES);
-    down_size_filter_outlier.setTraceThreshold(TRACE_THRESHOLD_MAPPING);    
-
-    down_size_filter_surf_map_cov.setLeafSize(MAP_SURF_RES, MAP_SURF_RES, MAP_SURF_RES);
-    down_size_filter_surf_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-    down_size_filter_corner_map_cov.setLeafSize(MAP_CORNER_RES, MAP_CORNER_RES, MAP_CORNER_RES);
-    down_size_filter_corner_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-    down_size_filter_outlier_map_cov.setLeafSize(MAP_OUTLIER_RES, MAP_OUTLIER_RES, MAP_OUTLIER_RES);
-    down_size_filter_outlier_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-    down_size_filter_surrounding_keyframes.setLeafSize(MAP_SUR_KF_RES, MAP_SUR_KF_RES, MAP_SUR_KF_RES);
-    down_size_filter_global_map_keyframes.setLeafSize(10, 10, 10);
-
-    cov_mapping.setZero();
-
-    pose_ext.resize(NUM_OF_LASER);
-
-    pose_point_prev.x = 0.0;
-    pose_point_prev.y = 0.0;
-    pose_point_prev.z = 0.0;
-    q_ori_prev.setIdentity();
-
-    pose_point_cur.x = 0.0;
-    pose_point_cur.y = 0.0;
-    pose_point_cur.z = 0.0;
-    q_ori_cur.setIdentity();
-
-    pose_keyframes_6d.clear();
-    pose_keyframes_3d->clear();
-    laser_keyframes_6d.poses.clear();
+    initMapping();
 
     signal(SIGINT, sigintHandler);
 
@@ -1326,6 +1383,8 @@ int main(int argc, char **argv)
     mapping_process.join();
     return 0;
 }
+#endif
+
 
 
 
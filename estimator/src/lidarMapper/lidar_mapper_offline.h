@@ -0,0 +1,34 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include "../estimator/estimator.h"
+
+// ****************** the mapper called in process, implemented in lidar_mapper_keyframe.cpp compiled with MLOAM_OFFLINE
+// lidar_mapper.h is not included since it defines the flags of the mapper (config_file, output_path, gf_method, ...),
+// which are shared with the caller through DECLARE_*
+
+// set up the mapper after readParameters, MLOAM_RESULT_SAVE and OUTPUT_FOLDER are set
+void initMapping();
+
+// register a frame of odometry to the map, return true and the pose of the keyframe if the frame is a new keyframe
+bool processMapping(const OdometryFrame &frame, Pose &pose_keyframe);
+
+// the pose of the last frame in the map
+Pose getMappingPose();
+
+// save the trajectory, the statistics and the global map
+void saveMapping();
+
+//
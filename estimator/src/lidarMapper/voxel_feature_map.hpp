@@ -0,0 +1,278 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <boost/shared_ptr.hpp>
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/StdVector>
+
+#include "common/types/type.h"
+#include "mloam_pcl/point_with_cov.hpp"
+
+#include "../utility/utility.h"
+#include "../estimator/pose.h"
+#include "../estimator/parameters.h"
+#include "keyframe_submap.hpp"
+
+// ****************** hash-voxel map with per-voxel point statistics for scan-to-map matching
+// each voxel keeps the running covariance-weighted statistics of the keyframe points falling into it
+// (w = trace_threshold - trace(cov) as in KeyframeSubmap) together with their propagated covariance,
+// and caches a plane (feature_type 's') or a line (feature_type 'c') fitted from them.
+// A query point is matched to the best fitting feature among its own voxel and the neighboring voxels
+// whose centroid lies within one voxel size: 27 lookups and without kNN search.
+class VoxelFeatureMap
+{
+public:
+    typedef boost::shared_ptr<VoxelFeatureMap> Ptr;
+
+    struct Voxel
+    {
+        Voxel() : weight_(0), cnt_(0), valid_(false)
+        {
+            sum_point_.setZero();
+            sum_sq_point_.setZero();
+            sum_cov_.setZero();
+        }
+
+        // accumulated relative to the voxel origin to keep the covariance well conditioned
+        Eigen::Vector3d origin_;
+        Eigen::Vector3d sum_point_;    // sum(w * p)
+        Eigen::Matrix3d sum_sq_point_; // sum(w * p * p^T)
+        Eigen::Matrix3d sum_cov_;      // sum(w * cov), the propagated covariance of the points
+        double weight_;
+        int cnt_;
+
+        bool valid_;
+        Eigen::Vector3d center_;
+        Eigen::Matrix<double, 6, 1> coeffs_; // plane: [n, d, 0, 0], line: [X1, X2]
+    };
+
+    VoxelFeatureMap(const char &feature_type = 's')
+        : feature_type_(feature_type), voxel_size_(1.0f), min_point_num_(5), plane_thre_(0.1), trace_threshold_(2.0),
+          valid_num_(0) {}
+
+    void setVoxelSize(const float &voxel_size) { voxel_size_ = voxel_size; }
+
+    // points with trace(cov) >= trace_threshold are rejected, the others are weighted by trace_threshold - trace(cov)
+    void setTraceThreshold(const double &trace_threshold) { trace_threshold_ = trace_threshold; }
+
+    void setMinPointNum(const int &min_point_num) { min_point_num_ = min_point_num; }
+
+    // the maximum std of the voxel points along the plane normal, including their propagated uncertainty
+    void setPlaneThreshold(const double &plane_thre) { plane_thre_ = plane_thre; }
+
+    void clear()
+    {
+        voxels_.clear();
+        keyframes_.clear();
+        dirty_voxels_.clear();
+        valid_num_ = 0;
+    }
+
+    bool hasKeyframe(const int &key_ind) const { return keyframes_.find(key_ind) != keyframes_.end(); }
+
+    std::vector<int> getKeyframeIndices() const
+    {
+        std::vector<int> key_inds;
+        key_inds.reserve(keyframes_.size());
+        for (const auto &kf : keyframes_) key_inds.push_back(kf.first);
+        return key_inds;
+    }
+
+    size_t keyframeSize() const { return keyframes_.size(); }
+
+    size_t size() const { return voxels_.size(); }
+
+    // the number of voxels with a feature, as of the last updateFeatures
+    size_t validSize() const { return valid_num_; }
+
+    // cloud: the keyframe cloud in the world frame
+    void insertKeyframe(const int &key_ind, const common::PointICovCloudPtr &cloud)
+    {
+        if (hasKeyframe(key_ind)) return;
+        keyframes_[key_ind] = cloud;
+        for (const common::PointIWithCov &point : *cloud) updateVoxel(point, 1);
+    }
+
+    void removeKeyframe(const int &key_ind)
+    {
+        auto it = keyframes_.find(key_ind);
+        if (it == keyframes_.end()) return;
+        for (const common::PointIWithCov &point : *(it->second)) updateVoxel(point, -1);
+        keyframes_.erase(it);
+    }
+
+    // refit the features of the voxels changed since the last call
+    void updateFeatures()
+    {
+        for (const int64_t &key : dirty_voxels_)
+        {
+            auto it = voxels_.find(key);
+            if (it == voxels_.end()) continue;
+            if (it->second.valid_) valid_num_--;
+            fitFeature(it->second);
+            if (it->second.valid_) valid_num_++;
+        }
+        dirty_voxels_.clear();
+    }
+
+    // the same output as FeatureExtract::matchSurfPointFromMap/matchCornerPointFromMap (without the fov check)
+    // a point near a voxel border is often better explained by the neighboring voxel, so every valid voxel
+    // whose centroid is within voxel_size of the point is a candidate (all of them lie in the 3x3x3 neighborhood),
+    // together with the own voxel, and the one with the smallest point-to-feature distance is matched
+    template <typename PointType>
+    bool matchPoint(const PointType &point_ori, const Pose &pose_local, PointPlaneFeature &feature, const size_t &idx) const
+    {
+        PointType point_sel;
+        pointAssociateToMap(point_ori, point_sel, pose_local);
+        const Eigen::Vector3d p(point_sel.x, point_sel.y, point_sel.z);
+        const float inv_voxel_size = 1.0f / voxel_size_;
+        const int ci = static_cast<int>(floor(point_sel.x * inv_voxel_size));
+        const int cj = static_cast<int>(floor(point_sel.y * inv_voxel_size));
+        const int ck = static_cast<int>(floor(point_sel.z * inv_voxel_size));
+        const double sq_voxel_size = voxel_size_ * voxel_size_;
+        const Voxel *best = nullptr;
+        double min_dis = 0;
+        for (int di = -1; di <= 1; di++)
+            for (int dj = -1; dj <= 1; dj++)
+                for (int dk = -1; dk <= 1; dk++)
+                {
+                    auto it = voxels_.find(voxelKey(ci + di, cj + dj, ck + dk));
+                    if ((it == voxels_.end()) || (!it->second.valid_)) continue;
+                    const Voxel &voxel = it->second;
+                    const bool own_voxel = (di == 0) && (dj == 0) && (dk == 0);
+                    if (!own_voxel && ((p - voxel.center_).squaredNorm() > sq_voxel_size)) continue;
+                    const double dis = featureDistance(voxel, p);
+                    if (!best || dis < min_dis)
+                    {
+                        best = &voxel;
+                        min_dis = dis;
+                    }
+                }
+        if (!best) return false;
+
+        const Voxel &voxel = *best;
+        feature.idx_ = idx;
+        feature.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z};
+        if (feature_type_ == 's')
+            feature.coeffs_ = voxel.coeffs_.head<4>();
+        else
+            feature.coeffs_ = voxel.coeffs_;
+        feature.laser_idx_ = (size_t)point_ori.intensity;
+        feature.type_ = feature_type_;
+        return true;
+    }
+
+private:
+    // the distance from p to the plane or the line of a valid voxel
+    double featureDistance(const Voxel &voxel, const Eigen::Vector3d &p) const
+    {
+        if (feature_type_ == 's') return fabs(voxel.coeffs_.head<3>().dot(p) + voxel.coeffs_(3));
+        const Eigen::Vector3d X1 = voxel.coeffs_.head<3>(), X2 = voxel.coeffs_.tail<3>();
+        return ((p - X1).cross(p - X2)).norm() / (X1 - X2).norm();
+    }
+
+    // sign: 1 to add the point, -1 to remove it
+    void updateVoxel(const common::PointIWithCov &point, const int &sign)
+    {
+        const float trace = point.cov_vec[0] + point.cov_vec[3] + point.cov_vec[5];
+        if (fabs(trace) >= trace_threshold_) return; // the same rejection as KeyframeSubmap
+        const double w = trace_threshold_ - trace;
+
+        const float inv_voxel_size = 1.0f / voxel_size_;
+        const int64_t key = voxelKey(point, inv_voxel_size);
+        auto it = voxels_.find(key);
+        if (sign < 0)
+        {
+            if (it == voxels_.end()) return;
+            if (--it->second.cnt_ <= 0)
+            {
+                if (it->second.valid_) valid_num_--;
+                voxels_.erase(it);
+                return;
+            }
+        }
+        else if (it == voxels_.end())
+        {
+            it = voxels_.insert(std::make_pair(key, Voxel())).first;
+            it->second.origin_ = Eigen::Vector3d(floor(point.x * inv_voxel_size),
+                                                 floor(point.y * inv_voxel_size),
+                                                 floor(point.z * inv_voxel_size)) * voxel_size_;
+        }
+
+        Voxel &voxel = it->second;
+        const Eigen::Vector3d p = Eigen::Vector3d(point.x, point.y, point.z) - voxel.origin_;
+        Eigen::Matrix3d cov;
+        cov << point.cov_vec[0], point.cov_vec[1], point.cov_vec[2],
+               point.cov_vec[1], point.cov_vec[3], point.cov_vec[4],
+               point.cov_vec[2], point.cov_vec[4], point.cov_vec[5];
+        if (sign > 0) voxel.cnt_++;
+        voxel.weight_ += sign * w;
+        voxel.sum_point_ += sign * w * p;
+        voxel.sum_sq_point_ += sign * w * p * p.transpose();
+        voxel.sum_cov_ += sign * w * cov;
+        dirty_voxels_.insert(key);
+    }
+
+    // the shape of the feature is fitted from the weighted scatter of the points, and the mean propagated
+    // covariance of the points is added to the spread across it when the feature is checked
+    void fitFeature(Voxel &voxel) const
+    {
+        voxel.valid_ = false;
+        if ((voxel.cnt_ < min_point_num_) || (voxel.weight_ <= 0)) return;
+        const Eigen::Vector3d mean = voxel.sum_point_ / voxel.weight_;
+        const Eigen::Matrix3d scatter = voxel.sum_sq_point_ / voxel.weight_ - mean * mean.transpose();
+        const Eigen::Matrix3d point_cov = voxel.sum_cov_ / voxel.weight_;
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> esolver(scatter);
+        // note Eigen library sort eigenvalues in increasing order
+        const Eigen::Vector3d &lambda = esolver.eigenvalues();
+        const Eigen::Vector3d center = mean + voxel.origin_;
+        if (feature_type_ == 's')
+        {
+            const Eigen::Vector3d norm = esolver.eigenvectors().col(0);
+            const double var_norm = lambda(0) + norm.dot(point_cov * norm);
+            if ((var_norm > plane_thre_ * plane_thre_) || (lambda(1) < 3 * var_norm)) return;
+            voxel.coeffs_ << norm, -norm.dot(center), 0, 0;
+        }
+        else
+        {
+            // the same line criterion as FeatureExtract::matchCornerPointFromMap
+            const Eigen::Vector3d unit_direction = esolver.eigenvectors().col(2);
+            const double var_perp = lambda(1) + 0.5 * (point_cov.trace() - unit_direction.dot(point_cov * unit_direction));
+            if (lambda(2) < 3 * var_perp) return;
+            voxel.coeffs_ << center + 0.1 * unit_direction, center - 0.1 * unit_direction;
+        }
+        voxel.center_ = center;
+        voxel.valid_ = true;
+    }
+
+    char feature_type_;
+    float voxel_size_;
+    int min_point_num_;
+    double plane_thre_;
+    double trace_threshold_;
+    std::unordered_map<int64_t, Voxel, std::hash<int64_t>, std::equal_to<int64_t>,
+                       Eigen::aligned_allocator<std::pair<const int64_t, Voxel> > > voxels_;
+    std::unordered_map<int, common::PointICovCloudPtr> keyframes_;
+    std::unordered_set<int64_t> dirty_voxels_;
+    size_t valid_num_;
+};
+
+//
@@ -0,0 +1,231 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+// rosrun mloam mloam_offline -config_file=config.yaml -output_path=/tmp/ -data_path=/data/sequence/ -start_idx=0 -end_idx=10000
+// reprocess a sequence in the layout of the "pcd" data source (cloud_N/timestamps.txt, cloud_N/data/%06d.pcd):
+// loading (CloudLoader), odometry and mapping run as a pipeline of threads connected by bounded queues,
+// without serialization, frame drops or pacing, so a sequence is processed as fast as the slowest stage.
+// with -loop_closure, the keyframes of the mapping are also fed to the PoseGraph of mloam_loop in this process and
+// the reported frame rate includes the loop closure: a keyframe waits if the loop verification queue is full, and the
+// last verification and pose graph optimization are finished before the time is taken.
+// the keyframes are saved in the pose graph container of mloam_loop, run the loop closure on them later with
+// rosrun mloam_loop loop_closure_node -config_file=config.yaml -output_path=/tmp/ -keyframe_file=/tmp/offline_keyframes.bin
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "mloam_loop/parameters.hpp"
+#include "mloam_loop/pose_graph.h"
+#include "mloam_loop/pose_graph_storage.hpp"
+
+#include "save_statistics.hpp"
+#include "estimator/estimator.h"
+#include "estimator/parameters.h"
+#include "lidarMapper/lidar_mapper_offline.h"
+#include "utility/blocking_queue.h"
+#include "utility/cloud_loader.h"
+#include "utility/tic_toc.h"
+
+// defined in lidar_mapper.h
+DECLARE_bool(result_save);
+DECLARE_string(config_file);
+DECLARE_string(output_path);
+DECLARE_string(trace_file);
+DECLARE_int32(random_seed);
+
+DEFINE_string(data_path, "", "the data path");
+DEFINE_int32(delta_idx, 1, "the delta index");
+DEFINE_int32(start_idx, 0, "the start index");
+DEFINE_int32(end_idx, 100000, "the end index");
+DEFINE_int32(queue_size, 4, "the frames buffered between odometry and mapping");
+DEFINE_string(cloud_format, "pcd", "the format of the clouds in data_path: pcd or bin (raw KITTI)");
+DEFINE_int32(loader_thread_num, 2, "the threads reading the clouds");
+DEFINE_int32(loader_prefetch_num, 8, "the frames read ahead of the odometry");
+DEFINE_string(keyframe_file, "offline_keyframes.bin", "the keyframes saved in output_path for loop_closure_node, not saved if empty");
+DEFINE_bool(loop_closure, false, "run the loop closure of mloam_loop on the keyframes of the mapping");
+DEFINE_string(loop_config_file, "", "the yaml config file of mloam_loop, used with -loop_closure");
+
+Estimator estimator;
+
+mloam_loop::LoopConfig loop_config;
+mloam_loop::PoseGraph posegraph;
+
+int odom_frame_cnt = 0;
+
+// the estimator runs synchronously in this thread, its frames are pushed to the mapper by the callback
+void processOdometry(CloudLoader &loader, BlockingQueue<OdometryFrame::Ptr> &odom_queue)
+{
+    common::timing::Trace::SetThreadName("odometry");
+    estimator.setFrameCallback([&](const OdometryFrame::Ptr &frame) { odom_queue.push(frame); });
+    CloudFrame::Ptr scan;
+    while (loader.getFrame(scan))
+    {
+        estimator.inputCloud(scan->time_, scan->laser_cloud_list_);
+        odom_frame_cnt++;
+    }
+    odom_queue.close();
+}
+
+// the same skipping of the loop detection as loop_closure_node, the keyframe waits instead of dropping a candidate
+void addLoopKeyFrame(const OdometryFrame &frame, const Pose &pose_keyframe, const int &index)
+{
+    int max_loop_queue_size = std::max(1, loop_config.loop_verify_queue_size_ - 1);
+    while (posegraph.getLoopQueueSize() >= max_loop_queue_size)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    mloam_loop::Pose pose_w(pose_keyframe.q_, pose_keyframe.t_);
+    pose_w.cov_ = pose_keyframe.cov_;
+    pcl::PointCloud<pcl::PointXYZI>::Ptr surf_cloud(new pcl::PointCloud<pcl::PointXYZI>(frame.surf_points_less_flat_));
+    pcl::PointCloud<pcl::PointXYZI>::Ptr corner_cloud(new pcl::PointCloud<pcl::PointXYZI>(frame.corner_points_less_sharp_));
+    pcl::PointCloud<pcl::PointXYZI>::Ptr full_cloud(new pcl::PointCloud<pcl::PointXYZI>(frame.laser_cloud_));
+    pcl::PointCloud<pcl::PointXYZI>::Ptr outlier_cloud(new pcl::PointCloud<pcl::PointXYZI>(frame.laser_cloud_outlier_));
+    mloam_loop::KeyFrame keyframe(frame.time_, index, pose_w, surf_cloud, corner_cloud, full_cloud, outlier_cloud, 0);
+
+    posegraph.skip_cnt_++;
+    if (posegraph.skip_cnt_ >= loop_config.loop_skip_interval_)
+        posegraph.addKeyFrame(std::move(keyframe), 1);
+    else
+        posegraph.addKeyFrame(std::move(keyframe), 0);
+}
+
+int main(int argc, char **argv)
+{
+    google::InitGoogleLogging(argv[0]);
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    printf("config_file: %s\n", FLAGS_config_file.c_str());
+    readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
+    // the frames are handed over by the queues, the estimator does not need its own thread
+    MULTIPLE_THREAD = 0;
+    estimator.setParameter();
+    if (FLAGS_random_seed >= 0) estimator.rgi_.setSeed(FLAGS_random_seed);
+
+    MLOAM_RESULT_SAVE = FLAGS_result_save;
+    OUTPUT_FOLDER = FLAGS_output_path;
+    MLOAM_ODOM_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_odom_estimate_" + to_string(ODOM_GF_RATIO) + ".txt";
+    EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "others/extrinsic_parameter.txt";
+    EX_CALIB_EIG_PATH = OUTPUT_FOLDER + "others/calib_eig.txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
+    initMapping();
+    printf("read sequence from: %s\n", FLAGS_data_path.c_str());
+
+    if (FLAGS_loop_closure)
+    {
+        loop_config.result_save_ = FLAGS_result_save;
+        loop_config.setOutputFolder(OUTPUT_FOLDER);
+        printf("loop_config_file: %s\n", FLAGS_loop_config_file.c_str());
+        if (!mloam_loop::readParameters(FLAGS_loop_config_file, loop_config))
+            return 1;
+        posegraph.setParameter(loop_config);
+        posegraph.setPGOTread();
+        posegraph.setLoopVerifyThread(loop_config.loop_verify_thread_num_);
+    }
+
+    mloam_loop::PoseGraphWriter keyframe_writer;
+    bool save_keyframe = !FLAGS_keyframe_file.empty();
+    if (save_keyframe && !keyframe_writer.open(OUTPUT_FOLDER + FLAGS_keyframe_file, mloam_loop::CODEC_RAW))
+    {
+        printf("cannot create the keyframe file: %s\n", (OUTPUT_FOLDER + FLAGS_keyframe_file).c_str());
+        return 1;
+    }
+    bool keyframe_error = false;
+
+    TicToc t_whole;
+    CloudLoader loader(FLAGS_data_path, NUM_OF_LASER, FLAGS_cloud_format);
+    if (!loader.start(std::max(FLAGS_start_idx, 0), std::max(FLAGS_end_idx, 0), std::max(FLAGS_delta_idx, 1),
+                      FLAGS_loader_thread_num, FLAGS_loader_prefetch_num))
+        return 1;
+    BlockingQueue<OdometryFrame::Ptr> odom_queue(FLAGS_queue_size);
+    std::thread odom_thread(processOdometry, std::ref(loader), std::ref(odom_queue));
+
+    // mapping in the main thread
+    common::timing::Trace::SetThreadName("mapping");
+    int map_frame_cnt = 0, keyframe_cnt = 0;
+    OdometryFrame::Ptr frame;
+    while (odom_queue.pop(frame))
+    {
+        map_frame_cnt++;
+        Pose pose_keyframe;
+        if (!processMapping(*frame, pose_keyframe)) continue;
+        if (FLAGS_loop_closure) addLoopKeyFrame(*frame, pose_keyframe, keyframe_cnt);
+        if (save_keyframe && !keyframe_error)
+        {
+            mloam_loop::KeyFrameRecord record;
+            memset(&record, 0, sizeof(mloam_loop::KeyFrameRecord));
+            record.index_ = keyframe_cnt;
+            record.loop_index_ = -1;
+            record.time_stamp_ = frame->time_;
+            for (int i = 0; i < 3; i++) record.pose_w_[i] = pose_keyframe.t_(i);
+            for (int i = 0; i < 4; i++) record.pose_w_[3 + i] = pose_keyframe.q_.coeffs()(i);
+            record.loop_info_[6] = 1.0;
+            const pcl::PointCloud<pcl::PointXYZI> *clouds[mloam_loop::NUM_CLOUD_TYPE];
+            clouds[mloam_loop::CLOUD_SURF] = &frame->surf_points_less_flat_;
+            clouds[mloam_loop::CLOUD_CORNER] = &frame->corner_points_less_sharp_;
+            clouds[mloam_loop::CLOUD_FULL] = &frame->laser_cloud_;
+            clouds[mloam_loop::CLOUD_OUTLIER] = &frame->laser_cloud_outlier_;
+            if (!keyframe_writer.addKeyFrame(record, clouds))
+            {
+                printf("fail to write the keyframe: %d\n", keyframe_cnt);
+                keyframe_error = true;
+            }
+        }
+        keyframe_cnt++;
+    }
+    odom_thread.join();
+    if (FLAGS_loop_closure)
+    {
+        while (!posegraph.isLoopClosureIdle())
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    double whole_time = t_whole.toc() / 1000;
+    if (save_keyframe)
+    {
+        if (keyframe_writer.close() && !keyframe_error)
+        {
+            printf("save %d keyframes to %s\n", keyframe_cnt, (OUTPUT_FOLDER + FLAGS_keyframe_file).c_str());
+        }
+        else
+        {
+            printf("fail to write the keyframe file: %s\n", (OUTPUT_FOLDER + FLAGS_keyframe_file).c_str());
+            keyframe_error = true;
+        }
+    }
+
+    printf("odometry frames: %d, mapping frames: %d, keyframes: %d\n", odom_frame_cnt, map_frame_cnt, keyframe_cnt);
+    printf("whole time: %fs, %f frames/s, waiting for the clouds: %fs\n",
+           whole_time, whole_time > 0 ? odom_frame_cnt / whole_time : 0.0, loader.getWaitTime() / 1000);
+    if (FLAGS_loop_closure)
+    {
+        posegraph.printLoopStatistics();
+        if (loop_config.result_save_) posegraph.savePoseGraph();
+    }
+
+    if (MLOAM_RESULT_SAVE)
+    {
+        SaveStatistics save_statistics;
+        save_statistics.saveOdomStatistics(EX_CALIB_EIG_PATH, EX_CALIB_RESULT_PATH, MLOAM_ODOM_PATH, estimator);
+        save_statistics.saveOdomTimeStatistics(OUTPUT_FOLDER + "time/time_mloam_odometry_" + std::to_string(ODOM_GF_RATIO) + ".txt", estimator);
+    }
+    saveMapping();
+    common::timing::Trace::Stop();
+    return keyframe_error ? 1 : 0;
+}
+
+//
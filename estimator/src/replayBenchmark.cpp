@@ -0,0 +1,465 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+// rosrun mloam mloam_replay_benchmark -config_file=config.yaml -output_path=/tmp/ -data_path=/data/sequence/ -end_idx=1000
+// replay a sequence in the layout of the "pcd" data source through the odometry and the mapping to compare the
+// performance commit to commit: every frame is read, estimated and mapped in turn in this thread with fixed
+// seeds, so two runs see the same input in the same order. written to report_path (output_path by default):
+//   replay_frames.csv: the time, the heap allocations of this thread and the RSS of the odometry and the mapping
+//   per frame (the allocations are counted by mloam_common built with MLOAM_ALLOC_COUNTING, 0 otherwise)
+//   replay_stage_alloc.csv: the allocations per frame and timer (build with MLOAM_ALLOC_COUNTING)
+//   replay_timing.csv/.json: the statistics of all common::timing timers (the stages of odometry and mapping)
+//   replay_summary.json: throughput, peak RSS, allocations per frame (and per stage) and the ATE of odometry and mapping
+// the ground truth is gt_odom/data/%06d.txt of the sequence or the TUM file gt_file. the ATE is the RMSE of the
+// positions after the rigid alignment (Umeyama), the offset between the reference laser and the frame of the
+// ground truth is not removed, so the ATE is meant to be compared between runs rather than between methods.
+// the results are reproducible except for the time budget of the good feature selection (use -gf_method=wo_gf)
+// and the order of the OpenMP reductions
+// script/replay_map_method.sh runs it with -map_method=kdtree and -map_method=voxel and compares the ATE of
+// the mapping and the time per mapped frame of the two map representations
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+
+#include "common/alloc_counter.hpp"
+#include "common/timing.hpp"
+
+#include "estimator/estimator.h"
+#include "estimator/parameters.h"
+#include "lidarMapper/lidar_mapper_offline.h"
+#include "utility/cloud_loader.h"
+#include "utility/tic_toc.h"
+
+// defined in lidar_mapper.h
+DECLARE_bool(result_save);
+DECLARE_string(config_file);
+DECLARE_string(output_path);
+DECLARE_string(trace_file);
+DECLARE_int32(random_seed);
+DECLARE_string(map_method);
+
+DEFINE_string(data_path, "", "the data path");
+DEFINE_int32(delta_idx, 1, "the delta index");
+DEFINE_int32(start_idx, 0, "the start index");
+DEFINE_int32(end_idx, 100000, "the end index");
+DEFINE_string(cloud_format, "pcd", "the format of the clouds in data_path: pcd or bin (raw KITTI)");
+DEFINE_string(gt_file, "", "the ground truth in TUM format (timestamp tx ty tz qx qy qz qw) instead of gt_odom/data");
+DEFINE_double(gt_max_time_diff, 0.02, "the max time difference (s) between a frame and its pose in gt_file");
+DEFINE_string(report_path, "", "the path of the reports, output_path if empty");
+
+// VmRSS (the current resident set) or VmHWM (the peak resident set) of /proc/self/status in MB, 0 if unknown
+double getMemoryMB(const char *key)
+{
+    FILE *file = fopen("/proc/self/status", "r");
+    if (!file) return 0;
+    char line[256];
+    double kb = 0;
+    size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ':')
+        {
+            kb = atof(line + key_len + 1);
+            break;
+        }
+    }
+    fclose(file);
+    return kb / 1024.0;
+}
+
+// ****************** the allocations per stage
+// the allocations recorded by the common::timing timers (MLOAM_ALLOC_COUNTING), a stage
+// includes its nested stages, e.g. odom_process > odom_solver
+struct StageAlloc
+{
+    size_t handle_;
+    uint64_t num_, bytes_;
+};
+
+struct StageAllocSummary
+{
+    StageAllocSummary() : frame_num_(0), num_(0), bytes_(0), max_num_(0) {}
+
+    size_t frame_num_;
+    uint64_t num_, bytes_, max_num_;
+};
+
+class StageAllocCounter
+{
+public:
+    StageAllocCounter() : last_(common::timing::kMaxTimers) {}
+
+    // the stages which ran since the last call
+    void update(std::vector<StageAlloc> &stage_alloc_list)
+    {
+        stage_alloc_list.clear();
+        for (const common::timing::Timing::map_t::value_type &tag : common::timing::Timing::GetTimers())
+        {
+            size_t handle = tag.second;
+            if (handle >= last_.size()) continue;
+            common::timing::TimerStatistics stat = common::timing::Timing::GetStatistics(handle);
+            if (stat.num_samples_ == last_[handle].num_samples_) continue;
+            stage_alloc_list.push_back(StageAlloc{handle, stat.alloc_num_ - last_[handle].alloc_num_,
+                                                  stat.alloc_bytes_ - last_[handle].alloc_bytes_});
+            last_[handle] = stat;
+        }
+    }
+
+private:
+    std::vector<common::timing::TimerStatistics> last_;
+};
+
+// ****************** trajectory error
+struct FrameRecord
+{
+    size_t idx_;
+    double time_;
+    double odom_ms_, map_ms_; // map_ms_ < 0 if the frame is not mapped
+    common::alloc::AllocCount odom_alloc_, map_alloc_;
+    std::vector<StageAlloc> stage_alloc_;
+    double rss_mb_;
+    Eigen::Vector3d t_odom_, t_map_;
+    bool gt_valid_;
+    Eigen::Vector3d t_gt_;
+};
+
+struct TrajectoryError
+{
+    size_t num_;
+    double rmse_, mean_, max_;
+};
+
+// align the estimated positions to the ground truth with a rigid transformation
+TrajectoryError evalATE(const std::vector<Eigen::Vector3d> &est, const std::vector<Eigen::Vector3d> &gt)
+{
+    TrajectoryError error = {est.size(), 0, 0, 0};
+    if (est.size() < 3) return error;
+    Eigen::Matrix3Xd src(3, est.size()), dst(3, gt.size());
+    for (size_t i = 0; i < est.size(); i++)
+    {
+        src.col(i) = est[i];
+        dst.col(i) = gt[i];
+    }
+    Eigen::Matrix4d T = Eigen::umeyama(src, dst, false);
+    Eigen::Matrix3Xd src_aligned = (T.topLeftCorner<3, 3>() * src).colwise() + T.topRightCorner<3, 1>();
+    Eigen::VectorXd dis = (src_aligned - dst).colwise().norm();
+    error.rmse_ = std::sqrt(dis.squaredNorm() / dis.size());
+    error.mean_ = dis.mean();
+    error.max_ = dis.maxCoeff();
+    return error;
+}
+
+// the positions of the TUM file sorted by time
+bool readGroundTruth(const std::string &filename, std::map<double, Eigen::Vector3d> &gt_list)
+{
+    FILE *file = fopen(filename.c_str(), "r");
+    if (!file)
+    {
+        printf("cannot find the ground truth: %s\n", filename.c_str());
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        double t, x, y, z;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%lf %lf %lf %lf", &t, &x, &y, &z) == 4) gt_list[t] = Eigen::Vector3d(x, y, z);
+    }
+    fclose(file);
+    printf("read %lu poses of the ground truth from %s\n", gt_list.size(), filename.c_str());
+    return true;
+}
+
+bool findGroundTruth(const std::map<double, Eigen::Vector3d> &gt_list, const double &time, Eigen::Vector3d &t_gt)
+{
+    std::map<double, Eigen::Vector3d>::const_iterator it = gt_list.lower_bound(time);
+    double time_diff = FLAGS_gt_max_time_diff;
+    bool found = false;
+    if (it != gt_list.end() && it->first - time <= time_diff)
+    {
+        time_diff = it->first - time;
+        t_gt = it->second;
+        found = true;
+    }
+    if (it != gt_list.begin() && time - std::prev(it)->first <= time_diff)
+    {
+        t_gt = std::prev(it)->second;
+        found = true;
+    }
+    return found;
+}
+
+// ****************** report
+bool writeFrames(const std::string &filename, const std::vector<FrameRecord> &record_list)
+{
+    FILE *file = fopen(filename.c_str(), "w");
+    if (!file)
+    {
+        printf("cannot create file: %s\n", filename.c_str());
+        return false;
+    }
+    fprintf(file, "idx,time,odom_ms,map_ms,odom_alloc_num,odom_alloc_mb,map_alloc_num,map_alloc_mb,rss_mb\n");
+    for (const FrameRecord &record : record_list)
+    {
+        fprintf(file, "%lu,%.6f,%.3f,%.3f,%lu,%.3f,%lu,%.3f,%.1f\n",
+                record.idx_, record.time_, record.odom_ms_, record.map_ms_,
+                record.odom_alloc_.num_, record.odom_alloc_.bytes_ / 1048576.0,
+                record.map_alloc_.num_, record.map_alloc_.bytes_ / 1048576.0, record.rss_mb_);
+    }
+    fclose(file);
+    return true;
+}
+
+bool writeStageAlloc(const std::string &filename, const std::vector<FrameRecord> &record_list,
+                     const std::vector<std::string> &tag_list)
+{
+    FILE *file = fopen(filename.c_str(), "w");
+    if (!file)
+    {
+        printf("cannot create file: %s\n", filename.c_str());
+        return false;
+    }
+    fprintf(file, "idx,time,stage,alloc_num,alloc_kb\n");
+    for (const FrameRecord &record : record_list)
+    {
+        for (const StageAlloc &stage_alloc : record.stage_alloc_)
+        {
+            fprintf(file, "%lu,%.6f,%s,%lu,%.3f\n", record.idx_, record.time_, tag_list[stage_alloc.handle_].c_str(),
+                    stage_alloc.num_, stage_alloc.bytes_ / 1024.0);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+void writeError(FILE *file, const char *name, const TrajectoryError &error)
+{
+    fprintf(file, "  \"%s\": {\"num\": %lu, \"rmse\": %.6f, \"mean\": %.6f, \"max\": %.6f}",
+            name, error.num_, error.rmse_, error.mean_, error.max_);
+}
+
+int main(int argc, char **argv)
+{
+    google::InitGoogleLogging(argv[0]);
+    // the benchmark is reproducible by default
+    google::SetCommandLineOptionWithMode("random_seed", "0", google::SET_FLAGS_DEFAULT);
+    google::SetCommandLineOptionWithMode("result_save", "false", google::SET_FLAGS_DEFAULT);
+    google::ParseCommandLineFlags(&argc, &argv, true);
+
+    printf("config_file: %s\n", FLAGS_config_file.c_str());
+    readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
+    MULTIPLE_THREAD = 0;
+
+    Estimator estimator;
+    estimator.setParameter();
+    if (FLAGS_random_seed >= 0) estimator.rgi_.setSeed(FLAGS_random_seed);
+    OdometryFrame::Ptr odom_frame;
+    estimator.setFrameCallback([&](const OdometryFrame::Ptr &frame) { odom_frame = frame; });
+
+    MLOAM_RESULT_SAVE = FLAGS_result_save;
+    OUTPUT_FOLDER = FLAGS_output_path;
+    MLOAM_ODOM_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_odom_estimate_" + to_string(ODOM_GF_RATIO) + ".txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
+    initMapping();
+    std::string report_path = FLAGS_report_path.empty() ? OUTPUT_FOLDER : FLAGS_report_path;
+
+    std::map<double, Eigen::Vector3d> gt_list;
+    if (!FLAGS_gt_file.empty() && !readGroundTruth(FLAGS_gt_file, gt_list)) return 1;
+
+    // no prefetching, the clouds are read between the frames and neither their time nor their memory is counted
+    CloudLoader loader(FLAGS_data_path, NUM_OF_LASER, FLAGS_cloud_format);
+    if (!loader.start(std::max(FLAGS_start_idx, 0), std::max(FLAGS_end_idx, 0), std::max(FLAGS_delta_idx, 1), 0))
+        return 1;
+    common::timing::Timing::Reset();
+
+    std::vector<FrameRecord> record_list;
+    record_list.reserve(loader.getFrameNum());
+    StageAllocCounter stage_alloc_counter;
+    double rss_start = getMemoryMB("VmRSS");
+    TicToc t_whole;
+    double load_time = 0;
+    CloudFrame::Ptr scan;
+    while (true)
+    {
+        TicToc t_load;
+        if (!loader.getFrame(scan)) break;
+        load_time += t_load.toc();
+
+        FrameRecord record;
+        record.idx_ = scan->idx_;
+        record.time_ = scan->time_;
+        record.gt_valid_ = scan->gt_valid_;
+        if (record.gt_valid_) record.t_gt_ = scan->t_world_base_;
+        if (!FLAGS_gt_file.empty()) record.gt_valid_ = findGroundTruth(gt_list, scan->time_, record.t_gt_);
+
+        common::alloc::AllocCount alloc_start = common::alloc::GetThreadCount();
+        TicToc t_odom;
+        estimator.inputCloud(scan->time_, scan->laser_cloud_list_);
+        record.odom_ms_ = t_odom.toc();
+        common::alloc::AllocCount alloc_odom = common::alloc::GetThreadCount();
+        record.odom_alloc_ = common::alloc::AllocCount{alloc_odom.num_ - alloc_start.num_, alloc_odom.bytes_ - alloc_start.bytes_};
+        record.t_odom_ = estimator.getOdometryPose().t_;
+
+        record.map_ms_ = -1;
+        record.map_alloc_ = common::alloc::AllocCount{0, 0};
+        if (odom_frame)
+        {
+            TicToc t_map;
+            Pose pose_keyframe;
+            processMapping(*odom_frame, pose_keyframe);
+            record.map_ms_ = t_map.toc();
+            odom_frame.reset();
+            common::alloc::AllocCount alloc_map = common::alloc::GetThreadCount();
+            record.map_alloc_ = common::alloc::AllocCount{alloc_map.num_ - alloc_odom.num_, alloc_map.bytes_ - alloc_odom.bytes_};
+        }
+        record.t_map_ = getMappingPose().t_;
+        if (common::alloc::IsCounting()) stage_alloc_counter.update(record.stage_alloc_);
+        record.rss_mb_ = getMemoryMB("VmRSS");
+        scan.reset();
+        record_list.push_back(record);
+    }
+    double whole_time = (t_whole.toc() - load_time) / 1000;
+    double rss_peak = getMemoryMB("VmHWM");
+
+    // only the mapped frames have a mapping pose of their own
+    std::vector<Eigen::Vector3d> est_odom, gt_odom, est_map, gt_map;
+    double odom_time = 0, map_time = 0;
+    uint64_t odom_alloc_num = 0, map_alloc_num = 0;
+    size_t map_frame_num = 0;
+    for (const FrameRecord &record : record_list)
+    {
+        odom_time += record.odom_ms_;
+        odom_alloc_num += record.odom_alloc_.num_;
+        if (record.gt_valid_)
+        {
+            est_odom.push_back(record.t_odom_);
+            gt_odom.push_back(record.t_gt_);
+        }
+        if (record.map_ms_ < 0) continue;
+        map_frame_num++;
+        map_time += record.map_ms_;
+        map_alloc_num += record.map_alloc_.num_;
+        if (record.gt_valid_)
+        {
+            est_map.push_back(record.t_map_);
+            gt_map.push_back(record.t_gt_);
+        }
+    }
+    size_t frame_num = record_list.size();
+
+    // the allocations per frame of each stage, over the frames in which the stage ran
+    std::vector<std::string> tag_list(common::timing::kMaxTimers);
+    for (const common::timing::Timing::map_t::value_type &tag : common::timing::Timing::GetTimers())
+        if (tag.second < tag_list.size()) tag_list[tag.second] = tag.first;
+    std::map<std::string, StageAllocSummary> stage_summary;
+    for (const FrameRecord &record : record_list)
+    {
+        for (const StageAlloc &stage_alloc : record.stage_alloc_)
+        {
+            StageAllocSummary &summary = stage_summary[tag_list[stage_alloc.handle_]];
+            summary.frame_num_++;
+            summary.num_ += stage_alloc.num_;
+            summary.bytes_ += stage_alloc.bytes_;
+            summary.max_num_ = std::max(summary.max_num_, stage_alloc.num_);
+        }
+    }
+    TrajectoryError error_odom = evalATE(est_odom, gt_odom);
+    TrajectoryError error_map = evalATE(est_map, gt_map);
+
+    writeFrames(report_path + "replay_frames.csv", record_list);
+    if (common::alloc::IsCounting()) writeStageAlloc(report_path + "replay_stage_alloc.csv", record_list, tag_list);
+    common::timing::Timing::WriteCsv(report_path + "replay_timing.csv");
+    common::timing::Timing::WriteJson(report_path + "replay_timing.json");
+    FILE *file = fopen((report_path + "replay_summary.json").c_str(), "w");
+    if (file)
+    {
+        fprintf(file, "{\n");
+        fprintf(file, "  \"data_path\": \"%s\",\n", FLAGS_data_path.c_str());
+        fprintf(file, "  \"random_seed\": %d,\n", FLAGS_random_seed);
+        fprintf(file, "  \"map_method\": \"%s\",\n", FLAGS_map_method.c_str());
+        fprintf(file, "  \"frame_num\": %lu,\n  \"map_frame_num\": %lu,\n", frame_num, map_frame_num);
+        fprintf(file, "  \"whole_time_s\": %.3f,\n  \"fps\": %.3f,\n", whole_time, whole_time > 0 ? frame_num / whole_time : 0.0);
+        fprintf(file, "  \"odom_mean_ms\": %.3f,\n", frame_num > 0 ? odom_time / frame_num : 0.0);
+        fprintf(file, "  \"map_mean_ms\": %.3f,\n", map_frame_num > 0 ? map_time / map_frame_num : 0.0);
+        fprintf(file, "  \"odom_alloc_per_frame\": %.1f,\n", frame_num > 0 ? 1.0 * odom_alloc_num / frame_num : 0.0);
+        fprintf(file, "  \"map_alloc_per_frame\": %.1f,\n", map_frame_num > 0 ? 1.0 * map_alloc_num / map_frame_num : 0.0);
+        fprintf(file, "  \"rss_start_mb\": %.1f,\n  \"rss_peak_mb\": %.1f,\n", rss_start, rss_peak);
+        writeError(file, "ate_odom", error_odom);
+        fprintf(file, ",\n");
+        writeError(file, "ate_map", error_map);
+        if (common::alloc::IsCounting())
+        {
+            fprintf(file, ",\n  \"stage_alloc\": {");
+            bool first = true;
+            for (const std::pair<const std::string, StageAllocSummary> &stage : stage_summary)
+            {
+                const StageAllocSummary &summary = stage.second;
+                fprintf(file, "%s\n    \"%s\": {\"frame_num\": %lu, \"alloc_per_frame\": %.1f, "
+                        "\"alloc_kb_per_frame\": %.3f, \"max_alloc\": %lu}", first ? "" : ",", stage.first.c_str(),
+                        summary.frame_num_, 1.0 * summary.num_ / summary.frame_num_,
+                        summary.bytes_ / 1024.0 / summary.frame_num_, summary.max_num_);
+                first = false;
+            }
+            fprintf(file, "\n  }");
+        }
+        fprintf(file, "\n}\n");
+        fclose(file);
+    }
+
+    printf("frames: %lu, mapped frames: %lu, whole time: %fs, %f frames/s\n",
+           frame_num, map_frame_num, whole_time, whole_time > 0 ? frame_num / whole_time : 0.0);
+    printf("odometry: %fms, %.1f allocations per frame\n",
+           frame_num > 0 ? odom_time / frame_num : 0.0, frame_num > 0 ? 1.0 * odom_alloc_num / frame_num : 0.0);
+    printf("mapping (%s): %fms, %.1f allocations per frame\n", FLAGS_map_method.c_str(),
+           map_frame_num > 0 ? map_time / map_frame_num : 0.0, map_frame_num > 0 ? 1.0 * map_alloc_num / map_frame_num : 0.0);
+    printf("RSS: %.1fMB at start, %.1fMB at peak\n", rss_start, rss_peak);
+    if (common::alloc::IsCounting())
+    {
+        printf("allocations per frame of each stage (including its nested stages):\n");
+        for (const std::pair<const std::string, StageAllocSummary> &stage : stage_summary)
+        {
+            const StageAllocSummary &summary = stage.second;
+            printf("  %-32s %10.1f allocations %12.1fKB, max %lu (%lu frames)\n", stage.first.c_str(),
+                   1.0 * summary.num_ / summary.frame_num_, summary.bytes_ / 1024.0 / summary.frame_num_,
+                   summary.max_num_, summary.frame_num_);
+        }
+    }
+    else
+    {
+        printf("built without MLOAM_ALLOC_COUNTING, no allocations per stage\n");
+    }
+    printf("ATE of odometry: %fm (%lu poses), mapping: %fm (%lu poses)\n",
+           error_odom.rmse_, error_odom.num_, error_map.rmse_, error_map.num_);
+    printf("write the reports to %sreplay_*\n", report_path.c_str());
+    common::timing::Timing::Print(std::cout);
+
+    if (MLOAM_RESULT_SAVE) saveMapping();
+    common::timing::Trace::Stop();
+    return 0;
+}
+
+//
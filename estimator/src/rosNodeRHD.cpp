@@ -36,8 +36,6 @@
 #include <sensor_msgs/NavSatFix.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Imu.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -46,20 +44,21 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/cloud_ingest.h"
 
 using namespace std;
 
 DEFINE_bool(result_save, true, "save or not save the results");
 DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(output_path, "", "the path ouf saving results");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
 
 Estimator estimator;
 
 SaveStatistics save_statistics;
 
 // message buffer
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr>> all_cloud_buf(2);
-std::mutex m_buf;
+CloudIngest<pcl::PointXYZ> cloud_ingest;
 
 // laser path groundtruth
 nav_msgs::Path laser_gt_path;
@@ -68,67 +67,23 @@ Pose pose_world_ref_ini;
 
 int frame_drop_cnt = 0;
 
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    m_buf.unlock();
-}
-
-pcl::PointCloud<pcl::PointXYZ> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZ> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(laser_cloud, laser_cloud, indices);
-    return laser_cloud;
-}
-
 // extract images with same timestamp from two topics
 // independent from ros::spin()
 void sync_process()
 {
+    common::timing::Trace::SetThreadName("odometry_input");
     while(1)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
+        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud;
         double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty())
+        if (cloud_ingest.getFrame(time, v_laser_cloud))
         {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
+            bool empty_check = false;
             for (size_t i = 0; i < NUM_OF_LASER; i++)
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++) all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty())
-        {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
+                if (v_laser_cloud[i].size() == 0) empty_check = true;
 
-        bool empty_check = false;
-        for (size_t i = 0; i < NUM_OF_LASER; i++)
-            if (v_laser_cloud[i].size() == 0) empty_check = true;
-
-        if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+            if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(2));
     }
 }
@@ -190,6 +145,7 @@ int main(int argc, char **argv)
     // ******************************************
     printf("config_file: %s\n", FLAGS_config_file.c_str());
     readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
     estimator.setParameter();
     registerPub(nh);
 
@@ -199,22 +155,13 @@ int main(int argc, char **argv)
     MLOAM_GT_PATH = OUTPUT_FOLDER + "traj/stamped_groundtruth.txt";
     EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "others/extrinsic_parameter.txt";
     EX_CALIB_EIG_PATH = OUTPUT_FOLDER + "others/calib_eig.txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
     printf("save result (0/1): %d\n", MLOAM_RESULT_SAVE);
     std::cout << common::YELLOW << "waiting for cloud..." << common::RESET << std::endl;
 
     // ******************************************
-    typedef sensor_msgs::PointCloud2 LidarMsgType;
-    typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType> LidarSyncPolicy;
-    typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-    std::vector<LidarSubType *> sub_lidar(2);
-    NUM_OF_LASER = NUM_OF_LASER < 2 ? NUM_OF_LASER : 2;
-    for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 1);
-    for (size_t i = NUM_OF_LASER; i < 2; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 1);
-    message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-        new message_filters::Synchronizer<LidarSyncPolicy>(
-            LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1]);
-    lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2));
+    cloud_ingest.setParameter(NUM_OF_LASER, LASER_SYNC_THRESHOLD);
+    cloud_ingest.subscribe(nh, CLOUD_TOPIC);
 
     ros::Subscriber sub_restart = nh.subscribe("/mlod_restart", 5, restart_callback);
     ros::Subscriber sub_pose_gt = nh.subscribe("/base_pose_gt", 5, pose_gt_callback);
@@ -233,6 +180,8 @@ int main(int argc, char **argv)
         loop_rate.sleep();
     }
 
+    frame_drop_cnt = cloud_ingest.getDropCount();
+    cloud_ingest.printStatistics();
     std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
     if (MLOAM_RESULT_SAVE)
     {
@@ -244,6 +193,7 @@ int main(int argc, char **argv)
 
     cloud_visualizer_thread.join();
     sync_thread.join();
+    common::timing::Trace::Stop();
     return 0;
 }
 
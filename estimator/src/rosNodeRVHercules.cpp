@@ -40,8 +40,6 @@
 #include <sensor_msgs/NavSatFix.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Imu.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -51,24 +49,29 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/cloud_loader.h"
+#include "utility/cloud_ingest.h"
 
 using namespace std;
 
 DEFINE_bool(result_save, true, "save or not save the results");
 DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(output_path, "", "the path ouf saving results");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
 DEFINE_string(data_source, "bag", "the data source: bag or bag");
 DEFINE_string(data_path, "", "the data path");
 DEFINE_int32(delta_idx, 1, "the delta index");
 DEFINE_int32(start_idx, 1, "the start index");
 DEFINE_int32(end_idx, 100, "the end index");
+DEFINE_string(cloud_format, "pcd", "the format of the clouds in data_path: pcd or bin (raw KITTI)");
+DEFINE_int32(loader_thread_num, 2, "the threads reading the clouds of the data source pcd");
+DEFINE_int32(loader_prefetch_num, 8, "the frames read ahead of the odometry");
 
 Estimator estimator;
 
 SaveStatistics save_statistics;
 
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr> > all_cloud_buf(5);
-std::mutex m_buf;
+CloudIngest<pcl::PointXYZ> cloud_ingest;
 
 nav_msgs::Path laser_gt_path;
 Pose pose_world_ref_ini;
@@ -84,21 +87,6 @@ int frame_drop_cnt = 0;
 int frame_cnt = 0;
 size_t DELTA_IDX;
 
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud2_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud3_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud4_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    all_cloud_buf[2].push(cloud2_msg);
-    all_cloud_buf[3].push(cloud3_msg);
-    all_cloud_buf[4].push(cloud4_msg);
-    m_buf.unlock();
-}
-
 void gtCallback(const nav_msgs::OdometryConstPtr &gt_odom_msg)
 {
     Pose pose_world_base(*gt_odom_msg);
@@ -163,59 +151,24 @@ void pauseCallback(std_msgs::StringConstPtr msg)
     printf("%s\n", msg->data.c_str());
     b_pause = !b_pause;
 }
-pcl::PointCloud<pcl::PointXYZ> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZ> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(laser_cloud, laser_cloud, indices);
-    return laser_cloud;
-}
 
 void sync_process()
 {
+    common::timing::Trace::SetThreadName("odometry_input");
     while (1)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
+        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud;
         double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty() && !all_cloud_buf[2].empty() 
-         && !all_cloud_buf[3].empty() && !all_cloud_buf[4].empty())
-        {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
-            for (size_t i = 0; i < NUM_OF_LASER; i++) 
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++) all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty())
+        if (cloud_ingest.getFrame(time, v_laser_cloud))
         {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance" 
-                      << common::RESET << std::endl;
+            bool empty_check = false;
+            for (size_t i = 0; i < NUM_OF_LASER; i++)
+                if (v_laser_cloud[i].size() == 0) empty_check = true;
+
+            if (frame_cnt % DELTA_IDX == 0)
+                if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+            frame_cnt++;
         }
-        m_buf.unlock();
-
-        bool empty_check = false;
-        for (size_t i = 0; i < NUM_OF_LASER; i++)
-            if (v_laser_cloud[i].size() == 0) empty_check = true;
-            
-        if (frame_cnt % DELTA_IDX == 0)
-            if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
-        frame_cnt++;
         std::this_thread::sleep_for(std::chrono::milliseconds(2));
     }
 }
@@ -236,6 +189,7 @@ int main(int argc, char **argv)
     // ******************************************
     printf("config_file: %s\n", FLAGS_config_file.c_str());
     readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
     estimator.setParameter();
     registerPub(nh);
 
@@ -246,6 +200,7 @@ int main(int argc, char **argv)
     MLOAM_GT_PATH = OUTPUT_FOLDER + "traj/stamped_groundtruth.txt";
     EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "others/extrinsic_parameter.txt";
     EX_CALIB_EIG_PATH = OUTPUT_FOLDER + "others/calib_eig.txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
     printf("save result (0/1): %d\n", MLOAM_RESULT_SAVE);
     string data_source = FLAGS_data_source;
     printf("data source: %s\n", data_source.c_str());
@@ -258,18 +213,8 @@ int main(int argc, char **argv)
     // ******************************************
     if (!data_source.compare("bag")) // use bag as the data source
     {
-        typedef sensor_msgs::PointCloud2 LidarMsgType;
-        typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType, LidarMsgType, LidarMsgType, LidarMsgType> LidarSyncPolicy;
-        typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-        std::vector<LidarSubType *> sub_lidar(5);
-        NUM_OF_LASER = NUM_OF_LASER < 5 ? NUM_OF_LASER : 5;
-        for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 1);
-        for (size_t i = NUM_OF_LASER; i < 5; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 1);
-        message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-            new message_filters::Synchronizer<LidarSyncPolicy>(
-                LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1], *sub_lidar[2], *sub_lidar[3], *sub_lidar[4]);
-        lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2, _3, _4, _5));
+        cloud_ingest.setParameter(NUM_OF_LASER, LASER_SYNC_THRESHOLD);
+        cloud_ingest.subscribe(nh, CLOUD_TOPIC);
 
         ros::Subscriber sub_gt = nh.subscribe<nav_msgs::Odometry>("/base_odom_gt", 1, gtCallback);
         ros::Subscriber sub_gps = nh.subscribe<sensor_msgs::NavSatFix>("/novatel718d/pos", 1, gpsCallback);
@@ -285,8 +230,9 @@ int main(int argc, char **argv)
             loop_rate.sleep();
         }
 
+        frame_drop_cnt = cloud_ingest.getDropCount();
+        cloud_ingest.printStatistics();
         std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
-        std::cout << "odometry drop frame: " << frame_drop_cnt;
         if (MLOAM_RESULT_SAVE)
         {
             std::cout << common::RED << "saving odometry results" << common::RESET << std::endl;
@@ -317,78 +263,28 @@ int main(int argc, char **argv)
         // }
 
         // *************************************
-        // read cloud list
-        FILE *file;
-        double cloud_time;
-        vector<double> cloud_time_list;
+        // read data, the clouds of the next frames are read on the threads of loader
+        CloudLoader loader(data_path, NUM_OF_LASER, FLAGS_cloud_format);
+        if (!loader.start(FLAGS_start_idx, FLAGS_end_idx, DELTA_IDX, FLAGS_loader_thread_num, FLAGS_loader_prefetch_num))
         {
-            file = std::fopen((data_path + "cloud_0/timestamps.txt").c_str(), "r");
-            if (!file)
-            {
-                printf("cannot find file: %stimes.txt\n", data_path.c_str());
-                ROS_BREAK();
-                return 0;
-            }
-            while (fscanf(file, "%lf", &cloud_time) != EOF)
-            {
-                cloud_time_list.push_back(cloud_time);
-            }
-            std::fclose(file);    
-        }  
-
-        // *************************************
-        // read data
-        size_t START_IDX = FLAGS_start_idx;
-        size_t END_IDX = FLAGS_end_idx;
-        printf("start idx: %d, end idx: %d, whole data size: %lu\n", START_IDX, END_IDX, cloud_time_list.size());
-        for (size_t i = START_IDX; i < std::min(cloud_time_list.size(), END_IDX); i+=DELTA_IDX)
+            ROS_BREAK();
+            return 0;
+        }
+        CloudFrame::Ptr frame;
+        while (loader.getFrame(frame))
         {	
             if (!ros::ok()) break;
-            stringstream ss, ss_cloud;
-            double cloud_time;
-            cloud_time = cloud_time_list[i];
-            std::cout << common::YELLOW << "process data: " << i << " " << cloud_time << common::RESET << std::endl;
-            ss << setfill('0') << setw(6) << i;
-
-            // load cloud
-            std::vector<pcl::PointCloud<pcl::PointXYZ> > laser_cloud_list(NUM_OF_LASER);
-            for (size_t j = 0; j < NUM_OF_LASER; j++)
-            {
-                std::stringstream cloud_path;
-                cloud_path << data_path << "cloud_" << j << "/data/" << ss.str() << ".pcd";
-                if (pcl::io::loadPCDFile<pcl::PointXYZ>(cloud_path.str(), laser_cloud_list[j]) == -1)
-                {
-                    printf("Couldn't read file %s\n", cloud_path.str().c_str());
-                    ROS_BREAK();
-                    return 0;
-                }
-                ss_cloud << laser_cloud_list[j].size() << " ";
-                std::vector<int> indices;
-                pcl::removeNaNFromPointCloud(laser_cloud_list[j], laser_cloud_list[j], indices);
-            }
+            stringstream ss_cloud;
+            double cloud_time = frame->time_;
+            std::cout << common::YELLOW << "process data: " << frame->idx_ << " " << cloud_time << common::RESET << std::endl;
+            std::vector<pcl::PointCloud<pcl::PointXYZ> > &laser_cloud_list = frame->laser_cloud_list_;
+            for (size_t j = 0; j < NUM_OF_LASER; j++) ss_cloud << laser_cloud_list[j].size() << " ";
             printf("size of finding laser_cloud: %s\n", ss_cloud.str().c_str());
 
             // load odom
-            FILE *gt_odom_file;
-            std::string gt_odom_file_path = data_path + "gt_odom/data/" + ss.str() + ".txt";
-            gt_odom_file = std::fopen(gt_odom_file_path.c_str() , "r");
-            if(!gt_odom_file)
-            {
-                printf("cannot find file: %s\n", gt_odom_file_path.c_str());
-                // ROS_BREAK();
-                // return 0;          
-            } 
-            else
+            if (frame->gt_valid_)
             {
-                double posx, posy, posz;
-                double orix, oriy, oriz, oriw;
-                fscanf(gt_odom_file, "%lf %lf %lf ", &posx, &posy, &posz);
-                fscanf(gt_odom_file, "%lf %lf %lf %lf ", &orix, &oriy, &oriz, &oriw);
-                std::fclose(gt_odom_file);
-
-                Eigen::Vector3d t_world_base(posx, posy, posz);
-                Eigen::Quaterniond q_world_base(oriw, orix, oriy, oriz);
-                Pose pose_world_base(q_world_base, t_world_base);
+                Pose pose_world_base(frame->q_world_base_, frame->t_world_base_);
                 Pose pose_base_ref(Eigen::Quaterniond(1, 0, 0, 0), Eigen::Vector3d(0, 0, 0));
                 Pose pose_world_ref(pose_world_base * pose_base_ref);
 
@@ -419,36 +315,19 @@ int main(int argc, char **argv)
             }
 
             // load gps
-            FILE *gps_file;
-            std::string gps_file_path = data_path + "gps/data/" + ss.str() + ".txt";
-            gps_file = std::fopen(gps_file_path.c_str() , "r");
-            if(!gps_file)
+            if (frame->gps_valid_)
             {
-                // printf("cannot find file: %s\n", gps_file_path.c_str());
-                // ROS_BREAK();
-                // return 0;          
-            } 
-            else
-            {
-                double lat, lon, alt;
-                double posx_accuracy, posy_accuracy, posz_accuracy;
-                int navstat, numsats;
-                fscanf(gps_file, "%d %d ", &navstat, &numsats);
-                fscanf(gps_file, "%lf %lf %lf ", &lat, &lon, &alt);
-                fscanf(gps_file, "%lf %lf %lf ", &posx_accuracy, &posy_accuracy, &posz_accuracy);
-                std::fclose(gps_file);
-
                 sensor_msgs::NavSatFix gps_msgs;
                 gps_msgs.header.frame_id = "gps";
                 gps_msgs.header.stamp = ros::Time(cloud_time);
-                gps_msgs.status.status = navstat;
-                gps_msgs.status.service = numsats;
-                gps_msgs.latitude = lat;
-                gps_msgs.longitude = lon;
-                gps_msgs.altitude = alt;
-                gps_msgs.position_covariance[0] = posx_accuracy;
-                gps_msgs.position_covariance[4] = posy_accuracy;
-                gps_msgs.position_covariance[8] = posz_accuracy;
+                gps_msgs.status.status = frame->navstat_;
+                gps_msgs.status.service = frame->numsats_;
+                gps_msgs.latitude = frame->lat_;
+                gps_msgs.longitude = frame->lon_;
+                gps_msgs.altitude = frame->alt_;
+                gps_msgs.position_covariance[0] = frame->pos_accuracy_[0];
+                gps_msgs.position_covariance[4] = frame->pos_accuracy_[1];
+                gps_msgs.position_covariance[8] = frame->pos_accuracy_[2];
                 pub_gps.publish(gps_msgs);
 
                 gps_tools.updateGPSpose(gps_msgs);
@@ -502,6 +381,7 @@ int main(int argc, char **argv)
         }
         // cloud_visualizer_thread.join();
     }
+    common::timing::Trace::Stop();
     return 0;
 }
 
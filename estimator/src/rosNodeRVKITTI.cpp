@@ -40,8 +40,6 @@
 #include <sensor_msgs/NavSatFix.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Imu.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -51,6 +49,7 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/cloud_ingest.h"
 #include "mloam_pcl/point_with_time.hpp"
 
 using namespace std;
@@ -59,13 +58,13 @@ DEFINE_bool(result_save, true, "save or not save the results");
 DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(data_source, "bag", "the data source: bag or bag");
 DEFINE_string(output_path, "", "the path ouf saving results");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
 
 Estimator estimator;
 
 SaveStatistics save_statistics;
 
-std::queue<sensor_msgs::PointCloud2ConstPtr> cloud_buf;
-std::mutex m_buf;
+CloudIngest<pcl::PointXYZ> cloud_ingest;
 
 nav_msgs::Path laser_gt_path;
 Pose pose_world_ref_ini;
@@ -79,13 +78,6 @@ bool b_pause = false;
 
 int frame_drop_cnt = 0;
 
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    m_buf.lock();
-    cloud_buf.push(cloud_msg);
-    m_buf.unlock();
-}
-
 void gtCallback(const nav_msgs::OdometryConstPtr &gt_odom_msg)
 {
     Pose pose_world_gt(*gt_odom_msg);
@@ -151,44 +143,20 @@ void pauseCallback(std_msgs::StringConstPtr msg)
     b_pause = !b_pause;
 }
 
-pcl::PointCloud<pcl::PointXYZ> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZ> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(laser_cloud, laser_cloud, indices);
-    return laser_cloud;
-}
-
 void sync_process()
 {
+    common::timing::Trace::SetThreadName("odometry_input");
     while (1)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
+        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud;
         double time = 0;
-        m_buf.lock();
-        if (!cloud_buf.empty())
+        if (cloud_ingest.getFrame(time, v_laser_cloud))
         {
-            time = cloud_buf.front()->header.stamp.toSec();
-            header = cloud_buf.front()->header;
-            v_laser_cloud[0] = getCloudFromMsg(cloud_buf.front());
-            printf("size of finding laser_cloud: %lu\n", v_laser_cloud[0].size());
-            cloud_buf.pop();
-        }
-        while (!cloud_buf.empty())
-        {
-            frame_drop_cnt++;
-            cloud_buf.pop();
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
+            bool empty_check = false;
+            if (v_laser_cloud[0].size() == 0) empty_check = true;
 
-        bool empty_check = false;
-        if (v_laser_cloud[0].size() == 0) empty_check = true;
-
-        if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+            if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(2));
     }
 }
@@ -209,6 +177,7 @@ int main(int argc, char **argv)
     // ******************************************
     printf("config_file: %s\n", FLAGS_config_file.c_str());
     readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
     estimator.setParameter();
     registerPub(nh);
 
@@ -219,6 +188,7 @@ int main(int argc, char **argv)
     MLOAM_GPS_PATH = OUTPUT_FOLDER + "traj/stamped_gps.txt";
     EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "others/extrinsic_parameter.txt";
     EX_CALIB_EIG_PATH = OUTPUT_FOLDER + "others/calib_eig.txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
     printf("save result (0/1): %d\n", MLOAM_RESULT_SAVE);
     ROS_WARN("waiting for cloud...");
 
@@ -227,7 +197,8 @@ int main(int argc, char **argv)
 
     // ******************************************
     // use bag as the data source
-    ros::Subscriber sub_cloud = nh.subscribe<sensor_msgs::PointCloud2>(CLOUD_TOPIC[0], 5, dataProcessCallback);
+    cloud_ingest.setParameter(NUM_OF_LASER, LASER_SYNC_THRESHOLD);
+    cloud_ingest.subscribe(nh, CLOUD_TOPIC);
     ros::Subscriber sub_gps = nh.subscribe<sensor_msgs::NavSatFix>("/novatel718d/pos", 10, gpsCallback);
     ros::Subscriber sub_gt = nh.subscribe<nav_msgs::Odometry>("/base_pose_gt", 10, gtCallback);
     pub_laser_gt_path = nh.advertise<nav_msgs::Path>("/laser_gt_path", 10);
@@ -242,6 +213,8 @@ int main(int argc, char **argv)
         loop_rate.sleep();
     }
 
+    frame_drop_cnt = cloud_ingest.getDropCount();
+    cloud_ingest.printStatistics();
     std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
     if (MLOAM_RESULT_SAVE)
     {
@@ -252,6 +225,7 @@ int main(int argc, char **argv)
         save_statistics.saveOdomTimeStatistics(OUTPUT_FOLDER + "time/time_mloam_odometry_" + std::to_string(ODOM_GF_RATIO) + ".txt", estimator);
     }
     sync_thread.join();
+    common::timing::Trace::Stop();
     return 0;
 }
 
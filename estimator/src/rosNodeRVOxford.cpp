@@ -40,8 +40,6 @@
 #include <sensor_msgs/NavSatFix.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Imu.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -51,6 +49,8 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/cloud_loader.h"
+#include "utility/cloud_ingest.h"
 #include "mloam_pcl/point_with_time.hpp"
 
 #define MAX_BUF_LENGTH 5
@@ -62,17 +62,20 @@ DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(data_source, "bag", "the data source: bag or bag");
 DEFINE_string(data_path, "", "the data path");
 DEFINE_string(output_path, "", "the path ouf saving results");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
 DEFINE_int32(start_idx, 0, "the start idx of the data");
 DEFINE_int32(end_idx, 0, "the end idx of the data");
 DEFINE_int32(delta_idx, 1, "the delta idx of reading the data");
 DEFINE_bool(time_now, true, "use current time or data time");
+DEFINE_string(cloud_format, "pcd", "the format of the clouds in data_path: pcd or bin (raw KITTI)");
+DEFINE_int32(loader_thread_num, 2, "the threads reading the clouds of the data source pcd");
+DEFINE_int32(loader_prefetch_num, 8, "the frames read ahead of the odometry");
 
 Estimator estimator;
 
 SaveStatistics save_statistics;
 
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr> > all_cloud_buf(5);
-std::mutex m_buf;
+CloudIngest<pcl::PointXYZIWithTime> cloud_ingest;
 
 nav_msgs::Path laser_gt_path;
 Pose pose_world_ref_ini;
@@ -86,21 +89,6 @@ bool b_pause = false;
 
 int frame_drop_cnt = 0;
 
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud2_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud3_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud4_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    all_cloud_buf[2].push(cloud2_msg);
-    all_cloud_buf[3].push(cloud3_msg);
-    all_cloud_buf[4].push(cloud4_msg);
-    m_buf.unlock();
-}
-
 void gtCallback(const nav_msgs::OdometryConstPtr &gt_odom_msg)
 {
     Pose pose_world_stereo_gt(*gt_odom_msg);
@@ -167,57 +155,21 @@ void pauseCallback(std_msgs::StringConstPtr msg)
     b_pause = !b_pause;
 }
 
-pcl::PointCloud<pcl::PointXYZIWithTime> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZIWithTime> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(laser_cloud, laser_cloud, indices);
-    return laser_cloud;
-}
-
 void sync_process()
 {
+    common::timing::Trace::SetThreadName("odometry_input");
     while (1)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZIWithTime> > v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
+        std::vector<pcl::PointCloud<pcl::PointXYZIWithTime> > v_laser_cloud;
         double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty() && !all_cloud_buf[2].empty() 
-         && !all_cloud_buf[3].empty() && !all_cloud_buf[4].empty())
+        if (cloud_ingest.getFrame(time, v_laser_cloud))
         {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
-            for (size_t i = 0; i < NUM_OF_LASER; i++) 
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++) all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty())
-        {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
+            bool empty_check = false;
+            for (size_t i = 0; i < NUM_OF_LASER; i++)
+                if (v_laser_cloud[i].size() == 0) empty_check = true;
 
-        bool empty_check = false;
-        for (size_t i = 0; i < NUM_OF_LASER; i++)
-            if (v_laser_cloud[i].size() == 0) empty_check = true;
-
-        if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+            if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(2));
     }
 }
@@ -238,6 +190,7 @@ int main(int argc, char **argv)
     // ******************************************
     printf("config_file: %s\n", FLAGS_config_file.c_str());
     readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
     estimator.setParameter();
     registerPub(nh);
 
@@ -248,6 +201,7 @@ int main(int argc, char **argv)
     MLOAM_GT_PATH = OUTPUT_FOLDER + "traj/stamped_groundtruth.txt";
     EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "others/extrinsic_parameter.txt";
     EX_CALIB_EIG_PATH = OUTPUT_FOLDER + "others/calib_eig.txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
     printf("save result (0/1): %d\n", MLOAM_RESULT_SAVE);
     size_t START_IDX = FLAGS_start_idx;
     size_t END_IDX = FLAGS_end_idx;
@@ -262,18 +216,8 @@ int main(int argc, char **argv)
     // use bag as the data source
     if (!data_source.compare("bag"))
     {
-        typedef sensor_msgs::PointCloud2 LidarMsgType;
-        typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType, LidarMsgType, LidarMsgType, LidarMsgType> LidarSyncPolicy;
-        typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-        std::vector<LidarSubType *> sub_lidar(5);
-        NUM_OF_LASER = NUM_OF_LASER < 5 ? NUM_OF_LASER : 5;
-        for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 5);
-        for (size_t i = NUM_OF_LASER; i < 5; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 5);
-        message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-            new message_filters::Synchronizer<LidarSyncPolicy>(
-                LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1], *sub_lidar[2], *sub_lidar[3], *sub_lidar[4]);
-        lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2, _3, _4, _5));
+        cloud_ingest.setParameter(NUM_OF_LASER, LASER_SYNC_THRESHOLD);
+        cloud_ingest.subscribe(nh, CLOUD_TOPIC);
 
         ros::Subscriber sub_gt = nh.subscribe<nav_msgs::Odometry>("/base_pose_gt", 10, gtCallback);
         ros::Subscriber sub_gps = nh.subscribe<sensor_msgs::NavSatFix>("/novatel718d/pos", 10, gpsCallback);
@@ -289,7 +233,8 @@ int main(int argc, char **argv)
             loop_rate.sleep();
         }
 
-        // std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
+        frame_drop_cnt = cloud_ingest.getDropCount();
+        cloud_ingest.printStatistics();
         LOG(INFO) << "odometry drop frame: " << frame_drop_cnt;
         if (MLOAM_RESULT_SAVE)
         {
@@ -315,111 +260,52 @@ int main(int argc, char **argv)
         pub_gps_path = nh.advertise<nav_msgs::Path>("/gps/path", 10);
 
         // *************************************
-        // read cloud list
-        FILE *file;
-        double cloud_time;
-        vector<double> cloud_time_list;
+        // read data, the clouds of the next frames are read on the threads of loader
+        CloudLoader loader(data_path, NUM_OF_LASER, FLAGS_cloud_format);
+        if (!loader.start(START_IDX, END_IDX, DELTA_IDX, FLAGS_loader_thread_num, FLAGS_loader_prefetch_num))
         {
-            file = std::fopen((data_path + "cloud_0/timestamps.txt").c_str(), "r");
-            if (!file)
-            {
-                printf("cannot find file: %stimes.txt\n", data_path.c_str());
-                ROS_BREAK();
-                return 0;
-            }
-            while (fscanf(file, "%lf", &cloud_time) != EOF)
-            {
-                cloud_time_list.push_back(cloud_time);
-            }
-            std::fclose(file);    
-        }  
-
-        // *************************************
-        // read data
+            ROS_BREAK();
+            return 0;
+        }
         double base_time = ros::Time::now().toSec();
-        for (size_t i = START_IDX; i < std::min(END_IDX, cloud_time_list.size()); i+=DELTA_IDX)
+        CloudFrame::Ptr frame;
+        while (loader.getFrame(frame))
         {	
             if (ros::ok())
             {
                 double cloud_time;
                 if (TIME_NOW)
-                    cloud_time = base_time + cloud_time_list[i] - cloud_time_list[START_IDX];
+                    cloud_time = base_time + frame->time_ - loader.getTimeList()[START_IDX];
                 else
-                    cloud_time = cloud_time_list[i];
-                printf("process data: %d\n", i);
-                stringstream ss;
-                ss << setfill('0') << setw(6) << i;
+                    cloud_time = frame->time_;
+                printf("process data: %lu\n", frame->idx_);
 
                 // load cloud
                 printf("size of finding cloud: ");
-                std::vector<pcl::PointCloud<pcl::PointXYZ> > laser_cloud_list(NUM_OF_LASER);
-                for (size_t j = 0; j < NUM_OF_LASER; j++)
-                {
-                    stringstream ss_file;
-                    ss_file << "cloud_" << j << "/data/" << ss.str() << ".pcd";
-                    string cloud_path = data_path + ss_file.str();
-                    //printf("%lu  %f \n", i, cloud_time);
-                    // printf("%s\n", cloud_path.c_str());
-                    if (pcl::io::loadPCDFile<pcl::PointXYZ>(cloud_path, laser_cloud_list[j]) == -1)
-                    {
-                        printf("Couldn't read file %s\n", cloud_path.c_str());
-                        ROS_BREAK();
-                        return 0;
-                    }
-                    printf("%lu ", laser_cloud_list[j].size());
-                }
+                std::vector<pcl::PointCloud<pcl::PointXYZ> > &laser_cloud_list = frame->laser_cloud_list_;
+                for (size_t j = 0; j < NUM_OF_LASER; j++) printf("%lu ", laser_cloud_list[j].size());
                 printf("\n");
 
                 // load gps
-                FILE *gps_file;
-                string gps_file_path = data_path + "gps/data/" + ss.str() + ".txt";
-                gps_file = std::fopen(gps_file_path.c_str() , "r");
-                if(!gps_file)
-                {
-                    // printf("cannot find file: %s\n", gps_file_path.c_str());
-                    // ROS_BREAK();
-                    // return 0;          
-                } else
+                if (frame->gps_valid_)
                 {
-                    double lat, lon, alt;
-                    double posx_accuracy, posy_accuracy, posz_accuracy;
-                    int navstat, numsats;
-                    fscanf(gps_file, "%d %d ", &navstat, &numsats);
-                    fscanf(gps_file, "%lf %lf %lf ", &lat, &lon, &alt);
-                    fscanf(gps_file, "%lf %lf %lf ", &posx_accuracy, &posy_accuracy, &posz_accuracy);
-                    std::fclose(gps_file);
-
                     sensor_msgs::NavSatFix gps_position;
                     gps_position.header.frame_id = "gps";
                     gps_position.header.stamp = ros::Time(cloud_time);
-                    gps_position.status.status = navstat;
-                    gps_position.status.service = numsats;
-                    gps_position.latitude = lat;
-                    gps_position.longitude = lon;
-                    gps_position.altitude = alt;
-                    gps_position.position_covariance[0] = posx_accuracy;
-                    gps_position.position_covariance[4] = posy_accuracy;
-                    gps_position.position_covariance[8] = posz_accuracy;
+                    gps_position.status.status = frame->navstat_;
+                    gps_position.status.service = frame->numsats_;
+                    gps_position.latitude = frame->lat_;
+                    gps_position.longitude = frame->lon_;
+                    gps_position.altitude = frame->alt_;
+                    gps_position.position_covariance[0] = frame->pos_accuracy_[0];
+                    gps_position.position_covariance[4] = frame->pos_accuracy_[1];
+                    gps_position.position_covariance[8] = frame->pos_accuracy_[2];
                     pub_gps.publish(gps_position);
                 }
                 
                 // load odom
-                FILE *gt_odom_file;
-                string gt_odom_file_path = data_path + "gt_odom/data/" + ss.str() + ".txt";
-                gt_odom_file = std::fopen(gt_odom_file_path.c_str() , "r");
-                if(!gt_odom_file)
-                {
-                    // printf("cannot find file: %s\n", gt_odom_file_path.c_str());
-                    // ROS_BREAK();
-                    // return 0;          
-                } else
+                if (frame->gt_valid_)
                 {
-                    double posx, posy, posz;
-                    double orix, oriy, oriz, oriw;
-                    fscanf(gt_odom_file, "%lf %lf %lf ", &posx, &posy, &posz);
-                    fscanf(gt_odom_file, "%lf %lf %lf %lf ", &orix, &oriy, &oriz, &oriw);
-                    std::fclose(gt_odom_file);
-
                     // Eigen::Vector3d t_world_base(posx, posy, posz);
                     // Eigen::Quaterniond q_world_base(oriw, orix, oriy, oriz);
                     // Pose pose_world_base(q_world_base, t_world_base);
@@ -429,9 +315,7 @@ int main(int argc, char **argv)
                     // if (laser_gt_path.poses.size() == 0) pose_world_ref_ini = pose_world_ref;
                     // Pose pose_ref_ini_cur(pose_world_ref_ini.inverse() * pose_world_ref);
 
-                    Eigen::Vector3d t_world_stereo_gt(posx, posy, posz);
-                    Eigen::Quaterniond q_world_stereo_gt(oriw, orix, oriy, oriz);
-                    Pose pose_world_stereo_gt(q_world_stereo_gt, t_world_stereo_gt);
+                    Pose pose_world_stereo_gt(frame->q_world_base_, frame->t_world_base_);
                     Pose pose_world_base_world_stereo(Eigen::Quaterniond(0.99977, 0.0026139, -0.021008, 0.003888),
                                                       Eigen::Vector3d(0.61413, -0.3347, -0.24461));
                     Pose pose_world_base_gt(pose_world_base_world_stereo * pose_world_stereo_gt);
@@ -493,6 +377,7 @@ int main(int argc, char **argv)
         }
     }
 
+    common::timing::Trace::Stop();
     return 0;
 }
 
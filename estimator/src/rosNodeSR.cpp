@@ -33,8 +33,6 @@
 #include <nav_msgs/Odometry.h>
 #include <nav_msgs/Path.h>
 #include <sensor_msgs/PointCloud2.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -44,12 +42,14 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/cloud_ingest.h"
 
 using namespace std;
 
 DEFINE_bool(result_save, true, "save or not save the results");
 DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(output_path, "", "the path ouf saving results");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
 DEFINE_bool(inject_meas_noise, false, "inject measurement noise on the raw data");
 DEFINE_int32(mc_trial, 0, "monte carlo trial number");
 
@@ -57,8 +57,7 @@ Estimator estimator;
 SaveStatistics save_statistics;
 
 // message buffer
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr>> all_cloud_buf(2);
-std::mutex m_buf;
+CloudIngest<pcl::PointXYZ> cloud_ingest;
 
 // laser path groundtruth
 nav_msgs::Path laser_gt_path;
@@ -69,65 +68,14 @@ int frame_drop_cnt = 0;
 
 common::RandomGeneratorFloat<float> rgi;
 
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    m_buf.unlock();
-}
-
-pcl::PointCloud<pcl::PointXYZ> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZ> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    // roiCloudFilter(laser_cloud, ROI_RANGE);
-    return laser_cloud;
-}
-
 void sync_process()
 {
+    common::timing::Trace::SetThreadName("odometry_input");
     while (1)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZ>> v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
+        std::vector<pcl::PointCloud<pcl::PointXYZ>> v_laser_cloud;
         double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty())
-        {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
-            for (size_t i = 0; i < NUM_OF_LASER; i++)
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-                all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty())
-        {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
-
-        bool empty_check = false;
-        for (size_t i = 0; i < NUM_OF_LASER; i++)
-            empty_check = (v_laser_cloud[i].size() == 0);
-
-        if (!empty_check)
+        if (cloud_ingest.getFrame(time, v_laser_cloud))
         {
             // if (FLAGS_inject_meas_noise)
             // {
@@ -207,6 +155,7 @@ int main(int argc, char **argv)
     // ******************************************
     printf("config_file: %s\n", FLAGS_config_file.c_str());
     readParameters(FLAGS_config_file);
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
     estimator.setParameter();
     registerPub(nh);
 
@@ -216,22 +165,13 @@ int main(int argc, char **argv)
     MLOAM_GT_PATH = OUTPUT_FOLDER + "traj/stamped_groundtruth.txt";
     EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "others/extrinsic_parameter.txt";
     EX_CALIB_EIG_PATH = OUTPUT_FOLDER + "others/calib_eig.txt";
+    if (MLOAM_RESULT_SAVE) estimator.odom_traj_writer_.open(getTrajectoryBinPath(MLOAM_ODOM_PATH));
     printf("save result (0/1): %d\n", MLOAM_RESULT_SAVE);
     std::cout << common::YELLOW << "waiting for cloud..." << common::RESET << std::endl;
 
     // ******************************************
-    typedef sensor_msgs::PointCloud2 LidarMsgType;
-    typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType> LidarSyncPolicy;
-    typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-    std::vector<LidarSubType *> sub_lidar(2);
-    NUM_OF_LASER = NUM_OF_LASER < 2 ? NUM_OF_LASER : 2;
-    for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 1);
-    for (size_t i = NUM_OF_LASER; i < 2; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 1);
-    message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-        new message_filters::Synchronizer<LidarSyncPolicy>(
-            LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1]);
-    lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2));
+    cloud_ingest.setParameter(NUM_OF_LASER, LASER_SYNC_THRESHOLD);
+    cloud_ingest.subscribe(nh, CLOUD_TOPIC);
 
     ros::Subscriber sub_restart = nh.subscribe("/mlod_restart", 5, restart_callback);
     ros::Subscriber sub_odom_gt = nh.subscribe("/base_odom_gt", 5, odom_gt_callback);
@@ -250,6 +190,8 @@ int main(int argc, char **argv)
         loop_rate.sleep();
     }
 
+    frame_drop_cnt = cloud_ingest.getDropCount();
+    cloud_ingest.printStatistics();
     std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
     if (MLOAM_RESULT_SAVE)
     {
@@ -261,6 +203,7 @@ int main(int argc, char **argv)
 
     cloud_visualizer_thread.join();
     sync_thread.join();
+    common::timing::Trace::Stop();
     return 0;
 }
 
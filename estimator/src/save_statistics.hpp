@@ -20,29 +20,34 @@
 
 #include "estimator/estimator.h"
 #include "estimator/parameters.h"
+#include "utility/trajectory_writer.h"
 
 class SaveStatistics
 {
 public:
     void saveSensorPath(const std::string &filename, const nav_msgs::Path &sensor_path);
 
+    // the odometry is exported from estimator.odom_traj_writer_, which is closed
     void saveOdomStatistics(const string &calib_eig_filename, 
                             const string &calib_result_filename, 
                             const string &odom_filename,
-                            const Estimator &estimator);
+                            Estimator &estimator);
     void saveOdomTimeStatistics(const string &filename, const Estimator &estimator);
 
     void saveMapStatistics(const string &map_filename,
                            const string &gf_deg_factor_filename,
                            const string &gf_logdet_filename,
-                           const nav_msgs::Path &laser_aft_mapped_path,
+                           TrajectoryWriter &map_traj_writer,
                            const std::vector<double> &gf_deg_factor_list,
                            const std::vector<double> &gf_logdet_H_list);
 
     void saveMapTimeStatistics(const string &map_time_filename);
+
+    // the percentiles and deadline misses of all timers: time/xxx.txt -> time/xxx_percentile.csv and .json
+    void saveTimingPercentile(const string &time_filename);
 };
 
-void SaveStatistics::saveSensorPath(const string &filename, const nav_msgs::Path &sensor_path)
+inline void SaveStatistics::saveSensorPath(const string &filename, const nav_msgs::Path &sensor_path)
 {
     if (sensor_path.poses.size() == 0)
         return;
@@ -65,10 +70,10 @@ void SaveStatistics::saveSensorPath(const string &filename, const nav_msgs::Path
 }
 
 // odom format: timestamp tx ty tz qx qy qz qw
-void SaveStatistics::saveOdomStatistics(const string &calib_eig_filename, 
+inline void SaveStatistics::saveOdomStatistics(const string &calib_eig_filename, 
                                         const string &calib_result_filename, 
                                         const string &odom_filename,
-                                        const Estimator &estimator)
+                                        Estimator &estimator)
 {
     ofstream fout;
 
@@ -101,25 +106,14 @@ void SaveStatistics::saveOdomStatistics(const string &calib_eig_filename,
         fout.close();
     }
 
-    fout.open(odom_filename.c_str(), ios::out);
-    for (size_t i = 0; i < estimator.v_laser_path_[IDX_REF].poses.size(); i++)
+    if (estimator.odom_traj_writer_.isOpen())
     {
-        const geometry_msgs::PoseStamped &sensor_pose = estimator.v_laser_path_[IDX_REF].poses[i];
-        fout.precision(15);
-        fout << sensor_pose.header.stamp.toSec() << " ";
-        fout.precision(8);
-        fout << sensor_pose.pose.position.x << " "
-             << sensor_pose.pose.position.y << " "
-             << sensor_pose.pose.position.z << " "
-             << sensor_pose.pose.orientation.x << " "
-             << sensor_pose.pose.orientation.y << " "
-             << sensor_pose.pose.orientation.z << " "
-             << sensor_pose.pose.orientation.w << std::endl;
+        estimator.odom_traj_writer_.close();
+        exportTrajectory(estimator.odom_traj_writer_.getFilename(), odom_filename);
     }
-    fout.close();
 }
 
-void SaveStatistics::saveOdomTimeStatistics(const string &filename, const Estimator &estimator)
+inline void SaveStatistics::saveOdomTimeStatistics(const string &filename, const Estimator &estimator)
 {
     std::ofstream fout(filename.c_str(), std::ios::out);
     fout.precision(15);
@@ -134,33 +128,24 @@ void SaveStatistics::saveOdomTimeStatistics(const string &filename, const Estima
     fout << common::timing::Timing::GetNumSamples("odom_marg") << ", " << common::timing::Timing::GetMeanSeconds("odom_marg") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("odom_marg") * 1000 << std::endl;
     fout << common::timing::Timing::GetNumSamples("odom_process") << ", " << common::timing::Timing::GetMeanSeconds("odom_process") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("odom_process") * 1000 << std::endl;
     fout.close();
+    saveTimingPercentile(filename);
 }
 
-void SaveStatistics::saveMapStatistics(const string &map_filename,
+inline void SaveStatistics::saveMapStatistics(const string &map_filename,
                                        const string &gf_deg_factor_filename,
                                        const string &gf_logdet_filename,
-                                       const nav_msgs::Path &laser_aft_mapped_path,
+                                       TrajectoryWriter &map_traj_writer,
                                        const std::vector<double> &gf_deg_factor_list,
                                        const std::vector<double> &gf_logdet_H_list)
 {
     printf("Saving mapping statistics\n");
-    std::ofstream fout(map_filename.c_str(), std::ios::out);
-    for (size_t i = 0; i < laser_aft_mapped_path.poses.size(); i++)
+    if (map_traj_writer.isOpen())
     {
-        const geometry_msgs::PoseStamped &laser_pose = laser_aft_mapped_path.poses[i];
-        fout.precision(15);
-        fout << laser_pose.header.stamp.toSec() << " ";
-        fout.precision(8);
-        fout << laser_pose.pose.position.x << " "
-             << laser_pose.pose.position.y << " "
-             << laser_pose.pose.position.z << " "
-             << laser_pose.pose.orientation.x << " "
-             << laser_pose.pose.orientation.y << " "
-             << laser_pose.pose.orientation.z << " "
-             << laser_pose.pose.orientation.w << std::endl;
+        map_traj_writer.close();
+        exportTrajectory(map_traj_writer.getFilename(), map_filename);
     }
-    fout.close();
 
+    std::ofstream fout;
     fout.open(gf_deg_factor_filename.c_str(), std::ios::out);
     fout << "gf_deg_factor_list" << std::endl;
     fout.precision(8);
@@ -176,7 +161,7 @@ void SaveStatistics::saveMapStatistics(const string &map_filename,
     fout.close();
 }
 
-void SaveStatistics::saveMapTimeStatistics(const string &map_time_filename)
+inline void SaveStatistics::saveMapTimeStatistics(const string &map_time_filename)
 {
     std::ofstream fout(map_time_filename.c_str(), std::ios::out);
     fout.precision(15);
@@ -185,4 +170,12 @@ void SaveStatistics::saveMapTimeStatistics(const string &map_time_filename)
     fout << common::timing::Timing::GetNumSamples("mapping_solver") << ", " << common::timing::Timing::GetMeanSeconds("mapping_solver") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("mapping_solver") * 1000 << std::endl;
     fout << common::timing::Timing::GetNumSamples("mapping_process") << ", " << common::timing::Timing::GetMeanSeconds("mapping_process") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("mapping_process") * 1000 << std::endl;
     fout.close();
+    saveTimingPercentile(map_time_filename);
+}
+
+inline void SaveStatistics::saveTimingPercentile(const string &time_filename)
+{
+    string prefix = time_filename.substr(0, time_filename.rfind('.'));
+    common::timing::Timing::WriteCsv(prefix + "_percentile.csv");
+    common::timing::Timing::WriteJson(prefix + "_percentile.json");
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+// rosrun mloam mloam_traj_export -input=traj/stamped_mloam_odom_estimate_1.000000.bin -output=odom.txt -format=tum
+// convert the binary trajectory written by TrajectoryWriter into text, e.g. the trajectory of a run
+// that did not shut down cleanly, or the KITTI format
+
+#include <gflags/gflags.h>
+
+#include <cstdio>
+
+#include "utility/trajectory_writer.h"
+
+DEFINE_string(input, "", "the binary trajectory file");
+DEFINE_string(output, "", "the text file, input with .txt if empty");
+DEFINE_string(format, "tum", "tum: timestamp tx ty tz qx qy qz qw, kitti: the 3x4 matrix per line");
+
+int main(int argc, char **argv)
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_input.empty())
+    {
+        printf("please intput: rosrun mloam mloam_traj_export -help\n");
+        return 1;
+    }
+    if (FLAGS_format != "tum" && FLAGS_format != "kitti")
+    {
+        printf("unknown format: %s\n", FLAGS_format.c_str());
+        return 1;
+    }
+
+    std::string output = FLAGS_output;
+    if (output.empty())
+    {
+        output = FLAGS_input;
+        if (output.size() > 4 && output.compare(output.size() - 4, 4, ".bin") == 0)
+            output = output.substr(0, output.size() - 4);
+        output += ".txt";
+    }
+    int pose_num = exportTrajectory(FLAGS_input, output, FLAGS_format);
+    if (pose_num < 0) return 1;
+    printf("export %d poses to %s\n", pose_num, output.c_str());
+    return 0;
+}
+
+//
@@ -0,0 +1,76 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// bounded FIFO between two threads: push blocks if full and pop blocks if empty, so no item is dropped
+// and the producer runs at most capacity items ahead of the consumer
+template <typename T>
+class BlockingQueue
+{
+public:
+    explicit BlockingQueue(const size_t &capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+
+    // return false if the queue is closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m_queue_);
+        con_not_full_.wait(lock, [&] { return closed_ || queue_.size() < capacity_; });
+        if (closed_) return false;
+        queue_.push_back(std::move(item));
+        lock.unlock();
+        con_not_empty_.notify_one();
+        return true;
+    }
+
+    // return false if the queue is closed and empty
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_queue_);
+        con_not_empty_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+        if (queue_.empty()) return false;
+        item = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        con_not_full_.notify_one();
+        return true;
+    }
+
+    // no more item is pushed, the remaining items can still be popped
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_queue_);
+        closed_ = true;
+        con_not_full_.notify_all();
+        con_not_empty_.notify_all();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_queue_);
+        return queue_.size();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_;
+    std::deque<T> queue_;
+    std::mutex m_queue_;
+    std::condition_variable con_not_full_, con_not_empty_;
+};
+
+//
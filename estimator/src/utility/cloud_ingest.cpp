@@ -0,0 +1,270 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "cloud_ingest.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/filters/filter.h>
+
+#include "common/color.hpp"
+#include "mloam_pcl/point_with_time.hpp"
+
+// the offsets of the fields in a point of the message, -1 if not found
+struct CloudFieldOffset
+{
+    int x_, y_, z_, intensity_, timestamp_;
+};
+
+// return false if the field is found but not a single float
+static bool findFloatField(const sensor_msgs::PointCloud2 &cloud_msg, const std::string &name, int &offset)
+{
+    offset = -1;
+    for (const sensor_msgs::PointField &field : cloud_msg.fields)
+    {
+        if (field.name != name) continue;
+        if (field.datatype != sensor_msgs::PointField::FLOAT32 || field.count != 1) return false;
+        offset = field.offset;
+    }
+    return true;
+}
+
+static inline float getFloat(const uint8_t *data, const int &offset)
+{
+    float value = 0.0f;
+    if (offset >= 0) std::memcpy(&value, data + offset, sizeof(float));
+    return value;
+}
+
+// the fields other than x y z of the point type
+static inline bool findExtraFields(const sensor_msgs::PointCloud2 &, CloudFieldOffset &field, const pcl::PointXYZ *)
+{
+    field.intensity_ = field.timestamp_ = -1;
+    return true;
+}
+
+static inline bool findExtraFields(const sensor_msgs::PointCloud2 &cloud_msg, CloudFieldOffset &field, const pcl::PointXYZIWithTime *)
+{
+    return findFloatField(cloud_msg, "intensity", field.intensity_) &&
+           findFloatField(cloud_msg, "timestamp", field.timestamp_);
+}
+
+static inline void setPoint(const uint8_t *data, const CloudFieldOffset &field, pcl::PointXYZ &point)
+{
+    point.x = getFloat(data, field.x_);
+    point.y = getFloat(data, field.y_);
+    point.z = getFloat(data, field.z_);
+}
+
+static inline void setPoint(const uint8_t *data, const CloudFieldOffset &field, pcl::PointXYZIWithTime &point)
+{
+    point.x = getFloat(data, field.x_);
+    point.y = getFloat(data, field.y_);
+    point.z = getFloat(data, field.z_);
+    point.intensity = getFloat(data, field.intensity_);
+    point.timestamp = getFloat(data, field.timestamp_);
+}
+
+template <typename PointType>
+void convertCloudMsg(const sensor_msgs::PointCloud2 &cloud_msg, pcl::PointCloud<PointType> &cloud)
+{
+    CloudFieldOffset field;
+    bool in_place = !cloud_msg.is_bigendian &&
+                    findFloatField(cloud_msg, "x", field.x_) && field.x_ >= 0 &&
+                    findFloatField(cloud_msg, "y", field.y_) && field.y_ >= 0 &&
+                    findFloatField(cloud_msg, "z", field.z_) && field.z_ >= 0 &&
+                    findExtraFields(cloud_msg, field, static_cast<const PointType *>(NULL)) &&
+                    cloud_msg.point_step >= 3 * sizeof(float) &&
+                    cloud_msg.row_step >= cloud_msg.width * cloud_msg.point_step &&
+                    cloud_msg.data.size() >= static_cast<size_t>(cloud_msg.height) * cloud_msg.row_step;
+    if (!in_place)
+    {
+        pcl::fromROSMsg(cloud_msg, cloud);
+        std::vector<int> indices;
+        pcl::removeNaNFromPointCloud(cloud, cloud, indices);
+        return;
+    }
+
+    cloud.clear();
+    cloud.header = pcl_conversions::toPCL(cloud_msg.header);
+    cloud.points.reserve(cloud_msg.width * cloud_msg.height);
+    for (size_t row = 0; row < cloud_msg.height && !cloud_msg.data.empty(); row++)
+    {
+        const uint8_t *data = &cloud_msg.data[0] + row * cloud_msg.row_step;
+        for (size_t col = 0; col < cloud_msg.width; col++, data += cloud_msg.point_step)
+        {
+            PointType point;
+            setPoint(data, field, point);
+            if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+                continue;
+            cloud.points.push_back(point);
+        }
+    }
+    cloud.width = cloud.points.size();
+    cloud.height = 1;
+    cloud.is_dense = true;
+}
+
+// *********************************
+// CloudIngest
+template <typename PointType>
+CloudIngest<PointType>::CloudIngest()
+{
+    setParameter(1, 0.05);
+}
+
+template <typename PointType>
+void CloudIngest<PointType>::setParameter(const size_t &num_laser, const double &sync_tolerance, const size_t &buf_size)
+{
+    std::lock_guard<std::mutex> lock(m_buf_);
+    num_laser_ = std::max(num_laser, size_t(1));
+    sync_tolerance_ = sync_tolerance;
+    buf_size_ = std::max(buf_size, size_t(1));
+    all_cloud_buf_.clear();
+    all_cloud_buf_.resize(num_laser_);
+    LaserStatistics stat = {0, 0, 0.0, 0.0};
+    laser_stat_.assign(num_laser_, stat);
+    frame_cnt_ = 0;
+}
+
+template <typename PointType>
+void CloudIngest<PointType>::subscribe(ros::NodeHandle &nh, const std::vector<std::string> &topics)
+{
+    sub_cloud_.clear();
+    for (size_t i = 0; i < num_laser_ && i < topics.size(); i++)
+    {
+        sub_cloud_.push_back(nh.subscribe<sensor_msgs::PointCloud2>(
+            topics[i], buf_size_, boost::bind(&CloudIngest<PointType>::inputCloud, this, _1, i)));
+    }
+}
+
+template <typename PointType>
+void CloudIngest<PointType>::inputCloud(const sensor_msgs::PointCloud2ConstPtr &cloud_msg, const size_t &idx)
+{
+    if (idx >= num_laser_) return;
+    CloudEntry entry;
+    entry.msg_ = cloud_msg;
+    entry.time_ = cloud_msg->header.stamp.toSec();
+
+    std::lock_guard<std::mutex> lock(m_buf_);
+    std::deque<CloudEntry> &cloud_buf = all_cloud_buf_[idx];
+    laser_stat_[idx].recv_cnt_++;
+    if (cloud_buf.size() >= buf_size_)
+    {
+        cloud_buf.pop_front();
+        laser_stat_[idx].drop_cnt_++;
+    }
+    cloud_buf.push_back(entry);
+}
+
+template <typename PointType>
+bool CloudIngest<PointType>::getFrame(double &time, std::vector<CloudType> &v_laser_cloud)
+{
+    std::vector<CloudEntry> frame(num_laser_);
+    {
+        std::lock_guard<std::mutex> lock(m_buf_);
+        for (size_t i = 0; i < num_laser_; i++)
+            if (all_cloud_buf_[i].empty()) return false;
+
+        // from the newest cloud of laser 0, find the closest cloud of each laser
+        std::vector<size_t> match_idx(num_laser_);
+        bool matched = false;
+        for (size_t k = all_cloud_buf_[0].size(); k-- > 0 && !matched;)
+        {
+            double time_ref = all_cloud_buf_[0][k].time_;
+            match_idx[0] = k;
+            matched = true;
+            for (size_t i = 1; i < num_laser_ && matched; i++)
+            {
+                const std::deque<CloudEntry> &cloud_buf = all_cloud_buf_[i];
+                size_t j_best = 0;
+                for (size_t j = 1; j < cloud_buf.size(); j++)
+                    if (std::abs(cloud_buf[j].time_ - time_ref) < std::abs(cloud_buf[j_best].time_ - time_ref))
+                        j_best = j;
+                match_idx[i] = j_best;
+                matched = std::abs(cloud_buf[j_best].time_ - time_ref) <= sync_tolerance_;
+            }
+        }
+        if (!matched) return false;
+
+        // the clouds before the matched ones are outdated
+        for (size_t i = 0; i < num_laser_; i++)
+        {
+            std::deque<CloudEntry> &cloud_buf = all_cloud_buf_[i];
+            laser_stat_[i].drop_cnt_ += match_idx[i];
+            cloud_buf.erase(cloud_buf.begin(), cloud_buf.begin() + match_idx[i]);
+            frame[i] = cloud_buf.front();
+            cloud_buf.pop_front();
+        }
+        if (match_idx[0] > 0)
+        {
+            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance: " << match_idx[0]
+                      << common::RESET << std::endl;
+        }
+    }
+
+    // convert without holding the buffer
+    time = frame[0].time_;
+    v_laser_cloud.resize(num_laser_);
+    std::stringstream ss;
+    for (size_t i = 0; i < num_laser_; i++)
+    {
+        convertCloudMsg(*frame[i].msg_, v_laser_cloud[i]);
+        ss << v_laser_cloud[i].size() << " ";
+    }
+    printf("size of finding laser_cloud: %s\n", ss.str().c_str());
+
+    double time_now = ros::Time::now().toSec();
+    std::lock_guard<std::mutex> lock(m_buf_);
+    frame_cnt_++;
+    for (size_t i = 0; i < num_laser_; i++)
+    {
+        double latency = (time_now - frame[i].time_) * 1000;
+        laser_stat_[i].latency_sum_ += latency;
+        laser_stat_[i].latency_max_ = std::max(laser_stat_[i].latency_max_, latency);
+    }
+    return true;
+}
+
+template <typename PointType>
+int CloudIngest<PointType>::getDropCount()
+{
+    std::lock_guard<std::mutex> lock(m_buf_);
+    return laser_stat_[0].drop_cnt_;
+}
+
+template <typename PointType>
+void CloudIngest<PointType>::printStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_buf_);
+    printf("[CloudIngest] frames: %d, sync tolerance: %fs\n", frame_cnt_, sync_tolerance_);
+    for (size_t i = 0; i < num_laser_; i++)
+    {
+        const LaserStatistics &stat = laser_stat_[i];
+        printf("[CloudIngest] laser %lu received: %d, dropped: %d, latency mean: %fms, max: %fms\n",
+               i, stat.recv_cnt_, stat.drop_cnt_,
+               frame_cnt_ > 0 ? stat.latency_sum_ / frame_cnt_ : 0.0, stat.latency_max_);
+    }
+}
+
+template void convertCloudMsg(const sensor_msgs::PointCloud2 &cloud_msg, pcl::PointCloud<pcl::PointXYZ> &cloud);
+template void convertCloudMsg(const sensor_msgs::PointCloud2 &cloud_msg, pcl::PointCloud<pcl::PointXYZIWithTime> &cloud);
+template class CloudIngest<pcl::PointXYZ>;
+template class CloudIngest<pcl::PointXYZIWithTime>;
+
+//
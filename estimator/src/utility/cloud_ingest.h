@@ -0,0 +1,87 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// convert the message into cloud in one pass, the points with NaN coordinates are dropped.
+// the float fields are copied in place, the other layouts fall back to pcl::fromROSMsg.
+// instantiated for pcl::PointXYZ and pcl::PointXYZIWithTime
+template <typename PointType>
+void convertCloudMsg(const sensor_msgs::PointCloud2 &cloud_msg, pcl::PointCloud<PointType> &cloud);
+
+// the front-end of the nodes: buffer the clouds of NUM_OF_LASER topics and match them by timestamp,
+// a frame is a set of one cloud per laser within sync_tolerance of the cloud of laser 0
+template <typename PointType>
+class CloudIngest
+{
+public:
+    typedef pcl::PointCloud<PointType> CloudType;
+
+    CloudIngest();
+
+    // buf_size: the clouds buffered per laser, the oldest is dropped if full
+    void setParameter(const size_t &num_laser, const double &sync_tolerance, const size_t &buf_size = 10);
+
+    // subscribe topics[0 .. num_laser)
+    void subscribe(ros::NodeHandle &nh, const std::vector<std::string> &topics);
+
+    void inputCloud(const sensor_msgs::PointCloud2ConstPtr &cloud_msg, const size_t &idx);
+
+    // take the newest matched frame, the older clouds are dropped to keep up with the sensors.
+    // return false if no frame is matched yet
+    bool getFrame(double &time, std::vector<CloudType> &v_laser_cloud);
+
+    // the frames of laser 0 not processed
+    int getDropCount();
+
+    void printStatistics();
+
+private:
+    struct CloudEntry
+    {
+        sensor_msgs::PointCloud2ConstPtr msg_;
+        double time_;
+    };
+
+    struct LaserStatistics
+    {
+        int recv_cnt_;
+        int drop_cnt_;
+        double latency_sum_; // from the stamp to the frame handed to the estimator, in ms
+        double latency_max_;
+    };
+
+    size_t num_laser_;
+    double sync_tolerance_;
+    size_t buf_size_;
+
+    std::mutex m_buf_;
+    std::vector<std::deque<CloudEntry> > all_cloud_buf_;
+    std::vector<LaserStatistics> laser_stat_;
+    int frame_cnt_;
+
+    std::vector<ros::Subscriber> sub_cloud_;
+};
+
+//
@@ -0,0 +1,371 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "cloud_loader.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/filter.h>
+
+#include "tic_toc.h"
+
+// read-only mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : data_(NULL), size_(0) {}
+    ~MappedFile()
+    {
+        if (data_) munmap(const_cast<char *>(data_), size_);
+    }
+
+    bool open(const std::string &file_path)
+    {
+        int fd = ::open(file_path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        void *data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        // the file is read once from the beginning to the end
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char *>(data);
+        return true;
+    }
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char *data_;
+    size_t size_;
+};
+
+// append the points with finite x y z, the fields are float at the offsets of a point of stride bytes
+static void appendPoints(const char *data, const size_t &num_point, const size_t &stride,
+                         const size_t offset[3], common::PointCloud &pts)
+{
+    pts.points.reserve(pts.points.size() + num_point);
+    for (size_t i = 0; i < num_point; i++)
+    {
+        const char *p = data + i * stride;
+        common::Point point;
+        std::memcpy(&point.x, p + offset[0], sizeof(float));
+        std::memcpy(&point.y, p + offset[1], sizeof(float));
+        std::memcpy(&point.z, p + offset[2], sizeof(float));
+        if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+            continue;
+        pts.points.push_back(point);
+    }
+}
+
+// raw KITTI velodyne scan: float x y z intensity
+static bool loadKITTIBin(const MappedFile &file, common::PointCloud &pts)
+{
+    const size_t stride = 4 * sizeof(float);
+    const size_t offset[3] = {0, sizeof(float), 2 * sizeof(float)};
+    appendPoints(file.data(), file.size() / stride, stride, offset, pts);
+    return true;
+}
+
+// return 1 if parsed, 0 if the encoding or the fields are not supported, -1 if the file is broken
+static int loadBinaryPCD(const MappedFile &file, common::PointCloud &pts)
+{
+    std::vector<std::string> fields;
+    std::vector<size_t> size, count;
+    std::vector<char> type;
+    size_t num_point = 0;
+    bool data_found = false;
+    const char *p = file.data();
+    const char *end = file.data() + file.size();
+    while (p < end)
+    {
+        const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!eol) return -1;
+        std::istringstream line(std::string(p, eol));
+        p = eol + 1;
+        std::string key;
+        line >> key;
+        if (key == "FIELDS")
+        {
+            std::string s;
+            while (line >> s) fields.push_back(s);
+        }
+        else if (key == "SIZE")
+        {
+            size_t s;
+            while (line >> s) size.push_back(s);
+        }
+        else if (key == "TYPE")
+        {
+            char s;
+            while (line >> s) type.push_back(s);
+        }
+        else if (key == "COUNT")
+        {
+            size_t s;
+            while (line >> s) count.push_back(s);
+        }
+        else if (key == "POINTS")
+        {
+            line >> num_point;
+        }
+        else if (key == "DATA")
+        {
+            std::string encoding;
+            line >> encoding;
+            if (encoding != "binary") return 0;
+            data_found = true;
+            break;
+        }
+    }
+    if (!data_found) return -1;
+    if (count.empty()) count.resize(fields.size(), 1);
+    if (fields.empty() || size.size() != fields.size() || type.size() != fields.size() || count.size() != fields.size())
+        return -1;
+
+    size_t stride = 0;
+    int xyz_cnt = 0;
+    size_t offset[3];
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+        int axis = fields[i] == "x" ? 0 : fields[i] == "y" ? 1 : fields[i] == "z" ? 2 : -1;
+        if (axis >= 0)
+        {
+            if (type[i] != 'F' || size[i] != sizeof(float)) return 0;
+            offset[axis] = stride;
+            xyz_cnt++;
+        }
+        stride += size[i] * count[i];
+    }
+    if (xyz_cnt != 3) return 0;
+    if (static_cast<size_t>(end - p) < num_point * stride) return -1;
+    appendPoints(p, num_point, stride, offset, pts);
+    return 1;
+}
+
+bool loadCloudFile(const std::string &cloud_path, common::PointCloud &pts)
+{
+    pts.clear();
+    MappedFile file;
+    if (!file.open(cloud_path)) return false;
+    int result;
+    if (cloud_path.size() > 4 && cloud_path.compare(cloud_path.size() - 4, 4, ".bin") == 0)
+        result = loadKITTIBin(file, pts) ? 1 : -1;
+    else
+        result = loadBinaryPCD(file, pts);
+    if (result == 0)
+    {
+        if (pcl::io::loadPCDFile<common::Point>(cloud_path, pts) == -1) return false;
+        std::vector<int> indices;
+        pcl::removeNaNFromPointCloud(pts, pts, indices);
+        return true;
+    }
+    if (result < 0) return false;
+    pts.width = pts.points.size();
+    pts.height = 1;
+    pts.is_dense = true;
+    return true;
+}
+
+// *********************************
+// CloudLoader
+CloudLoader::CloudLoader(const std::string &data_path, const size_t &num_laser, const std::string &cloud_format)
+    : data_path_(data_path),
+      num_laser_(num_laser),
+      cloud_format_(cloud_format),
+      next_task_(0),
+      next_frame_(0),
+      stop_(false),
+      wait_time_(0.0)
+{
+}
+
+CloudLoader::~CloudLoader()
+{
+    stop();
+}
+
+bool CloudLoader::start(const size_t &start_idx, const size_t &end_idx, const size_t &delta_idx,
+                        const int &num_thread, const int &prefetch_num)
+{
+    FILE *file = std::fopen((data_path_ + "cloud_0/timestamps.txt").c_str(), "r");
+    if (!file)
+    {
+        printf("cannot find file: %scloud_0/timestamps.txt\n", data_path_.c_str());
+        return false;
+    }
+    double cloud_time;
+    while (fscanf(file, "%lf", &cloud_time) != EOF)
+        cloud_time_list_.push_back(cloud_time);
+    std::fclose(file);
+
+    for (size_t i = start_idx; i < std::min(end_idx, cloud_time_list_.size()); i += std::max(delta_idx, size_t(1)))
+        frame_idx_list_.push_back(i);
+    printf("[CloudLoader] start idx: %lu, end idx: %lu, whole data size: %lu, %d threads, prefetch %d frames\n",
+           start_idx, end_idx, cloud_time_list_.size(), num_thread, prefetch_num);
+
+    ring_.resize(std::max(prefetch_num, 1));
+    for (Slot &slot : ring_) slot.remain_ = 0;
+    for (int i = 0; i < num_thread; i++)
+        t_load_.push_back(std::thread(&CloudLoader::loadTask, this));
+    return true;
+}
+
+void CloudLoader::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_ring_);
+        stop_ = true;
+    }
+    con_task_.notify_all();
+    con_frame_.notify_all();
+    for (std::thread &t : t_load_) t.join();
+    t_load_.clear();
+}
+
+bool CloudLoader::getFrame(CloudFrame::Ptr &frame)
+{
+    TicToc t_wait;
+    std::unique_lock<std::mutex> lock(m_ring_);
+    if (next_frame_ >= frame_idx_list_.size()) return false;
+    if (t_load_.empty())
+    {
+        frame.reset(new CloudFrame());
+        frame->idx_ = frame_idx_list_[next_frame_];
+        frame->time_ = cloud_time_list_[frame->idx_];
+        frame->laser_cloud_list_.resize(num_laser_);
+        frame->valid_ = true;
+        next_frame_++;
+        lock.unlock();
+        for (size_t j = 0; j < num_laser_; j++)
+        {
+            std::stringstream cloud_path;
+            cloud_path << data_path_ << "cloud_" << j << "/data/"
+                       << std::setfill('0') << std::setw(6) << frame->idx_ << "." << cloud_format_;
+            if (!loadCloudFile(cloud_path.str(), frame->laser_cloud_list_[j]))
+            {
+                printf("Couldn't read file %s\n", cloud_path.str().c_str());
+                frame->valid_ = false;
+            }
+        }
+        loadAuxiliary(*frame);
+        wait_time_ += t_wait.toc();
+        return frame->valid_;
+    }
+    Slot &slot = ring_[next_frame_ % ring_.size()];
+    con_frame_.wait(lock, [&] { return stop_ || (slot.frame_ && slot.remain_ == 0); });
+    wait_time_ += t_wait.toc();
+    if (stop_) return false;
+    frame = slot.frame_;
+    slot.frame_.reset();
+    next_frame_++;
+    lock.unlock();
+    con_task_.notify_all();
+    return frame->valid_;
+}
+
+void CloudLoader::loadTask()
+{
+    const size_t num_task = frame_idx_list_.size() * num_laser_;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_ring_);
+        con_task_.wait(lock, [&] {
+            return stop_ || next_task_ >= num_task || next_task_ / num_laser_ < next_frame_ + ring_.size();
+        });
+        if (stop_ || next_task_ >= num_task) return;
+        size_t task = next_task_++;
+        size_t k = task / num_laser_, j = task % num_laser_;
+        Slot &slot = ring_[k % ring_.size()];
+        if (j == 0)
+        {
+            slot.frame_.reset(new CloudFrame());
+            slot.frame_->idx_ = frame_idx_list_[k];
+            slot.frame_->time_ = cloud_time_list_[frame_idx_list_[k]];
+            slot.frame_->laser_cloud_list_.resize(num_laser_);
+            slot.frame_->valid_ = true;
+            slot.remain_ = num_laser_;
+        }
+        CloudFrame::Ptr frame = slot.frame_;
+        lock.unlock();
+
+        // each task writes its own cloud of the frame
+        std::stringstream cloud_path;
+        cloud_path << data_path_ << "cloud_" << j << "/data/"
+                   << std::setfill('0') << std::setw(6) << frame->idx_ << "." << cloud_format_;
+        bool success = loadCloudFile(cloud_path.str(), frame->laser_cloud_list_[j]);
+        if (!success) printf("Couldn't read file %s\n", cloud_path.str().c_str());
+        if (j == 0) loadAuxiliary(*frame);
+
+        lock.lock();
+        if (!success) frame->valid_ = false;
+        if (--slot.remain_ == 0)
+        {
+            lock.unlock();
+            con_frame_.notify_all();
+        }
+    }
+}
+
+void CloudLoader::loadAuxiliary(CloudFrame &frame) const
+{
+    std::stringstream ss;
+    ss << std::setfill('0') << std::setw(6) << frame.idx_;
+
+    frame.gt_valid_ = false;
+    FILE *gt_odom_file = std::fopen((data_path_ + "gt_odom/data/" + ss.str() + ".txt").c_str(), "r");
+    if (gt_odom_file)
+    {
+        double posx, posy, posz;
+        double orix, oriy, oriz, oriw;
+        if (fscanf(gt_odom_file, "%lf %lf %lf ", &posx, &posy, &posz) == 3 &&
+            fscanf(gt_odom_file, "%lf %lf %lf %lf ", &orix, &oriy, &oriz, &oriw) == 4)
+        {
+            frame.t_world_base_ = Eigen::Vector3d(posx, posy, posz);
+            frame.q_world_base_ = Eigen::Quaterniond(oriw, orix, oriy, oriz);
+            frame.gt_valid_ = true;
+        }
+        std::fclose(gt_odom_file);
+    }
+
+    frame.gps_valid_ = false;
+    FILE *gps_file = std::fopen((data_path_ + "gps/data/" + ss.str() + ".txt").c_str(), "r");
+    if (gps_file)
+    {
+        if (fscanf(gps_file, "%d %d ", &frame.navstat_, &frame.numsats_) == 2 &&
+            fscanf(gps_file, "%lf %lf %lf ", &frame.lat_, &frame.lon_, &frame.alt_) == 3 &&
+            fscanf(gps_file, "%lf %lf %lf ", &frame.pos_accuracy_[0], &frame.pos_accuracy_[1], &frame.pos_accuracy_[2]) == 3)
+        {
+            frame.gps_valid_ = true;
+        }
+        std::fclose(gps_file);
+    }
+}
+
+//
@@ -0,0 +1,109 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "common/types/type.h"
+
+// one frame of a sequence in the layout of the "pcd" data source:
+// cloud_N/timestamps.txt, cloud_N/data/%06d.pcd (or the raw KITTI %06d.bin), gt_odom/data/%06d.txt, gps/data/%06d.txt
+struct CloudFrame
+{
+    typedef std::shared_ptr<CloudFrame> Ptr;
+
+    size_t idx_;
+    double time_;
+    std::vector<common::PointCloud> laser_cloud_list_; // the NaN points are removed
+    bool valid_; // all clouds are read
+
+    bool gt_valid_; // gt_odom/data/%06d.txt: [tx ty tz qx qy qz qw]
+    Eigen::Vector3d t_world_base_;
+    Eigen::Quaterniond q_world_base_;
+
+    bool gps_valid_; // gps/data/%06d.txt: [navstat numsats lat lon alt accuracy_x accuracy_y accuracy_z]
+    int navstat_, numsats_;
+    double lat_, lon_, alt_;
+    double pos_accuracy_[3];
+};
+
+// read a cloud into pts through a memory-mapped file, return false if the file cannot be read.
+// binary PCD with float x y z and raw KITTI .bin (float x y z intensity) are parsed in place,
+// the other PCD encodings (ascii, binary_compressed) fall back to pcl::io::loadPCDFile
+bool loadCloudFile(const std::string &cloud_path, common::PointCloud &pts);
+
+// prefetch the frames [start_idx, end_idx) with step delta_idx on I/O threads: the clouds of all lasers
+// of the next prefetch_num frames are read in parallel into a ring, getFrame() returns them in order
+class CloudLoader
+{
+public:
+    // cloud_format: "pcd" or "bin"
+    CloudLoader(const std::string &data_path, const size_t &num_laser, const std::string &cloud_format = "pcd");
+    ~CloudLoader();
+
+    // read cloud_0/timestamps.txt and start the threads, return false if the timestamps cannot be read.
+    // with num_thread = 0 nothing is prefetched, getFrame() reads the frame in the calling thread
+    bool start(const size_t &start_idx, const size_t &end_idx, const size_t &delta_idx,
+               const int &num_thread = 2, const int &prefetch_num = 8);
+
+    // block until the next frame is read, return false at the end of the sequence or if a cloud cannot be read
+    bool getFrame(CloudFrame::Ptr &frame);
+
+    void stop();
+
+    size_t getFrameNum() const { return frame_idx_list_.size(); }
+    const std::vector<double> &getTimeList() const { return cloud_time_list_; }
+    double getWaitTime() const { return wait_time_; } // the total time getFrame() waits for the disk, in ms
+
+private:
+    struct Slot
+    {
+        CloudFrame::Ptr frame_;
+        size_t remain_; // the clouds not read yet
+    };
+
+    void loadTask();
+    void loadAuxiliary(CloudFrame &frame) const;
+
+    std::string data_path_;
+    size_t num_laser_;
+    std::string cloud_format_;
+
+    std::vector<double> cloud_time_list_;
+    std::vector<size_t> frame_idx_list_;
+
+    // frame k is stored in ring_[k % ring_.size()], the tasks are the clouds of (frame, laser),
+    // a task is only taken if its frame is less than ring_.size() ahead of next_frame_
+    std::vector<Slot> ring_;
+    size_t next_task_;
+    size_t next_frame_;
+    bool stop_;
+    std::mutex m_ring_;
+    std::condition_variable con_task_, con_frame_;
+    std::vector<std::thread> t_load_;
+
+    double wait_time_;
+};
+
+//
@@ -0,0 +1,195 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "trajectory_writer.h"
+
+#include <chrono>
+#include <cstring>
+
+static const char TRAJECTORY_MAGIC[8] = {'M', 'L', 'T', 'R', 'A', 'J', '0', '1'};
+
+// the records read or written at a time by the export
+static const size_t TRAJECTORY_CHUNK = 1024;
+
+TrajectoryWriter::TrajectoryWriter()
+    : file_(NULL), flush_period_(1.0), pose_num_(0), stop_(true)
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+bool TrajectoryWriter::open(const std::string &filename, const double &flush_period)
+{
+    close();
+    FILE *file = std::fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        printf("[TrajectoryWriter] cannot create file: %s\n", filename.c_str());
+        return false;
+    }
+    if (std::fwrite(TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC), 1, file) != 1)
+    {
+        std::fclose(file);
+        return false;
+    }
+    std::fflush(file);
+
+    std::lock_guard<std::mutex> lock(m_buf_);
+    filename_ = filename;
+    file_ = file;
+    flush_period_ = flush_period;
+    pose_num_ = 0;
+    record_buf_.clear();
+    stop_ = false;
+    t_flush_ = std::thread(&TrajectoryWriter::flushTask, this);
+    return true;
+}
+
+void TrajectoryWriter::addPose(const double &time, const Eigen::Quaterniond &q, const Eigen::Vector3d &t)
+{
+    TrajectoryRecord record;
+    record.time_ = time;
+    for (size_t i = 0; i < 3; i++) record.t_[i] = t(i);
+    record.q_[0] = q.x();
+    record.q_[1] = q.y();
+    record.q_[2] = q.z();
+    record.q_[3] = q.w();
+
+    std::lock_guard<std::mutex> lock(m_buf_);
+    if (stop_) return;
+    record_buf_.push_back(record);
+    pose_num_++;
+}
+
+void TrajectoryWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_buf_);
+        if (stop_) return;
+        stop_ = true;
+    }
+    con_flush_.notify_all();
+    t_flush_.join();
+    std::fclose(file_);
+    file_ = NULL;
+}
+
+bool TrajectoryWriter::isOpen()
+{
+    std::lock_guard<std::mutex> lock(m_buf_);
+    return !stop_;
+}
+
+size_t TrajectoryWriter::getPoseNum()
+{
+    std::lock_guard<std::mutex> lock(m_buf_);
+    return pose_num_;
+}
+
+// only this thread writes the file, the buffer is swapped out so addPose never waits for the disk
+void TrajectoryWriter::flushTask()
+{
+    std::vector<TrajectoryRecord> records;
+    while (true)
+    {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(m_buf_);
+            con_flush_.wait_for(lock, std::chrono::duration<double>(flush_period_), [&] { return stop_; });
+            records.swap(record_buf_);
+            stop = stop_;
+        }
+        writeRecords(records);
+        records.clear();
+        if (stop) return;
+    }
+}
+
+void TrajectoryWriter::writeRecords(const std::vector<TrajectoryRecord> &records)
+{
+    if (records.empty()) return;
+    if (std::fwrite(&records[0], sizeof(TrajectoryRecord), records.size(), file_) != records.size())
+        printf("[TrajectoryWriter] fail to write %lu poses to %s\n", records.size(), filename_.c_str());
+    std::fflush(file_);
+}
+
+int exportTrajectory(const std::string &bin_filename, const std::string &txt_filename, const std::string &format)
+{
+    FILE *fin = std::fopen(bin_filename.c_str(), "rb");
+    if (!fin)
+    {
+        printf("[exportTrajectory] cannot open file: %s\n", bin_filename.c_str());
+        return -1;
+    }
+    char magic[sizeof(TRAJECTORY_MAGIC)];
+    if (std::fread(magic, sizeof(magic), 1, fin) != 1 || std::memcmp(magic, TRAJECTORY_MAGIC, sizeof(magic)) != 0)
+    {
+        printf("[exportTrajectory] not a trajectory file: %s\n", bin_filename.c_str());
+        std::fclose(fin);
+        return -1;
+    }
+    FILE *fout = std::fopen(txt_filename.c_str(), "w");
+    if (!fout)
+    {
+        printf("[exportTrajectory] cannot create file: %s\n", txt_filename.c_str());
+        std::fclose(fin);
+        return -1;
+    }
+
+    bool kitti = (format == "kitti");
+    int pose_num = 0;
+    std::vector<TrajectoryRecord> records(TRAJECTORY_CHUNK);
+    size_t n;
+    while ((n = std::fread(&records[0], sizeof(TrajectoryRecord), records.size(), fin)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            const TrajectoryRecord &r = records[i];
+            if (kitti)
+            {
+                Eigen::Matrix3d R = Eigen::Quaterniond(r.q_[3], r.q_[0], r.q_[1], r.q_[2]).normalized().toRotationMatrix();
+                for (size_t j = 0; j < 3; j++)
+                    fprintf(fout, "%.8f %.8f %.8f %.8f%c", R(j, 0), R(j, 1), R(j, 2), r.t_[j], j < 2 ? ' ' : '\n');
+            }
+            else
+            {
+                fprintf(fout, "%.9f %.8f %.8f %.8f %.8f %.8f %.8f %.8f\n",
+                        r.time_, r.t_[0], r.t_[1], r.t_[2], r.q_[0], r.q_[1], r.q_[2], r.q_[3]);
+            }
+        }
+        pose_num += n;
+    }
+    std::fclose(fin);
+    std::fclose(fout);
+    return pose_num;
+}
+
+std::string getTrajectoryBinPath(const std::string &txt_filename)
+{
+    if (txt_filename.size() > 4 && txt_filename.compare(txt_filename.size() - 4, 4, ".txt") == 0)
+        return txt_filename.substr(0, txt_filename.size() - 4) + ".bin";
+    return txt_filename + ".bin";
+}
+
+void pushPathWindow(nav_msgs::Path &path, const geometry_msgs::PoseStamped &pose, const size_t &window_size)
+{
+    path.header = pose.header;
+    path.poses.push_back(pose);
+    if (window_size > 0 && path.poses.size() > window_size)
+        path.poses.erase(path.poses.begin(), path.poses.begin() + (path.poses.size() - window_size));
+}
+
+//
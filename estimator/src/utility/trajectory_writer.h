@@ -0,0 +1,85 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <eigen3/Eigen/Dense>
+
+#include <nav_msgs/Path.h>
+
+// a pose of the binary trajectory file: the file starts with the 8 bytes "MLTRAJ01", followed by the records
+struct TrajectoryRecord
+{
+    double time_;
+    double t_[3]; // x y z
+    double q_[4]; // x y z w
+};
+
+// append-only trajectory file: the poses are buffered and written by a background thread every
+// flush_period seconds, so the trajectory is neither kept in memory nor formatted at shutdown
+class TrajectoryWriter
+{
+public:
+    TrajectoryWriter();
+    ~TrajectoryWriter();
+
+    // return false if the file cannot be created
+    bool open(const std::string &filename, const double &flush_period = 1.0);
+
+    // ignored if the file is not open
+    void addPose(const double &time, const Eigen::Quaterniond &q, const Eigen::Vector3d &t);
+
+    // write the remaining poses and close the file
+    void close();
+
+    bool isOpen();
+    const std::string &getFilename() const { return filename_; }
+    size_t getPoseNum(); // the poses added since open()
+
+private:
+    void flushTask();
+    void writeRecords(const std::vector<TrajectoryRecord> &records);
+
+    std::string filename_;
+    FILE *file_;
+    double flush_period_;
+    size_t pose_num_;
+
+    std::vector<TrajectoryRecord> record_buf_;
+    bool stop_;
+    std::mutex m_buf_;
+    std::condition_variable con_flush_;
+    std::thread t_flush_;
+};
+
+// convert a binary trajectory file into text, one line per pose:
+// "tum": timestamp tx ty tz qx qy qz qw (the format read by the evaluation scripts)
+// "kitti": r11 r12 r13 tx r21 r22 r23 ty r31 r32 r33 tz
+// the records are streamed, return the number of poses or -1 if a file cannot be opened
+int exportTrajectory(const std::string &bin_filename, const std::string &txt_filename, const std::string &format = "tum");
+
+// traj/xxx.txt -> traj/xxx.bin
+std::string getTrajectoryBinPath(const std::string &txt_filename);
+
+// append the pose to the published path and keep only the newest window_size poses,
+// so publishing the path costs the same on a long run
+void pushPathWindow(nav_msgs::Path &path, const geometry_msgs::PoseStamped &pose, const size_t &window_size);
+
+//
@@ -86,24 +86,12 @@ void pubPointCloud(const Estimator &estimator, const double &time)
     header.frame_id = "laser_" + std::to_string(IDX_REF);
     header.stamp = ros::Time(time);
 
-    PointICloud laser_cloud, laser_cloud_proj, laser_cloud_outlier;
-    PointICloud corner_points_sharp, corner_points_less_sharp, surf_points_flat, surf_points_less_flat;
-    for (size_t n = 0; n < NUM_OF_LASER; n++)
-    {
-        Pose pose_ext = Pose(estimator.qbl_[n], estimator.tbl_[n]);
-        cloudFeature cloud_feature_trans = transformCloudFeature(estimator.cur_feature_.second[n], pose_ext.T_.cast<float>(), n);
-        laser_cloud += cloud_feature_trans["laser_cloud"];
-        if ((ESTIMATE_EXTRINSIC == 0) || (n == IDX_REF))
-        {
-            laser_cloud_outlier += cloud_feature_trans["laser_cloud_outlier"];
-            corner_points_less_sharp += cloud_feature_trans["corner_points_less_sharp"];
-            surf_points_less_flat += cloud_feature_trans["surf_points_less_flat"];
-        }
-    }
-    publishCloud(pub_laser_cloud, header, laser_cloud);
-    publishCloud(pub_laser_outlier, header, laser_cloud_outlier);    
-    publishCloud(pub_corner_points_less_sharp, header, corner_points_less_sharp);
-    publishCloud(pub_surf_points_less_flat, header, surf_points_less_flat);
+    OdometryFrame frame;
+    estimator.getOdometryFrame(time, frame);
+    publishCloud(pub_laser_cloud, header, frame.laser_cloud_);
+    publishCloud(pub_laser_outlier, header, frame.laser_cloud_outlier_);    
+    publishCloud(pub_corner_points_less_sharp, header, frame.corner_points_less_sharp_);
+    publishCloud(pub_surf_points_less_flat, header, frame.surf_points_less_flat_);
 
     // publish local map
     if (estimator.solver_flag_ == Estimator::SolverFlag::NON_LINEAR)
@@ -179,20 +167,13 @@ void pubOdometry(Estimator &estimator, const double &time)
             geometry_msgs::PoseStamped laser_pose;
             laser_pose.header = laser_odom.header;
             laser_pose.pose = laser_odom.pose.pose;
-            estimator.v_laser_path_[n].header = laser_odom.header;
-            estimator.v_laser_path_[n].poses.push_back(laser_pose);
+            pushPathWindow(estimator.v_laser_path_[n], laser_pose, PATH_WINDOW_SIZE);
             v_pub_laser_path[n].publish(estimator.v_laser_path_[n]);
+            if (n == IDX_REF) estimator.odom_traj_writer_.addPose(time, pose_laser_cur.q_, pose_laser_cur.t_);
         }
     } else
     {
-        Pose pose_laser_cur;
-        if (estimator.solver_flag_ == Estimator::SolverFlag::INITIAL)
-        {
-            pose_laser_cur = estimator.pose_laser_cur_[IDX_REF];
-        } else
-        {
-            pose_laser_cur = Pose(estimator.Qs_[estimator.cir_buf_cnt_ - 1], estimator.Ts_[estimator.cir_buf_cnt_ - 1]);
-        }
+        Pose pose_laser_cur = estimator.getOdometryPose();
         nav_msgs::Odometry laser_odom;
         laser_odom.header.stamp = ros::Time(time);
         laser_odom.header.frame_id = "/world";
@@ -210,9 +191,9 @@ void pubOdometry(Estimator &estimator, const double &time)
         geometry_msgs::PoseStamped laser_pose;
         laser_pose.header = laser_odom.header;
         laser_pose.pose = laser_odom.pose.pose;
-        estimator.v_laser_path_[IDX_REF].header = laser_odom.header;
-        estimator.v_laser_path_[IDX_REF].poses.push_back(laser_pose);
+        pushPathWindow(estimator.v_laser_path_[IDX_REF], laser_pose, PATH_WINDOW_SIZE);
         v_pub_laser_path[IDX_REF].publish(estimator.v_laser_path_[IDX_REF]);
+        estimator.odom_traj_writer_.addPose(time, pose_laser_cur.q_, pose_laser_cur.t_);
     }
 
     // publish extrinsics
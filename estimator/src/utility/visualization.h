@@ -58,6 +58,8 @@ extern std::vector<ros::Publisher> v_pub_laser_path;
 // extrinsic
 extern ros::Publisher pub_extrinsics;
 
+cloudFeature transformCloudFeature(const cloudFeature &cloud_feature, const Eigen::Matrix4f &trans, const int &n);
+
 void clearPath();
 
 void registerPub(ros::NodeHandle &nh);
@@ -0,0 +1,132 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <random>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// ****************** the synthetic inputs of the kernel benchmark, generated with fixed seeds
+// a corridor of 60m x 24m with vertical walls, the floor 1.8m below the LiDAR and poles every 8m along y = +-6m
+#define ROOM_X 30.0
+#define ROOM_Y 12.0
+#define ROOM_FLOOR -1.8
+#define ROOM_CEIL 6.0
+#define POLE_RADIUS 0.15
+
+inline double raycastRoom(const double &dx, const double &dy, const double &dz)
+{
+    double t_hit = 100.0;
+    if (dz < 0) t_hit = std::min(t_hit, ROOM_FLOOR / dz);
+    if (dx != 0) t_hit = std::min(t_hit, (dx > 0 ? ROOM_X : -ROOM_X) / dx);
+    if (dy != 0) t_hit = std::min(t_hit, (dy > 0 ? ROOM_Y : -ROOM_Y) / dy);
+    // |t * d_xy - c| = r
+    const double a = dx * dx + dy * dy;
+    for (double cx = -24.0; cx <= 24.0; cx += 8.0)
+    {
+        for (double cy = -6.0; cy <= 6.0; cy += 12.0)
+        {
+            double b = -2 * (dx * cx + dy * cy);
+            double c = cx * cx + cy * cy - POLE_RADIUS * POLE_RADIUS;
+            double disc = b * b - 4 * a * c;
+            if (a <= 0 || disc < 0) continue;
+            double t = (-b - std::sqrt(disc)) / (2 * a);
+            if (t > 0) t_hit = std::min(t_hit, t);
+        }
+    }
+    return t_hit;
+}
+
+// a scan of a spinning LiDAR with num_ring rings in [-15deg, 15deg] at the center of the room,
+// in the order of the firing sequence (column by column), the range noise is 1cm
+template <typename PointType>
+void generateScan(const int &num_ring, const int &num_column, pcl::PointCloud<PointType> &cloud,
+                  const unsigned int &seed = 0)
+{
+    std::mt19937 gen(seed);
+    std::normal_distribution<double> noise(0.0, 0.01);
+    cloud.clear();
+    cloud.reserve(num_ring * num_column);
+    for (int c = 0; c < num_column; c++)
+    {
+        double azimuth = 2 * M_PI * c / num_column;
+        for (int r = 0; r < num_ring; r++)
+        {
+            double elevation = (-15.0 + 30.0 * r / std::max(num_ring - 1, 1)) * M_PI / 180.0;
+            double dx = std::cos(elevation) * std::cos(azimuth);
+            double dy = std::cos(elevation) * std::sin(azimuth);
+            double dz = std::sin(elevation);
+            double range = raycastRoom(dx, dy, dz);
+            if (range >= 100.0 || range * dz > ROOM_CEIL) continue;
+            range += noise(gen);
+            PointType point;
+            point.x = range * dx;
+            point.y = range * dy;
+            point.z = range * dz;
+            cloud.push_back(point);
+        }
+    }
+}
+
+// num_point points uniformly on the floor and the walls of the room
+template <typename PointType>
+void generatePlaneMap(const size_t &num_point, pcl::PointCloud<PointType> &cloud, const unsigned int &seed = 0)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> ux(-ROOM_X, ROOM_X), uy(-ROOM_Y, ROOM_Y), uz(ROOM_FLOOR, ROOM_CEIL);
+    // the share of each plane is proportional to its area
+    const double area_floor = 4 * ROOM_X * ROOM_Y;
+    const double area_wall_x = 2 * ROOM_Y * (ROOM_CEIL - ROOM_FLOOR), area_wall_y = 2 * ROOM_X * (ROOM_CEIL - ROOM_FLOOR);
+    std::discrete_distribution<int> plane({area_floor, area_wall_x, area_wall_x, area_wall_y, area_wall_y});
+    cloud.clear();
+    cloud.reserve(num_point);
+    for (size_t i = 0; i < num_point; i++)
+    {
+        PointType point;
+        switch (plane(gen))
+        {
+            case 0: point.x = ux(gen); point.y = uy(gen); point.z = ROOM_FLOOR; break;
+            case 1: point.x = ROOM_X; point.y = uy(gen); point.z = uz(gen); break;
+            case 2: point.x = -ROOM_X; point.y = uy(gen); point.z = uz(gen); break;
+            case 3: point.x = ux(gen); point.y = ROOM_Y; point.z = uz(gen); break;
+            default: point.x = ux(gen); point.y = -ROOM_Y; point.z = uz(gen); break;
+        }
+        cloud.push_back(point);
+    }
+}
+
+// num_point points on the surface of the poles
+template <typename PointType>
+void generatePoleMap(const size_t &num_point, pcl::PointCloud<PointType> &cloud, const unsigned int &seed = 0)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> pole(0, 13);
+    std::uniform_real_distribution<double> ua(0, 2 * M_PI), uz(ROOM_FLOOR, ROOM_CEIL);
+    cloud.clear();
+    cloud.reserve(num_point);
+    for (size_t i = 0; i < num_point; i++)
+    {
+        int k = pole(gen);
+        double angle = ua(gen);
+        PointType point;
+        point.x = -24.0 + 8.0 * (k / 2) + POLE_RADIUS * std::cos(angle);
+        point.y = (k % 2 == 0 ? -6.0 : 6.0) + POLE_RADIUS * std::sin(angle);
+        point.z = uz(gen);
+        cloud.push_back(point);
+    }
+}
+
+//
@@ -0,0 +1,436 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+// rosrun mloam mloam_kernel_benchmark [--benchmark_filter=<regex>] [--benchmark_out=<file>]
+// micro benchmarks of the odometry and mapping kernels on synthetic inputs with fixed seeds,
+// the loop closure kernels are in test_kernel_benchmark_sc.cpp.
+// The results are written to mloam_kernel_benchmark.json unless --benchmark_out is given,
+// compare two runs with tools/compare.py of google benchmark.
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <ceres/ceres.h>
+
+#include "../src/estimator/parameters.h"
+#include "../src/estimator/pose.h"
+#include "../src/imageSegmenter/image_segmenter.hpp"
+#include "../src/featureExtract/feature_extract.hpp"
+#include "../src/lidarMapper/associate_uct.hpp"
+#include "../src/factor/lidar_scan_factor.hpp"
+#include "../src/factor/lidar_map_factor.hpp"
+#include "../src/factor/lidar_pure_odom_factor.hpp"
+#include "../src/factor/lidar_online_calib_factor.hpp"
+#include "../src/factor/prior_factor.hpp"
+#include "../src/factor/marginalization_factor.h"
+
+#include "mloam_pcl/point_with_cov.hpp"
+#include "mloam_pcl/voxel_grid_covariance_mloam.h"
+#include "mloam_pcl/voxel_grid_covariance_mloam_impl.hpp"
+#include "mloam_pcl/ikd_tree.hpp"
+
+#include "kernel_benchmark_data.hpp"
+
+using namespace common;
+
+// the parameters of a 16-beam LiDAR (config/config_handheld.yaml)
+static void setKernelParameter(const int &horizon_scan)
+{
+    N_SCANS = 16;
+    HORIZON_SCAN = horizon_scan;
+    SCAN_PERIOD = 0.1;
+    ROI_RANGE = 2.0;
+    SEGMENT_THETA = 0.53;
+    MIN_CLUSTER_SIZE = 30;
+    MIN_LINE_SIZE = 10;
+    SEGMENT_VALID_POINT_NUM = 5;
+    SEGMENT_VALID_LINE_NUM = 3;
+    DISTANCE_SQ_THRESHOLD = 25;
+    NEARBY_SCAN = 2.5;
+    MIN_MATCH_SQ_DIS = 1.0;
+    MIN_PLANE_DIS = 0.2;
+    COV_MEASUREMENT = Eigen::Vector3d(0.0025, 0.0025, 0.0025).asDiagonal();
+}
+
+static void addNoise(const double &sigma, const unsigned int &seed, pcl::PointCloud<PointIWithCov> &cloud)
+{
+    std::mt19937 gen(seed);
+    std::normal_distribution<float> noise(0.0, sigma);
+    for (PointIWithCov &point : cloud.points)
+    {
+        point.x += noise(gen);
+        point.y += noise(gen);
+        point.z += noise(gen);
+        point.intensity = 0;
+    }
+}
+
+// ****************** odometry: segmentation and feature extraction
+// arg: the number of columns of the range image
+static void BM_SegmentCloud(benchmark::State &state)
+{
+    const int horizon_scan = state.range(0);
+    setKernelParameter(horizon_scan);
+    PointCloud laser_cloud_in;
+    generateScan(N_SCANS, horizon_scan, laser_cloud_in);
+    FeatureExtract f_extract;
+    PointICloud laser_cloud;
+    f_extract.calTimestamp(laser_cloud_in, laser_cloud);
+
+    ImageSegmenter img_segment;
+    img_segment.setParameter(N_SCANS, HORIZON_SCAN, MIN_CLUSTER_SIZE, SEGMENT_VALID_POINT_NUM, SEGMENT_VALID_LINE_NUM);
+    for (auto _ : state)
+    {
+        PointICloud laser_cloud_segment, laser_cloud_outlier;
+        ScanInfo scan_info(N_SCANS, true);
+        img_segment.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+        benchmark::DoNotOptimize(laser_cloud_segment.points.data());
+    }
+    state.SetItemsProcessed(state.iterations() * laser_cloud.size());
+}
+BENCHMARK(BM_SegmentCloud)->Arg(450)->Arg(900)->Arg(1800)->Unit(benchmark::kMicrosecond);
+
+static void BM_ExtractCloud(benchmark::State &state)
+{
+    const int horizon_scan = state.range(0);
+    setKernelParameter(horizon_scan);
+    PointCloud laser_cloud_in;
+    generateScan(N_SCANS, horizon_scan, laser_cloud_in);
+    FeatureExtract f_extract;
+    PointICloud laser_cloud;
+    f_extract.calTimestamp(laser_cloud_in, laser_cloud);
+
+    ImageSegmenter img_segment;
+    img_segment.setParameter(N_SCANS, HORIZON_SCAN, MIN_CLUSTER_SIZE, SEGMENT_VALID_POINT_NUM, SEGMENT_VALID_LINE_NUM);
+    PointICloud laser_cloud_segment, laser_cloud_outlier;
+    ScanInfo scan_info(N_SCANS, true);
+    img_segment.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+    for (auto _ : state)
+    {
+        cloudFeature cloud_feature;
+        f_extract.extractCloud(laser_cloud_segment, scan_info, cloud_feature);
+        benchmark::DoNotOptimize(cloud_feature);
+    }
+    state.SetItemsProcessed(state.iterations() * laser_cloud_segment.size());
+}
+BENCHMARK(BM_ExtractCloud)->Arg(450)->Arg(900)->Arg(1800)->Unit(benchmark::kMicrosecond);
+
+// ****************** mapping: the point-to-map association on the ikd-tree
+// arg: the number of map points, items: the queries
+#define NUM_QUERY 1000
+
+static void BM_MatchSurfPointFromMap(benchmark::State &state)
+{
+    setKernelParameter(1800);
+    PointICovCloud laser_map;
+    generatePlaneMap(state.range(0), laser_map, 0);
+    pcl::IKdTree<PointIWithCov>::Ptr kdtree(new pcl::IKdTree<PointIWithCov>());
+    kdtree->build(laser_map);
+    PointICovCloud query;
+    generatePlaneMap(NUM_QUERY, query, 1);
+    addNoise(0.02, 1, query);
+
+    FeatureExtract f_extract;
+    const Pose pose_local;
+    size_t num_match = 0;
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < query.size(); i++)
+        {
+            PointPlaneFeature feature;
+            num_match += f_extract.matchSurfPointFromMap(kdtree, kdtree->getCloud(), query.points[i], pose_local, feature, i, 5, false);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * query.size());
+    state.counters["match_ratio"] = 1.0 * num_match / (state.iterations() * query.size());
+}
+BENCHMARK(BM_MatchSurfPointFromMap)->Arg(20000)->Arg(100000)->Arg(500000)->Unit(benchmark::kMicrosecond);
+
+static void BM_MatchCornerPointFromMap(benchmark::State &state)
+{
+    setKernelParameter(1800);
+    PointICovCloud laser_map;
+    generatePoleMap(state.range(0), laser_map, 0);
+    pcl::IKdTree<PointIWithCov>::Ptr kdtree(new pcl::IKdTree<PointIWithCov>());
+    kdtree->build(laser_map);
+    PointICovCloud query;
+    generatePoleMap(NUM_QUERY, query, 1);
+    addNoise(0.02, 1, query);
+
+    FeatureExtract f_extract;
+    const Pose pose_local;
+    size_t num_match = 0;
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < query.size(); i++)
+        {
+            PointPlaneFeature feature;
+            num_match += f_extract.matchCornerPointFromMap(kdtree, kdtree->getCloud(), query.points[i], pose_local, feature, i, 5, false);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * query.size());
+    state.counters["match_ratio"] = 1.0 * num_match / (state.iterations() * query.size());
+}
+BENCHMARK(BM_MatchCornerPointFromMap)->Arg(10000)->Arg(50000)->Unit(benchmark::kMicrosecond);
+
+// ****************** mapping: map downsampling with the covariance
+// arg: the number of input points
+template <typename PointType>
+static void BM_VoxelGridCovariance(benchmark::State &state)
+{
+    typename pcl::PointCloud<PointType>::Ptr cloud(new pcl::PointCloud<PointType>());
+    generatePlaneMap(state.range(0), *cloud, 0);
+    pcl::VoxelGridCovarianceMLOAM<PointType> down_size_filter;
+    down_size_filter.setLeafSize(0.3, 0.3, 0.3);
+    down_size_filter.setTraceThreshold(2.0);
+    for (auto _ : state)
+    {
+        pcl::PointCloud<PointType> cloud_filter;
+        down_size_filter.setInputCloud(cloud);
+        down_size_filter.filter(cloud_filter);
+        benchmark::DoNotOptimize(cloud_filter.points.data());
+    }
+    state.SetItemsProcessed(state.iterations() * cloud->size());
+}
+BENCHMARK_TEMPLATE(BM_VoxelGridCovariance, PointI)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_VoxelGridCovariance, PointIWithCov)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// ****************** mapping: uncertainty propagation
+// arg: the method of compoundPoseWithCov
+static void BM_CompoundPoseWithCov(benchmark::State &state)
+{
+    const int method = state.range(0);
+    Pose pose_1(Eigen::Quaterniond(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ())), Eigen::Vector3d(1.0, 2.0, 0.5));
+    Pose pose_2(Eigen::Quaterniond(Eigen::AngleAxisd(-0.2, Eigen::Vector3d::UnitY())), Eigen::Vector3d(-0.5, 0.3, 0.1));
+    pose_1.cov_ = Eigen::Matrix<double, 6, 6>::Identity() * 1e-3;
+    pose_2.cov_ = Eigen::Matrix<double, 6, 6>::Identity() * 2e-3;
+    for (auto _ : state)
+    {
+        Pose pose_cp;
+        compoundPoseWithCov(pose_1, pose_2, pose_cp, method);
+        benchmark::DoNotOptimize(pose_cp.cov_.data());
+    }
+}
+BENCHMARK(BM_CompoundPoseWithCov)->Arg(1)->Arg(2);
+
+static void BM_EvalPointUncertainty(benchmark::State &state)
+{
+    setKernelParameter(1800);
+    PointICloud cloud;
+    generatePlaneMap(state.range(0), cloud, 0);
+    Pose pose(Eigen::Quaterniond(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ())), Eigen::Vector3d(1.0, 2.0, 0.5));
+    pose.cov_ = Eigen::Matrix<double, 6, 6>::Identity() * 1e-3;
+    PointICovCloud cloud_out(cloud.size(), 1);
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < cloud.size(); i++)
+        {
+            Eigen::Matrix3d cov_point;
+            PointI point_sel;
+            pointAssociateToMap(cloud.points[i], point_sel, pose);
+            evalPointUncertainty(cloud.points[i], cov_point, pose);
+            PointIWithCov &point_cov = cloud_out.points[i];
+            point_cov.x = point_sel.x;
+            point_cov.y = point_sel.y;
+            point_cov.z = point_sel.z;
+            point_cov.intensity = point_sel.intensity;
+            updateCov(point_cov, cov_point);
+        }
+        benchmark::DoNotOptimize(cloud_out.points.data());
+    }
+    state.SetItemsProcessed(state.iterations() * cloud.size());
+}
+BENCHMARK(BM_EvalPointUncertainty)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+static void BM_EvalPointUncertaintyBatch(benchmark::State &state)
+{
+    setKernelParameter(1800);
+    PointICloud cloud;
+    generatePlaneMap(state.range(0), cloud, 0);
+    Pose pose(Eigen::Quaterniond(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ())), Eigen::Vector3d(1.0, 2.0, 0.5));
+    pose.cov_ = Eigen::Matrix<double, 6, 6>::Identity() * 1e-3;
+    std::vector<Pose> pose_uct(1, pose);
+    for (auto _ : state)
+    {
+        PointICovCloud cloud_out;
+        evalPointUncertaintyBatch(cloud, cloud_out, pose, pose_uct, true, 10.0, 1);
+        benchmark::DoNotOptimize(cloud_out.points.data());
+    }
+    state.SetItemsProcessed(state.iterations() * cloud.size());
+}
+BENCHMARK(BM_EvalPointUncertaintyBatch)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// ****************** optimization: the residuals and jacobians of the factors
+// a plane through the floor and a line along the pole at (8, 6)
+static const Eigen::Vector3d FACTOR_POINT(8.1, 5.9, 1.0);
+static const Eigen::Vector4d FACTOR_PLANE(0.0, 0.0, 1.0, 1.8);
+static Eigen::VectorXd factorLine()
+{
+    Eigen::VectorXd coeff(6);
+    coeff << 8.0, 6.0, 0.0, 8.0, 6.0, 1.0;
+    return coeff;
+}
+
+static void setFactorPose(double *para, const double &yaw, const Eigen::Vector3d &t)
+{
+    Eigen::Quaterniond q(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()));
+    para[0] = t.x(); para[1] = t.y(); para[2] = t.z();
+    para[3] = q.x(); para[4] = q.y(); para[5] = q.z(); para[6] = q.w();
+}
+
+// arg: 1 to evaluate the jacobians
+static void BM_FactorEvaluate(benchmark::State &state, const std::function<ceres::CostFunction *()> &create)
+{
+    std::unique_ptr<ceres::CostFunction> cost_function(create());
+    const std::vector<int32_t> &block_sizes = cost_function->parameter_block_sizes();
+    const int num_residuals = cost_function->num_residuals();
+
+    std::vector<std::vector<double> > para(block_sizes.size());
+    std::vector<double *> parameters(block_sizes.size());
+    std::vector<std::vector<double> > jaco(block_sizes.size());
+    std::vector<double *> jacobians(block_sizes.size());
+    for (size_t i = 0; i < block_sizes.size(); i++)
+    {
+        para[i].resize(block_sizes[i]);
+        if (block_sizes[i] == 7)
+            setFactorPose(para[i].data(), 0.05 * i, Eigen::Vector3d(0.1 * i, -0.05 * i, 0.02));
+        parameters[i] = para[i].data();
+        jaco[i].resize(num_residuals * block_sizes[i]);
+        jacobians[i] = jaco[i].data();
+    }
+    std::vector<double> residuals(num_residuals);
+    double **jacobians_ptr = state.range(0) ? jacobians.data() : nullptr;
+    for (auto _ : state)
+    {
+        cost_function->Evaluate(parameters.data(), residuals.data(), jacobians_ptr);
+        benchmark::DoNotOptimize(residuals.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarScanPlaneNormFactor,
+                  [] { return new LidarScanPlaneNormFactor(FACTOR_POINT, FACTOR_PLANE); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarScanEdgeFactor,
+                  [] { return new LidarScanEdgeFactor(FACTOR_POINT, factorLine()); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarScanEdgeFactorVector,
+                  [] { return new LidarScanEdgeFactorVector(FACTOR_POINT, factorLine()); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarMapPlaneNormFactor,
+                  [] { return new LidarMapPlaneNormFactor(FACTOR_POINT, FACTOR_PLANE); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarMapEdgeFactor,
+                  [] { return new LidarMapEdgeFactor(FACTOR_POINT, factorLine()); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarMapEdgeFactorVector,
+                  [] { return new LidarMapEdgeFactorVector(FACTOR_POINT, factorLine()); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarPureOdomPlaneNormFactor,
+                  [] { return new LidarPureOdomPlaneNormFactor(FACTOR_POINT, FACTOR_PLANE); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarPureOdomEdgeFactor,
+                  [] { return new LidarPureOdomEdgeFactor(FACTOR_POINT, factorLine()); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarOnlineCalibPlaneNormFactor,
+                  [] { return new LidarOnlineCalibPlaneNormFactor(FACTOR_POINT, FACTOR_PLANE); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, LidarOnlineCalibEdgeFactor,
+                  [] { return new LidarOnlineCalibEdgeFactor(FACTOR_POINT, factorLine()); })->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_FactorEvaluate, PriorFactor,
+                  [] { return new PriorFactor(Eigen::Vector3d(0.1, 0.2, 0.0), Eigen::Quaterniond::Identity(), 1.0, 1.0); })
+    ->Arg(0)->Arg(1);
+
+// ****************** optimization: marginalization of the oldest frame of the sliding window
+// a window of W frames with F plane and F edge features per frame, the features of all the frames
+// are associated with the pivot frame 0 through the extrinsic, as in Estimator::optimizeMap
+struct MarginalizationProblem
+{
+    MarginalizationProblem(const int &window_size, const int &feature_num)
+        : para_pose(window_size + 1, std::vector<double>(7)), para_ex(7)
+    {
+        for (int i = 0; i <= window_size; i++)
+            setFactorPose(para_pose[i].data(), 0.02 * i, Eigen::Vector3d(0.5 * i, 0.1 * i, 0.0));
+        setFactorPose(para_ex.data(), 0.0, Eigen::Vector3d::Zero());
+
+        static ceres::HuberLoss loss_function(0.5); // not released by MarginalizationInfo
+        std::mt19937 gen(0);
+        std::uniform_real_distribution<double> ux(-ROOM_X, ROOM_X), uy(-ROOM_Y, ROOM_Y), uz(ROOM_FLOOR, ROOM_CEIL);
+        info = new MarginalizationInfo();
+        for (int i = 1; i <= window_size; i++)
+        {
+            for (int j = 0; j < feature_num; j++)
+            {
+                std::vector<double *> parameter_blocks{para_pose[0].data(), para_pose[i].data(), para_ex.data()};
+                const Eigen::Vector3d point_plane(ux(gen), uy(gen), ROOM_FLOOR);
+                info->addResidualBlockInfo(new ResidualBlockInfo(
+                    new LidarPureOdomPlaneNormFactor(point_plane, FACTOR_PLANE), &loss_function, parameter_blocks, std::vector<int>{0}));
+                const Eigen::Vector3d point_edge(8.0, 6.0, uz(gen));
+                info->addResidualBlockInfo(new ResidualBlockInfo(
+                    new LidarPureOdomEdgeFactor(point_edge, factorLine()), &loss_function, parameter_blocks, std::vector<int>{0}));
+            }
+        }
+        info->preMarginalize();
+    }
+
+    ~MarginalizationProblem() { delete info; }
+
+    std::vector<std::vector<double> > para_pose;
+    std::vector<double> para_ex;
+    MarginalizationInfo *info;
+};
+
+// args: the window size, the features of each type per frame
+static void BM_Marginalize(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::unique_ptr<MarginalizationProblem> problem(new MarginalizationProblem(state.range(0), state.range(1)));
+        state.ResumeTiming();
+        problem->info->marginalize();
+        state.PauseTiming();
+        problem.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1) * 2);
+}
+BENCHMARK(BM_Marginalize)->Args({2, 50})->Args({4, 50})->Args({4, 200})->Unit(benchmark::kMillisecond);
+
+static void BM_FactorEvaluateMarginalization(benchmark::State &state)
+{
+    MarginalizationProblem problem(4, 50);
+    problem.info->marginalize();
+    BM_FactorEvaluate(state, [&problem] { return new MarginalizationFactor(problem.info); });
+}
+BENCHMARK(BM_FactorEvaluateMarginalization)->Arg(0)->Arg(1);
+
+// the results are written as JSON by default so that runs can be compared
+int main(int argc, char **argv)
+{
+    std::vector<char *> args(argv, argv + argc);
+    bool has_out = false;
+    for (int i = 1; i < argc; i++)
+        if (strncmp(argv[i], "--benchmark_out=", 16) == 0) has_out = true;
+    std::string arg_out = "--benchmark_out=mloam_kernel_benchmark.json";
+    std::string arg_format = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(&arg_out[0]);
+        args.push_back(&arg_format[0]);
+    }
+    int args_num = static_cast<int>(args.size());
+    benchmark::Initialize(&args_num, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_num, args.data())) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
+
+//
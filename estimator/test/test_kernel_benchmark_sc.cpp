@@ -0,0 +1,89 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+// the loop closure kernels of mloam_kernel_benchmark, kept apart from test_kernel_benchmark.cpp
+// since scan_context.hpp brings the Eigen and nanoflann namespaces into the global one
+
+#include <benchmark/benchmark.h>
+
+#include "mloam_loop/scan_context/scan_context.hpp"
+
+#include "kernel_benchmark_data.hpp"
+
+using mloam_loop::SCManager;
+
+// the scan context of 20 rings within 80m as in PoseGraph::setParameter, arg: the number of sectors
+static void setSCParameter(SCManager &sc_manager, const int &num_sector)
+{
+    sc_manager.setParameter(2.0, 20, num_sector, 80.0, 360.0 / num_sector, 80.0 / 20, 50, 10, 0.1, 0.4, 50);
+}
+
+static void BM_MakeScancontext(benchmark::State &state)
+{
+    SCManager sc_manager;
+    setSCParameter(sc_manager, state.range(0));
+    pcl::PointCloud<SCPointType> scan;
+    generateScan(16, 1800, scan, 0);
+    for (auto _ : state)
+    {
+        Eigen::MatrixXd sc = sc_manager.makeScancontext(scan);
+        benchmark::DoNotOptimize(sc.data());
+    }
+    state.SetItemsProcessed(state.iterations() * scan.size());
+}
+BENCHMARK(BM_MakeScancontext)->Arg(60)->Arg(120)->Arg(360)->Unit(benchmark::kMicrosecond);
+
+// the scan contexts of two scans with different noise
+static void BM_DistanceBtnScanContext(benchmark::State &state)
+{
+    SCManager sc_manager;
+    setSCParameter(sc_manager, state.range(0));
+    pcl::PointCloud<SCPointType> scan_1, scan_2;
+    generateScan(16, 1800, scan_1, 0);
+    generateScan(16, 1800, scan_2, 1);
+    Eigen::MatrixXd sc_1 = sc_manager.makeScancontext(scan_1);
+    Eigen::MatrixXd sc_2 = sc_manager.makeScancontext(scan_2);
+    for (auto _ : state)
+    {
+        std::pair<double, int> result = sc_manager.distanceBtnScanContext(sc_1, sc_2);
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_DistanceBtnScanContext)->Arg(60)->Arg(120)->Arg(360)->Unit(benchmark::kMicrosecond);
+
+// the same distance on the normalized scan contexts and the sector keys stored by makeAndSaveScancontextAndKeys
+static void BM_DistanceBtnScanContextNormalized(benchmark::State &state)
+{
+    SCManager sc_manager;
+    setSCParameter(sc_manager, state.range(0));
+    pcl::PointCloud<SCPointType> scan_1, scan_2;
+    generateScan(16, 1800, scan_1, 0);
+    generateScan(16, 1800, scan_2, 1);
+    Eigen::MatrixXd sc_1 = sc_manager.makeScancontext(scan_1);
+    Eigen::MatrixXd sc_2 = sc_manager.makeScancontext(scan_2);
+    Eigen::MatrixXd sc_1_normalized, sc_2_normalized;
+    Eigen::RowVectorXd col_valid_1, col_valid_2;
+    normalizeColumns(sc_1, sc_1_normalized, col_valid_1);
+    normalizeColumns(sc_2, sc_2_normalized, col_valid_2);
+    const Eigen::MatrixXd vkey_1 = sc_manager.makeSectorkeyFromScancontext(sc_1);
+    const Eigen::MatrixXd vkey_2 = sc_manager.makeSectorkeyFromScancontext(sc_2);
+    for (auto _ : state)
+    {
+        std::pair<double, int> result = sc_manager.distanceBtnScanContext(sc_1_normalized, col_valid_1, vkey_1,
+                                                                          sc_2_normalized, col_valid_2, vkey_2);
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_DistanceBtnScanContextNormalized)->Arg(60)->Arg(120)->Arg(360)->Unit(benchmark::kMicrosecond);
+
+//
@@ -0,0 +1,51 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#ifndef MLOAM_COMMON_ALLOC_COUNTER_HPP_
+#define MLOAM_COMMON_ALLOC_COUNTER_HPP_
+
+#include <cstdint>
+
+// build with -DMLOAM_ALLOC_COUNTING=ON to replace the global operator new/delete and (with glibc) malloc,
+// calloc and realloc by counting ones
+#ifndef MLOAM_ALLOC_COUNTING
+#define MLOAM_ALLOC_COUNTING 0
+#endif
+
+namespace common
+{
+    namespace alloc
+    {
+        // the heap allocations of a thread through malloc, calloc, realloc and the global operator new and new[]
+        // (the shared pointers, the std containers, the Ceres factors, and through Eigen::aligned_allocator the
+        // points of PCL and the aligned Eigen containers), each counted once. without glibc only operator new is
+        // counted. a common::timing::Timer records the allocations of its thread between Start() and Stop() into
+        // its handle, so a span includes the allocations of the spans nested in it, e.g. odom_process >
+        // odom_solver (and, once per thread and handle, the histogram allocated by the first sample of a nested
+        // timer)
+        struct AllocCount
+        {
+            uint64_t num_;
+            uint64_t bytes_;
+        };
+
+        // the allocations of the calling thread since it started, {0, 0} if not counting
+        AllocCount GetThreadCount();
+
+        // whether mloam_common is built with MLOAM_ALLOC_COUNTING
+        bool IsCounting();
+
+    } // namespace alloc
+} // namespace common
+
+#endif // MLOAM_COMMON_ALLOC_COUNTER_HPP_
@@ -23,8 +23,16 @@ namespace common
         std::normal_distribution< T > m_dist_normal;
         RandomGeneratorFloat(): m_random_engine( std::random_device{}() )
         {};
+        // a fixed seed makes the sequence reproducible, e.g. for the replay benchmark
+        explicit RandomGeneratorFloat( unsigned int seed ): m_random_engine( seed )
+        {};
         ~RandomGeneratorFloat(){};
 
+        void setSeed( unsigned int seed )
+        {
+            m_random_engine.seed( seed );
+        }
+
         T geneRandUniform( T low = 0.0, T hight = 100.0 )
         {
             m_dist = std::uniform_real_distribution< T >( low, hight );
@@ -57,8 +65,16 @@ namespace common
         std::uniform_int_distribution< T > m_dist;
         RandomGeneratorInt(): m_random_engine( std::random_device{}() )
         {};
+        // a fixed seed makes the sequence reproducible, e.g. for the replay benchmark
+        explicit RandomGeneratorInt( unsigned int seed ): m_random_engine( seed )
+        {};
         ~RandomGeneratorInt(){};
 
+        void setSeed( unsigned int seed )
+        {
+            m_random_engine.seed( seed );
+        }
+
         T geneRandUniform( T low = 0, T hight = 100 )
         {
             m_dist = std::uniform_int_distribution<T>(low, hight);
@@ -38,8 +38,20 @@
 #include <string>
 #include <vector>
 
+#include <atomic>
+#include <cstdint>
+
 #include <Eigen/Core>
 
+#include "common/alloc_counter.hpp"
+#include "common/trace.hpp"
+
+// build with -DMLOAM_ENABLE_TIMING=0 to record nothing, set for all packages by mloam_common (cmake -DMLOAM_TIMING=OFF)
+// since Timer is inline and has to be the same everywhere
+#ifndef MLOAM_ENABLE_TIMING
+#define MLOAM_ENABLE_TIMING 1
+#endif
+
 namespace common
 {
     // Aligned Eigen containers
@@ -65,96 +77,79 @@ namespace common
     namespace timing
     {
 
-        template <typename T, typename Total, int N>
-        class Accumulator
+        // the timers are recorded into a slot per handle of each thread, a handle >= kMaxTimers is not recorded
+        const size_t kMaxTimers = 256;
+
+        // log-bucketed histogram of the samples in ns (HDR histogram style): 2^kHistogramSubBits buckets per
+        // power of two, i.e. a percentile is within 1/16 of the sample, up to 2^kHistogramMaxBits ns (~18min)
+        const int kHistogramSubBits = 4;
+        const int kHistogramMaxBits = 40;
+        const size_t kHistogramNumBuckets = (kHistogramMaxBits - kHistogramSubBits + 1) << kHistogramSubBits;
+
+        class Histogram
         {
         public:
-            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            Histogram() : counts_(kHistogramNumBuckets, 0), num_samples_(0) {}
 
-            Accumulator()
-                : window_samples_(0),
-                  totalsamples_(0),
-                  window_sum_(0),
-                  sum_(0),
-                  min_(std::numeric_limits<T>::max()),
-                  max_(std::numeric_limits<T>::min()) {}
-
-            void Add(T sample)
-            {
-                if (window_samples_ < N)
-                {
-                    samples_[window_samples_++] = sample;
-                    window_sum_ += sample;
-                }
-                else
-                {
-                    T &oldest = samples_[window_samples_++ % N];
-                    window_sum_ += sample - oldest;
-                    oldest = sample;
-                }
-                sum_ += sample;
-                ++totalsamples_;
-                if (sample > max_)
-                {
-                    max_ = sample;
-                }
-                if (sample < min_)
-                {
-                    min_ = sample;
-                }
-                newest_time_ = sample;
-            }
-
-            int TotalSamples() const { return totalsamples_; }
-
-            double NewestTime() const { return newest_time_; }
-
-            double Sum() const { return sum_; }
-
-            double Mean() const { return sum_ / totalsamples_; }
-
-            double RollingMean() const
-            {
-                return window_sum_ / std::min(window_samples_, N);
-            }
-
-            double Max() const { return max_; }
-
-            double Min() const { return min_; }
-
-            double LazyVariance() const
-            {
-                if (window_samples_ == 0)
-                {
-                    return 0.0;
-                }
-                double var = 0;
-                double mean = RollingMean();
-                for (int i = 0; i < std::min(window_samples_, N); ++i)
-                {
-                    var += (samples_[i] - mean) * (samples_[i] - mean);
-                }
-                var /= std::min(window_samples_, N);
-                return var;
-            }
+            static size_t GetBucket(uint64_t ns);
+            // the largest sample in the bucket
+            static double GetBucketMaxSeconds(size_t bucket);
 
-        private:
-            int window_samples_;
-            int totalsamples_;
-            Total window_sum_;
-            Total sum_;
-            T min_;
-            T max_;
-            T samples_[N];
-            T newest_time_;
+            void Add(uint64_t ns);
+            void Merge(const Histogram &histogram);
+
+            // percentile in [0, 100], 0 if no sample
+            double GetPercentileSeconds(double percentile) const;
+
+            std::vector<uint64_t> counts_;
+            uint64_t num_samples_;
         };
 
-        struct TimerMapValue
+        // the samples of a handle recorded by one thread: only the thread writes (so relaxed load + store is
+        // enough), the other threads read the slot when the timers are queried
+        struct ThreadAccumulator
         {
-            TimerMapValue() {}
+            ThreadAccumulator() : buckets_(nullptr) { Reset(); }
+            ~ThreadAccumulator() { delete[] buckets_.load(); }
+
+            void Add(double sample, int64_t stamp, double deadline);
+            void AddAlloc(uint64_t num, uint64_t bytes);
+            void Reset();
+
+            std::atomic<uint64_t> num_samples_;
+            std::atomic<double> sum_;
+            std::atomic<double> sum_sq_;
+            std::atomic<double> min_;
+            std::atomic<double> max_;
+            std::atomic<double> newest_;
+            std::atomic<int64_t> newest_stamp_; // steady clock in ns, to find the newest sample among the threads
+            std::atomic<uint64_t> deadline_miss_;
+            std::atomic<uint64_t> alloc_num_;   // MLOAM_ALLOC_COUNTING
+            std::atomic<uint64_t> alloc_bytes_;
+            std::atomic<std::atomic<uint64_t> *> buckets_; // kHistogramNumBuckets, allocated by the first sample
+        };
 
-            /// Create an accumulator with specified window size.
-            Accumulator<double, double, 500> acc_;
+        // the samples of a handle merged over the threads
+        struct TimerStatistics
+        {
+            TimerStatistics()
+                : num_samples_(0), sum_(0), sum_sq_(0), min_(std::numeric_limits<double>::max()), max_(0),
+                  newest_(0), newest_stamp_(std::numeric_limits<int64_t>::min()), deadline_miss_(0),
+                  alloc_num_(0), alloc_bytes_(0) {}
+
+            void Merge(const ThreadAccumulator &acc);
+
+            uint64_t num_samples_;
+            double sum_, sum_sq_, min_, max_, newest_;
+            int64_t newest_stamp_;
+            uint64_t deadline_miss_;
+            uint64_t alloc_num_, alloc_bytes_;
+            Histogram histogram_;
+        };
+
+        struct ThreadTimers
+        {
+            ThreadAccumulator acc_[kMaxTimers];
         };
 
         /**
@@ -173,10 +168,18 @@ namespace common
             ~DummyTimer() {}
 
             void Start() {}
-            double Stop() {}
+            double Stop() { return 0.0; }
             bool IsTiming() { return false; }
         };
 
+        // measure with the monotonic steady clock. construct it with TIMING_HANDLE("tag") on the hot paths:
+        // the tag is then looked up once per call site instead of in the map of tags on every construction.
+        // with MLOAM_ENABLE_TIMING = 0 the timers still measure (Stop() and GetCountTime() are used by the
+        // algorithms), but nothing is recorded.
+        // overhead per Start/Stop pair (mloam_test/src/test_timing_benchmark.cpp, median of 3 runs on one core,
+        // steady_clock::now() ~50ns): ~110ns with a handle, ~140ns with a tag, ~100ns with MLOAM_ENABLE_TIMING = 0,
+        // i.e. the two clock reads dominate and recording a sample into the accumulators and the histogram costs ~10ns.
+        // with MLOAM_ALLOC_COUNTING the allocations of the thread between Start() and Stop() are recorded as well
         class Timer
         {
         public:
@@ -192,10 +195,11 @@ namespace common
             bool IsTiming() const;
 
         private:
-            std::chrono::time_point<std::chrono::system_clock> time_;
+            std::chrono::steady_clock::time_point time_;
 
             bool timing_;
             size_t handle_;
+            alloc::AllocCount alloc_start_;
         };
 
         class Timing
@@ -205,7 +209,8 @@ namespace common
 
             typedef std::map<std::string, size_t> map_t;
             friend class Timer;
-            // Definition of static functions to query the timers.
+            friend struct ThreadTimersHolder;
+            // Definition of static functions to query the timers, the samples of all threads are merged.
             static size_t GetHandle(std::string const &tag);
             static std::string GetTag(size_t handle);
             static double GetNewestTime(size_t handle);
@@ -226,28 +231,103 @@ namespace common
             static double GetMaxSeconds(std::string const &tag);
             static double GetHz(size_t handle);
             static double GetHz(std::string const &tag);
+            // percentile in [0, 100], e.g. 99.9
+            static double GetPercentileSeconds(size_t handle, double percentile);
+            static double GetPercentileSeconds(std::string const &tag, double percentile);
+            // count the samples longer than deadline (<= 0: none), e.g. odom_process > SCAN_PERIOD
+            static void SetDeadline(size_t handle, double seconds);
+            static double GetDeadline(size_t handle);
+            static size_t GetDeadlineMissCount(size_t handle);
+            static size_t GetDeadlineMissCount(std::string const &tag);
+            // the allocations recorded by the timer (MLOAM_ALLOC_COUNTING), including its nested timers
+            static size_t GetAllocNum(size_t handle);
+            static size_t GetAllocNum(std::string const &tag);
+            static size_t GetAllocBytes(size_t handle);
+            static size_t GetAllocBytes(std::string const &tag);
+            static TimerStatistics GetStatistics(size_t handle);
+            // the statistics and percentiles of all timers, return false if the file cannot be created
+            static bool WriteCsv(std::string const &filename);
+            static bool WriteJson(std::string const &filename);
             static void Print(std::ostream &out);
             static std::string Print();
             static std::string SecondsToTimeString(double seconds);
+            // clear the samples, the handles stay valid
             static void Reset();
             static const map_t &GetTimers() { return Instance().tagMap_; }
 
         private:
-            void AddTime(size_t handle, double seconds);
+            static void AddTime(size_t handle, double seconds, int64_t stamp);
+            static void AddAlloc(size_t handle, uint64_t num, uint64_t bytes);
 
             static Timing &Instance();
+            static ThreadTimers &LocalTimers();
 
             Timing();
             ~Timing();
 
-            typedef AlignedVector<TimerMapValue> list_t;
-
-            list_t timers_;
+            // the timers of the running threads, and the samples of the exited threads
+            std::vector<std::shared_ptr<ThreadTimers> > threadTimers_;
+            std::vector<TimerStatistics> retired_;
             map_t tagMap_;
             size_t maxTagLength_;
             std::mutex mutex_;
         };
 
+        inline Timer::Timer(size_t handle, bool constructStopped)
+            : timing_(false), handle_(handle), alloc_start_{0, 0}
+        {
+            if (!constructStopped) Start();
+        }
+
+        inline Timer::Timer(std::string const &tag, bool constructStopped)
+#if MLOAM_ENABLE_TIMING
+            : timing_(false), handle_(Timing::GetHandle(tag)), alloc_start_{0, 0}
+#else
+            : timing_(false), handle_(0), alloc_start_{0, 0}
+#endif
+        {
+            if (!constructStopped) Start();
+        }
+
+        inline Timer::~Timer()
+        {
+            if (IsTiming()) Stop();
+        }
+
+        inline void Timer::Start()
+        {
+            timing_ = true;
+#if MLOAM_ENABLE_TIMING && MLOAM_ALLOC_COUNTING
+            alloc_start_ = alloc::GetThreadCount();
+#endif
+            time_ = std::chrono::steady_clock::now();
+        }
+
+        inline double Timer::GetCountTime()
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - time_).count();
+        }
+
+        inline double Timer::Stop()
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - time_).count();
+#if MLOAM_ENABLE_TIMING
+            int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+#if MLOAM_ALLOC_COUNTING
+            alloc::AllocCount alloc_stop = alloc::GetThreadCount();
+            Timing::AddAlloc(handle_, alloc_stop.num_ - alloc_start_.num_, alloc_stop.bytes_ - alloc_start_.bytes_);
+#endif
+            Timing::AddTime(handle_, dt, now_ns);
+            if (Trace::IsEnabled())
+                Trace::AddSpan(handle_, std::chrono::duration_cast<std::chrono::nanoseconds>(time_.time_since_epoch()).count(), now_ns);
+#endif
+            timing_ = false;
+            return dt;
+        }
+
+        inline bool Timer::IsTiming() const { return timing_; }
+
 #if ENABLE_MSF_TIMING
         typedef Timer DebugTimer;
 #else
@@ -257,4 +337,11 @@ namespace common
     } // namespace timing
 } // namespace voxblox
 
+// the handle of a tag, registered once per call site: common::timing::Timer t(TIMING_HANDLE("odom_solver"));
+#if MLOAM_ENABLE_TIMING
+#define TIMING_HANDLE(tag) ([]() -> size_t { static const size_t handle = common::timing::Timing::GetHandle(tag); return handle; }())
+#else
+#define TIMING_HANDLE(tag) (size_t(0))
+#endif
+
 #endif // VOXBLOX_UTILS_TIMING_H_
\ No newline at end of file
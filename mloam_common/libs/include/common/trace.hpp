@@ -0,0 +1,56 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#ifndef MLOAM_COMMON_TRACE_HPP_
+#define MLOAM_COMMON_TRACE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace common
+{
+    namespace timing
+    {
+        // the spans of the common::timing timers on a timeline: while started, every Timer::Stop() records
+        // (tag, thread, start, duration, frame) in a buffer of the calling thread, and Stop() writes the
+        // spans as Chrome trace JSON (chrome://tracing, https://ui.perfetto.dev). the spans of a thread
+        // nest by their time, e.g. odom_process > odom_solver, and the frame is the timestamp of the cloud,
+        // which is shared by the odometry, the mapping and the loop closure of the frame
+        class Trace
+        {
+        public:
+            // max_event_num: the spans kept per thread, the later ones are dropped
+            static bool Start(const std::string &filename, const size_t &max_event_num = 1000000);
+
+            // write the trace and stop recording, return the number of spans written or -1 if not started
+            static int Stop();
+
+            static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+            // the frame of the spans recorded by the calling thread from now on
+            static void SetFrame(const double &time);
+
+            // the name of the calling thread on the timeline
+            static void SetThreadName(const std::string &name);
+
+            static void AddSpan(const size_t &handle, const int64_t &start_ns, const int64_t &end_ns);
+
+        private:
+            static std::atomic<bool> enabled_;
+        };
+
+    } // namespace timing
+} // namespace common
+
+#endif // MLOAM_COMMON_TRACE_HPP_
@@ -0,0 +1,160 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "common/alloc_counter.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef __GLIBC__
+// the allocator of glibc behind malloc, calloc and realloc
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t num, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+}
+#endif
+
+namespace common
+{
+    namespace alloc
+    {
+        // constant-initialized, so that they are safe to touch from malloc at any time (also while a thread
+        // starts or exits) and are only read and written by their thread. initial-exec since a dynamic TLS
+        // access may call malloc
+        static thread_local uint64_t thread_alloc_num __attribute__((tls_model("initial-exec"))) = 0;
+        static thread_local uint64_t thread_alloc_bytes __attribute__((tls_model("initial-exec"))) = 0;
+
+        AllocCount GetThreadCount()
+        {
+            return AllocCount{thread_alloc_num, thread_alloc_bytes};
+        }
+
+        bool IsCounting()
+        {
+            return MLOAM_ALLOC_COUNTING != 0;
+        }
+
+#if MLOAM_ALLOC_COUNTING
+        static inline void count(const size_t &size)
+        {
+            thread_alloc_num++;
+            thread_alloc_bytes += size;
+        }
+
+        // the allocation is counted by malloc (or here without glibc)
+        static void *allocate(std::size_t size)
+        {
+            if (size == 0) size = 1;
+#ifndef __GLIBC__
+            count(size);
+#endif
+            while (true)
+            {
+                void *ptr = std::malloc(size);
+                if (ptr) return ptr;
+                std::new_handler handler = std::get_new_handler();
+                if (!handler) throw std::bad_alloc();
+                handler();
+            }
+        }
+
+        // posix_memalign is not interposed, so the aligned allocation is counted here
+        static void *allocateAligned(std::size_t size, std::align_val_t alignment)
+        {
+            if (size == 0) size = 1;
+            count(size);
+            size_t align = std::max(static_cast<size_t>(alignment), sizeof(void *));
+            while (true)
+            {
+                void *ptr = nullptr;
+                if (posix_memalign(&ptr, align, size) == 0) return ptr;
+                std::new_handler handler = std::get_new_handler();
+                if (!handler) throw std::bad_alloc();
+                handler();
+            }
+        }
+#endif
+
+    } // namespace alloc
+} // namespace common
+
+#if MLOAM_ALLOC_COUNTING
+#ifdef __GLIBC__
+// malloc is interposed since most of the memory (the points of PCL, the matrices of Eigen) is allocated through
+// Eigen::aligned_allocator, which calls malloc instead of operator new. realloc counts the new size
+extern "C"
+{
+    void *malloc(size_t size)
+    {
+        common::alloc::count(size);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t num, size_t size)
+    {
+        common::alloc::count(num * size);
+        return __libc_calloc(num, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        common::alloc::count(size);
+        return __libc_realloc(ptr, size);
+    }
+}
+#endif
+
+// the replaceable global allocation functions, all the deallocation functions are replaced as well so that
+// the memory is released by the allocator which returned it
+void *operator new(std::size_t size) { return common::alloc::allocate(size); }
+void *operator new[](std::size_t size) { return common::alloc::allocate(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return common::alloc::allocate(size); } catch (...) { return nullptr; }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return common::alloc::allocate(size); } catch (...) { return nullptr; }
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) { return common::alloc::allocateAligned(size, alignment); }
+void *operator new[](std::size_t size, std::align_val_t alignment) { return common::alloc::allocateAligned(size, alignment); }
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try { return common::alloc::allocateAligned(size, alignment); } catch (...) { return nullptr; }
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try { return common::alloc::allocateAligned(size, alignment); } catch (...) { return nullptr; }
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { std::free(ptr); }
+#endif
+
+//
@@ -18,6 +18,7 @@
 /* Adapted from Paul Furgale Schweizer Messer sm_timing*/
 
 #include <math.h>
+#include <cmath>
 #include <stdio.h>
 #include <algorithm>
 #include <ostream>
@@ -30,14 +31,171 @@ namespace common {
 
 namespace timing {
 
-const double kNumSecondsPerNanosecond = 1.e-9;
+// Deadline per handle, 0 if none. Read by AddTime without a lock.
+static std::atomic<double> deadlines[kMaxTimers];
+
+size_t Histogram::GetBucket(uint64_t ns) {
+  const uint64_t kSubBuckets = 1ULL << kHistogramSubBits;
+  if (ns < kSubBuckets) return ns;
+  int exponent = 63 - __builtin_clzll(ns);
+  if (exponent >= kHistogramMaxBits) return kHistogramNumBuckets - 1;
+  uint64_t sub = (ns >> (exponent - kHistogramSubBits)) & (kSubBuckets - 1);
+  return ((exponent - kHistogramSubBits + 1) << kHistogramSubBits) + sub;
+}
+
+double Histogram::GetBucketMaxSeconds(size_t bucket) {
+  const uint64_t kSubBuckets = 1ULL << kHistogramSubBits;
+  if (bucket < kSubBuckets) return bucket * 1e-9;
+  int exponent = (bucket >> kHistogramSubBits) + kHistogramSubBits - 1;
+  uint64_t sub = bucket & (kSubBuckets - 1);
+  uint64_t width = 1ULL << (exponent - kHistogramSubBits);
+  return ((kSubBuckets + sub) * width + width - 1) * 1e-9;
+}
+
+void Histogram::Add(uint64_t ns) {
+  counts_[GetBucket(ns)]++;
+  num_samples_++;
+}
+
+void Histogram::Merge(const Histogram& histogram) {
+  for (size_t i = 0; i < kHistogramNumBuckets; ++i) {
+    counts_[i] += histogram.counts_[i];
+  }
+  num_samples_ += histogram.num_samples_;
+}
+
+double Histogram::GetPercentileSeconds(double percentile) const {
+  if (num_samples_ == 0) return 0.0;
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  uint64_t rank = std::max(
+      static_cast<uint64_t>(std::ceil(percentile / 100.0 * num_samples_)),
+      static_cast<uint64_t>(1));
+  uint64_t count = 0;
+  for (size_t i = 0; i < kHistogramNumBuckets; ++i) {
+    count += counts_[i];
+    if (count >= rank) return GetBucketMaxSeconds(i);
+  }
+  return GetBucketMaxSeconds(kHistogramNumBuckets - 1);
+}
+
+void ThreadAccumulator::Add(double sample, int64_t stamp, double deadline) {
+  num_samples_.store(num_samples_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+  sum_.store(sum_.load(std::memory_order_relaxed) + sample,
+             std::memory_order_relaxed);
+  sum_sq_.store(sum_sq_.load(std::memory_order_relaxed) + sample * sample,
+                std::memory_order_relaxed);
+  if (sample < min_.load(std::memory_order_relaxed))
+    min_.store(sample, std::memory_order_relaxed);
+  if (sample > max_.load(std::memory_order_relaxed))
+    max_.store(sample, std::memory_order_relaxed);
+  newest_.store(sample, std::memory_order_relaxed);
+  newest_stamp_.store(stamp, std::memory_order_relaxed);
+  if (deadline > 0 && sample > deadline) {
+    deadline_miss_.store(deadline_miss_.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t>* buckets = buckets_.load(std::memory_order_relaxed);
+  if (!buckets) {
+    buckets = new std::atomic<uint64_t>[kHistogramNumBuckets]();
+    buckets_.store(buckets, std::memory_order_release);
+  }
+  std::atomic<uint64_t>& bucket =
+      buckets[Histogram::GetBucket(static_cast<uint64_t>(std::max(sample, 0.0) * 1e9))];
+  bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+}
+
+void ThreadAccumulator::AddAlloc(uint64_t num, uint64_t bytes) {
+  alloc_num_.store(alloc_num_.load(std::memory_order_relaxed) + num,
+                   std::memory_order_relaxed);
+  alloc_bytes_.store(alloc_bytes_.load(std::memory_order_relaxed) + bytes,
+                     std::memory_order_relaxed);
+}
+
+void ThreadAccumulator::Reset() {
+  num_samples_.store(0, std::memory_order_relaxed);
+  sum_.store(0.0, std::memory_order_relaxed);
+  sum_sq_.store(0.0, std::memory_order_relaxed);
+  min_.store(std::numeric_limits<double>::max(), std::memory_order_relaxed);
+  max_.store(0.0, std::memory_order_relaxed);
+  newest_.store(0.0, std::memory_order_relaxed);
+  newest_stamp_.store(std::numeric_limits<int64_t>::min(),
+                      std::memory_order_relaxed);
+  deadline_miss_.store(0, std::memory_order_relaxed);
+  alloc_num_.store(0, std::memory_order_relaxed);
+  alloc_bytes_.store(0, std::memory_order_relaxed);
+  std::atomic<uint64_t>* buckets = buckets_.load(std::memory_order_acquire);
+  if (buckets) {
+    for (size_t i = 0; i < kHistogramNumBuckets; ++i) {
+      buckets[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void TimerStatistics::Merge(const ThreadAccumulator& acc) {
+  uint64_t num_samples = acc.num_samples_.load(std::memory_order_relaxed);
+  if (num_samples == 0) return;
+  num_samples_ += num_samples;
+  sum_ += acc.sum_.load(std::memory_order_relaxed);
+  sum_sq_ += acc.sum_sq_.load(std::memory_order_relaxed);
+  min_ = std::min(min_, acc.min_.load(std::memory_order_relaxed));
+  max_ = std::max(max_, acc.max_.load(std::memory_order_relaxed));
+  int64_t stamp = acc.newest_stamp_.load(std::memory_order_relaxed);
+  if (stamp >= newest_stamp_) {
+    newest_stamp_ = stamp;
+    newest_ = acc.newest_.load(std::memory_order_relaxed);
+  }
+  deadline_miss_ += acc.deadline_miss_.load(std::memory_order_relaxed);
+  alloc_num_ += acc.alloc_num_.load(std::memory_order_relaxed);
+  alloc_bytes_ += acc.alloc_bytes_.load(std::memory_order_relaxed);
+  const std::atomic<uint64_t>* buckets =
+      acc.buckets_.load(std::memory_order_acquire);
+  if (buckets) {
+    for (size_t i = 0; i < kHistogramNumBuckets; ++i) {
+      uint64_t count = buckets[i].load(std::memory_order_relaxed);
+      histogram_.counts_[i] += count;
+      histogram_.num_samples_ += count;
+    }
+  }
+}
+
+// Registers the timers of a thread on its first sample, and keeps the samples
+// in the retired statistics when the thread exits.
+struct ThreadTimersHolder {
+  ThreadTimersHolder() : timers_(new ThreadTimers) {
+    Timing& timing = Timing::Instance();
+    std::lock_guard<std::mutex> lock(timing.mutex_);
+    timing.threadTimers_.push_back(timers_);
+  }
+
+  ~ThreadTimersHolder() {
+    Timing& timing = Timing::Instance();
+    std::lock_guard<std::mutex> lock(timing.mutex_);
+    for (size_t i = 0; i < timing.retired_.size(); ++i) {
+      timing.retired_[i].Merge(timers_->acc_[i]);
+    }
+    timing.threadTimers_.erase(std::remove(timing.threadTimers_.begin(),
+                                           timing.threadTimers_.end(),
+                                           timers_),
+                               timing.threadTimers_.end());
+  }
+
+  std::shared_ptr<ThreadTimers> timers_;
+};
 
 Timing& Timing::Instance() {
   static Timing t;
   return t;
 }
 
-Timing::Timing() : maxTagLength_(0) {}
+ThreadTimers& Timing::LocalTimers() {
+  thread_local ThreadTimersHolder holder;
+  return *holder.timers_;
+}
+
+Timing::Timing() : retired_(kMaxTimers), maxTagLength_(0) {}
 
 Timing::~Timing() {}
 
@@ -48,9 +206,12 @@ size_t Timing::GetHandle(std::string const& tag) {
   map_t::iterator i = Instance().tagMap_.find(tag);
   if (i == Instance().tagMap_.end()) {
     // If it is not there, create a tag.
-    size_t handle = Instance().timers_.size();
+    size_t handle = Instance().tagMap_.size();
     Instance().tagMap_[tag] = handle;
-    Instance().timers_.push_back(TimerMapValue());
+    if (handle >= kMaxTimers) {
+      fprintf(stderr, "[Timing] more than %lu timers, %s is not recorded\n",
+              kMaxTimers, tag.c_str());
+    }
     // Track the maximum tag length to help printing a table of timing values
     // later.
     Instance().maxTagLength_ = std::max(Instance().maxTagLength_, tag.size());
@@ -73,61 +234,33 @@ std::string Timing::GetTag(size_t handle) {
   return tag;
 }
 
-// Class functions used for timing.
-Timer::Timer(size_t handle, bool constructStopped)
-    : timing_(false), handle_(handle) {
-  if (!constructStopped) Start();
+// Only the calling thread writes its accumulators, no lock is taken.
+void Timing::AddTime(size_t handle, double seconds, int64_t stamp) {
+  if (handle >= kMaxTimers) return;
+  LocalTimers().acc_[handle].Add(
+      seconds, stamp, deadlines[handle].load(std::memory_order_relaxed));
 }
 
-Timer::Timer(std::string const& tag, bool constructStopped)
-    : timing_(false), handle_(Timing::GetHandle(tag)) {
-  if (!constructStopped) Start();
+void Timing::AddAlloc(size_t handle, uint64_t num, uint64_t bytes) {
+  if (handle >= kMaxTimers) return;
+  LocalTimers().acc_[handle].AddAlloc(num, bytes);
 }
 
-Timer::~Timer() {
-  if (IsTiming()) Stop();
-}
-
-void Timer::Start() {
-  timing_ = true;
-  time_ = std::chrono::system_clock::now();
-}
-
-double Timer::GetCountTime() {
-  std::chrono::time_point<std::chrono::system_clock> now =
-      std::chrono::system_clock::now();
-  double dt =
-      static_cast<double>(
-          std::chrono::duration_cast<std::chrono::nanoseconds>(now - time_)
-              .count()) *
-      kNumSecondsPerNanosecond;
-  return dt;
-}
-
-double Timer::Stop() {
-  std::chrono::time_point<std::chrono::system_clock> now =
-      std::chrono::system_clock::now();
-  double dt =
-      static_cast<double>(
-          std::chrono::duration_cast<std::chrono::nanoseconds>(now - time_)
-              .count()) *
-      kNumSecondsPerNanosecond;
-
-  Timing::Instance().AddTime(handle_, dt);
-  timing_ = false;
-  return dt;
-}
-
-bool Timer::IsTiming() const { return timing_; }
-
-void Timing::AddTime(size_t handle, double seconds) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  timers_[handle].acc_.Add(seconds);
+// Merge the samples of the running and the exited threads.
+TimerStatistics Timing::GetStatistics(size_t handle) {
+  TimerStatistics stat;
+  if (handle >= kMaxTimers) return stat;
+  Timing& timing = Instance();
+  std::lock_guard<std::mutex> lock(timing.mutex_);
+  stat = timing.retired_[handle];
+  for (const std::shared_ptr<ThreadTimers>& timers : timing.threadTimers_) {
+    stat.Merge(timers->acc_[handle]);
+  }
+  return stat;
 }
 
 double Timing::GetNewestTime(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return Instance().timers_[handle].acc_.NewestTime();
+  return GetStatistics(handle).newest_;
 }
 
 double Timing::GetNewestTime(std::string const& tag) {
@@ -135,63 +268,178 @@ double Timing::GetNewestTime(std::string const& tag) {
 }
 
 double Timing::GetTotalSeconds(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return Instance().timers_[handle].acc_.Sum();
+  return GetStatistics(handle).sum_;
 }
 double Timing::GetTotalSeconds(std::string const& tag) {
   return GetTotalSeconds(GetHandle(tag));
 }
 double Timing::GetMeanSeconds(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return Instance().timers_[handle].acc_.Mean();
+  TimerStatistics stat = GetStatistics(handle);
+  return stat.num_samples_ > 0 ? stat.sum_ / stat.num_samples_ : 0.0;
 }
 double Timing::GetMeanSeconds(std::string const& tag) {
   return GetMeanSeconds(GetHandle(tag));
 }
 size_t Timing::GetNumSamples(size_t handle) {
-  return Instance().timers_[handle].acc_.TotalSamples();
+  return GetStatistics(handle).num_samples_;
 }
 size_t Timing::GetNumSamples(std::string const& tag) {
   return GetNumSamples(GetHandle(tag));
 }
 double Timing::GetVarianceSeconds(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return Instance().timers_[handle].acc_.LazyVariance();
+  TimerStatistics stat = GetStatistics(handle);
+  if (stat.num_samples_ < 2) return 0.0;
+  double mean = stat.sum_ / stat.num_samples_;
+  return std::max(stat.sum_sq_ / stat.num_samples_ - mean * mean, 0.0);
 }
 double Timing::GetVarianceSeconds(std::string const& tag) {
   return GetVarianceSeconds(GetHandle(tag));
 }
 double Timing::GetSTDSeconds(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return sqrt(Instance().timers_[handle].acc_.LazyVariance());
+  return sqrt(GetVarianceSeconds(handle));
 }
 double Timing::GetSTDSeconds(std::string const& tag) {
   return GetSTDSeconds(GetHandle(tag));
 }
 double Timing::GetMinSeconds(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return Instance().timers_[handle].acc_.Min();
+  TimerStatistics stat = GetStatistics(handle);
+  return stat.num_samples_ > 0 ? stat.min_ : 0.0;
 }
 double Timing::GetMinSeconds(std::string const& tag) {
   return GetMinSeconds(GetHandle(tag));
 }
 double Timing::GetMaxSeconds(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  return Instance().timers_[handle].acc_.Max();
+  return GetStatistics(handle).max_;
 }
 double Timing::GetMaxSeconds(std::string const& tag) {
   return GetMaxSeconds(GetHandle(tag));
 }
 
 double Timing::GetHz(size_t handle) {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  const double rolling_mean = Instance().timers_[handle].acc_.RollingMean();
-  // CHECK_GT(rolling_mean, 0.0);
-  return 1.0 / rolling_mean;
+  const double mean = GetMeanSeconds(handle);
+  // CHECK_GT(mean, 0.0);
+  return 1.0 / mean;
 }
 
 double Timing::GetHz(std::string const& tag) { return GetHz(GetHandle(tag)); }
 
+double Timing::GetPercentileSeconds(size_t handle, double percentile) {
+  TimerStatistics stat = GetStatistics(handle);
+  if (stat.num_samples_ == 0) return 0.0;
+  // the bucket bounds are clamped by the samples
+  return std::min(std::max(stat.histogram_.GetPercentileSeconds(percentile),
+                           stat.min_),
+                  stat.max_);
+}
+double Timing::GetPercentileSeconds(std::string const& tag,
+                                    double percentile) {
+  return GetPercentileSeconds(GetHandle(tag), percentile);
+}
+
+void Timing::SetDeadline(size_t handle, double seconds) {
+  if (handle >= kMaxTimers) return;
+  deadlines[handle].store(seconds, std::memory_order_relaxed);
+}
+double Timing::GetDeadline(size_t handle) {
+  if (handle >= kMaxTimers) return 0.0;
+  return deadlines[handle].load(std::memory_order_relaxed);
+}
+size_t Timing::GetDeadlineMissCount(size_t handle) {
+  return GetStatistics(handle).deadline_miss_;
+}
+size_t Timing::GetDeadlineMissCount(std::string const& tag) {
+  return GetDeadlineMissCount(GetHandle(tag));
+}
+
+size_t Timing::GetAllocNum(size_t handle) {
+  return GetStatistics(handle).alloc_num_;
+}
+size_t Timing::GetAllocNum(std::string const& tag) {
+  return GetAllocNum(GetHandle(tag));
+}
+size_t Timing::GetAllocBytes(size_t handle) {
+  return GetStatistics(handle).alloc_bytes_;
+}
+size_t Timing::GetAllocBytes(std::string const& tag) {
+  return GetAllocBytes(GetHandle(tag));
+}
+
+// The percentiles written by WriteCsv and WriteJson.
+static const double kPercentiles[] = {50.0, 90.0, 99.0, 99.9};
+static const char* kPercentileNames[] = {"p50", "p90", "p99", "p999"};
+static const size_t kNumPercentiles = 4;
+
+bool Timing::WriteCsv(std::string const& filename) {
+  FILE* file = fopen(filename.c_str(), "w");
+  if (!file) {
+    printf("[Timing] cannot create file: %s\n", filename.c_str());
+    return false;
+  }
+  map_t tagMap;
+  {
+    std::lock_guard<std::mutex> lock(Instance().mutex_);
+    tagMap = Instance().tagMap_;
+  }
+  fprintf(file, "tag, num_samples, total_s, mean_s, std_s, min_s, max_s");
+  for (size_t j = 0; j < kNumPercentiles; ++j) {
+    fprintf(file, ", %s_s", kPercentileNames[j]);
+  }
+  fprintf(file, ", deadline_s, deadline_miss, alloc_num, alloc_bytes\n");
+  for (const map_t::value_type& t : tagMap) {
+    size_t i = t.second;
+    TimerStatistics stat = GetStatistics(i);
+    if (stat.num_samples_ == 0) continue;
+    fprintf(file, "%s, %lu, %.9f, %.9f, %.9f, %.9f, %.9f", t.first.c_str(),
+            stat.num_samples_, stat.sum_, stat.sum_ / stat.num_samples_,
+            sqrt(GetVarianceSeconds(i)), stat.min_, stat.max_);
+    for (size_t j = 0; j < kNumPercentiles; ++j) {
+      fprintf(file, ", %.9f", GetPercentileSeconds(i, kPercentiles[j]));
+    }
+    fprintf(file, ", %.9f, %lu, %lu, %lu\n", GetDeadline(i), stat.deadline_miss_,
+            stat.alloc_num_, stat.alloc_bytes_);
+  }
+  fclose(file);
+  return true;
+}
+
+bool Timing::WriteJson(std::string const& filename) {
+  FILE* file = fopen(filename.c_str(), "w");
+  if (!file) {
+    printf("[Timing] cannot create file: %s\n", filename.c_str());
+    return false;
+  }
+  map_t tagMap;
+  {
+    std::lock_guard<std::mutex> lock(Instance().mutex_);
+    tagMap = Instance().tagMap_;
+  }
+  fprintf(file, "{\n");
+  bool first = true;
+  for (const map_t::value_type& t : tagMap) {
+    size_t i = t.second;
+    TimerStatistics stat = GetStatistics(i);
+    if (stat.num_samples_ == 0) continue;
+    fprintf(file, "%s  \"%s\": {\"num_samples\": %lu, \"total_s\": %.9f, "
+            "\"mean_s\": %.9f, \"std_s\": %.9f, \"min_s\": %.9f, "
+            "\"max_s\": %.9f",
+            first ? "" : ",\n", t.first.c_str(), stat.num_samples_, stat.sum_,
+            stat.sum_ / stat.num_samples_, sqrt(GetVarianceSeconds(i)),
+            stat.min_, stat.max_);
+    for (size_t j = 0; j < kNumPercentiles; ++j) {
+      fprintf(file, ", \"%s_s\": %.9f", kPercentileNames[j],
+              GetPercentileSeconds(i, kPercentiles[j]));
+    }
+    fprintf(file, ", \"deadline_s\": %.9f, \"deadline_miss\": %lu, "
+            "\"alloc_num\": %lu, \"alloc_bytes\": %lu}",
+            GetDeadline(i), stat.deadline_miss_, stat.alloc_num_,
+            stat.alloc_bytes_);
+    first = false;
+  }
+  fprintf(file, "\n}\n");
+  fclose(file);
+  return true;
+}
+
 std::string Timing::SecondsToTimeString(double seconds) {
   char buffer[256];
   snprintf(buffer, sizeof(buffer), "%09.6f", seconds);
@@ -199,7 +447,11 @@ std::string Timing::SecondsToTimeString(double seconds) {
 }
 
 void Timing::Print(std::ostream& out) {
-  map_t& tagMap = Instance().tagMap_;
+  map_t tagMap;
+  {
+    std::lock_guard<std::mutex> lock(Instance().mutex_);
+    tagMap = Instance().tagMap_;
+  }
 
   if (tagMap.empty()) {
     return;
@@ -215,20 +467,30 @@ void Timing::Print(std::ostream& out) {
     out.width(7);
 
     out.setf(std::ios::right, std::ios::adjustfield);
-    out << GetNumSamples(i) << "\t";
-    if (GetNumSamples(i) > 0) {
-      out << SecondsToTimeString(GetTotalSeconds(i)) << "\t";
-      double meansec = GetMeanSeconds(i);
+    TimerStatistics stat = GetStatistics(i);
+    out << stat.num_samples_ << "\t";
+    if (stat.num_samples_ > 0) {
+      out << SecondsToTimeString(stat.sum_) << "\t";
+      double meansec = stat.sum_ / stat.num_samples_;
       double stddev = sqrt(GetVarianceSeconds(i));
       out << "(" << SecondsToTimeString(meansec) << " +- ";
       out << SecondsToTimeString(stddev) << ")\t";
 
-      double minsec = GetMinSeconds(i);
-      double maxsec = GetMaxSeconds(i);
+      double minsec = stat.min_;
+      double maxsec = stat.max_;
 
       // The min or max are out of bounds.
       out << "[" << SecondsToTimeString(minsec) << ","
           << SecondsToTimeString(maxsec) << "]";
+      out << "\tp50 " << SecondsToTimeString(GetPercentileSeconds(i, 50.0))
+          << " p99 " << SecondsToTimeString(GetPercentileSeconds(i, 99.0));
+      if (stat.deadline_miss_ > 0) {
+        out << "\tdeadline miss " << stat.deadline_miss_;
+      }
+      if (stat.alloc_num_ > 0) {
+        out << "\talloc " << stat.alloc_num_ / stat.num_samples_ << " ("
+            << stat.alloc_bytes_ / stat.num_samples_ << "B) per sample";
+      }
     }
     out << std::endl;
   }
@@ -239,9 +501,15 @@ std::string Timing::Print() {
   return ss.str();
 }
 
+// The handles cached by TIMING_HANDLE stay valid, only the samples are cleared.
+// The samples added by the other threads during Reset() may be kept.
 void Timing::Reset() {
-  std::lock_guard<std::mutex> lock(Instance().mutex_);
-  Instance().tagMap_.clear();
+  Timing& timing = Instance();
+  std::lock_guard<std::mutex> lock(timing.mutex_);
+  timing.retired_.assign(kMaxTimers, TimerStatistics());
+  for (const std::shared_ptr<ThreadTimers>& timers : timing.threadTimers_) {
+    for (size_t i = 0; i < kMaxTimers; ++i) timers->acc_[i].Reset();
+  }
 }
 
 }  // namespace timing
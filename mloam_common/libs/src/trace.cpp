@@ -0,0 +1,203 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "common/trace.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common/timing.hpp"
+
+namespace common
+{
+    namespace timing
+    {
+        struct TraceEvent
+        {
+            size_t handle_;
+            int64_t start_ns_;
+            int64_t dur_ns_;
+            double frame_; // NaN if not set
+        };
+
+        // the spans of a thread, the mutex is only contended while the trace is written
+        struct ThreadTrace
+        {
+            std::mutex mutex_;
+            std::vector<TraceEvent> events_;
+            size_t drop_cnt_;
+            int tid_;
+            std::string name_;
+        };
+
+        struct TraceState
+        {
+            std::mutex mutex_;
+            std::vector<std::shared_ptr<ThreadTrace> > threads_; // kept after the threads exit
+            std::string filename_;
+            std::atomic<size_t> max_event_num_;
+            int64_t start_ns_;
+        };
+
+        static TraceState &traceState()
+        {
+            static TraceState state;
+            return state;
+        }
+
+        struct ThreadTraceHolder
+        {
+            ThreadTraceHolder() : trace_(new ThreadTrace), frame_(std::numeric_limits<double>::quiet_NaN())
+            {
+                trace_->drop_cnt_ = 0;
+                TraceState &state = traceState();
+                std::lock_guard<std::mutex> lock(state.mutex_);
+                trace_->tid_ = static_cast<int>(state.threads_.size());
+                state.threads_.push_back(trace_);
+            }
+
+            std::shared_ptr<ThreadTrace> trace_;
+            double frame_;
+        };
+
+        static ThreadTraceHolder &localTrace()
+        {
+            thread_local ThreadTraceHolder holder;
+            return holder;
+        }
+
+        static void writeJsonString(FILE *file, const std::string &str)
+        {
+            fputc('"', file);
+            for (const char &c : str)
+            {
+                if (c == '"' || c == '\\') fputc('\\', file);
+                if (static_cast<unsigned char>(c) >= 0x20) fputc(c, file);
+            }
+            fputc('"', file);
+        }
+
+        std::atomic<bool> Trace::enabled_(false);
+
+        bool Trace::Start(const std::string &filename, const size_t &max_event_num)
+        {
+            FILE *file = fopen(filename.c_str(), "w");
+            if (!file)
+            {
+                printf("[Trace] cannot create file: %s\n", filename.c_str());
+                return false;
+            }
+            fclose(file);
+
+            TraceState &state = traceState();
+            std::lock_guard<std::mutex> lock(state.mutex_);
+            for (const std::shared_ptr<ThreadTrace> &thread : state.threads_)
+            {
+                std::lock_guard<std::mutex> lock_thread(thread->mutex_);
+                thread->events_.clear();
+                thread->drop_cnt_ = 0;
+            }
+            state.filename_ = filename;
+            state.max_event_num_.store(max_event_num, std::memory_order_relaxed);
+            state.start_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            enabled_.store(true, std::memory_order_relaxed);
+            printf("[Trace] record the timers to %s\n", filename.c_str());
+            return true;
+        }
+
+        int Trace::Stop()
+        {
+            TraceState &state = traceState();
+            std::lock_guard<std::mutex> lock(state.mutex_);
+            if (!enabled_.exchange(false)) return -1;
+
+            FILE *file = fopen(state.filename_.c_str(), "w");
+            if (!file)
+            {
+                printf("[Trace] cannot create file: %s\n", state.filename_.c_str());
+                return -1;
+            }
+            std::vector<std::string> tags;
+            int event_num = 0;
+            size_t drop_cnt = 0;
+            fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+            fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"mloam\"}}");
+            for (const std::shared_ptr<ThreadTrace> &thread : state.threads_)
+            {
+                std::lock_guard<std::mutex> lock_thread(thread->mutex_);
+                if (thread->events_.empty()) continue;
+                fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", thread->tid_);
+                writeJsonString(file, thread->name_.empty() ? "thread_" + std::to_string(thread->tid_) : thread->name_);
+                fprintf(file, "}}");
+                for (const TraceEvent &event : thread->events_)
+                {
+                    // started before the trace
+                    if (event.start_ns_ < state.start_ns_) continue;
+                    if (event.handle_ >= tags.size()) tags.resize(event.handle_ + 1);
+                    if (tags[event.handle_].empty()) tags[event.handle_] = Timing::GetTag(event.handle_);
+                    fprintf(file, ",\n{\"name\":");
+                    writeJsonString(file, tags[event.handle_]);
+                    fprintf(file, ",\"cat\":\"mloam\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                            thread->tid_, (event.start_ns_ - state.start_ns_) * 1e-3, event.dur_ns_ * 1e-3);
+                    if (std::isnan(event.frame_))
+                        fprintf(file, "}");
+                    else
+                        fprintf(file, ",\"args\":{\"frame\":%.6f}}", event.frame_);
+                    event_num++;
+                }
+                drop_cnt += thread->drop_cnt_;
+                std::vector<TraceEvent>().swap(thread->events_);
+            }
+            fprintf(file, "\n]}\n");
+            fclose(file);
+            printf("[Trace] write %d spans to %s, dropped: %lu\n", event_num, state.filename_.c_str(), drop_cnt);
+            return event_num;
+        }
+
+        void Trace::SetFrame(const double &time)
+        {
+            localTrace().frame_ = time;
+        }
+
+        void Trace::SetThreadName(const std::string &name)
+        {
+            ThreadTrace &thread = *localTrace().trace_;
+            std::lock_guard<std::mutex> lock(thread.mutex_);
+            thread.name_ = name;
+        }
+
+        void Trace::AddSpan(const size_t &handle, const int64_t &start_ns, const int64_t &end_ns)
+        {
+            ThreadTraceHolder &holder = localTrace();
+            ThreadTrace &thread = *holder.trace_;
+            TraceEvent event = {handle, start_ns, end_ns - start_ns, holder.frame_};
+            std::lock_guard<std::mutex> lock(thread.mutex_);
+            // the spans recorded after Stop() has written this thread are not kept
+            if (!IsEnabled()) return;
+            if (thread.events_.size() >= traceState().max_event_num_.load(std::memory_order_relaxed))
+            {
+                thread.drop_cnt_++;
+                return;
+            }
+            thread.events_.push_back(event);
+        }
+
+    } // namespace timing
+} // namespace common
+
+//
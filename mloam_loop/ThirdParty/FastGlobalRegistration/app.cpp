@@ -42,9 +42,19 @@ void CApp::ReadFeature(const char* filepath)
 }
 
 void CApp::LoadFeature(const Points& pts, const Feature& feat)
+{
+	int dim = feat.empty() ? 0 : feat[0].size();
+	FlatFeature flat_feat(feat.size() * dim);
+	for (size_t v = 0; v < feat.size(); v++)
+		Eigen::Map<Eigen::VectorXf>(&flat_feat[v * dim], dim) = feat[v];
+	LoadFeature(pts, flat_feat, dim);
+}
+
+void CApp::LoadFeature(const Points& pts, const FlatFeature& feat, int dim)
 {
 	pointcloud_.push_back(pts);
 	features_.push_back(feat);
+	feature_dim_ = dim;
 }
 
 void CApp::ReadFeature(const char* filepath, Points& pts, Feature& feat)
@@ -88,6 +98,15 @@ void CApp::BuildKDTree(const vector<T>& data, KDTree* tree)
 	*tree = temp_tree;
 }
 
+void CApp::BuildKDTree(FlatFeature& data, int dim, KDTree* tree)
+{
+	int rows = (int)data.size() / dim;
+	flann::Matrix<float> dataset_mat(&data[0], rows, dim);
+	KDTree temp_tree(dataset_mat, flann::KDTreeSingleIndexParams(15));
+	temp_tree.buildIndex();
+	*tree = temp_tree;
+}
+
 template <typename T>
 void CApp::SearchKDTree(KDTree* tree, const T& input, 
 							std::vector<int>& indices,
@@ -128,24 +147,23 @@ void CApp::AdvancedMatching()
 
 	int nPti = pointcloud_[fi].size();
 	int nPtj = pointcloud_[fj].size();
+	corres_.clear();
+	if (nPti == 0 || nPtj == 0)
+		return;
 
 	///////////////////////////
 	/// BUILD FLANNTREE
 	///////////////////////////
 
 	KDTree feature_tree_i(flann::KDTreeSingleIndexParams(15));
-	BuildKDTree(features_[fi], &feature_tree_i);
+	BuildKDTree(features_[fi], feature_dim_, &feature_tree_i);
 
 	KDTree feature_tree_j(flann::KDTreeSingleIndexParams(15));
-	BuildKDTree(features_[fj], &feature_tree_j);
+	BuildKDTree(features_[fj], feature_dim_, &feature_tree_j);
 
 	bool crosscheck = true;
 	bool tuple = true;
 
-	std::vector<int> corres_K, corres_K2;
-	std::vector<float> dis;
-	std::vector<int> ind;
-
 	std::vector<std::pair<int, int> > corres;
 	std::vector<std::pair<int, int> > corres_cross;
 	std::vector<std::pair<int, int> > corres_ij;
@@ -153,21 +171,49 @@ void CApp::AdvancedMatching()
 
 	///////////////////////////
 	/// INITIAL MATCHING
+	/// the queries are searched in batches by num_threads_ threads
 	///////////////////////////
 
+	flann::SearchParams search_params(128);
+	search_params.cores = num_threads_;
+	int dim = feature_dim_;
+
+	// nearest feature of i for every feature of j
+	std::vector<int> nn_ji(nPtj);
+	std::vector<float> dis_ji(nPtj);
+	flann::Matrix<float> query_j(&features_[fj][0], nPtj, dim);
+	flann::Matrix<int> indices_ji(&nn_ji[0], nPtj, 1);
+	flann::Matrix<float> dists_ji(&dis_ji[0], nPtj, 1);
+	feature_tree_i.knnSearch(query_j, indices_ji, dists_ji, 1, search_params);
+
+	// nearest feature of j for every feature of i matched above
 	std::vector<int> i_to_j(nPti, -1);
+	std::vector<int> query_i_id;
 	for (int j = 0; j < nPtj; j++)
 	{
-		SearchKDTree(&feature_tree_i, features_[fj][j], corres_K, dis, 1);
-		int i = corres_K[0];
+		int i = nn_ji[j];
 		if (i_to_j[i] == -1)
 		{
-			SearchKDTree(&feature_tree_j, features_[fi][i], corres_K, dis, 1);
-			int ij = corres_K[0];
-			i_to_j[i] = ij;
+			i_to_j[i] = -2;
+			query_i_id.push_back(i);
 		}
 		corres_ji.push_back(std::pair<int, int>(i, j));
 	}
+	int nQuery = query_i_id.size();
+	std::vector<float> query_i_feat(nQuery * dim);
+	for (int k = 0; k < nQuery; k++)
+		std::copy(&features_[fi][query_i_id[k] * dim], &features_[fi][query_i_id[k] * dim] + dim, &query_i_feat[k * dim]);
+	std::vector<int> nn_ij(nQuery);
+	std::vector<float> dis_ij(nQuery);
+	if (nQuery > 0)
+	{
+		flann::Matrix<float> query_i(&query_i_feat[0], nQuery, dim);
+		flann::Matrix<int> indices_ij(&nn_ij[0], nQuery, 1);
+		flann::Matrix<float> dists_ij(&dis_ij[0], nQuery, 1);
+		feature_tree_j.knnSearch(query_i, indices_ij, dists_ij, 1, search_params);
+	}
+	for (int k = 0; k < nQuery; k++)
+		i_to_j[query_i_id[k]] = nn_ij[k];
 
 	for (int i = 0; i < nPti; i++)
 	{
@@ -32,10 +32,13 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
+#define FGR_NUM_THREADS 4
+
 namespace fgr {
   
 typedef std::vector<Eigen::Vector3f> Points;
 typedef std::vector<Eigen::VectorXf> Feature;
+typedef std::vector<float> FlatFeature; // the features of all points stored row by row
 typedef flann::Index<flann::L2<float> > KDTree;
 typedef std::vector<std::pair<int, int> > Correspondences;
 
@@ -52,8 +55,11 @@ public:
 		 max_corr_dist_(max_corr_dist),
 		 iteration_number_(iteration_number),
 		 tuple_scale_(tuple_scale),
-		 tuple_max_cnt_(tuple_max_cnt){}
+		 tuple_max_cnt_(tuple_max_cnt),
+		 num_threads_(FGR_NUM_THREADS){}
+	void SetNumThreads(int num_threads) { num_threads_ = num_threads > 0 ? num_threads : 1; }
 	void LoadFeature(const Points& pts, const Feature& feat);
+	void LoadFeature(const Points& pts, const FlatFeature& feat, int dim);
 	void ReadFeature(const char* filepath);
 	void NormalizePoints();
 	void AdvancedMatching();
@@ -70,7 +76,8 @@ public:
 private:
 	// containers
 	std::vector<Points> pointcloud_;
-	std::vector<Feature> features_;
+	std::vector<FlatFeature> features_;
+	int feature_dim_ = 0;
 	Eigen::Matrix4f TransOutput_;
 	std::vector<std::pair<int, int> > corres_;
 
@@ -87,6 +94,7 @@ private:
 	
 	template <typename T>
 	void BuildKDTree(const std::vector<T>& data, KDTree* tree);
+	void BuildKDTree(FlatFeature& data, int dim, KDTree* tree);
 	template <typename T>
 	void SearchKDTree(KDTree* tree,
 		const T& input,
@@ -100,6 +108,7 @@ private:
 	int    iteration_number_;
 	float  tuple_scale_;
 	int    tuple_max_cnt_;
+	int    num_threads_; // of the feature search
 };
 
 }
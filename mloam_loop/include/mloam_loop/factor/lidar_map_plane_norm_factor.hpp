@@ -18,6 +18,9 @@
 
 #include <eigen3/Eigen/Dense>
 
+namespace mloam_loop
+{
+
 template <typename Derived>
 static Eigen::Matrix<typename Derived::Scalar, 3, 3> skewSymmetric(const Eigen::MatrixBase<Derived> &q)
 {
@@ -146,3 +149,5 @@ private:
 	Eigen::Vector4d coeff_;
 	Eigen::Matrix3d cov_matrix_, sqrt_info_;
 };
+
+} // namespace mloam_loop
@@ -17,6 +17,9 @@
 #include <ceres/ceres.h>
 #include "../utility/utility.h"
 
+namespace mloam_loop
+{
+
 // x: [tx ty tz; qx qy qz qw]
 class PoseLocalParameterization : public ceres::LocalParameterization
 {
@@ -30,3 +33,5 @@ public:
     bool is_degenerate_;
     Eigen::Matrix<double, 6, 6> V_update_;
 };
+
+} // namespace mloam_loop
@@ -12,6 +12,7 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <eigen3/Eigen/Dense>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -19,6 +20,12 @@
 #include "parameters.hpp"
 #include "utility/tic_toc.h"
 #include "utility/pose.h"
+#include "pose_graph_storage.hpp"
+
+namespace mloam_loop
+{
+
+struct FPFHCloud;
 
 class KeyFrame
 {
@@ -43,6 +50,22 @@ public:
 			 const Pose &loop_info,
 			 const int sequence);
 
+	// keyframe whose clouds are in storage, they are decoded in loadCloud()
+	KeyFrame(const double &time_stamp,
+			 const int &index,
+			 const Pose &pose_w,
+			 const std::shared_ptr<const KeyFrameCloudStorage> &storage,
+			 const size_t &storage_id,
+			 const int &loop_index,
+			 const Pose &loop_info,
+			 const int sequence);
+
+	bool isCloudLoaded() const { return cloud_loaded_; }
+	void loadCloud();
+	// drop the clouds in memory, they are reloaded from storage_ on demand
+	void releaseCloud();
+	size_t getCloudBytes() const;
+
 	void getPose(Pose &pose_w);
 	void getLastPose(Pose &last_pose_w);
 	void updatePose(const Pose &pose_w);
@@ -59,11 +82,27 @@ public:
 	pcl::PointCloud<pcl::PointXYZI>::Ptr corner_cloud_;
 	pcl::PointCloud<pcl::PointXYZI>::Ptr full_cloud_;
 	pcl::PointCloud<pcl::PointXYZI>::Ptr outlier_cloud_;
+	// surf_cloud_ and corner_cloud_ downsampled for loop verification
+	pcl::PointCloud<pcl::PointXYZI>::Ptr surf_cloud_ds_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr corner_cloud_ds_;
 
 	bool has_loop_;
 	int loop_index_;
 	Pose loop_info_;
 
 	int sequence_;
+
+	// FPFH of surf_cloud_ds_ in the keyframe frame,
+	// computed when the keyframe is first used in loop verification and shared by later candidates
+	std::shared_ptr<const FPFHCloud> fpfh_cloud_;
+
+	// where the clouds are read from if they are not in memory, kept after loading so that
+	// releasing the clouds again does not rewrite them
+	std::shared_ptr<const KeyFrameCloudStorage> storage_;
+	size_t storage_id_;
+	bool cloud_loaded_;
+	uint64_t last_access_; // the tick of the last use of the clouds
 };
 
+} // namespace mloam_loop
+
@@ -16,6 +16,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <unordered_set>
 
 #include <ceres/ceres.h>
 #include <pcl/io/pcd_io.h>
@@ -33,16 +35,52 @@
 #include "factor/impl_loss_function.hpp"
 #include "../ThirdParty/FastGlobalRegistration/app.h"
 
+#define FPFH_DIM 33
+
+namespace mloam_loop
+{
+
+// points with their FPFH descriptors, the descriptors of all points are stored row by row
+// and handed to FGR without conversion
+struct FPFHCloud
+{
+    void clear()
+    {
+        points_.clear();
+        features_.clear();
+    }
+
+    size_t size() const { return points_.size(); }
+
+    fgr::Points points_;
+    fgr::FlatFeature features_;
+};
+
 class LoopRegistration
 {
 public:
 
-    LoopRegistration() {}
+    LoopRegistration() : opti_cost_(0.0) {}
+
+    void setParameter(const RegistrationConfig &config) { config_ = config; }
+
+    // compute the normals and FPFH descriptors of cloud with one search tree
+    static void computeFPFH(const pcl::PointCloud<pcl::PointXYZI>::Ptr &cloud,
+                            const RegistrationConfig &config,
+                            FPFHCloud &fpfh_cloud);
 
-    void parseFPFH(const pcl::PointCloud<pcl::PointXYZI>::Ptr &cloud,
-                   const pcl::PointCloud<pcl::FPFHSignature33>::Ptr &fpfh_feature,
-                   fgr::Points &points,
-                   fgr::Feature &features);
+    // append the points of src transformed by T to dst, the descriptors are kept as FPFH is invariant to rigid
+    // transformation. only the first point falling in each voxel of leaf_size is kept, voxels is the set of
+    // occupied voxels of dst. this approximates the FPFH of the merged cloud: the descriptors computed per
+    // keyframe miss the neighbours in the adjacent keyframes within the FPFH radius of the keyframe border
+    static void mergeFPFH(const FPFHCloud &src,
+                          const Eigen::Matrix4f &T,
+                          const float &leaf_size,
+                          std::unordered_set<int64_t> &voxels,
+                          FPFHCloud &dst);
+
+    std::pair<bool, Eigen::Matrix4d> performGlobalRegistration(const FPFHCloud &fpfh_map,
+                                                               const FPFHCloud &fpfh_cloud);
 
     std::pair<bool, Eigen::Matrix4d> performGlobalRegistration(pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_map,
                                                                pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_cloud);
@@ -53,8 +91,18 @@ public:
                                                               const pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_cloud_corner,
                                                               const Eigen::Matrix4d &T_ini);
 
+    // the fraction of the points of cloud transformed by T which have a point of map within max_dist
+    static double computeOverlap(const pcl::PointCloud<pcl::PointXYZI>::Ptr &map,
+                                 const pcl::PointCloud<pcl::PointXYZI>::Ptr &cloud,
+                                 const Eigen::Matrix4d &T,
+                                 const double &max_dist);
+
+    RegistrationConfig config_;
     FeatureExtract f_extract_;
+    double opti_cost_; // the cost of the last global or local registration
 };
 
+} // namespace mloam_loop
+
 #endif
 //
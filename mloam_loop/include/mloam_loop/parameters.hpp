@@ -20,51 +20,80 @@
 #include <map>
 #include <cassert>
 #include <cstdio>
+#include <string>
 
 using namespace std;
 
-extern int RESULT_SAVE;
-extern std::string OUTPUT_FOLDER;
-extern std::string MLOAM_LOOP_PATH;
-
-extern int LOOP_SKIP_INTERVAL;
-extern int LOOP_HISTORY_SEARCH_NUM;
-extern double LOOP_DISTANCE_THRESHOLD;
-extern double LOOP_OPTI_COST_THRESHOLD;
-extern double LOOP_TEMPORAL_CONSISTENCY_THRESHOLD;
-extern double LOOP_GLOBAL_REGISTRATION_THRESHOLD;
-extern double LOOP_LOCAL_REGISTRATION_THRESHOLD;
-
-extern int VISUALIZE_IMAGE;
-extern int LOAD_PREVIOUS_POSE_GRAPH;
-extern int LOOP_SAVE_PCD;
-extern string POSE_GRAPH_SAVE_PATH;
-
-extern int VISUALIZATION_SHIFT_X;
-extern int VISUALIZATION_SHIFT_Y;
-
-// scan context
-extern double LIDAR_HEIGHT;
-extern int PC_NUM_RING;
-extern int PC_NUM_SECTOR;
-extern double PC_MAX_RADIUS;
-extern double PC_UNIT_SECTORANGLE;
-extern double PC_UNIT_RINGGAP;
-extern int NUM_EXCLUDE_RECENT;
-extern int NUM_CANDIDATES_FROM_TREE;
-extern double SEARCH_RATIO;
-extern double SC_DIST_THRES;
-extern int TREE_MAKING_PERIOD;
-
-// registration
-extern double NORMAL_RADIUS;
-extern double FPFH_RADIUS;
-extern double DIV_FACTOR;
-extern double USE_ABSOLUTE_SCALE;
-extern double MAX_CORR_DIST;
-extern double ITERATION_NUMBER;
-extern double TUPLE_SCALE;
-extern double TUPLE_MAX_CNT;
+namespace mloam_loop
+{
+// the parameters of registering a loop candidate to its submap
+struct RegistrationConfig
+{
+    RegistrationConfig();
+
+    double normal_radius_;
+    double fpfh_radius_;
+    double div_factor_;
+    double use_absolute_scale_;
+    double max_corr_dist_;
+    double iteration_number_;
+    double tuple_scale_;
+    double tuple_max_cnt_;
+    double global_registration_threshold_;
+    double local_registration_threshold_;
+    int thread_num_; // the threads of FPFH and FGR in each verification thread
+};
+
+// the parameters of the loop closure, owned by PoseGraph so that it can run in the process of mloam
+struct LoopConfig
+{
+    LoopConfig();
+
+    // the results are written to output_folder: the trajectory, the memory of the clouds and the pose graph
+    void setOutputFolder(const std::string &output_folder);
+
+    int result_save_;
+    std::string output_folder_;
+    std::string loop_path_;
+    std::string loop_memory_path_;
+    std::string pose_graph_save_path_;
+
+    int loop_skip_interval_;
+    int loop_history_search_num_;
+    double loop_distance_threshold_;
+    double loop_temporal_consistency_threshold_;
+    int loop_verify_thread_num_;
+    int loop_verify_queue_size_;
+    double loop_yaw_prior_overlap_threshold_;
+
+    int visualize_image_;
+    int load_previous_pose_graph_;
+    int loop_save_pcd_;
+    int loop_save_codec_;
+    int loop_cloud_memory_budget_;
+
+    int visualization_shift_x_;
+    int visualization_shift_y_;
+
+    // scan context
+    double lidar_height_;
+    int pc_num_ring_;
+    int pc_num_sector_;
+    double pc_max_radius_;
+    double pc_unit_sectorangle_;
+    double pc_unit_ringgap_;
+    int num_exclude_recent_;
+    int num_candidates_from_tree_;
+    double search_ratio_;
+    double sc_dist_thres_;
+    int tree_making_period_;
+    int sc_thread_num_;
+
+    RegistrationConfig registration_;
+};
+
+// read the loop closure parameters of config_file, the output folder is not changed
+bool readParameters(const std::string &config_file, LoopConfig &config);
 
 enum SIZE_PARAMETERIZATION
 {
@@ -90,3 +119,4 @@ enum NoiseOrder
     O_GW = 9
 };
 
+} // namespace mloam_loop
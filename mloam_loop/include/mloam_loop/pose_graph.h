@@ -13,12 +13,16 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <opencv2/opencv.hpp>
 #include <eigen3/Eigen/Dense>
 #include <string>
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include <queue>
+#include <list>
+#include <unordered_set>
 #include <assert.h>
 #include <nav_msgs/Path.h>
 #include <geometry_msgs/PointStamped.h>
@@ -40,13 +44,94 @@
 #include "utility/utility.h"
 #include "utility/CameraPoseVisualization.h"
 #include "utility/tic_toc.h"
+#include "common/timing.hpp"
 #include "scan_context/scan_context.hpp"
 #include "factor/lidar_map_plane_norm_factor.hpp"
 #include "factor/pose_local_parameterization.h"
+#include "factor/pose_graph_factor.hpp"
+#include "pose_graph_optimizer.hpp"
+#include "pose_graph_storage.hpp"
 
 #define SHOW_S_EDGE true
 #define SHOW_L_EDGE true
 
+#define LOOP_MAP_LEAF_SIZE 0.4
+#define SUBMAP_CACHE_SIZE 8
+#define LOOP_OVERLAP_DISTANCE 1.0 // a keyframe point within the distance of the map overlaps it
+#define CLOUD_BUDGET_SPILL_RATIO 0.9 // the clouds over the memory budget are spilled down to this ratio of the budget
+#define CLOUD_MEMORY_REPORT_INTERVAL 50 // the memory of the clouds is reported every this number of keyframes and after a spill
+
+namespace mloam_loop
+{
+
+// a loop candidate passing the scan context and temporal checks, waiting for geometric verification
+struct LoopCandidate
+{
+	int que_index_;
+	int match_index_;
+	double yaw_diff_rad_;
+	double que_time_; // the timestamp of the query keyframe
+	TicToc t_candidate_; // started when the candidate is generated
+};
+
+// the stages of the geometric verification
+enum LoopVerifyStage
+{
+	STAGE_YAW_PRIOR = 0, // local registration from the scan context yaw
+	STAGE_GLOBAL_REG, // FPFH + FGR
+	STAGE_LOCAL_REG, // local registration from the global registration
+	NUM_LOOP_VERIFY_STAGE
+};
+
+// acceptance and timing of a verification stage
+struct LoopStageStatistics
+{
+	LoopStageStatistics() : try_cnt_(0), accept_cnt_(0), time_sum_(0.0), time_max_(0.0) {}
+
+	int try_cnt_;
+	int accept_cnt_;
+	double time_sum_;
+	double time_max_;
+};
+
+// the downsampled model around a match keyframe in its frame, shared by the candidates of the same match keyframe
+struct LoopSubmap
+{
+	int match_index_;
+	int begin_index_; // the keyframes [begin_index_, end_index_) are merged
+	int end_index_;
+	int version_; // the pose graph version of the relative poses
+	pcl::PointCloud<pcl::PointXYZI>::Ptr surf_cloud_ds_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr corner_cloud_ds_;
+	FPFHCloud fpfh_cloud_;
+};
+
+// the registration state owned by one verification worker
+struct LoopVerifier
+{
+	LoopVerifier();
+
+	LoopRegistration loop_reg_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_ds_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_ds_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_from_map_;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_from_map_;
+	std::shared_ptr<const LoopSubmap> submap_;
+	pcl::VoxelGrid<pcl::PointXYZI> down_size_filter_surf_map_;
+	pcl::VoxelGrid<pcl::PointXYZI> down_size_filter_corner_map_;
+	pcl::PCDWriter pcd_writer_;
+
+	// the keyframe input of the global registration, merged from the FPFH of keyframes
+	FPFHCloud fpfh_cloud_;
+	std::unordered_set<int64_t> voxels_;
+
+	// the stages performed for the last candidate, -1: skipped, 0: rejected, 1: accepted
+	int stage_result_[NUM_LOOP_VERIFY_STAGE];
+	double stage_time_[NUM_LOOP_VERIFY_STAGE];
+};
+
 class PoseGraph
 {
 public:
@@ -54,59 +139,102 @@ public:
 	~PoseGraph();
 	void registerPub(ros::NodeHandle &nh);
 	void setPGOTread();
-	void setParameter();
-	void addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
-	void loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
+	void setLoopVerifyThread(const int &num_thread);
+	void setParameter(const LoopConfig &config);
+	void addKeyFrame(KeyFrame &&keyframe, bool flag_detect_loop);
+	void loadKeyFrame(KeyFrame &&keyframe, bool flag_detect_loop);
 	KeyFrame* getKeyFrame(int index);
 	void savePoseGraph();
 	void loadPoseGraph();
 	void publishLoopInfo();
 	void publish();
 	int getKeyFrameSize();
+	int getLoopQueueSize();
+	// no loop candidate is pending or being verified and no pose graph optimization is waiting or running
+	bool isLoopClosureIdle();
+	void printLoopStatistics();
 	int skip_cnt_;
 
 	nav_msgs::Path pg_path_;
 	CameraPoseVisualization *posegraph_visualization;
 
 private:
+	LoopConfig config_; // set before the threads are started, read only afterwards
+
 	std::pair<int, double> detectLoop(const KeyFrame* keyframe, const int que_index);
 	std::pair<bool, int> checkTemporalConsistency(const int &que_index, const int &match_index); 
-	void constructLocalMap(const KeyFrame *cur_kf, const int &que_index, const int &match_index, const Pose &pose_ini);
-	std::pair<bool, Pose> checkGeometricConsistency(const KeyFrame *cur_kf, const int &que_index, const int &match_index, const Pose &pose_ini);
+	void pushLoopCandidate(const LoopCandidate &candidate);
+	void verifyLoop();
+	void constructLocalMap(LoopVerifier &verifier, const LoopCandidate &candidate, const Pose &pose_ini);
+	void prepareKeyFrameCloud(KeyFrame *keyframe);
+	void loadKeyFrameCloud(KeyFrame *keyframe);
+	void touchKeyFrameCloud(KeyFrame *keyframe);
+	void enforceCloudBudget();
+	void reportCloudMemory(const int &num_spill, const double &spill_time);
+	std::shared_ptr<const FPFHCloud> computeKeyFrameFPFH(const pcl::PointCloud<pcl::PointXYZI>::Ptr &surf_cloud_ds);
+	int updateKeyFrameFPFH(const std::vector<KeyFrame *> &kfs,
+						   const std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> &surf_cloud_ds,
+						   std::vector<std::shared_ptr<const FPFHCloud> > &fpfh);
+	std::shared_ptr<const LoopSubmap> getLoopSubmap(const int &match_index, const int &begin_index, const int &end_index, const int &version);
+	void insertLoopSubmap(const std::shared_ptr<const LoopSubmap> &submap);
+	std::shared_ptr<const LoopSubmap> buildLoopSubmap(LoopVerifier &verifier, const int &match_index, const int &begin_index, const int &end_index);
+	std::pair<bool, Pose> checkGeometricConsistency(LoopVerifier &verifier, const LoopCandidate &candidate, const Pose &pose_ini);
 	void addKeyFrameIntoDB(KeyFrame *keyframe);
 	void optimizePoseGraph();
 	void updatePath();
-	list<KeyFrame*> keyframelist_;
+	void loadPoseGraphText();
+	// keyframes are owned by the pose graph and stored at the position of their index_,
+	// push_back on a deque never moves the existing elements, so KeyFrame* stays valid
+	std::deque<KeyFrame, Eigen::aligned_allocator<KeyFrame> > keyframelist_;
 	std::mutex m_keyframelist;
 	std::mutex m_optimize_buf;
 	std::mutex m_path;
 	std::mutex m_drift;
 	std::thread t_optimization;
-	std::queue<int> optimize_buf_;
+	std::deque<int> optimize_buf_; // the keyframes with a verified loop waiting for optimization
+	bool pgo_busy_; // guarded by m_optimize_buf
+	PoseGraphOptimizer pgo_; // only accessed by the optimization thread
+
+	// bounded queue of the candidates waiting for geometric verification
+	std::mutex m_loop_buf;
+	std::condition_variable con_loop_buf_;
+	std::deque<LoopCandidate> loop_buf_;
+	std::vector<std::thread> t_verification;
+	int loop_verify_busy_; // the candidates being verified
+	int loop_verify_cnt_;
+	int loop_accept_cnt_;
+	int loop_cancel_cnt_;
+	double loop_latency_sum_;
+	double loop_latency_max_;
+	LoopStageStatistics loop_stage_stat_[NUM_LOOP_VERIFY_STAGE];
+
+	// the recently used model submaps, the most recent at the front
+	std::mutex m_submap_cache;
+	std::list<std::shared_ptr<const LoopSubmap> > submap_cache_;
+	int submap_hit_cnt_;
+	int submap_miss_cnt_;
+	int pose_graph_version_; // increased after each pose graph optimization, guarded by m_keyframelist
+
+	// the keyframe clouds beyond the memory budget of config_ are spilled to cloud_segment_ in the least recently used order,
+	// only accessed by the thread adding keyframes
+	std::shared_ptr<CloudSegmentFile> cloud_segment_;
+	bool spill_disabled_; // the segment file cannot be opened, the clouds stay in memory
+	uint64_t cloud_access_tick_; // guarded by m_keyframelist
+	size_t resident_cloud_bytes_; // the getCloudBytes() of the keyframes with clouds in memory, guarded by m_keyframelist
+	int num_resident_cloud_; // guarded by m_keyframelist
+	int memory_report_cnt_;
 
 	int global_index_; // the index of pose graph
 	int earliest_loop_index_; // the eqrliest loop index for performing loop closure
 	bool pgo_flag_;
 
-	LoopRegistration loop_reg_;	
 	SCManager sc_manager_;
 
-	// store map and current cloud
+	// the clouds of the last accepted loop for visualization
 	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_ds_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_ds_;	
-	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_from_map_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_from_map_;
 	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_from_map_ds_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_from_map_ds_;
-	pcl::VoxelGrid<pcl::PointXYZI> down_size_filter_surf_map_;
-	pcl::VoxelGrid<pcl::PointXYZI> down_size_filter_corner_map_;
-	pcl::KdTreeFLANN<pcl::PointXYZI>::Ptr kdtree_surf_from_map_;
-	pcl::KdTreeFLANN<pcl::PointXYZI>::Ptr kdtree_corner_from_map_;
 
 	pcl::PCDReader pcd_reader_;
-	pcl::PCDWriter pcd_writer_;
 
 	// ros publisher
 	ros::Publisher pub_sc_;
@@ -117,236 +245,4 @@ private:
 	ros::Publisher pub_loop_info_;
 };
 
-template <typename T> inline
-void QuaternionInverse(const T q[4], T q_inverse[4])
-{
-	q_inverse[0] = q[0];
-	q_inverse[1] = -q[1];
-	q_inverse[2] = -q[2];
-	q_inverse[3] = -q[3];
-};
-
-template <typename T>
-T NormalizeAngle(const T& angle_degrees) {
-  if (angle_degrees > T(180.0))
-  	return angle_degrees - T(360.0);
-  else if (angle_degrees < T(-180.0))
-  	return angle_degrees + T(360.0);
-  else
-  	return angle_degrees;
-};
-
-class AngleLocalParameterization {
- public:
-
-  template <typename T>
-  bool operator()(const T* theta_radians, const T* delta_theta_radians,
-                  T* theta_radians_plus_delta) const {
-    *theta_radians_plus_delta =
-        NormalizeAngle(*theta_radians + *delta_theta_radians);
-
-    return true;
-  }
-
-  static ceres::LocalParameterization* Create() {
-    return (new ceres::AutoDiffLocalParameterization<AngleLocalParameterization,
-                                                     1, 1>);
-  }
-};
-
-template <typename T> 
-void YawPitchRollToRotationMatrix(const T yaw, const T pitch, const T roll, T R[9])
-{
-
-	T y = yaw / T(180.0) * T(M_PI);
-	T p = pitch / T(180.0) * T(M_PI);
-	T r = roll / T(180.0) * T(M_PI);
-
-
-	R[0] = cos(y) * cos(p);
-	R[1] = -sin(y) * cos(r) + cos(y) * sin(p) * sin(r);
-	R[2] = sin(y) * sin(r) + cos(y) * sin(p) * cos(r);
-	R[3] = sin(y) * cos(p);
-	R[4] = cos(y) * cos(r) + sin(y) * sin(p) * sin(r);
-	R[5] = -cos(y) * sin(r) + sin(y) * sin(p) * cos(r);
-	R[6] = -sin(p);
-	R[7] = cos(p) * sin(r);
-	R[8] = cos(p) * cos(r);
-};
-
-template <typename T> 
-void RotationMatrixTranspose(const T R[9], T inv_R[9])
-{
-	inv_R[0] = R[0];
-	inv_R[1] = R[3];
-	inv_R[2] = R[6];
-	inv_R[3] = R[1];
-	inv_R[4] = R[4];
-	inv_R[5] = R[7];
-	inv_R[6] = R[2];
-	inv_R[7] = R[5];
-	inv_R[8] = R[8];
-};
-
-template <typename T> 
-void RotationMatrixRotatePoint(const T R[9], const T t[3], T r_t[3])
-{
-	r_t[0] = R[0] * t[0] + R[1] * t[1] + R[2] * t[2];
-	r_t[1] = R[3] * t[0] + R[4] * t[1] + R[5] * t[2];
-	r_t[2] = R[6] * t[0] + R[7] * t[1] + R[8] * t[2];
-};
-
-struct FourDOFError
-{
-	FourDOFError(double t_x, double t_y, double t_z, double relative_yaw, double pitch_i, double roll_i)
-				  :t_x(t_x), t_y(t_y), t_z(t_z), relative_yaw(relative_yaw), pitch_i(pitch_i), roll_i(roll_i){}
-
-	template <typename T>
-	bool operator()(const T* const yaw_i, const T* ti, const T* yaw_j, const T* tj, T* residuals) const
-	{
-		T t_w_ij[3];
-		t_w_ij[0] = tj[0] - ti[0];
-		t_w_ij[1] = tj[1] - ti[1];
-		t_w_ij[2] = tj[2] - ti[2];
-
-		// euler to rotation
-		T w_R_i[9];
-		YawPitchRollToRotationMatrix(yaw_i[0], T(pitch_i), T(roll_i), w_R_i);
-		// rotation transpose
-		T i_R_w[9];
-		RotationMatrixTranspose(w_R_i, i_R_w);
-		// rotation matrix rotate point
-		T t_i_ij[3];
-		RotationMatrixRotatePoint(i_R_w, t_w_ij, t_i_ij);
-
-		residuals[0] = (t_i_ij[0] - T(t_x));
-		residuals[1] = (t_i_ij[1] - T(t_y));
-		residuals[2] = (t_i_ij[2] - T(t_z));
-		residuals[3] = NormalizeAngle(yaw_j[0] - yaw_i[0] - T(relative_yaw));
-
-		return true;
-	}
-
-	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
-									   const double relative_yaw, const double pitch_i, const double roll_i) 
-	{
-	  return (new ceres::AutoDiffCostFunction<
-	          FourDOFError, 4, 1, 3, 1, 3>(
-	          	new FourDOFError(t_x, t_y, t_z, relative_yaw, pitch_i, roll_i)));
-	}
-
-	double t_x, t_y, t_z;
-	double relative_yaw, pitch_i, roll_i;
-
-};
-
-struct FourDOFWeightError
-{
-	FourDOFWeightError(double t_x, double t_y, double t_z, double relative_yaw, double pitch_i, double roll_i)
-				  :t_x(t_x), t_y(t_y), t_z(t_z), relative_yaw(relative_yaw), pitch_i(pitch_i), roll_i(roll_i){
-				  	weight = 1;
-				  }
-
-	template <typename T>
-	bool operator()(const T* const yaw_i, const T* ti, const T* yaw_j, const T* tj, T* residuals) const
-	{
-		T t_w_ij[3];
-		t_w_ij[0] = tj[0] - ti[0];
-		t_w_ij[1] = tj[1] - ti[1];
-		t_w_ij[2] = tj[2] - ti[2];
-
-		// euler to rotation
-		T w_R_i[9];
-		YawPitchRollToRotationMatrix(yaw_i[0], T(pitch_i), T(roll_i), w_R_i);
-		// rotation transpose
-		T i_R_w[9];
-		RotationMatrixTranspose(w_R_i, i_R_w);
-		// rotation matrix rotate point
-		T t_i_ij[3];
-		RotationMatrixRotatePoint(i_R_w, t_w_ij, t_i_ij);
-
-		residuals[0] = (t_i_ij[0] - T(t_x)) * T(weight);
-		residuals[1] = (t_i_ij[1] - T(t_y)) * T(weight);
-		residuals[2] = (t_i_ij[2] - T(t_z)) * T(weight);
-		residuals[3] = NormalizeAngle((yaw_j[0] - yaw_i[0] - T(relative_yaw))) * T(weight) / T(10.0);
-
-		return true;
-	}
-
-	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
-									   const double relative_yaw, const double pitch_i, const double roll_i) 
-	{
-	  return (new ceres::AutoDiffCostFunction<
-	          FourDOFWeightError, 4, 1, 3, 1, 3>(
-	          	new FourDOFWeightError(t_x, t_y, t_z, relative_yaw, pitch_i, roll_i)));
-	}
-
-	double t_x, t_y, t_z;
-	double relative_yaw, pitch_i, roll_i;
-	double weight;
-
-};
-
-struct RelativeRTError
-{
-	RelativeRTError(double t_x, double t_y, double t_z, 
-					double q_w, double q_x, double q_y, double q_z,
-					double t_var, double q_var)
-				  :t_x(t_x), t_y(t_y), t_z(t_z), 
-				   q_w(q_w), q_x(q_x), q_y(q_y), q_z(q_z),
-				   t_var(t_var), q_var(q_var){}
-
-	template <typename T>
-	bool operator()(const T* const w_q_i, const T* ti, const T* w_q_j, const T* tj, T* residuals) const
-	{
-		T t_w_ij[3];
-		t_w_ij[0] = tj[0] - ti[0];
-		t_w_ij[1] = tj[1] - ti[1];
-		t_w_ij[2] = tj[2] - ti[2];
-
-		T i_q_w[4];
-		QuaternionInverse(w_q_i, i_q_w);
-
-		T t_i_ij[3];
-		ceres::QuaternionRotatePoint(i_q_w, t_w_ij, t_i_ij);
-
-		residuals[0] = (t_i_ij[0] - T(t_x)) / T(t_var);
-		residuals[1] = (t_i_ij[1] - T(t_y)) / T(t_var);
-		residuals[2] = (t_i_ij[2] - T(t_z)) / T(t_var);
-
-		T relative_q[4];
-		relative_q[0] = T(q_w);
-		relative_q[1] = T(q_x);
-		relative_q[2] = T(q_y);
-		relative_q[3] = T(q_z);
-
-		T q_i_j[4];
-		ceres::QuaternionProduct(i_q_w, w_q_j, q_i_j);
-
-		T relative_q_inv[4];
-		QuaternionInverse(relative_q, relative_q_inv);
-
-		T error_q[4];
-		ceres::QuaternionProduct(relative_q_inv, q_i_j, error_q); 
-
-		residuals[3] = T(2) * error_q[1] / T(q_var);
-		residuals[4] = T(2) * error_q[2] / T(q_var);
-		residuals[5] = T(2) * error_q[3] / T(q_var);
-
-		return true;
-	}
-
-	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
-									   const double q_w, const double q_x, const double q_y, const double q_z,
-									   const double t_var, const double q_var) 
-	{
-	  return (new ceres::AutoDiffCostFunction<
-	          RelativeRTError, 6, 4, 3, 4, 3>(
-	          	new RelativeRTError(t_x, t_y, t_z, q_w, q_x, q_y, q_z, t_var, q_var)));
-	}
-
-	double t_x, t_y, t_z, t_norm;
-	double q_w, q_x, q_y, q_z;
-	double t_var, q_var;
-
-};
\ No newline at end of file
+} // namespace mloam_loop
@@ -0,0 +1,88 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cassert>
+#include <deque>
+#include <memory>
+
+#include <eigen3/Eigen/Dense>
+#include <ceres/ceres.h>
+
+#include "utility/pose.h"
+#include "factor/pose_graph_factor.hpp"
+
+namespace mloam_loop
+{
+
+// ****************** persistent 6 DoF pose graph
+// nodes and edges are appended to one ceres::Problem as keyframes and loops arrive,
+// and each optimization is warm started from the previous estimates.
+// Node i is the keyframe with index start_index + i, the first node is fixed.
+class PoseGraphOptimizer
+{
+public:
+    PoseGraphOptimizer();
+
+    // remove all nodes and edges, the next added node should be the keyframe of start_index
+    void reset(const int &start_index);
+
+    bool empty() const { return nodes_.empty(); }
+
+    int startIndex() const { return start_index_; }
+
+    // the index of the next node to add
+    int endIndex() const { return start_index_ + static_cast<int>(nodes_.size()); }
+
+    size_t size() const { return nodes_.size(); }
+
+    bool hasNode(const int &index) const { return (index >= start_index_) && (index < endIndex()); }
+
+    // append the node of keyframe endIndex() with its initial pose, and the sequential edges to
+    // the previous NUM_SEQUENTIAL_EDGE nodes measured from their current estimates
+    void addNode(const Pose &pose_w);
+
+    // pose_relative: the pose of the keyframe index in the frame of the keyframe loop_index,
+    // a keyframe has at most one loop edge, return false if the keyframe index already has one
+    bool addLoopEdge(const int &index, const int &loop_index, const Pose &pose_relative);
+
+    bool hasLoopEdge(const int &index) const { return hasNode(index) && nodes_[index - start_index_].has_loop_edge_; }
+
+    void optimize(ceres::Solver::Summary &summary);
+
+    Pose getPose(const int &index) const;
+
+    ceres::Solver::Options options_;
+
+    static const int NUM_SEQUENTIAL_EDGE = 4;
+
+private:
+    struct Node
+    {
+        double q_[4]; // [w x y z] as ceres quaternion
+        double t_[3];
+        bool has_loop_edge_;
+    };
+
+    // a deque keeps the parameter blocks at fixed addresses as nodes are appended
+    std::deque<Node> nodes_;
+    std::unique_ptr<ceres::LossFunction> loss_function_;
+    std::unique_ptr<ceres::LocalParameterization> local_parameterization_;
+    std::unique_ptr<ceres::Problem> problem_;
+    int start_index_;
+};
+
+} // namespace mloam_loop
+
+//
@@ -0,0 +1,171 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// ****************** binary container of a saved pose graph
+// layout: [FileHeader] [blob of keyframe 0] ... [blob of keyframe n-1] [KeyFrameRecord x n]
+// a blob is the four clouds of a keyframe, each stored as (x, y, z, intensity) floats and compressed
+// by the codec of the file. The index is written at the end so that the keyframes can be streamed out,
+// the reader maps the file and decodes the clouds of a keyframe only when they are requested.
+// all fields are in the byte order of the host.
+
+namespace mloam_loop
+{
+
+enum KeyFrameCloudType
+{
+    CLOUD_SURF = 0,
+    CLOUD_CORNER,
+    CLOUD_FULL,
+    CLOUD_OUTLIER,
+    NUM_CLOUD_TYPE
+};
+
+enum StorageCodec
+{
+    CODEC_RAW = 0,
+    CODEC_LZ4 = 1 // available if built WITH_LZ4
+};
+
+struct KeyFrameRecord
+{
+    int32_t index_;
+    int32_t loop_index_;
+    int32_t sequence_;
+    int32_t reserved_;
+    double time_stamp_;
+    double pose_w_[7]; // [tx ty tz qx qy qz qw]
+    double loop_info_[7];
+    uint64_t cloud_offset_[NUM_CLOUD_TYPE]; // the offset of the encoded cloud from the beginning of the file
+    uint64_t cloud_bytes_[NUM_CLOUD_TYPE]; // the size of the encoded cloud
+    uint32_t cloud_size_[NUM_CLOUD_TYPE]; // the number of points
+};
+
+// the source of the clouds of the keyframes not resident in memory
+class KeyFrameCloudStorage
+{
+public:
+    virtual ~KeyFrameCloudStorage() {}
+
+    // decode one cloud of the keyframe id, thread-safe
+    virtual bool readCloud(const size_t &id, const int &type, pcl::PointCloud<pcl::PointXYZI> &cloud) const = 0;
+};
+
+class PoseGraphReader;
+
+class PoseGraphWriter
+{
+public:
+    PoseGraphWriter();
+    ~PoseGraphWriter();
+
+    // return false if the file cannot be created or the codec is not available
+    bool open(const std::string &file_path, const int &codec);
+
+    // write the clouds of the keyframe and append record to the index
+    bool addKeyFrame(KeyFrameRecord record,
+                     const pcl::PointCloud<pcl::PointXYZI> *clouds[NUM_CLOUD_TYPE]);
+
+    // copy the clouds of a keyframe in storage, the encoded clouds of a container of the same codec are copied without decoding
+    bool addKeyFrame(KeyFrameRecord record, const KeyFrameCloudStorage &storage, const size_t &id);
+
+    // write the index and the header
+    bool close();
+
+    size_t bytesWritten() const { return offset_; }
+
+private:
+    bool writeBlob(const void *data, const size_t &bytes);
+
+    FILE *fp_;
+    int codec_;
+    uint64_t offset_;
+    std::vector<KeyFrameRecord> records_;
+    std::vector<float> buffer_;
+    std::vector<char> compressed_;
+};
+
+class PoseGraphReader : public KeyFrameCloudStorage
+{
+public:
+    PoseGraphReader();
+    ~PoseGraphReader();
+
+    // map the file and validate its header and index
+    bool open(const std::string &file_path);
+
+    size_t size() const { return num_keyframe_; }
+
+    const KeyFrameRecord &getRecord(const size_t &id) const { return records_[id]; }
+
+    const char *getBlob(const size_t &id, const int &type) const { return data_ + records_[id].cloud_offset_[type]; }
+
+    int codec() const { return codec_; }
+
+    bool readCloud(const size_t &id, const int &type, pcl::PointCloud<pcl::PointXYZI> &cloud) const override;
+
+    static const uint32_t VERSION = 1;
+
+private:
+    const char *data_;
+    size_t file_size_;
+    size_t num_keyframe_;
+    int codec_;
+    const KeyFrameRecord *records_;
+};
+
+// append-only file of the keyframe clouds spilled from memory, read back on demand.
+// the file is removed when closed, it only lives as long as the process
+class CloudSegmentFile : public KeyFrameCloudStorage
+{
+public:
+    CloudSegmentFile();
+    ~CloudSegmentFile();
+
+    bool open(const std::string &file_path, const int &codec);
+
+    // return the id of the appended clouds, -1 if failed
+    int append(const pcl::PointCloud<pcl::PointXYZI> *clouds[NUM_CLOUD_TYPE]);
+
+    bool readCloud(const size_t &id, const int &type, pcl::PointCloud<pcl::PointXYZI> &cloud) const override;
+
+    size_t size() const;
+
+    size_t bytesWritten() const;
+
+private:
+    std::string file_path_;
+    int fd_;
+    int codec_;
+    uint64_t offset_;
+    std::deque<KeyFrameRecord> records_;
+    mutable std::mutex m_records_; // guard records_ and offset_
+    std::mutex m_append_; // guard the encoding buffers
+    std::vector<float> buffer_;
+    std::vector<char> compressed_;
+};
+
+} // namespace mloam_loop
+
+//
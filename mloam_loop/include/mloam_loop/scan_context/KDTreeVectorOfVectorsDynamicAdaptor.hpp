@@ -0,0 +1,135 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2011-16 Jose Luis Blanco (joseluisblancoc@gmail.com).
+ *   All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#pragma once
+
+#include "nanoflann.hpp"
+
+#include <vector>
+#include <cassert>
+#include <stdexcept>
+
+
+/** A vector-of-vectors adaptor for the dynamic (log-structured) kd-tree of nanoflann, without duplicating the storage.
+  *  The vectors are indexed in the order of the storage: addPointsUpTo(num) indexes the vectors [size(), num),
+  *  the vectors appended to the storage afterwards are not visible to the queries until they are added.
+  *
+  *  \tparam DIM If set to >0, it specifies a compile-time fixed dimensionality for the points in the data set, allowing more compiler optimizations.
+  *  \tparam num_t The type of the point coordinates (typically, double or float).
+  *  \tparam Distance The distance metric to use: nanoflann::metric_L1, nanoflann::metric_L2, nanoflann::metric_L2_Simple, etc.
+  *  \tparam IndexType The type for indices in the KD-tree index (typically, size_t of int)
+  */
+template <class VectorOfVectorsType, typename num_t = double, int DIM = -1, class Distance = nanoflann::metric_L2, typename IndexType = size_t>
+struct KDTreeVectorOfVectorsDynamicAdaptor
+{
+    typedef KDTreeVectorOfVectorsDynamicAdaptor<VectorOfVectorsType, num_t, DIM, Distance> self_t;
+    typedef typename Distance::template traits<num_t, self_t>::distance_t metric_t;
+    typedef nanoflann::KDTreeSingleIndexDynamicAdaptor<metric_t, self_t, DIM, IndexType> index_t;
+
+    index_t *index; //! The kd-tree index for the user to call its methods as usual with any other FLANN index.
+
+    // max_point_count: decides the number of the static sub-trees (log2)
+    KDTreeVectorOfVectorsDynamicAdaptor(const size_t dimensionality, const VectorOfVectorsType &mat, const int leaf_max_size = 10, const size_t max_point_count = 1U << 24) 
+        : m_data(mat), m_num_indexed(0)
+    {
+        if (DIM > 0 && static_cast<int>(dimensionality) != DIM)
+            throw std::runtime_error("Data set dimensionality does not match the 'DIM' template argument");
+        index = new index_t(static_cast<int>(dimensionality), *this /* adaptor */, nanoflann::KDTreeSingleIndexAdaptorParams(leaf_max_size), max_point_count);
+    }
+
+    ~KDTreeVectorOfVectorsDynamicAdaptor()
+    {
+        delete index;
+    }
+
+    const VectorOfVectorsType &m_data;
+    size_t m_num_indexed;
+
+    /** Index the vectors [size(), num) of the storage, the indexed vectors are kept. */
+    inline void addPointsUpTo(const size_t num)
+    {
+        if (num <= m_num_indexed)
+            return;
+        assert(num <= m_data.size());
+        const size_t start = m_num_indexed;
+        m_num_indexed = num;
+        index->addPoints(start, num - 1);
+    }
+
+    inline size_t size() const
+    {
+        return m_num_indexed;
+    }
+
+    /** Query for the \a num_closest closest points to a given point (entered as query_point[0:dim-1]).
+	  *  Note that this is a short-cut method for index->findNeighbors().
+	  * \note nChecks_IGNORED is ignored but kept for compatibility with the original FLANN interface.
+	  * \return the number of the found points
+	  */
+    inline size_t query(const num_t *query_point, const size_t num_closest, IndexType *out_indices, num_t *out_distances_sq, const int nChecks_IGNORED = 10) const
+    {
+        nanoflann::KNNResultSet<num_t, IndexType> resultSet(num_closest);
+        resultSet.init(out_indices, out_distances_sq);
+        index->findNeighbors(resultSet, query_point, nanoflann::SearchParams());
+        return resultSet.size();
+    }
+
+    /** @name Interface expected by KDTreeSingleIndexDynamicAdaptor
+	  * @{ */
+
+    const self_t &derived() const
+    {
+        return *this;
+    }
+    self_t &derived()
+    {
+        return *this;
+    }
+
+    // Must return the number of data points
+    inline size_t kdtree_get_point_count() const
+    {
+        return m_num_indexed;
+    }
+
+    // Returns the dim'th component of the idx'th point in the class:
+    inline num_t kdtree_get_pt(const size_t idx, const size_t dim) const
+    {
+        return m_data[idx][dim];
+    }
+
+    // Optional bounding-box computation: return false to default to a standard bbox computation loop.
+    template <class BBOX>
+    bool kdtree_get_bbox(BBOX & /*bb*/) const
+    {
+        return false;
+    }
+
+    /** @} */
+
+}; // end of KDTreeVectorOfVectorsDynamicAdaptor
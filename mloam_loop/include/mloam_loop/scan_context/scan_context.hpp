@@ -10,7 +10,9 @@
 #include <memory>
 #include <iostream>
 #include <fstream>
+#include <limits>
 
+#include <omp.h>
 #include <Eigen/Dense>
 
 #include <opencv2/opencv.hpp>
@@ -25,6 +27,7 @@
 
 #include "nanoflann.hpp"
 #include "KDTreeVectorOfVectorsAdaptor.hpp"
+#include "KDTreeVectorOfVectorsDynamicAdaptor.hpp"
 #include "../utility/tic_toc.h"
 
 using namespace Eigen;
@@ -40,7 +43,10 @@ using std::sin;
 
 using SCPointType = pcl::PointXYZI; // using xyz only. but a user can exchange the original bin encoding function (i.e., max hegiht) to max intensity (for detail, refer 20 ICRA Intensity Scan Context)
 using KeyMat = std::vector<std::vector<float>>;
-using InvKeyTree = KDTreeVectorOfVectorsAdaptor<KeyMat, float>;
+using InvKeyTree = KDTreeVectorOfVectorsDynamicAdaptor<KeyMat, float>;
+
+namespace mloam_loop
+{
 
 class QueryResult
 {
@@ -62,6 +68,7 @@ float rad2deg(const float radians);
 float deg2rad(const float degrees);
 
 MatrixXd circshift(MatrixXd &_mat, int _num_shift);
+void normalizeColumns(const MatrixXd &_mat, MatrixXd &_mat_normalized, RowVectorXd &_col_valid);
 std::vector<float> eig2stdvec(MatrixXd _eigmat);
 
 template<typename T, typename... Args>
@@ -88,7 +95,8 @@ public:
                       int num_candidates_from_tree,
                       double search_ratio,
                       double sc_dist_thres,
-                      int tree_making_period) 
+                      int tree_making_period,
+                      int num_threads = 1)
     {                    
         LIDAR_HEIGHT = lidar_height;
         PC_NUM_RING = pc_num_ring;
@@ -101,6 +109,7 @@ public:
         SEARCH_RATIO = search_ratio;
         SC_DIST_THRES = sc_dist_thres;
         TREE_MAKING_PERIOD = tree_making_period;
+        NUM_THREADS = num_threads > 0 ? num_threads : omp_get_max_threads();
 
         std::cout << "[SCManager param]: "
                   << "lidar_height: " << LIDAR_HEIGHT << ", " 
@@ -113,9 +122,12 @@ public:
                   << "num_candidates_from_tree: " << NUM_CANDIDATES_FROM_TREE << ", " 
                   << "search_ratio: " << SEARCH_RATIO << ", " 
                   << "sc_dist_thres: " << SC_DIST_THRES << ", " 
-                  << "tree_making_period: " << TREE_MAKING_PERIOD << std::endl;
+                  << "tree_making_period: " << TREE_MAKING_PERIOD << ", "
+                  << "num_threads: " << NUM_THREADS << std::endl;
 
-        tree_making_period_conter_ = 0;
+        polarcontext_tree_ = std::make_unique<InvKeyTree>(PC_NUM_RING /* dim */,
+                                                          polarcontext_invkeys_mat_,
+                                                          10 /* max leaf */);
 
         init_color();
     }        
@@ -124,10 +136,18 @@ public:
     Eigen::MatrixXd makeRingkeyFromScancontext(Eigen::MatrixXd &_desc);
     Eigen::MatrixXd makeSectorkeyFromScancontext(Eigen::MatrixXd &_desc);
 
-    int fastAlignUsingVkey(MatrixXd &_vkey1, MatrixXd &_vkey2);
+    int fastAlignUsingVkey(const MatrixXd &_vkey1, const MatrixXd &_vkey2);
     double distDirectSC(MatrixXd &_sc1, MatrixXd &_sc2);                           // "d" (eq 5) in the original paper (IROS 18)
     std::pair<double, int> distanceBtnScanContext(MatrixXd &_sc1, MatrixXd &_sc2); // "D" (eq 6) in the original paper (IROS 18)
 
+    // allocation-free versions on the column-normalized scan contexts
+    // _num_shift: the columns of sc2 are circularly shifted to the right, i.e., the same as circshift(sc2, _num_shift)
+    double distDirectSC(const MatrixXd &_sc1_normalized, const RowVectorXd &_col_valid1,
+                        const MatrixXd &_sc2_normalized, const RowVectorXd &_col_valid2,
+                        const int &_num_shift) const;
+    std::pair<double, int> distanceBtnScanContext(const MatrixXd &_sc1_normalized, const RowVectorXd &_col_valid1, const MatrixXd &_vkey1,
+                                                  const MatrixXd &_sc2_normalized, const RowVectorXd &_col_valid2, const MatrixXd &_vkey2);
+
     // User-side API
     void makeAndSaveScancontextAndKeys(pcl::PointCloud<SCPointType> &_scan_down);
     QueryResult detectLoopClosureID(const int &query_idx); // int: nearest node index, float: relative yaw
@@ -156,21 +176,24 @@ public:
     double SC_DIST_THRES; // 0.4-0.6 is good choice for using with robust kernel (e.g., Cauchy, DCS) + icp fitness threshold
 
     // config
-    int TREE_MAKING_PERIOD; // i.e., remaking tree frequency, to avoid non-mandatory every remaking, to save time cost
-    int tree_making_period_conter_;
+    int TREE_MAKING_PERIOD; // not used: the ring keys are appended to a dynamic tree, which is never remade
+    int NUM_THREADS; // threads to evaluate the loop candidates
 
     // data
     std::vector<double> polarcontexts_timestamp_; // optional.
     std::vector<Eigen::MatrixXd> polarcontexts_;
     std::vector<Eigen::MatrixXd> polarcontext_invkeys_;
     std::vector<Eigen::MatrixXd> polarcontext_vkeys_;
+    std::vector<Eigen::MatrixXd> polarcontexts_normalized_; // each column divided by its norm
+    std::vector<Eigen::RowVectorXd> polarcontext_col_valid_; // 1 for the nonzero columns
 
     KeyMat polarcontext_invkeys_mat_;
-    KeyMat polarcontext_invkeys_to_search_;
-    std::unique_ptr<InvKeyTree> polarcontext_tree_;
+    std::unique_ptr<InvKeyTree> polarcontext_tree_; // indexes polarcontext_invkeys_mat_ in place
 
     std::vector<cv::Vec3b> color_projection_;
 
 }; // SCManager
 
+} // namespace mloam_loop
+
 // } // namespace SC2
\ No newline at end of file
@@ -17,6 +17,9 @@
 #include <Eigen/Geometry>
 #include <opencv2/opencv.hpp>
 
+namespace mloam_loop
+{
+
 class CameraPoseVisualization {
 public:
 	std::string m_marker_ns;
@@ -56,3 +59,5 @@ private:
 	static const Eigen::Vector3d lt1 ;
 	static const Eigen::Vector3d lt2 ;
 };
+
+} // namespace mloam_loop
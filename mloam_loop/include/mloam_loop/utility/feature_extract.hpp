@@ -11,8 +11,8 @@
  * Author: Jianhao JIAO (jiaojh1994@gmail.com)
  *******************************************************/
 
-#ifndef FEATURE_EXTRACT_HPP
-#define FEATURE_EXTRACT_HPP
+#ifndef MLOAM_LOOP_FEATURE_EXTRACT_HPP
+#define MLOAM_LOOP_FEATURE_EXTRACT_HPP
 
 #include <iostream>
 #include <cmath>
@@ -25,6 +25,9 @@
 #include <pcl/filters/voxel_grid.h>
 #include <pcl/kdtree/kdtree_flann.h>
 
+namespace mloam_loop
+{
+
 template <typename PointType>
 inline void pointAssociateToMap(const PointType &pi, PointType &po, const Eigen::Matrix4f &T)
 {
@@ -246,5 +249,7 @@ void FeatureExtract::matchSurfFromMap(const typename pcl::KdTreeFLANN<PointType>
     features.resize(cloud_cnt);
 }
 
+} // namespace mloam_loop
+
 #endif
 //
@@ -25,6 +25,9 @@
 
 using namespace std;
 
+namespace mloam_loop
+{
+
 class Pose
 {
 public:
@@ -55,4 +58,6 @@ public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW // TODO: the Eigen bugs in initializing the class
 };
 
+} // namespace mloam_loop
+
 //
@@ -13,6 +13,9 @@
 #include <cstdlib>
 #include <chrono>
 
+namespace mloam_loop
+{
+
 class TicToc
 {
   public:
@@ -36,3 +39,5 @@ class TicToc
   private:
     std::chrono::time_point<std::chrono::system_clock> start, end;
 };
+
+} // namespace mloam_loop
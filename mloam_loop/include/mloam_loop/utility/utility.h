@@ -14,6 +14,9 @@
 #include <cstring>
 #include <eigen3/Eigen/Dense>
 
+namespace mloam_loop
+{
+
 class Utility
 {
   public:
@@ -147,3 +150,5 @@ class Utility
             two_pi * std::floor((-angle_degrees + T(180)) / two_pi);
     };
 };
+
+} // namespace mloam_loop
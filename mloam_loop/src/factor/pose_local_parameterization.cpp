@@ -13,6 +13,9 @@
 
 #include "mloam_loop/factor/pose_local_parameterization.h"
 
+namespace mloam_loop
+{
+
 void PoseLocalParameterization::setParameter()
 {
     is_degenerate_ = false;
@@ -53,6 +56,8 @@ bool PoseLocalParameterization::ComputeJacobian(const double *x, double *jacobia
     return true;
 }
 
+} // namespace mloam_loop
+
 
 
 
@@ -11,6 +11,9 @@
 
 #include "mloam_loop/keyframe.h"
 
+namespace mloam_loop
+{
+
 // create keyframe online
 KeyFrame::KeyFrame(const double &time_stamp,
 				   const int &index,
@@ -39,6 +42,9 @@ KeyFrame::KeyFrame(const double &time_stamp,
 	loop_index_ = -1;
 	loop_info_ = Pose(Eigen::Quaterniond::Identity(), Eigen::Vector3d::Zero());
 	sequence_ = sequence;
+	storage_id_ = 0;
+	cloud_loaded_ = true;
+	last_access_ = 0;
 }
 
 // load previous keyframe
@@ -74,6 +80,84 @@ KeyFrame::KeyFrame(const double &time_stamp,
 	loop_index_ = loop_index;
 	loop_info_ = loop_info;
 	sequence_ = sequence;
+	storage_id_ = 0;
+	cloud_loaded_ = true;
+	last_access_ = 0;
+}
+
+// load keyframe from a saved pose graph
+KeyFrame::KeyFrame(const double &time_stamp,
+				   const int &index,
+				   const Pose &pose_w,
+				   const std::shared_ptr<const KeyFrameCloudStorage> &storage,
+				   const size_t &storage_id,
+				   const int &loop_index,
+				   const Pose &loop_info,
+				   const int sequence)
+{
+	time_stamp_ = time_stamp;
+	index_ = index;
+	pose_w_ = pose_w;
+	pose_3d_w_.x = pose_w.t_(0);
+	pose_3d_w_.y = pose_w.t_(1);
+	pose_3d_w_.z = pose_w.t_(2);
+	surf_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	corner_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	full_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	outlier_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	storage_ = storage;
+	storage_id_ = storage_id;
+	cloud_loaded_ = false;
+	last_access_ = 0;
+	if (loop_index != -1)
+		has_loop_ = true;
+	else
+		has_loop_ = false;
+	loop_index_ = loop_index;
+	loop_info_ = loop_info;
+	sequence_ = sequence;
+}
+
+// not thread-safe, called with the keyframe list locked
+void KeyFrame::loadCloud()
+{
+	if (cloud_loaded_ || !storage_)
+		return;
+	// new clouds, the released ones may still be used by the verification threads
+	surf_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	corner_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	full_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	outlier_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	if (!storage_->readCloud(storage_id_, CLOUD_SURF, *surf_cloud_) ||
+		!storage_->readCloud(storage_id_, CLOUD_CORNER, *corner_cloud_) ||
+		!storage_->readCloud(storage_id_, CLOUD_FULL, *full_cloud_) ||
+		!storage_->readCloud(storage_id_, CLOUD_OUTLIER, *outlier_cloud_))
+	{
+		printf("[KeyFrame] fail to load the clouds of keyframe %d\n", index_);
+	}
+	cloud_loaded_ = true;
+}
+
+// not thread-safe, called with the keyframe list locked
+void KeyFrame::releaseCloud()
+{
+	if (!cloud_loaded_ || !storage_)
+		return;
+	surf_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	corner_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	full_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	outlier_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+	surf_cloud_ds_.reset();
+	corner_cloud_ds_.reset();
+	cloud_loaded_ = false;
+}
+
+size_t KeyFrame::getCloudBytes() const
+{
+	size_t num_point = surf_cloud_->size() + corner_cloud_->size() + full_cloud_->size() + outlier_cloud_->size();
+	if (surf_cloud_ds_) num_point += surf_cloud_ds_->size();
+	if (corner_cloud_ds_) num_point += corner_cloud_ds_->size();
+	return num_point * sizeof(pcl::PointXYZI);
 }
 
 void KeyFrame::getPose(Pose &pose_w)
@@ -113,3 +197,5 @@ Pose KeyFrame::getLoopRelativePose()
 // 	}
 // }
 
+} // namespace mloam_loop
+
@@ -48,49 +48,12 @@
 DEFINE_bool(result_save, true, "save or not save the results");
 DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(output_path, "", "the path ouf saving results");
+DEFINE_string(keyframe_file, "", "replay the keyframes of a pose graph container (e.g. saved by mloam_offline) without ROS");
+DEFINE_string(trace_file, "", "write the spans of the timers as chrome trace json, e.g. trace.json");
 
-// loading parameter
-int RESULT_SAVE;
-std::string OUTPUT_FOLDER;
-std::string MLOAM_LOOP_PATH;
-
-// setting in config.yaml
-int LOOP_SKIP_INTERVAL;
-int LOOP_HISTORY_SEARCH_NUM;
-double LOOP_DISTANCE_THRESHOLD;
-double LOOP_OPTI_COST_THRESHOLD;
-double LOOP_TEMPORAL_CONSISTENCY_THRESHOLD;
-double LOOP_GLOBAL_REGISTRATION_THRESHOLD;
-double LOOP_LOCAL_REGISTRATION_THRESHOLD;
-int VISUALIZE_IMAGE;
-int LOAD_PREVIOUS_POSE_GRAPH;
-int LOOP_SAVE_PCD;
-
-double LIDAR_HEIGHT;
-int PC_NUM_RING;
-int PC_NUM_SECTOR;
-double PC_MAX_RADIUS;
-double PC_UNIT_SECTORANGLE;
-double PC_UNIT_RINGGAP;
-int NUM_EXCLUDE_RECENT;
-int NUM_CANDIDATES_FROM_TREE;
-double SEARCH_RATIO;
-double SC_DIST_THRES;
-int TREE_MAKING_PERIOD;
-
-double NORMAL_RADIUS;
-double FPFH_RADIUS;
-double DIV_FACTOR;
-double USE_ABSOLUTE_SCALE;
-double MAX_CORR_DIST;
-double ITERATION_NUMBER;
-double TUPLE_SCALE;
-double TUPLE_MAX_CNT;
-
-// setting in the main procedure
-std::string POSE_GRAPH_SAVE_PATH;
-int VISUALIZATION_SHIFT_X;
-int VISUALIZATION_SHIFT_Y;
+using namespace mloam_loop;
+
+LoopConfig loop_config;
 
 std::mutex m_buf, m_process;
 
@@ -166,6 +129,7 @@ void pubLoopInfo()
 
 void process()
 {
+    common::timing::Trace::SetThreadName("loop_detect");
     while(1)
     {
 		if (!ros::ok()) break;
@@ -260,46 +224,99 @@ void process()
                 for (size_t j = 0; j < 6; j++)
                     pose_w.cov_(i, j) = double(keyframes_msg.poses.back().pose.covariance[i * 6 + j]);
 
-            KeyFrame *keyframe = new KeyFrame(time_keyframe,
-                                              frame_cnt,
-                                              pose_w,
-                                              laser_cloud_surf_last,
-                                              laser_cloud_corner_last,
-                                              laser_cloud_full_res,
-                                              laser_cloud_outlier,
-                                              0);
+            KeyFrame keyframe(time_keyframe,
+                              frame_cnt,
+                              pose_w,
+                              laser_cloud_surf_last,
+                              laser_cloud_corner_last,
+                              laser_cloud_full_res,
+                              laser_cloud_outlier,
+                              0);
 
             m_process.lock();
             posegraph.skip_cnt_++;
-            if (posegraph.skip_cnt_ >= LOOP_SKIP_INTERVAL)
+            if (posegraph.skip_cnt_ >= loop_config.loop_skip_interval_)
             {
                 printf("start loop detection: %d\n", posegraph.skip_cnt_);
-                posegraph.addKeyFrame(keyframe, 1);
+                posegraph.addKeyFrame(std::move(keyframe), 1);
             }
             else
             {
                 printf("skip loop detection: %d\n", posegraph.skip_cnt_);
-                posegraph.addKeyFrame(keyframe, 0);
+                posegraph.addKeyFrame(std::move(keyframe), 0);
             }
             m_process.unlock();
             frame_cnt++;            
-            std::cout << common::RED << "keyframe size: " << posegraph.getKeyFrameSize() << common::RESET << std::endl << std::endl;
+            std::cout << common::RED << "keyframe size: " << posegraph.getKeyFrameSize()
+                      << ", loop queue: " << posegraph.getLoopQueueSize() << common::RESET << std::endl << std::endl;
         }
         std::chrono::milliseconds dura(5);
         std::this_thread::sleep_for(dura);
     }
 }
 
+// feed the keyframes as fast as the loop verification consumes them, then wait for the last optimization
+int replayKeyFrames(const std::string &keyframe_file)
+{
+    std::shared_ptr<PoseGraphReader> reader(new PoseGraphReader());
+    if (!reader->open(keyframe_file))
+    {
+        printf("cannot open the keyframe file: %s\n", keyframe_file.c_str());
+        return 1;
+    }
+    printf("replay %lu keyframes from %s\n", reader->size(), keyframe_file.c_str());
+
+    TicToc t_replay;
+    int max_loop_queue_size = std::max(1, loop_config.loop_verify_queue_size_ - 1);
+    for (size_t id = 0; id < reader->size(); id++)
+    {
+        // the candidates are not dropped as in pushLoopCandidate if the queue is kept below its size
+        while (posegraph.getLoopQueueSize() >= max_loop_queue_size)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        const KeyFrameRecord &record = reader->getRecord(id);
+        Eigen::Quaterniond q(record.pose_w_[6], record.pose_w_[3], record.pose_w_[4], record.pose_w_[5]);
+        Eigen::Vector3d t(record.pose_w_[0], record.pose_w_[1], record.pose_w_[2]);
+        KeyFrame keyframe(record.time_stamp_, frame_cnt, Pose(q, t), reader, id, -1, Pose(), 0);
+
+        m_process.lock();
+        posegraph.skip_cnt_++;
+        if (posegraph.skip_cnt_ >= loop_config.loop_skip_interval_)
+            posegraph.addKeyFrame(std::move(keyframe), 1);
+        else
+            posegraph.addKeyFrame(std::move(keyframe), 0);
+        m_process.unlock();
+        frame_cnt++;
+    }
+    while (!posegraph.isLoopClosureIdle())
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    double replay_time = t_replay.toc() / 1000;
+
+    posegraph.printLoopStatistics();
+    printf("[loop_closure_node] %d keyframes in %fs, %f keyframes/s\n",
+           frame_cnt, replay_time, replay_time > 0 ? frame_cnt / replay_time : 0.0);
+    if (loop_config.result_save_)
+    {
+        m_process.lock();
+        posegraph.savePoseGraph();
+        m_process.unlock();
+    }
+    common::timing::Trace::Stop();
+    return 0;
+}
+
 void sigintHandler(int sig)
 {
     printf("[loop_closure_node] press ctrl-c\n");
     // std::cout << common::YELLOW << "mapping drop frame: " << frame_drop_cnt << common::RESET << std::endl;
-    if (RESULT_SAVE)
+    posegraph.printLoopStatistics();
+    if (loop_config.result_save_)
     {
         m_process.lock();
         posegraph.savePoseGraph();
         m_process.unlock();
     }
+    common::timing::Trace::Stop();
     ros::shutdown();
 }
 
@@ -313,65 +330,28 @@ int main(int argc, char **argv)
     google::InitGoogleLogging(argv[0]);
     google::ParseCommandLineFlags(&argc, &argv, true);
 
-    ros::init(argc, argv, "loop_closure_node");
-    ros::NodeHandle nh("~");
-    posegraph.registerPub(nh);
-
-    VISUALIZATION_SHIFT_X = 0;
-    VISUALIZATION_SHIFT_Y = 0;
-
-    RESULT_SAVE = FLAGS_result_save;
-    OUTPUT_FOLDER = FLAGS_output_path;
-    MLOAM_LOOP_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_loop_estimate.txt";
-    POSE_GRAPH_SAVE_PATH = OUTPUT_FOLDER + "pose_graph/";
-    printf("[loop_closure_node] save result (0/1): %d to %s\n", RESULT_SAVE, OUTPUT_FOLDER.c_str());
-    printf("config_file: %s\n", FLAGS_config_file.c_str());
-
-    cv::FileStorage fsSettings(FLAGS_config_file, cv::FileStorage::READ);
-    if (!fsSettings.isOpened())
+    // ROS is not initialized if the keyframes are replayed, nothing is published
+    bool replay = !FLAGS_keyframe_file.empty();
+    std::unique_ptr<ros::NodeHandle> nh;
+    if (!replay)
     {
-        std::cerr << "ERROR: Wrong path to settings" << std::endl;
+        ros::init(argc, argv, "loop_closure_node");
+        nh.reset(new ros::NodeHandle("~"));
+        posegraph.registerPub(*nh);
     }
 
+    loop_config.result_save_ = FLAGS_result_save;
+    loop_config.setOutputFolder(FLAGS_output_path);
+    printf("[loop_closure_node] save result (0/1): %d to %s\n", loop_config.result_save_, loop_config.output_folder_.c_str());
+    printf("config_file: %s\n", FLAGS_config_file.c_str());
+    if (!readParameters(FLAGS_config_file, loop_config))
+        return 1;
+    if (!FLAGS_trace_file.empty()) common::timing::Trace::Start(FLAGS_trace_file);
 
-    LOOP_SKIP_INTERVAL = fsSettings["loop_skip_interval"];
-    LOOP_HISTORY_SEARCH_NUM = fsSettings["loop_history_search_num"];
-    LOOP_DISTANCE_THRESHOLD = fsSettings["loop_distance_threshold"];
-    LOOP_TEMPORAL_CONSISTENCY_THRESHOLD = fsSettings["loop_temporal_consistency_threshold"];
-    LOOP_GLOBAL_REGISTRATION_THRESHOLD = fsSettings["loop_global_registration_threshold"];
-    LOOP_LOCAL_REGISTRATION_THRESHOLD = fsSettings["loop_local_registration_threshold"];
-    VISUALIZE_IMAGE = fsSettings["visualize_image"];
-    LOAD_PREVIOUS_POSE_GRAPH = fsSettings["load_previous_pose_graph"];
-    LOOP_SAVE_PCD = fsSettings["loop_save_pcd"];
-
-    // scan context
-    LIDAR_HEIGHT = fsSettings["lidar_height"];
-    PC_NUM_RING = fsSettings["pc_num_ring"];
-    PC_NUM_SECTOR = fsSettings["pc_num_sector"];
-    PC_MAX_RADIUS = fsSettings["pc_max_radius"];
-    PC_UNIT_SECTORANGLE = 360.0 / double(PC_NUM_SECTOR);
-    PC_UNIT_RINGGAP = PC_MAX_RADIUS / double(PC_NUM_RING);
-    NUM_EXCLUDE_RECENT = fsSettings["num_exclude_recent"];
-    NUM_CANDIDATES_FROM_TREE = fsSettings["num_candidates_from_tree"];
-    SEARCH_RATIO = fsSettings["search_ratio"];
-    SC_DIST_THRES = fsSettings["sc_dist_thres"];
-    TREE_MAKING_PERIOD = fsSettings["tree_making_period"];
-
-    // registration
-    NORMAL_RADIUS = fsSettings["normal_radius"];
-    FPFH_RADIUS = fsSettings["fpfh_radius"];
-    DIV_FACTOR = fsSettings["div_factor"];
-    USE_ABSOLUTE_SCALE = fsSettings["use_absolute_scale"];
-    MAX_CORR_DIST = fsSettings["max_corr_dist"];
-    ITERATION_NUMBER = fsSettings["iteration_number"];
-    TUPLE_SCALE = fsSettings["tuple_scale"];
-    TUPLE_MAX_CNT = fsSettings["tuple_max_cnt"];
-
-    fsSettings.release();
-
-    posegraph.setParameter();
+    posegraph.setParameter(loop_config);
     posegraph.setPGOTread();
-    if (LOAD_PREVIOUS_POSE_GRAPH)
+    posegraph.setLoopVerifyThread(loop_config.loop_verify_thread_num_);
+    if (loop_config.load_previous_pose_graph_)
     {
         // printf("Load pose graph\n");
         m_process.lock();
@@ -383,13 +363,15 @@ int main(int argc, char **argv)
     {
         printf("Not load pose graph\n");
     }
+    if (replay)
+        return replayKeyFrames(FLAGS_keyframe_file);
 
     // *******************************
-    ros::Subscriber sub_laser_cloud_full_res = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud", 2, laserCloudFullResHandler);
-    ros::Subscriber sub_laser_cloud_outlier = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_outlier", 2, laserCloudOutlierResHandler);
-    ros::Subscriber sub_laser_cloud_surf_last = nh.subscribe<sensor_msgs::PointCloud2>("/surf_points_less_flat", 2, laserCloudSurfLastHandler);
-	ros::Subscriber sub_laser_cloud_corner_last = nh.subscribe<sensor_msgs::PointCloud2>("/corner_points_less_sharp", 2, laserCloudCornerLastHandler);
-    ros::Subscriber sub_laser_keyframes = nh.subscribe<mloam_msgs::Keyframes>("/laser_map_keyframes_6d", 5, laserKeyframeHandler);
+    ros::Subscriber sub_laser_cloud_full_res = nh->subscribe<sensor_msgs::PointCloud2>("/laser_cloud", 2, laserCloudFullResHandler);
+    ros::Subscriber sub_laser_cloud_outlier = nh->subscribe<sensor_msgs::PointCloud2>("/laser_cloud_outlier", 2, laserCloudOutlierResHandler);
+    ros::Subscriber sub_laser_cloud_surf_last = nh->subscribe<sensor_msgs::PointCloud2>("/surf_points_less_flat", 2, laserCloudSurfLastHandler);
+	ros::Subscriber sub_laser_cloud_corner_last = nh->subscribe<sensor_msgs::PointCloud2>("/corner_points_less_sharp", 2, laserCloudCornerLastHandler);
+    ros::Subscriber sub_laser_keyframes = nh->subscribe<mloam_msgs::Keyframes>("/laser_map_keyframes_6d", 5, laserKeyframeHandler);
 
     // pub_laser_loop_keyframes_6d = nh.advertise<mloam_msgs::Keyframes>("/laser_loop_keyframes_6d", 5);
     // pub_scan_context = nh.advertise<sensor_msgs::Image>("/input_scan_context", 5);
@@ -15,81 +15,89 @@
 
 #include "mloam_loop/loop_registration.hpp"
 
-void LoopRegistration::parseFPFH(const pcl::PointCloud<pcl::PointXYZI>::Ptr &cloud,
-                                 const pcl::PointCloud<pcl::FPFHSignature33>::Ptr &fpfh_feature,
-                                 fgr::Points &points,
-                                 fgr::Feature &features)
+namespace mloam_loop
 {
+
+void LoopRegistration::computeFPFH(const pcl::PointCloud<pcl::PointXYZI>::Ptr &cloud,
+                                   const RegistrationConfig &config,
+                                   FPFHCloud &fpfh_cloud)
+{
+    pcl::search::KdTree<pcl::PointXYZI>::Ptr tree(new pcl::search::KdTree<pcl::PointXYZI>());
+    pcl::NormalEstimation<pcl::PointXYZI, pcl::Normal> ne;
+    pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>());
+    ne.setInputCloud(cloud);
+    ne.setSearchMethod(tree);
+    // ne.setKSearch(10);
+    ne.setRadiusSearch(config.normal_radius_);
+    ne.compute(*normals);
+
+    pcl::FPFHEstimationOMP<pcl::PointXYZI, pcl::Normal, pcl::FPFHSignature33> fest;
+    pcl::PointCloud<pcl::FPFHSignature33> object_features;
+    fest.setInputCloud(cloud);
+    fest.setInputNormals(normals);
+    fest.setSearchMethod(tree);
+    fest.setRadiusSearch(config.fpfh_radius_);
+    fest.setNumberOfThreads(config.thread_num_);
+    fest.compute(object_features);
+
+    fpfh_cloud.points_.resize(cloud->size());
+    fpfh_cloud.features_.resize(cloud->size() * FPFH_DIM);
     for (size_t i = 0; i < cloud->size(); i++)
     {
         const pcl::PointXYZI &pt = cloud->points[i];
-        Eigen::Vector3f pts(pt.x, pt.y, pt.z);
-        points.push_back(pts);
-
-        const pcl::FPFHSignature33 &feature = fpfh_feature->points[i];
-        Eigen::VectorXf feat(33);
-        for (size_t j = 0; j < 33; j++)
-            feat(j) = feature.histogram[j];
-        features.push_back(feat);
+        fpfh_cloud.points_[i] = Eigen::Vector3f(pt.x, pt.y, pt.z);
+        std::copy(object_features.points[i].histogram, object_features.points[i].histogram + FPFH_DIM,
+                  &fpfh_cloud.features_[i * FPFH_DIM]);
     }
 }
 
-std::pair<bool, Eigen::Matrix4d> LoopRegistration::performGlobalRegistration(pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_map,
-                                                                             pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_cloud)
+void LoopRegistration::mergeFPFH(const FPFHCloud &src,
+                                 const Eigen::Matrix4f &T,
+                                 const float &leaf_size,
+                                 std::unordered_set<int64_t> &voxels,
+                                 FPFHCloud &dst)
 {
-    std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> point_cloud;
-    point_cloud.push_back(laser_map);
-    point_cloud.push_back(laser_cloud);
-
-    TicToc t_fpfh;
-    std::vector<pcl::PointCloud<pcl::FPFHSignature33>::Ptr> fpfh_feature;
-    for (size_t i = 0; i < point_cloud.size(); i++)
+    const Eigen::Matrix3f R = T.block<3, 3>(0, 0);
+    const Eigen::Vector3f t = T.block<3, 1>(0, 3);
+    for (size_t i = 0; i < src.size(); i++)
     {
-        pcl::NormalEstimation<pcl::PointXYZI, pcl::Normal> ne;
-        pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>());
-        pcl::search::KdTree<pcl::PointXYZI>::Ptr tree_normal(new pcl::search::KdTree<pcl::PointXYZI>());
-        ne.setInputCloud(point_cloud[i]);
-        ne.setSearchMethod(tree_normal);
-        // ne.setKSearch(10);
-        ne.setRadiusSearch(NORMAL_RADIUS);
-        ne.compute(*normals);
-
-        pcl::FPFHEstimationOMP<pcl::PointXYZI, pcl::Normal, pcl::FPFHSignature33> fest;
-        pcl::PointCloud<pcl::FPFHSignature33>::Ptr object_features(new pcl::PointCloud<pcl::FPFHSignature33>());
-        pcl::search::KdTree<pcl::PointXYZI>::Ptr tree_fpfh(new pcl::search::KdTree<pcl::PointXYZI>());
-        fest.setInputCloud(point_cloud[i]);
-        fest.setInputNormals(normals);
-        fest.setSearchMethod(tree_fpfh);
-        fest.setRadiusSearch(FPFH_RADIUS);
-        fest.compute(*object_features);
-        fpfh_feature.push_back(object_features);
+        Eigen::Vector3f pt = R * src.points_[i] + t;
+        // 21 bits for each axis
+        int64_t ix = static_cast<int64_t>(std::floor(pt.x() / leaf_size)) & 0x1FFFFF;
+        int64_t iy = static_cast<int64_t>(std::floor(pt.y() / leaf_size)) & 0x1FFFFF;
+        int64_t iz = static_cast<int64_t>(std::floor(pt.z() / leaf_size)) & 0x1FFFFF;
+        if (!voxels.insert((ix << 42) | (iy << 21) | iz).second)
+            continue;
+        dst.points_.push_back(pt);
+        dst.features_.insert(dst.features_.end(), &src.features_[i * FPFH_DIM], &src.features_[i * FPFH_DIM] + FPFH_DIM);
     }
-    fgr::Points p1, p2;
-    fgr::Feature f1, f2;
-    parseFPFH(point_cloud[0], fpfh_feature[0], p1, f1);
-    parseFPFH(point_cloud[1], fpfh_feature[1], p2, f2);
-    printf("extract fpfh from %lu clouds: %fms\n", fpfh_feature.size(), t_fpfh.toc());
+}
 
+std::pair<bool, Eigen::Matrix4d> LoopRegistration::performGlobalRegistration(const FPFHCloud &fpfh_map,
+                                                                             const FPFHCloud &fpfh_cloud)
+{
     TicToc t_fgr;
-    fgr::CApp app(DIV_FACTOR,
-                  USE_ABSOLUTE_SCALE,
-                  MAX_CORR_DIST,
-                  ITERATION_NUMBER,
-                  TUPLE_SCALE,
-                  TUPLE_MAX_CNT);
-    app.LoadFeature(p1, f1);
-    app.LoadFeature(p2, f2);
+    fgr::CApp app(config_.div_factor_,
+                  config_.use_absolute_scale_,
+                  config_.max_corr_dist_,
+                  config_.iteration_number_,
+                  config_.tuple_scale_,
+                  config_.tuple_max_cnt_);
+    app.SetNumThreads(config_.thread_num_);
+    app.LoadFeature(fpfh_map.points_, fpfh_map.features_, FPFH_DIM);
+    app.LoadFeature(fpfh_cloud.points_, fpfh_cloud.features_, FPFH_DIM);
     app.NormalizePoints();
     app.AdvancedMatching();
     app.OptimizePairwise(true);
     printf("FGR: %fms\n", t_fgr.toc());
 
     double opti_cost = app.final_cost_normalize_;
+    opti_cost_ = opti_cost;
     Eigen::Matrix4d T_relative = app.GetOutputTrans().cast<double>();
     std::cout << "opti_cost: " << opti_cost << ", rlt: \n" << T_relative << std::endl;
 
     std::pair<bool, Eigen::Matrix4d> result;
-    if (opti_cost <= LOOP_GLOBAL_REGISTRATION_THRESHOLD)
+    if (opti_cost <= config_.global_registration_threshold_)
     {
         result = make_pair(true, T_relative);
     }
@@ -100,6 +108,17 @@ std::pair<bool, Eigen::Matrix4d> LoopRegistration::performGlobalRegistration(pcl
     return result;
 }
 
+std::pair<bool, Eigen::Matrix4d> LoopRegistration::performGlobalRegistration(pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_map,
+                                                                             pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_cloud)
+{
+    TicToc t_fpfh;
+    FPFHCloud fpfh_map, fpfh_cloud;
+    computeFPFH(laser_map, config_, fpfh_map);
+    computeFPFH(laser_cloud, config_, fpfh_cloud);
+    printf("extract fpfh from 2 clouds: %fms\n", t_fpfh.toc());
+    return performGlobalRegistration(fpfh_map, fpfh_cloud);
+}
+
 // perform loop optimization between the model (as the base frame) to the keyframe point cloud
 std::pair<bool, Eigen::Matrix4d> LoopRegistration::performLocalRegistration(const pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_cloud_surf_from_map,
                                                                             const pcl::PointCloud<pcl::PointXYZI>::Ptr &laser_cloud_corner_from_map,
@@ -197,9 +216,10 @@ std::pair<bool, Eigen::Matrix4d> LoopRegistration::performLocalRegistration(cons
         T_relative.block<3, 1>(0, 3) = t_relative;
     }
     std::cout << "opti_cost: " << opti_cost << "\nrlt: \n" << T_relative << std::endl;
+    opti_cost_ = opti_cost;
 
     std::pair<bool, Eigen::Matrix4d> result;
-    if (opti_cost <= LOOP_LOCAL_REGISTRATION_THRESHOLD)
+    if (opti_cost <= config_.local_registration_threshold_)
     {
         result = make_pair(true, T_relative);
     }
@@ -209,3 +229,29 @@ std::pair<bool, Eigen::Matrix4d> LoopRegistration::performLocalRegistration(cons
     }
     return result;
 }
+
+double LoopRegistration::computeOverlap(const pcl::PointCloud<pcl::PointXYZI>::Ptr &map,
+                                        const pcl::PointCloud<pcl::PointXYZI>::Ptr &cloud,
+                                        const Eigen::Matrix4d &T,
+                                        const double &max_dist)
+{
+    if (map->empty() || cloud->empty())
+        return 0.0;
+    pcl::KdTreeFLANN<pcl::PointXYZI> kdtree_map;
+    kdtree_map.setInputCloud(map);
+    pcl::PointCloud<pcl::PointXYZI> cloud_trans;
+    pcl::transformPointCloud(*cloud, cloud_trans, T.cast<float>());
+    std::vector<int> point_search_idx(1);
+    std::vector<float> point_search_sq_dis(1);
+    const float max_sq_dist = max_dist * max_dist;
+    size_t num_overlap = 0;
+    for (const pcl::PointXYZI &point : cloud_trans.points)
+    {
+        if (kdtree_map.nearestKSearch(point, 1, point_search_idx, point_search_sq_dis) > 0 &&
+            point_search_sq_dis[0] <= max_sq_dist)
+            num_overlap++;
+    }
+    return 1.0 * num_overlap / cloud_trans.size();
+}
+
+} // namespace mloam_loop
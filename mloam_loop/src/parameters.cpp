@@ -0,0 +1,141 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "mloam_loop/parameters.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include <opencv2/core/core.hpp>
+
+#include "../ThirdParty/FastGlobalRegistration/app.h"
+
+namespace mloam_loop
+{
+
+RegistrationConfig::RegistrationConfig()
+    : normal_radius_(0.0),
+      fpfh_radius_(0.0),
+      div_factor_(0.0),
+      use_absolute_scale_(0.0),
+      max_corr_dist_(0.0),
+      iteration_number_(0.0),
+      tuple_scale_(0.0),
+      tuple_max_cnt_(0.0),
+      global_registration_threshold_(0.0),
+      local_registration_threshold_(0.0),
+      thread_num_(1)
+{
+}
+
+LoopConfig::LoopConfig()
+    : result_save_(0),
+      loop_skip_interval_(0),
+      loop_history_search_num_(0),
+      loop_distance_threshold_(0.0),
+      loop_temporal_consistency_threshold_(0.0),
+      loop_verify_thread_num_(1),
+      loop_verify_queue_size_(4),
+      loop_yaw_prior_overlap_threshold_(0.0),
+      visualize_image_(0),
+      load_previous_pose_graph_(0),
+      loop_save_pcd_(0),
+      loop_save_codec_(0),
+      loop_cloud_memory_budget_(0),
+      visualization_shift_x_(0),
+      visualization_shift_y_(0),
+      lidar_height_(0.0),
+      pc_num_ring_(0),
+      pc_num_sector_(0),
+      pc_max_radius_(0.0),
+      pc_unit_sectorangle_(0.0),
+      pc_unit_ringgap_(0.0),
+      num_exclude_recent_(0),
+      num_candidates_from_tree_(0),
+      search_ratio_(0.0),
+      sc_dist_thres_(0.0),
+      tree_making_period_(0),
+      sc_thread_num_(0)
+{
+    setOutputFolder("");
+}
+
+void LoopConfig::setOutputFolder(const std::string &output_folder)
+{
+    output_folder_ = output_folder;
+    loop_path_ = output_folder_ + "traj/stamped_mloam_loop_estimate.txt";
+    loop_memory_path_ = output_folder_ + "traj/mloam_loop_memory.txt";
+    pose_graph_save_path_ = output_folder_ + "pose_graph/";
+}
+
+bool readParameters(const std::string &config_file, LoopConfig &config)
+{
+    cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
+    if (!fsSettings.isOpened())
+    {
+        std::cerr << "ERROR: Wrong path to settings: " << config_file << std::endl;
+        return false;
+    }
+
+    config.loop_skip_interval_ = fsSettings["loop_skip_interval"];
+    config.loop_history_search_num_ = fsSettings["loop_history_search_num"];
+    config.loop_distance_threshold_ = fsSettings["loop_distance_threshold"];
+    config.loop_temporal_consistency_threshold_ = fsSettings["loop_temporal_consistency_threshold"];
+    config.loop_verify_thread_num_ = fsSettings["loop_verify_thread_num"];
+    if (config.loop_verify_thread_num_ <= 0) config.loop_verify_thread_num_ = 1;
+    config.loop_verify_queue_size_ = fsSettings["loop_verify_queue_size"];
+    if (config.loop_verify_queue_size_ <= 0) config.loop_verify_queue_size_ = 4;
+    config.loop_yaw_prior_overlap_threshold_ = fsSettings["loop_yaw_prior_overlap_threshold"];
+    config.visualize_image_ = fsSettings["visualize_image"];
+    config.load_previous_pose_graph_ = fsSettings["load_previous_pose_graph"];
+    config.loop_save_pcd_ = fsSettings["loop_save_pcd"];
+    config.loop_save_codec_ = fsSettings["loop_save_codec"];
+    config.loop_cloud_memory_budget_ = fsSettings["loop_cloud_memory_budget"];
+
+    // scan context
+    config.lidar_height_ = fsSettings["lidar_height"];
+    config.pc_num_ring_ = fsSettings["pc_num_ring"];
+    config.pc_num_sector_ = fsSettings["pc_num_sector"];
+    config.pc_max_radius_ = fsSettings["pc_max_radius"];
+    config.pc_unit_sectorangle_ = 360.0 / double(config.pc_num_sector_);
+    config.pc_unit_ringgap_ = config.pc_max_radius_ / double(config.pc_num_ring_);
+    config.num_exclude_recent_ = fsSettings["num_exclude_recent"];
+    config.num_candidates_from_tree_ = fsSettings["num_candidates_from_tree"];
+    config.search_ratio_ = fsSettings["search_ratio"];
+    config.sc_dist_thres_ = fsSettings["sc_dist_thres"];
+    config.tree_making_period_ = fsSettings["tree_making_period"];
+    config.sc_thread_num_ = fsSettings["sc_thread_num"];
+
+    // registration
+    RegistrationConfig &reg = config.registration_;
+    reg.normal_radius_ = fsSettings["normal_radius"];
+    reg.fpfh_radius_ = fsSettings["fpfh_radius"];
+    reg.div_factor_ = fsSettings["div_factor"];
+    reg.use_absolute_scale_ = fsSettings["use_absolute_scale"];
+    reg.max_corr_dist_ = fsSettings["max_corr_dist"];
+    reg.iteration_number_ = fsSettings["iteration_number"];
+    reg.tuple_scale_ = fsSettings["tuple_scale"];
+    reg.tuple_max_cnt_ = fsSettings["tuple_max_cnt"];
+    reg.global_registration_threshold_ = fsSettings["loop_global_registration_threshold"];
+    reg.local_registration_threshold_ = fsSettings["loop_local_registration_threshold"];
+    // the verification threads share the cores instead of each running FGR_NUM_THREADS threads
+    reg.thread_num_ = std::max(1, std::min(FGR_NUM_THREADS,
+        static_cast<int>(std::thread::hardware_concurrency()) / config.loop_verify_thread_num_));
+
+    fsSettings.release();
+    return true;
+}
+
+} // namespace mloam_loop
+
+//
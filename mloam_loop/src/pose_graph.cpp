@@ -11,6 +11,27 @@
 
 #include "mloam_loop/pose_graph.h"
 
+#include <unistd.h>
+
+namespace mloam_loop
+{
+
+namespace
+{
+// the resident set size of the process in MB
+double getResidentMemory()
+{
+    long num_page = 0, num_resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0.0;
+    if (fscanf(fp, "%ld %ld", &num_page, &num_resident) != 2)
+        num_resident = 0;
+    fclose(fp);
+    return num_resident * sysconf(_SC_PAGESIZE) / 1e6;
+}
+}
+
 PoseGraph::PoseGraph()
 {
     posegraph_visualization = new CameraPoseVisualization(1.0, 0.0, 0.0, 1.0);
@@ -21,26 +42,51 @@ PoseGraph::PoseGraph()
     earliest_loop_index_ = -1;
     global_index_ = 0;
     pgo_flag_ = false;
+    pgo_busy_ = false;
+
+    loop_verify_busy_ = 0;
+    loop_verify_cnt_ = 0;
+    loop_accept_cnt_ = 0;
+    loop_cancel_cnt_ = 0;
+    loop_latency_sum_ = 0.0;
+    loop_latency_max_ = 0.0;
+    submap_hit_cnt_ = 0;
+    submap_miss_cnt_ = 0;
+    pose_graph_version_ = 0;
+    cloud_access_tick_ = 0;
+    resident_cloud_bytes_ = 0;
+    num_resident_cloud_ = 0;
+    spill_disabled_ = false;
+    memory_report_cnt_ = 0;
 
+    laser_cloud_surf_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    laser_cloud_surf_from_map_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+}
+
+PoseGraph::~PoseGraph()
+{
+    t_optimization.detach();
+    for (std::thread &t : t_verification)
+        t.detach();
+}
+
+LoopVerifier::LoopVerifier()
+{
     laser_cloud_surf_.reset(new pcl::PointCloud<pcl::PointXYZI>());
     laser_cloud_corner_.reset(new pcl::PointCloud<pcl::PointXYZI>());
     laser_cloud_surf_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
     laser_cloud_corner_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());    
     laser_cloud_surf_from_map_.reset(new pcl::PointCloud<pcl::PointXYZI>());
     laser_cloud_corner_from_map_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-    laser_cloud_surf_from_map_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-    laser_cloud_corner_from_map_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-    down_size_filter_surf_map_.setLeafSize(0.4, 0.4, 0.4);
-    down_size_filter_corner_map_.setLeafSize(0.4, 0.4, 0.4);
+    down_size_filter_surf_map_.setLeafSize(LOOP_MAP_LEAF_SIZE, LOOP_MAP_LEAF_SIZE, LOOP_MAP_LEAF_SIZE);
+    down_size_filter_corner_map_.setLeafSize(LOOP_MAP_LEAF_SIZE, LOOP_MAP_LEAF_SIZE, LOOP_MAP_LEAF_SIZE);
+    for (int i = 0; i < NUM_LOOP_VERIFY_STAGE; i++)
+    {
+        stage_result_[i] = -1;
+        stage_time_[i] = 0.0;
+    }
     // down_size_filter_surf_map_.setLeafSize(1.0, 1.0, 1.0);
     // down_size_filter_corner_map_.setLeafSize(1.0, 1.0, 1.0);    
-    kdtree_surf_from_map_.reset(new pcl::KdTreeFLANN<pcl::PointXYZI>());
-    kdtree_corner_from_map_.reset(new pcl::KdTreeFLANN<pcl::PointXYZI>());
-}
-
-PoseGraph::~PoseGraph()
-{
-    t_optimization.detach();
 }
 
 void PoseGraph::registerPub(ros::NodeHandle &nh)
@@ -53,19 +99,21 @@ void PoseGraph::registerPub(ros::NodeHandle &nh)
     pub_loop_info_ = nh.advertise<mloam_msgs::Keyframes>("/loop_info", 5);
 }
 
-void PoseGraph::setParameter()
+void PoseGraph::setParameter(const LoopConfig &config)
 {
-    sc_manager_.setParameter(LIDAR_HEIGHT,
-                             PC_NUM_RING,
-                             PC_NUM_SECTOR,
-                             PC_MAX_RADIUS,
-                             PC_UNIT_SECTORANGLE,
-                             PC_UNIT_RINGGAP,
-                             NUM_EXCLUDE_RECENT,
-                             NUM_CANDIDATES_FROM_TREE,
-                             SEARCH_RATIO,
-                             SC_DIST_THRES,
-                             TREE_MAKING_PERIOD);
+    config_ = config;
+    sc_manager_.setParameter(config_.lidar_height_,
+                             config_.pc_num_ring_,
+                             config_.pc_num_sector_,
+                             config_.pc_max_radius_,
+                             config_.pc_unit_sectorangle_,
+                             config_.pc_unit_ringgap_,
+                             config_.num_exclude_recent_,
+                             config_.num_candidates_from_tree_,
+                             config_.search_ratio_,
+                             config_.sc_dist_thres_,
+                             config_.tree_making_period_,
+                             config_.sc_thread_num_);
 }
 
 void PoseGraph::setPGOTread()
@@ -74,13 +122,31 @@ void PoseGraph::setPGOTread()
     t_optimization = std::thread(&PoseGraph::optimizePoseGraph, this);
 }
 
+void PoseGraph::setLoopVerifyThread(const int &num_thread)
+{
+    printf("[PoseGraph] set %d loop verification threads\n", num_thread);
+    for (int i = 0; i < num_thread; i++)
+        t_verification.push_back(std::thread(&PoseGraph::verifyLoop, this));
+}
+
 void PoseGraph::addKeyFrameIntoDB(KeyFrame *keyframe)
 {
     pcl::PointCloud<pcl::PointXYZI>::Ptr raw_cloud(new pcl::PointCloud<pcl::PointXYZI>());
-    *raw_cloud += *keyframe->full_cloud_;
-    *raw_cloud += *keyframe->outlier_cloud_;
+    if (keyframe->isCloudLoaded())
+    {
+        *raw_cloud += *keyframe->full_cloud_;
+        *raw_cloud += *keyframe->outlier_cloud_;
+    }
+    else
+    {
+        // decode the clouds for the scan context only, the keyframe keeps them in storage until accessed
+        pcl::PointCloud<pcl::PointXYZI> outlier_cloud;
+        keyframe->storage_->readCloud(keyframe->storage_id_, CLOUD_FULL, *raw_cloud);
+        keyframe->storage_->readCloud(keyframe->storage_id_, CLOUD_OUTLIER, outlier_cloud);
+        *raw_cloud += outlier_cloud;
+    }
     sc_manager_.makeAndSaveScancontextAndKeys(*raw_cloud);
-    // if (VISUALIZE_IMAGE)
+    // if (config_.visualize_image_)
     // {
     //     cv::Mat tmp1_image = sc_manager_.getScanContextImage(que_index);
     //     cv::Mat tmp2_image = sc_manager_.getScanContextImage(detect);
@@ -89,17 +155,25 @@ void PoseGraph::addKeyFrameIntoDB(KeyFrame *keyframe)
     // }
 }
 
-void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
+void PoseGraph::addKeyFrame(KeyFrame &&keyframe, bool flag_detect_loop)
 {
-    cur_kf->index_ = global_index_;
+    common::timing::Trace::SetFrame(keyframe.time_stamp_);
+    keyframe.index_ = global_index_;
     global_index_++;
-    keyframelist_.push_back(cur_kf);
+    prepareKeyFrameCloud(&keyframe);
+    m_keyframelist.lock();
+    keyframelist_.push_back(std::move(keyframe));
+    KeyFrame *cur_kf = &keyframelist_.back();
+    touchKeyFrameCloud(cur_kf);
+    resident_cloud_bytes_ += cur_kf->getCloudBytes();
+    num_resident_cloud_++;
+    m_keyframelist.unlock();
     if (flag_detect_loop)
     {
         // detect loop candidates
-        TicToc t_loop_detect;
+        common::timing::Timer t_loop_detect(TIMING_HANDLE("loop_detect"));
         std::pair<int, double> ld_result = detectLoop(cur_kf, cur_kf->index_);
-        printf("loop_detection: %fms\n", t_loop_detect.toc());
+        printf("loop_detection: %fms, database size: %lu\n", t_loop_detect.Stop() * 1000, sc_manager_.getDataBaseSize());
         if (ld_result.first != -1)
         {           
             int loop_index = ld_result.first;
@@ -107,9 +181,9 @@ void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
             printf("find a loop candidate: %d <-> %d, yaw_ini: %f\n", cur_kf->index_, loop_index, yaw_diff_rad);
 
             // check temporal consistency
-            TicToc t_check_tc;
+            common::timing::Timer t_check_tc(TIMING_HANDLE("loop_check_tc"));
             std::pair<bool, int> tc_result = checkTemporalConsistency(cur_kf->index_, loop_index);
-            printf("check temporal consistency: %fms\n", t_check_tc.toc());
+            printf("check temporal consistency: %fms\n", t_check_tc.Stop() * 1000);
             if (!tc_result.first)
             {
                 printf("loop reject with temporal verificiation\n");
@@ -118,33 +192,21 @@ void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
             {
                 skip_cnt_ = 0; // not perform frequent geometric verification
 
-                // set the initial guess using the yaw
-                Eigen::Quaterniond q_ini(Eigen::AngleAxisd(yaw_diff_rad, Eigen::Vector3d::UnitZ()));
-                Eigen::Vector3d t_ini = Eigen::Vector3d::Zero();
-                Pose pose_ini_map_kf(q_ini, t_ini);
-
-                // check geometric consistency
-                TicToc t_check_gc;
-                std::pair<bool, Pose> reg_result = checkGeometricConsistency(cur_kf, cur_kf->index_,
-                                                                             loop_index,
-                                                                             pose_ini_map_kf);
-                printf("check geoometryc consistency %fs\n", t_check_gc.toc() / 1000);
-                if (!reg_result.first)
-                {
-                    printf("loop reject with geometry verificiation\n");
-                }
-                else 
+                // geometric verification is performed by the verification threads
+                LoopCandidate candidate;
+                candidate.que_index_ = cur_kf->index_;
+                candidate.match_index_ = loop_index;
+                candidate.yaw_diff_rad_ = yaw_diff_rad;
+                candidate.que_time_ = cur_kf->time_stamp_;
+                // keep the clouds around the match keyframe in memory until the verification
+                m_keyframelist.lock();
+                for (int k = std::max(0, loop_index - config_.loop_history_search_num_); k <= loop_index + config_.loop_history_search_num_; k++)
                 {
-                    // perform pose graph optimization
-                    Pose loop_info = reg_result.second;
-                    cur_kf->updateLoopInfo(loop_index, loop_info);
-                    if (earliest_loop_index_ > loop_index || earliest_loop_index_ == -1)
-                        earliest_loop_index_ = loop_index;
-
-                    m_optimize_buf.lock();
-                    optimize_buf_.push(cur_kf->index_);
-                    m_optimize_buf.unlock();
+                    KeyFrame *tmp_kf = getKeyFrame(k);
+                    if (tmp_kf) touchKeyFrameCloud(tmp_kf);
                 }
+                m_keyframelist.unlock();
+                pushLoopCandidate(candidate);
             }
         }
     }
@@ -161,8 +223,8 @@ void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp_);
     pose_stamped.header.frame_id = "/world";
-    pose_stamped.pose.position.x = pose_w.t_(0) + VISUALIZATION_SHIFT_X;
-    pose_stamped.pose.position.y = pose_w.t_(1) + VISUALIZATION_SHIFT_Y;
+    pose_stamped.pose.position.x = pose_w.t_(0) + config_.visualization_shift_x_;
+    pose_stamped.pose.position.y = pose_w.t_(1) + config_.visualization_shift_y_;
     pose_stamped.pose.position.z = pose_w.t_(2);
     pose_stamped.pose.orientation.x = pose_w.q_.x();
     pose_stamped.pose.orientation.y = pose_w.q_.y();
@@ -172,9 +234,9 @@ void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
     pg_path_.header = pose_stamped.header;
     posegraph_visualization->add_lidar_pose(pose_w.t_, pose_w.q_);
 
-    if (RESULT_SAVE)
+    if (config_.result_save_)
     {
-        ofstream loop_path_file(MLOAM_LOOP_PATH, ios::app);
+        ofstream loop_path_file(config_.loop_path_, ios::app);
         loop_path_file.setf(ios::fixed, ios::floatfield);
         loop_path_file.precision(15);
         loop_path_file << cur_kf->time_stamp_ << " ";
@@ -192,17 +254,15 @@ void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
     //draw local connection
     if (SHOW_S_EDGE)
     {
-        list<KeyFrame *>::reverse_iterator rit = keyframelist_.rbegin();
-        for (int i = 0; i < 4; i++)
+        for (int i = 1; i < 5; i++)
         {
-            if (rit == keyframelist_.rend())
+            if (cur_kf->index_ - i < 0)
                 break;
             Pose connected_pose;
-            (*rit)->getPose(connected_pose);
+            keyframelist_[cur_kf->index_ - i].getPose(connected_pose);
             posegraph_visualization->add_edge(pose_w.t_, connected_pose.t_);
-            rit++;
         }
-    }    
+    }
     if (SHOW_L_EDGE)
     {
         if (cur_kf->has_loop_)
@@ -214,18 +274,28 @@ void PoseGraph::addKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
             Pose pose_0;
             cur_kf->getPose(pose_0);
             //printf("add loop into visual \n");
-            posegraph_visualization->add_loopedge(pose_0.t_, connected_pose.t_ + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
+            posegraph_visualization->add_loopedge(pose_0.t_, connected_pose.t_ + Vector3d(config_.visualization_shift_x_, config_.visualization_shift_y_, 0));
         }
     }
 
     publish();
     m_keyframelist.unlock();
+    enforceCloudBudget();
 }
 
-void PoseGraph::loadKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
+void PoseGraph::loadKeyFrame(KeyFrame &&keyframe, bool flag_detect_loop)
 {
-    cur_kf->index_ = global_index_;
+    keyframe.index_ = global_index_;
     global_index_++;
+    m_keyframelist.lock();
+    keyframelist_.push_back(std::move(keyframe));
+    KeyFrame *cur_kf = &keyframelist_.back();
+    if (cur_kf->isCloudLoaded())
+    {
+        resident_cloud_bytes_ += cur_kf->getCloudBytes();
+        num_resident_cloud_++;
+    }
+    m_keyframelist.unlock();
     int loop_index = -1;
     addKeyFrameIntoDB(cur_kf);
 
@@ -236,8 +306,8 @@ void PoseGraph::loadKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp_);
     pose_stamped.header.frame_id = "/world";
-    pose_stamped.pose.position.x = pose_w.t_(0) + VISUALIZATION_SHIFT_X;
-    pose_stamped.pose.position.y = pose_w.t_(1) + VISUALIZATION_SHIFT_Y;
+    pose_stamped.pose.position.x = pose_w.t_(0) + config_.visualization_shift_x_;
+    pose_stamped.pose.position.y = pose_w.t_(1) + config_.visualization_shift_y_;
     pose_stamped.pose.position.z = pose_w.t_(2);
     pose_stamped.pose.orientation.x = pose_w.q_.x();
     pose_stamped.pose.orientation.y = pose_w.q_.y();
@@ -249,15 +319,13 @@ void PoseGraph::loadKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
 
     if (SHOW_S_EDGE)
     {
-        list<KeyFrame *>::reverse_iterator rit = keyframelist_.rbegin();
-        for (int i = 0; i < 4; i++)
+        for (int i = 1; i < 5; i++)
         {
-            if (rit == keyframelist_.rend())
+            if (cur_kf->index_ - i < 0)
                 break;
             Pose connected_pose;
-            (*rit)->getPose(connected_pose);
+            keyframelist_[cur_kf->index_ - i].getPose(connected_pose);
             posegraph_visualization->add_edge(pose_w.t_, connected_pose.t_);
-            rit++;
         }
     }
 
@@ -269,13 +337,13 @@ void PoseGraph::loadKeyFrame(KeyFrame *cur_kf, bool flag_detect_loop)
         Pose connected_pose; 
         connected_KF->getPose(connected_pose);
         //printf("add loop into visual \n");
-        posegraph_visualization->add_loopedge(pose_w.t_, connected_pose.t_ + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
+        posegraph_visualization->add_loopedge(pose_w.t_, connected_pose.t_ + Vector3d(config_.visualization_shift_x_, config_.visualization_shift_y_, 0));
     }
     */
 
-    keyframelist_.push_back(cur_kf);
     publish();
     m_keyframelist.unlock();
+    enforceCloudBudget();
 }
 
 std::pair<int, double> PoseGraph::detectLoop(const KeyFrame *keyframe, const int que_index)
@@ -297,23 +365,19 @@ std::pair<int, double> PoseGraph::detectLoop(const KeyFrame *keyframe, const int
     {
         int match_index = detect_result.first;
         Eigen::Vector3d t_que = keyframe->pose_w_.t_;
-        Eigen::Vector3d t_match;
-        list<KeyFrame *>::iterator it;
-        for (it = keyframelist_.begin(); it != keyframelist_.end(); it++)
+        const KeyFrame *match_kf = getKeyFrame(match_index);
+        // check if the candidate loop is to far
+        if (!match_kf)
         {
-            if ((*it)->index_ == match_index)
-            {
-                t_match = (*it)->pose_w_.t_;
-                break;
-            }
+            printf("loop reject since keyframe %d is not in the pose graph\n", match_index);
+            detect_result.first = -1;
         }
-        // check if the candidate loop is to far
-        if ((t_que - t_match).norm() > LOOP_DISTANCE_THRESHOLD)
+        else if ((t_que - match_kf->pose_w_.t_).norm() > config_.loop_distance_threshold_)
         {
-            printf("loop reject since distance is far: %f\n", (t_que - t_match).norm());
+            printf("loop reject since distance is far: %f\n", (t_que - match_kf->pose_w_.t_).norm());
             detect_result.first = -1;
         }
-        // if (VISUALIZE_IMAGE)
+        // if (config_.visualize_image_)
         // {
         //     cv::Mat tmp1_image = sc_manager_.getScanContextImage(que_index);
         //     cv::Mat tmp2_image = sc_manager_.getScanContextImage(match_index);
@@ -342,7 +406,7 @@ std::pair<bool, int> PoseGraph::checkTemporalConsistency(const int &que_index,
     //     redetect_result.second = qr.yaw_diff_rad_;
     //     int rematch_index = redetect_result.first;
     //     // std::cout << "reque_index: " << reque_index << std::endl;
-    //     if ((rematch_index == -1) || (abs(match_index - rematch_index) > LOOP_TEMPORAL_CONSISTENCY_THRESHOLD))
+    //     if ((rematch_index == -1) || (abs(match_index - rematch_index) > config_.loop_temporal_consistency_threshold_))
     //     {
     //         tc_flag = false;
     //         printf("%d <-> %d\n", match_index, rematch_index);
@@ -360,99 +424,545 @@ std::pair<bool, int> PoseGraph::checkTemporalConsistency(const int &que_index,
     return make_pair(tc_flag, match_index);
 }
 
-// all point clouds are transformed into the map (local) frame
-void PoseGraph::constructLocalMap(const KeyFrame *cur_kf,
-                                  const int &que_index,
-                                  const int &match_index,
-                                  const Pose &pose_ini)
+void PoseGraph::pushLoopCandidate(const LoopCandidate &candidate)
 {
+    m_loop_buf.lock();
+    // a pending candidate matched to the same place is superseded by the newer query
+    for (auto it = loop_buf_.begin(); it != loop_buf_.end();)
+    {
+        if (abs(it->match_index_ - candidate.match_index_) <= config_.loop_history_search_num_)
+        {
+            printf("[PoseGraph] cancel loop candidate %d <-> %d\n", it->que_index_, it->match_index_);
+            it = loop_buf_.erase(it);
+            loop_cancel_cnt_++;
+        }
+        else
+        {
+            it++;
+        }
+    }
+    // drop the oldest candidates if the verification falls behind
+    while (static_cast<int>(loop_buf_.size()) >= config_.loop_verify_queue_size_)
+    {
+        printf("[PoseGraph] drop loop candidate %d <-> %d\n", loop_buf_.front().que_index_, loop_buf_.front().match_index_);
+        loop_buf_.pop_front();
+        loop_cancel_cnt_++;
+    }
+    loop_buf_.push_back(candidate);
+    m_loop_buf.unlock();
+    con_loop_buf_.notify_one();
+}
+
+void PoseGraph::verifyLoop()
+{
+    LoopVerifier verifier;
+    verifier.loop_reg_.setParameter(config_.registration_);
+    common::timing::Trace::SetThreadName("loop_verify");
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_loop_buf);
+        con_loop_buf_.wait(lock, [&] { return !loop_buf_.empty(); });
+        LoopCandidate candidate = loop_buf_.front();
+        loop_buf_.pop_front();
+        loop_verify_busy_++;
+        lock.unlock();
+
+        // set the initial guess using the yaw
+        Eigen::Quaterniond q_ini(Eigen::AngleAxisd(candidate.yaw_diff_rad_, Eigen::Vector3d::UnitZ()));
+        Eigen::Vector3d t_ini = Eigen::Vector3d::Zero();
+        Pose pose_ini_map_kf(q_ini, t_ini);
+        common::timing::Trace::SetFrame(candidate.que_time_);
+
+        // check geometric consistency
+        common::timing::Timer t_check_gc(TIMING_HANDLE("loop_check_gc"));
+        std::pair<bool, Pose> reg_result = checkGeometricConsistency(verifier, candidate, pose_ini_map_kf);
+        printf("check geoometryc consistency %fs\n", t_check_gc.Stop());
+        if (!reg_result.first)
+        {
+            printf("loop reject with geometry verificiation\n");
+        }
+        else
+        {
+            m_keyframelist.lock();
+            getKeyFrame(candidate.que_index_)->updateLoopInfo(candidate.match_index_, reg_result.second);
+            *laser_cloud_surf_ = *verifier.laser_cloud_surf_;
+            *laser_cloud_surf_from_map_ds_ = *verifier.submap_->surf_cloud_ds_;
+
+            // perform pose graph optimization, queued before m_keyframelist is released so that
+            // optimizePoseGraph sees a loop either in optimize_buf_ or already popped
+            m_optimize_buf.lock();
+            if (earliest_loop_index_ > candidate.match_index_ || earliest_loop_index_ == -1)
+                earliest_loop_index_ = candidate.match_index_;
+            optimize_buf_.push_back(candidate.que_index_);
+            m_optimize_buf.unlock();
+            m_keyframelist.unlock();
+        }
+
+        double latency = candidate.t_candidate_.toc();
+        lock.lock();
+        loop_verify_busy_--;
+        loop_verify_cnt_++;
+        loop_accept_cnt_ += reg_result.first ? 1 : 0;
+        loop_latency_sum_ += latency;
+        loop_latency_max_ = std::max(loop_latency_max_, latency);
+        for (int i = 0; i < NUM_LOOP_VERIFY_STAGE; i++)
+        {
+            if (verifier.stage_result_[i] < 0)
+                continue;
+            LoopStageStatistics &stat = loop_stage_stat_[i];
+            stat.try_cnt_++;
+            stat.accept_cnt_ += verifier.stage_result_[i];
+            stat.time_sum_ += verifier.stage_time_[i];
+            stat.time_max_ = std::max(stat.time_max_, verifier.stage_time_[i]);
+        }
+        printf("[PoseGraph] loop %d <-> %d verification latency: %fms, queue: %lu\n",
+               candidate.que_index_, candidate.match_index_, latency, loop_buf_.size());
+        lock.unlock();
+    }
+}
+
+// downsample the keyframe clouds once, the clouds not in memory are decoded first
+void PoseGraph::prepareKeyFrameCloud(KeyFrame *keyframe)
+{
+    keyframe->loadCloud();
+    if (keyframe->surf_cloud_ds_ && keyframe->corner_cloud_ds_)
+        return;
+    pcl::VoxelGrid<pcl::PointXYZI> down_size_filter;
+    down_size_filter.setLeafSize(LOOP_MAP_LEAF_SIZE, LOOP_MAP_LEAF_SIZE, LOOP_MAP_LEAF_SIZE);
+    keyframe->surf_cloud_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    down_size_filter.setInputCloud(keyframe->surf_cloud_);
+    down_size_filter.filter(*keyframe->surf_cloud_ds_);
+    keyframe->corner_cloud_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    down_size_filter.setInputCloud(keyframe->corner_cloud_);
+    down_size_filter.filter(*keyframe->corner_cloud_ds_);
+}
+
+// prepare the clouds of a keyframe in the list, called with the keyframe list locked
+void PoseGraph::loadKeyFrameCloud(KeyFrame *keyframe)
+{
+    const bool loaded = keyframe->isCloudLoaded();
+    const size_t bytes = keyframe->getCloudBytes();
+    prepareKeyFrameCloud(keyframe);
+    resident_cloud_bytes_ += keyframe->getCloudBytes() - bytes;
+    if (!loaded) num_resident_cloud_++;
+}
+
+// mark the clouds as recently used, called with the keyframe list locked
+void PoseGraph::touchKeyFrameCloud(KeyFrame *keyframe)
+{
+    cloud_access_tick_++;
+    keyframe->last_access_ = cloud_access_tick_;
+}
+
+// spill the least recently used keyframe clouds to disk when the resident clouds exceed config_.loop_cloud_memory_budget_,
+// down to CLOUD_BUDGET_SPILL_RATIO of it so that the keyframe list is only scanned once per batch of spills.
+// the most recent keyframes which form the query of the next candidates are always kept.
+// the scan context, FPFH and poses are not counted and stay in memory
+void PoseGraph::enforceCloudBudget()
+{
+    TicToc t_spill;
+    const size_t budget = static_cast<size_t>(std::max(config_.loop_cloud_memory_budget_, 0)) * 1024 * 1024;
+    if (budget == 0 || spill_disabled_)
+    {
+        reportCloudMemory(0, 0.0);
+        return;
+    }
+    std::vector<std::pair<uint64_t, int> > lru; // (last_access_, index_)
+    std::vector<KeyFrame *> victims;
+    std::vector<uint64_t> victims_access;
+    std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> victims_cloud;
+    m_keyframelist.lock();
+    if (resident_cloud_bytes_ <= budget)
+    {
+        m_keyframelist.unlock();
+        reportCloudMemory(0, 0.0);
+        return;
+    }
+    const int num_keyframe = static_cast<int>(keyframelist_.size());
+    for (int k = 0; k < num_keyframe - config_.loop_history_search_num_ - 1; k++)
+    {
+        const KeyFrame &tmp_kf = keyframelist_[k];
+        if (tmp_kf.isCloudLoaded())
+            lru.push_back(std::make_pair(tmp_kf.last_access_, k));
+    }
+    std::sort(lru.begin(), lru.end());
+    const size_t budget_spill = static_cast<size_t>(budget * CLOUD_BUDGET_SPILL_RATIO);
+    size_t bytes = resident_cloud_bytes_;
+    for (size_t i = 0; i < lru.size() && bytes > budget_spill; i++)
+    {
+        KeyFrame *tmp_kf = &keyframelist_[lru[i].second];
+        bytes -= tmp_kf->getCloudBytes();
+        victims.push_back(tmp_kf);
+        victims_access.push_back(tmp_kf->last_access_);
+        if (tmp_kf->storage_)
+        {
+            victims_cloud.resize(victims_cloud.size() + NUM_CLOUD_TYPE);
+            continue;
+        }
+        victims_cloud.push_back(tmp_kf->surf_cloud_);
+        victims_cloud.push_back(tmp_kf->corner_cloud_);
+        victims_cloud.push_back(tmp_kf->full_cloud_);
+        victims_cloud.push_back(tmp_kf->outlier_cloud_);
+    }
+    m_keyframelist.unlock();
+
+    if (!victims.empty() && !cloud_segment_)
+    {
+        cloud_segment_.reset(new CloudSegmentFile());
+        if (!cloud_segment_->open(config_.output_folder_ + "loop_cloud_segment.bin", config_.loop_save_codec_))
+        {
+            printf("[PoseGraph] cannot spill the keyframe clouds, the memory budget is disabled\n");
+            cloud_segment_.reset();
+            spill_disabled_ = true;
+            return;
+        }
+    }
+
+    // the clouds are not changed after insertion, write them without holding the lock.
+    // the keyframes loaded from a saved pose graph are only released as their clouds are already in storage
+    std::vector<int> victims_id(victims.size(), -1);
+    for (size_t i = 0; i < victims.size(); i++)
+    {
+        if (!victims_cloud[NUM_CLOUD_TYPE * i])
+            continue;
+        const pcl::PointCloud<pcl::PointXYZI> *clouds[NUM_CLOUD_TYPE];
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+            clouds[type] = victims_cloud[NUM_CLOUD_TYPE * i + type].get();
+        victims_id[i] = cloud_segment_->append(clouds);
+        if (victims_id[i] < 0)
+            break;
+    }
+    victims_cloud.clear();
+
+    int num_spill = 0;
+    m_keyframelist.lock();
+    for (size_t i = 0; i < victims.size(); i++)
+    {
+        KeyFrame *tmp_kf = victims[i];
+        if (!tmp_kf->storage_)
+        {
+            if (victims_id[i] < 0)
+                continue;
+            tmp_kf->storage_ = cloud_segment_;
+            tmp_kf->storage_id_ = victims_id[i];
+        }
+        // used by the verification in the meantime
+        if (tmp_kf->last_access_ != victims_access[i])
+            continue;
+        resident_cloud_bytes_ -= tmp_kf->getCloudBytes();
+        tmp_kf->releaseCloud();
+        num_resident_cloud_--;
+        num_spill++;
+    }
+    m_keyframelist.unlock();
+    reportCloudMemory(num_spill, t_spill.toc());
+}
+
+// print the memory of the keyframe clouds (and write it with config_.result_save_) after a spill and
+// every CLOUD_MEMORY_REPORT_INTERVAL keyframes, called by the thread adding keyframes
+void PoseGraph::reportCloudMemory(const int &num_spill, const double &spill_time)
+{
+    if (num_spill == 0 && global_index_ % CLOUD_MEMORY_REPORT_INTERVAL != 0)
+        return;
+    m_keyframelist.lock();
+    const int num_keyframe = static_cast<int>(keyframelist_.size());
+    const int num_resident = num_resident_cloud_;
+    const size_t resident_bytes = resident_cloud_bytes_;
+    m_keyframelist.unlock();
+
+    double rss = getResidentMemory();
+    size_t segment_bytes = cloud_segment_ ? cloud_segment_->bytesWritten() : 0;
+    printf("[PoseGraph] keyframe clouds in memory: %d/%d, %fMB, spill %d: %fms, segment file: %fMB, rss: %fMB\n",
+           num_resident, num_keyframe, resident_bytes / 1e6, num_spill, spill_time, segment_bytes / 1e6, rss);
+    if (config_.result_save_)
+    {
+        ofstream memory_file(config_.loop_memory_path_, memory_report_cnt_ == 0 ? ios::out : ios::app);
+        memory_file.setf(ios::fixed, ios::floatfield);
+        memory_file.precision(3);
+        memory_file << num_keyframe << " " << num_resident << " "
+                    << resident_bytes / 1e6 << " " << segment_bytes / 1e6 << " " << rss << std::endl;
+        memory_file.close();
+    }
+    memory_report_cnt_++;
+}
+
+std::shared_ptr<const FPFHCloud> PoseGraph::computeKeyFrameFPFH(const pcl::PointCloud<pcl::PointXYZI>::Ptr &surf_cloud_ds)
+{
+    std::shared_ptr<FPFHCloud> fpfh_cloud(new FPFHCloud());
+    LoopRegistration::computeFPFH(surf_cloud_ds, config_.registration_, *fpfh_cloud);
+    return fpfh_cloud;
+}
+
+// compute the FPFH of the keyframes used for the first time, and cache them for the later candidates.
+// each keyframe is described alone, which approximates the FPFH of the submap (see LoopRegistration::mergeFPFH)
+int PoseGraph::updateKeyFrameFPFH(const std::vector<KeyFrame *> &kfs,
+                                  const std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> &surf_cloud_ds,
+                                  std::vector<std::shared_ptr<const FPFHCloud> > &fpfh)
+{
+    int num_new_fpfh = 0;
+    for (size_t j = 0; j < kfs.size(); j++)
+        if (!fpfh[j])
+        {
+            fpfh[j] = computeKeyFrameFPFH(surf_cloud_ds[j]);
+            num_new_fpfh++;
+        }
+    if (num_new_fpfh > 0)
+    {
+        m_keyframelist.lock();
+        for (size_t j = 0; j < kfs.size(); j++)
+            if (!kfs[j]->fpfh_cloud_) kfs[j]->fpfh_cloud_ = fpfh[j];
+        m_keyframelist.unlock();
+    }
+    return num_new_fpfh;
+}
+
+std::shared_ptr<const LoopSubmap> PoseGraph::getLoopSubmap(const int &match_index,
+                                                           const int &begin_index,
+                                                           const int &end_index,
+                                                           const int &version)
+{
+    std::lock_guard<std::mutex> lock(m_submap_cache);
+    for (auto it = submap_cache_.begin(); it != submap_cache_.end(); it++)
+    {
+        const LoopSubmap &submap = **it;
+        if (submap.match_index_ == match_index && submap.begin_index_ == begin_index &&
+            submap.end_index_ == end_index && submap.version_ == version)
+        {
+            // move to the front as the most recently used
+            submap_cache_.splice(submap_cache_.begin(), submap_cache_, it);
+            submap_hit_cnt_++;
+            return submap_cache_.front();
+        }
+    }
+    submap_miss_cnt_++;
+    return std::shared_ptr<const LoopSubmap>();
+}
+
+void PoseGraph::insertLoopSubmap(const std::shared_ptr<const LoopSubmap> &submap)
+{
+    std::lock_guard<std::mutex> lock(m_submap_cache);
+    // the outdated submap of the same match keyframe is replaced
+    for (auto it = submap_cache_.begin(); it != submap_cache_.end(); it++)
+    {
+        if ((*it)->match_index_ == submap->match_index_)
+        {
+            submap_cache_.erase(it);
+            break;
+        }
+    }
+    submap_cache_.push_front(submap);
+    while (submap_cache_.size() > SUBMAP_CACHE_SIZE)
+        submap_cache_.pop_back();
+}
+
+// the model submap in the frame of the match keyframe
+std::shared_ptr<const LoopSubmap> PoseGraph::buildLoopSubmap(LoopVerifier &verifier,
+                                                             const int &match_index,
+                                                             const int &begin_index,
+                                                             const int &end_index)
+{
+    std::shared_ptr<LoopSubmap> submap(new LoopSubmap());
+    submap->match_index_ = match_index;
+    submap->begin_index_ = begin_index;
+    submap->end_index_ = end_index;
+    submap->surf_cloud_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    submap->corner_cloud_ds_.reset(new pcl::PointCloud<pcl::PointXYZI>());
+
+    // the clouds may be released by enforceCloudBudget() once the lock is unlocked, keep their pointers
+    std::vector<KeyFrame *> match_kfs;
+    std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> match_surf_ds, match_corner_ds;
+    std::vector<std::shared_ptr<const FPFHCloud> > match_fpfh;
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > match_T;
+    m_keyframelist.lock();
+    const KeyFrame *old_kf = getKeyFrame(match_index);
+    for (int k = begin_index; k < end_index; k++)
+    {
+        KeyFrame *tmp_kf = getKeyFrame(k);
+        if (!tmp_kf)
+            continue;
+        loadKeyFrameCloud(tmp_kf);
+        touchKeyFrameCloud(tmp_kf);
+        match_kfs.push_back(tmp_kf);
+        match_surf_ds.push_back(tmp_kf->surf_cloud_ds_);
+        match_corner_ds.push_back(tmp_kf->corner_cloud_ds_);
+        match_fpfh.push_back(tmp_kf->fpfh_cloud_);
+        match_T.push_back(old_kf->pose_w_.T_.inverse() * tmp_kf->pose_w_.T_);
+    }
+    submap->version_ = pose_graph_version_;
+    m_keyframelist.unlock();
+
+    common::timing::Timer t_fpfh(TIMING_HANDLE("loop_map_fpfh"));
+    int num_new_fpfh = updateKeyFrameFPFH(match_kfs, match_surf_ds, match_fpfh);
+    printf("[loop_closure] compute fpfh of %d/%lu map keyframes: %fms\n", num_new_fpfh, match_kfs.size(), t_fpfh.Stop() * 1000);
+
+    verifier.voxels_.clear();
+    for (size_t j = 0; j < match_kfs.size(); j++)
+        LoopRegistration::mergeFPFH(*match_fpfh[j], match_T[j].cast<float>(), LOOP_MAP_LEAF_SIZE, verifier.voxels_, submap->fpfh_cloud_);
+
     pcl::PointCloud<pcl::PointXYZI> surf_trans, corner_trans;
+    verifier.laser_cloud_surf_from_map_->clear();
+    verifier.laser_cloud_corner_from_map_->clear();
+    for (size_t j = 0; j < match_kfs.size(); j++)
+    {
+        pcl::transformPointCloud(*match_surf_ds[j], surf_trans, match_T[j].cast<float>());
+        *verifier.laser_cloud_surf_from_map_ += surf_trans;
+        pcl::transformPointCloud(*match_corner_ds[j], corner_trans, match_T[j].cast<float>());
+        *verifier.laser_cloud_corner_from_map_ += corner_trans;
+    }
+    verifier.down_size_filter_surf_map_.setInputCloud(verifier.laser_cloud_surf_from_map_);
+    verifier.down_size_filter_surf_map_.filter(*submap->surf_cloud_ds_);
+    verifier.down_size_filter_corner_map_.setInputCloud(verifier.laser_cloud_corner_from_map_);
+    verifier.down_size_filter_corner_map_.filter(*submap->corner_cloud_ds_);
+    return submap;
+}
 
-    // construct the keyframe point cloud
-    laser_cloud_surf_->clear();
-    laser_cloud_corner_->clear();
-    for (int j = -LOOP_HISTORY_SEARCH_NUM; j <= 0; j++)
+// all point clouds are transformed into the map (local) frame
+void PoseGraph::constructLocalMap(LoopVerifier &verifier,
+                                  const LoopCandidate &candidate,
+                                  const Pose &pose_ini)
+{
+    const int &que_index = candidate.que_index_;
+    const int &match_index = candidate.match_index_;
+    const int match_begin = std::max(0, match_index - config_.loop_history_search_num_);
+    const int match_end = std::min(que_index, match_index + config_.loop_history_search_num_ + 1);
+
+    // the keyframe clouds are not changed after insertion, but the poses are updated by the pose graph optimization:
+    // collect the clouds with their relative poses under the lock, and transform the clouds outside it
+    std::vector<KeyFrame *> que_kfs;
+    std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> que_surf_ds, que_corner_ds;
+    std::vector<std::shared_ptr<const FPFHCloud> > que_fpfh;
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > que_T;
+    m_keyframelist.lock();
+    const KeyFrame *cur_kf = getKeyFrame(que_index);
+    for (int j = -config_.loop_history_search_num_; j <= 0; j++)
     {
         if (que_index + j < 0)
             continue;
         KeyFrame *tmp_kf = getKeyFrame(que_index + j);
         if (!tmp_kf)
             continue;
+        loadKeyFrameCloud(tmp_kf);
+        touchKeyFrameCloud(tmp_kf);
         Eigen::Matrix4d T_relative = cur_kf->pose_w_.T_.inverse() * tmp_kf->pose_w_.T_;
-        Eigen::Matrix4d T_ini_map_kf = pose_ini.T_ * T_relative;
-        pcl::transformPointCloud(*tmp_kf->surf_cloud_, surf_trans, T_ini_map_kf.cast<float>());
-        *laser_cloud_surf_ += surf_trans;
-        pcl::transformPointCloud(*tmp_kf->corner_cloud_, corner_trans, T_ini_map_kf.cast<float>());
-        *laser_cloud_corner_ += corner_trans;
-    }
-    down_size_filter_surf_map_.setInputCloud(laser_cloud_surf_);
-    down_size_filter_surf_map_.filter(*laser_cloud_surf_ds_);
-    down_size_filter_corner_map_.setInputCloud(laser_cloud_corner_);
-    down_size_filter_corner_map_.filter(*laser_cloud_corner_ds_);
-    printf("[loop_closure] kf surf num: %lu, corner num: %lu\n", laser_cloud_surf_ds_->size(), laser_cloud_corner_ds_->size());
-
-    // construct the model point cloud
-    laser_cloud_surf_from_map_->clear();
-    laser_cloud_corner_from_map_->clear();
-    KeyFrame *old_kf = getKeyFrame(match_index); // check NULL
-    for (int j = -LOOP_HISTORY_SEARCH_NUM; j <= LOOP_HISTORY_SEARCH_NUM; j++)
-    {
-        if (match_index + j < 0 || match_index + j >= que_index)
-            continue;
-        KeyFrame *tmp_kf = getKeyFrame(match_index + j);
-        if (!tmp_kf)
-            continue;
-        Eigen::Matrix4d T_relative = old_kf->pose_w_.T_.inverse() * tmp_kf->pose_w_.T_;
-        pcl::transformPointCloud(*tmp_kf->surf_cloud_, surf_trans, T_relative.cast<float>());
-        *laser_cloud_surf_from_map_ += surf_trans;
-        pcl::transformPointCloud(*tmp_kf->corner_cloud_, corner_trans, T_relative.cast<float>());
-        *laser_cloud_corner_from_map_ += corner_trans;
+        que_kfs.push_back(tmp_kf);
+        que_surf_ds.push_back(tmp_kf->surf_cloud_ds_);
+        que_corner_ds.push_back(tmp_kf->corner_cloud_ds_);
+        que_fpfh.push_back(tmp_kf->fpfh_cloud_);
+        que_T.push_back(pose_ini.T_ * T_relative);
     }
-    down_size_filter_surf_map_.setInputCloud(laser_cloud_surf_from_map_);
-    down_size_filter_surf_map_.filter(*laser_cloud_surf_from_map_ds_);
-    down_size_filter_corner_map_.setInputCloud(laser_cloud_corner_from_map_);
-    down_size_filter_corner_map_.filter(*laser_cloud_corner_from_map_ds_);
+    int version = pose_graph_version_;
+    m_keyframelist.unlock();
 
-    size_t laser_cloud_surf_from_map_num = laser_cloud_surf_from_map_ds_->size();
-    size_t laser_cloud_corner_from_map_num = laser_cloud_corner_from_map_ds_->size();
-    printf("[loop_closure] map surf num: %lu, corner num: %lu\n", laser_cloud_surf_from_map_num, laser_cloud_corner_from_map_num);
+    // the model submap is shared by the candidates of the same match keyframe until the poses are optimized
+    verifier.submap_ = getLoopSubmap(match_index, match_begin, match_end, version);
+    if (!verifier.submap_)
+    {
+        verifier.submap_ = buildLoopSubmap(verifier, match_index, match_begin, match_end);
+        insertLoopSubmap(verifier.submap_);
+    }
+    else
+    {
+        printf("[loop_closure] reuse the map of keyframe %d\n", match_index);
+    }
+
+    common::timing::Timer t_fpfh(TIMING_HANDLE("loop_kf_fpfh"));
+    int num_new_fpfh = updateKeyFrameFPFH(que_kfs, que_surf_ds, que_fpfh);
+    printf("[loop_closure] compute fpfh of %d/%lu keyframes: %fms\n", num_new_fpfh, que_kfs.size(), t_fpfh.Stop() * 1000);
+    verifier.fpfh_cloud_.clear();
+    verifier.voxels_.clear();
+    for (size_t j = 0; j < que_kfs.size(); j++)
+        LoopRegistration::mergeFPFH(*que_fpfh[j], que_T[j].cast<float>(), LOOP_MAP_LEAF_SIZE, verifier.voxels_, verifier.fpfh_cloud_);
+
+    // construct the keyframe point cloud
+    pcl::PointCloud<pcl::PointXYZI> surf_trans, corner_trans;
+    verifier.laser_cloud_surf_->clear();
+    verifier.laser_cloud_corner_->clear();
+    for (size_t j = 0; j < que_kfs.size(); j++)
+    {
+        pcl::transformPointCloud(*que_surf_ds[j], surf_trans, que_T[j].cast<float>());
+        *verifier.laser_cloud_surf_ += surf_trans;
+        pcl::transformPointCloud(*que_corner_ds[j], corner_trans, que_T[j].cast<float>());
+        *verifier.laser_cloud_corner_ += corner_trans;
+    }
+    verifier.down_size_filter_surf_map_.setInputCloud(verifier.laser_cloud_surf_);
+    verifier.down_size_filter_surf_map_.filter(*verifier.laser_cloud_surf_ds_);
+    verifier.down_size_filter_corner_map_.setInputCloud(verifier.laser_cloud_corner_);
+    verifier.down_size_filter_corner_map_.filter(*verifier.laser_cloud_corner_ds_);
+    printf("[loop_closure] kf surf num: %lu, corner num: %lu\n", verifier.laser_cloud_surf_ds_->size(), verifier.laser_cloud_corner_ds_->size());
+    printf("[loop_closure] map surf num: %lu, corner num: %lu\n", verifier.submap_->surf_cloud_ds_->size(), verifier.submap_->corner_cloud_ds_->size());
+    printf("[loop_closure] fpfh kf num: %lu, map num: %lu\n", verifier.fpfh_cloud_.size(), verifier.submap_->fpfh_cloud_.size());
 }
 
-std::pair<bool, Pose> PoseGraph::checkGeometricConsistency(const KeyFrame *cur_kf,
-                                                           const int &que_index,
-                                                           const int &match_index,
+std::pair<bool, Pose> PoseGraph::checkGeometricConsistency(LoopVerifier &verifier,
+                                                           const LoopCandidate &candidate,
                                                            const Pose &pose_ini)
 {
-    assert(que_index < 0);
-    assert(match_index < 0);
+    const int &que_index = candidate.que_index_;
+    assert(que_index >= 0);
+    assert(candidate.match_index_ >= 0);
 
     // map constrcution: give initial transformation on the kf
-    TicToc t_map_construction;
-    constructLocalMap(cur_kf, que_index, match_index, pose_ini);
-    printf("[loop_closure] map construction: %fms\n", t_map_construction.toc()); // 47ms
-
-    // global registration: initial guess is identity
-    TicToc t_global_reg;
-    std::pair<bool, Eigen::Matrix4d> global_reg_result =
-        loop_reg_.performGlobalRegistration(laser_cloud_surf_from_map_ds_,
-                                            laser_cloud_surf_ds_);
-    printf("global registration: %fs\n", t_global_reg.toc() / 1000);
-    Pose pose_global(global_reg_result.second.cast<double>());
-    if (!global_reg_result.first)
-    {
-        printf("loop reject in global registration ...\n");
-        return make_pair(false, pose_global);
-    }
-
-    // lobal registration: initial guess is the result of global registration
-    TicToc t_local_reg;
-    std::pair<bool, Eigen::Matrix4d> local_reg_result =
-        loop_reg_.performLocalRegistration(laser_cloud_surf_from_map_ds_,
-                                           laser_cloud_corner_from_map_ds_,
-                                           laser_cloud_surf_ds_,
-                                           laser_cloud_corner_ds_,
-                                           global_reg_result.second);
-    printf("local registration: %fs\n", t_local_reg.toc() / 1000);
+    common::timing::Timer t_map_construction(TIMING_HANDLE("loop_map_construction"));
+    constructLocalMap(verifier, candidate, pose_ini);
+    printf("[loop_closure] map construction: %fms\n", t_map_construction.Stop() * 1000); // 47ms
+
+    for (int i = 0; i < NUM_LOOP_VERIFY_STAGE; i++)
+    {
+        verifier.stage_result_[i] = -1;
+        verifier.stage_time_[i] = 0.0;
+    }
+
+    // yaw prior: the keyframe clouds are rotated by the scan context yaw, refine it by the local registration directly.
+    // the result is accepted if the aligned clouds overlap enough, otherwise the global registration is performed
+    std::pair<bool, Eigen::Matrix4d> local_reg_result(false, Eigen::Matrix4d::Identity());
+    if (config_.loop_yaw_prior_overlap_threshold_ > 0)
+    {
+        common::timing::Timer t_yaw_prior_reg(TIMING_HANDLE("loop_yaw_prior_reg"));
+        local_reg_result = verifier.loop_reg_.performLocalRegistration(verifier.submap_->surf_cloud_ds_,
+                                                                       verifier.submap_->corner_cloud_ds_,
+                                                                       verifier.laser_cloud_surf_ds_,
+                                                                       verifier.laser_cloud_corner_ds_,
+                                                                       Eigen::Matrix4d::Identity());
+        double overlap = 0.0;
+        if (local_reg_result.first)
+        {
+            overlap = LoopRegistration::computeOverlap(verifier.submap_->surf_cloud_ds_, verifier.laser_cloud_surf_ds_,
+                                                       local_reg_result.second, LOOP_OVERLAP_DISTANCE);
+            local_reg_result.first = overlap >= config_.loop_yaw_prior_overlap_threshold_;
+        }
+        verifier.stage_result_[STAGE_YAW_PRIOR] = local_reg_result.first ? 1 : 0;
+        verifier.stage_time_[STAGE_YAW_PRIOR] = t_yaw_prior_reg.Stop() * 1000;
+        printf("[loop_closure] yaw prior registration: %fms, cost: %f, overlap: %f\n",
+               verifier.stage_time_[STAGE_YAW_PRIOR], verifier.loop_reg_.opti_cost_, overlap);
+    }
+
+    if (!local_reg_result.first)
+    {
+        // global registration: initial guess is identity
+        common::timing::Timer t_global_reg(TIMING_HANDLE("loop_global_reg"));
+        std::pair<bool, Eigen::Matrix4d> global_reg_result =
+            verifier.loop_reg_.performGlobalRegistration(verifier.submap_->fpfh_cloud_, verifier.fpfh_cloud_);
+        verifier.stage_result_[STAGE_GLOBAL_REG] = global_reg_result.first ? 1 : 0;
+        verifier.stage_time_[STAGE_GLOBAL_REG] = t_global_reg.Stop() * 1000;
+        printf("global registration: %fs\n", verifier.stage_time_[STAGE_GLOBAL_REG] / 1000);
+        Pose pose_global(global_reg_result.second.cast<double>());
+        if (!global_reg_result.first)
+        {
+            printf("loop reject in global registration ...\n");
+            return make_pair(false, pose_global);
+        }
+
+        // lobal registration: initial guess is the result of global registration
+        common::timing::Timer t_local_reg(TIMING_HANDLE("loop_local_reg"));
+        local_reg_result = verifier.loop_reg_.performLocalRegistration(verifier.submap_->surf_cloud_ds_,
+                                                                       verifier.submap_->corner_cloud_ds_,
+                                                                       verifier.laser_cloud_surf_ds_,
+                                                                       verifier.laser_cloud_corner_ds_,
+                                                                       global_reg_result.second);
+        verifier.stage_result_[STAGE_LOCAL_REG] = local_reg_result.first ? 1 : 0;
+        verifier.stage_time_[STAGE_LOCAL_REG] = t_local_reg.Stop() * 1000;
+        printf("local registration: %fs\n", verifier.stage_time_[STAGE_LOCAL_REG] / 1000);
+    }
     Pose pose_icp(local_reg_result.second * pose_ini.T_);
     if (!local_reg_result.first)
     {
@@ -461,14 +971,14 @@ std::pair<bool, Pose> PoseGraph::checkGeometricConsistency(const KeyFrame *cur_k
     }
     std::cout << "Find loop, relative transformation: " << pose_icp << std::endl;
 
-    if (LOOP_SAVE_PCD)
+    if (config_.loop_save_pcd_)
     {
         pcl::PointCloud<pcl::PointXYZI> surf_trans, corner_trans;
-        pcl::transformPointCloud(*laser_cloud_surf_ds_, surf_trans, local_reg_result.second.cast<float>());
-        // pcl::transformPointCloud(*laser_cloud_corner_ds_, corner_trans, local_reg_result.second.cast<float>());
-        pcd_writer_.write(POSE_GRAPH_SAVE_PATH + to_string(que_index) + "_data.pcd", *laser_cloud_surf_ds_);
-        pcd_writer_.write(POSE_GRAPH_SAVE_PATH + to_string(que_index) + "_data_icp.pcd", surf_trans);
-        pcd_writer_.write(POSE_GRAPH_SAVE_PATH + to_string(que_index) + "_model.pcd", *laser_cloud_surf_from_map_ds_);
+        pcl::transformPointCloud(*verifier.laser_cloud_surf_ds_, surf_trans, local_reg_result.second.cast<float>());
+        // pcl::transformPointCloud(*verifier.laser_cloud_corner_ds_, corner_trans, local_reg_result.second.cast<float>());
+        verifier.pcd_writer_.write(config_.pose_graph_save_path_ + to_string(que_index) + "_data.pcd", *verifier.laser_cloud_surf_ds_);
+        verifier.pcd_writer_.write(config_.pose_graph_save_path_ + to_string(que_index) + "_data_icp.pcd", surf_trans);
+        verifier.pcd_writer_.write(config_.pose_graph_save_path_ + to_string(que_index) + "_model.pcd", *verifier.submap_->surf_cloud_ds_);
     }
     return make_pair(true, pose_icp);
 }
@@ -476,175 +986,123 @@ std::pair<bool, Pose> PoseGraph::checkGeometricConsistency(const KeyFrame *cur_k
 KeyFrame *PoseGraph::getKeyFrame(int index)
 {
     //    unique_lock<mutex> lock(m_keyframelist_);
-    list<KeyFrame *>::iterator it = keyframelist_.begin();
-    for (; it != keyframelist_.end(); it++)
-    {
-        if ((*it)->index_ == index)
-            break;
-    }
-    if (it != keyframelist_.end())
-        return *it;
-    else
+    if (index < 0 || index >= static_cast<int>(keyframelist_.size()))
         return NULL;
+    assert(keyframelist_[index].index_ == index);
+    return &keyframelist_[index];
 }
 
 void PoseGraph::optimizePoseGraph()
 {
+    common::timing::Trace::SetThreadName("loop_pgo");
     while(true)
     {
         int cur_index = -1;
         int first_looped_index = -1;
+        std::vector<int> loop_que_index;
         m_optimize_buf.lock();
         while (!optimize_buf_.empty())
         {
-            cur_index = optimize_buf_.front();
+            cur_index = std::max(cur_index, optimize_buf_.front());
             first_looped_index = earliest_loop_index_;
-            optimize_buf_.pop();
+            loop_que_index.push_back(optimize_buf_.front());
+            optimize_buf_.pop_front();
         }
+        pgo_busy_ = cur_index != -1;
         m_optimize_buf.unlock();
         if (cur_index != -1)
         {
             printf("optimize pose graph \n");
-            TicToc t_pgo;
+            common::timing::Timer t_pgo(TIMING_HANDLE("loop_pgo"));
             m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
-            int max_length = cur_index + 1;
-            double t_array[max_length][3];
-            double q_array[max_length][4];
-            double sequence_array[max_length];
-
-            ceres::Problem problem;
-            ceres::Solver::Options options;
-            options.linear_solver_type = ceres::DENSE_SCHUR;
-            // options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-            //ptions.minimizer_progress_to_stdout = true;
-            //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
-            options.max_num_iterations = 5;
-            ceres::Solver::Summary summary;
-            ceres::LossFunction *loss_function;
-            loss_function = new ceres::HuberLoss(1.0);
-            // loss_function = new ceres::HuberLoss(0.1);
-            //loss_function = new ceres::CauchyLoss(1.0);
-            ceres::LocalParameterization* local_parameterization = new ceres::QuaternionParameterization();
-
-            list<KeyFrame*>::iterator it;
-            int i = 0; // the index of the array
-            for (it = keyframelist_.begin(); it != keyframelist_.end(); it++)
+            common::timing::Trace::SetFrame(cur_kf->time_stamp_);
+
+            // the graph is rebuilt only if a loop reaches a keyframe before the first node
+            first_looped_index = std::max(first_looped_index, 0);
+            if (pgo_.empty() || first_looped_index < pgo_.startIndex())
             {
-                if ((*it)->index_ < first_looped_index)
-                    continue;
-                (*it)->local_index_ = i;
-                Pose tmp_pose;
-                (*it)->getPose(tmp_pose);
-                t_array[i][0] = tmp_pose.t_(0);
-                t_array[i][1] = tmp_pose.t_(1);
-                t_array[i][2] = tmp_pose.t_(2);
-                q_array[i][0] = tmp_pose.q_.w();
-                q_array[i][1] = tmp_pose.q_.x();
-                q_array[i][2] = tmp_pose.q_.y();
-                q_array[i][3] = tmp_pose.q_.z();
-                problem.AddParameterBlock(q_array[i], 4, local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
-                if ((*it)->index_ == first_looped_index) 
-                {   
-                    problem.SetParameterBlockConstant(q_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
-                }
+                printf("[PoseGraph] rebuild pose graph from keyframe %d\n", first_looped_index);
+                pgo_.reset(first_looped_index);
+            }
+            int end_index = pgo_.endIndex();
 
-                // add edge between previous frames
-                for (int j = 1; j < 5; j++)
-                {
-                    if (i - j >= 0)
-                    {
-                        Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                        Quaterniond q_i_j = Quaterniond(q_array[i-j][0], q_array[i-j][1], q_array[i-j][2], q_array[i-j][3]);
-                        Quaterniond q_i = Quaterniond(q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]);
-                        relative_t = q_i_j.inverse() * relative_t;
-                        Quaterniond relative_q = q_i_j.inverse() * q_i;
-                        ceres::CostFunction *f = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
-                                                                         relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
-                                                                         0.1, 0.01);
-                        problem.AddResidualBlock(f, NULL, q_array[i-j], t_array[i-j], q_array[i], t_array[i]);
-                    }
-                }
+            // the loops verified since optimize_buf_ was emptied are left to the next optimization,
+            // which also takes their match index into first_looped_index
+            std::unordered_set<int> pending_que_index;
+            m_optimize_buf.lock();
+            pending_que_index.insert(optimize_buf_.begin(), optimize_buf_.end());
+            m_optimize_buf.unlock();
 
+            // append the keyframes since the last optimization, initialized with their current poses
+            for (int k = end_index; k <= cur_index; k++)
+            {
+                KeyFrame *kf = &keyframelist_[k];
+                Pose tmp_pose;
+                kf->getPose(tmp_pose);
+                pgo_.addNode(tmp_pose);
                 // add loop edge
-                if((*it)->has_loop_)
+                if (kf->has_loop_ && !pending_que_index.count(k))
                 {
-                    assert((*it)->loop_index_ >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index_)->local_index_;
-                    Pose pose_relative = (*it)->getLoopRelativePose();
-                    Eigen::Vector3d relative_t = pose_relative.t_;
-                    Eigen::Quaterniond relative_q = pose_relative.q_;
-                    ceres::CostFunction *loop_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
-                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
-                                                                                 0.1, 0.01);
-                    problem.AddResidualBlock(loop_function, loss_function, q_array[connected_index], t_array[connected_index], q_array[i], t_array[i]);                    
-
-                    {
-                        Pose Twci, Twcj;
-                        (*it)->getPose(Twci);
-                        getKeyFrame((*it)->loop_index_)->getPose(Twcj);
-                        Pose rel_pose = Twcj.inverse() * Twci;
-                        std::cout << "est map-kf rel pose: " << rel_pose << std::endl;
-
-                        Pose pose_relative;
-                        pose_relative = (*it)->getLoopRelativePose();
-                        std::cout << "loop map-kf rel pose: " << pose_relative << std::endl;
-                        std::cout << "they should be equal" << std::endl;
-                    }
-
+                    assert(kf->loop_index_ >= first_looped_index);
+                    pgo_.addLoopEdge(k, kf->loop_index_, kf->getLoopRelativePose());
                 }
-                if ((*it)->index_ == cur_index)
-                    break;
-                i++;
             }
-            m_keyframelist.unlock();
-
-            ceres::Solve(options, &problem, &summary);
-            std::cout << summary.BriefReport() << "\n";
-            //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
+            // the loops verified after their keyframes were appended, an edge added above is not added twice
+            for (const int &que_index : loop_que_index)
             {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
+                if (que_index >= end_index)
+                    continue;
+                KeyFrame *kf = &keyframelist_[que_index];
+                pgo_.addLoopEdge(que_index, kf->loop_index_, kf->getLoopRelativePose());
             }
-            */
-            m_keyframelist.lock();
 
-            i = 0;
-            for (it = keyframelist_.begin(); it != keyframelist_.end(); it++)
             {
-                if ((*it)->index_ < first_looped_index)
-                    continue;
-                Quaterniond tmp_q(q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]);
-                Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
-                Pose tmp_pose(tmp_q, tmp_t);
-                (*it)->updatePose(tmp_pose);
-                if ((*it)->index_ == cur_index)
-                    break;
-                i++;
+                Pose Twci, Twcj;
+                cur_kf->getPose(Twci);
+                keyframelist_[cur_kf->loop_index_].getPose(Twcj);
+                Pose rel_pose = Twcj.inverse() * Twci;
+                std::cout << "est map-kf rel pose: " << rel_pose << std::endl;
+
+                Pose pose_relative;
+                pose_relative = cur_kf->getLoopRelativePose();
+                std::cout << "loop map-kf rel pose: " << pose_relative << std::endl;
+                std::cout << "they should be equal" << std::endl;
             }
+            m_keyframelist.unlock();
+
+            // the nodes keep their estimates, so each solve is warm started from the previous one
+            ceres::Solver::Summary summary;
+            pgo_.optimize(summary);
+            std::cout << summary.BriefReport() << "\n";
+            printf("[PoseGraph] pose graph size: %lu, solver time: %fms\n", pgo_.size(), summary.total_time_in_seconds * 1000);
+
+            m_keyframelist.lock();
+            for (int k = pgo_.startIndex(); k <= cur_index; k++)
+                keyframelist_[k].updatePose(pgo_.getPose(k));
+            pose_graph_version_++;
 
             // update the pose in behind frames
             Pose cur_pose_w, last_pose_w;
             cur_kf->getPose(cur_pose_w);
             cur_kf->getLastPose(last_pose_w);
             Pose pose_drift = cur_pose_w * last_pose_w.inverse();
-            it++;
-            for (; it != keyframelist_.end(); it++)
+            for (size_t k = cur_index + 1; k < keyframelist_.size(); k++)
             {
                 Pose update_pose;
-                (*it)->getPose(update_pose);
+                keyframelist_[k].getPose(update_pose);
                 update_pose = pose_drift * update_pose;
-                (*it)->updatePose(update_pose);
+                keyframelist_[k].updatePose(update_pose);
             }
             pgo_flag_ = true;
 
             m_keyframelist.unlock();
             updatePath();
             publishLoopInfo();
-            printf("perform pose graph optimization: %fs\n", t_pgo.toc() / 1000);
+            printf("perform pose graph optimization: %fs\n", t_pgo.Stop());
+            m_optimize_buf.lock();
+            pgo_busy_ = false;
+            m_optimize_buf.unlock();
         }
         std::chrono::milliseconds dura(2000);
         std::this_thread::sleep_for(dura);
@@ -656,50 +1114,114 @@ void PoseGraph::savePoseGraph()
 {
     m_keyframelist.lock();
     TicToc t_save_pose_graph;
-    FILE *pFile;
-    printf("[PoseGraph] pose graph path: %s\n", POSE_GRAPH_SAVE_PATH.c_str());
+    printf("[PoseGraph] pose graph path: %s\n", config_.pose_graph_save_path_.c_str());
     printf("[PoseGraph] pose graph saving %lu keyframes\n", keyframelist_.size());
-    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
-    pFile = fopen(file_path.c_str(),"w");
-    // fprintf(pFile, "index time_stamp px py pz qx qy qz qw loop_index loop_info\n");
-    list<KeyFrame*>::iterator it;
-    for (it = keyframelist_.begin(); it != keyframelist_.end(); it++)
+    // the previous file may still be mapped by the loaded keyframes: write a new file and replace it
+    string file_path = config_.pose_graph_save_path_ + "pose_graph.bin";
+    string tmp_file_path = file_path + ".tmp";
+    PoseGraphWriter writer;
+    if (!writer.open(tmp_file_path, config_.loop_save_codec_))
     {
-        std::string pcd_path;
-        if (LOOP_SAVE_PCD)
-        {
-            // printf("index: %lu, surf cloud size: %lu\n", (*it)->index_, (*it)->surf_cloud_->size());
-            // pcd_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index_) + "_surf_cloud.pcd";
-            // pcd_writer_.write(pcd_path, *(*it)->surf_cloud_);
-            // pcd_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index_) + "_corner_cloud.pcd";
-            // pcd_writer_.write(pcd_path, *(*it)->corner_cloud_);
-            // pcd_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index_) + "_full_cloud.pcd";
-            // pcd_writer_.write(pcd_path, *(*it)->full_cloud_);
-            // pcd_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index_) + "_outlier_cloud.pcd";
-            // pcd_writer_.write(pcd_path, *(*it)->outlier_cloud_);
-        }
-        Pose tmp_pose = (*it)->pose_w_;
-        Pose loop_info = (*it)->loop_info_; // the relative pose
-        fprintf(pFile, " %d %f %f %f %f %f %f %f %f %d %f %f %f %f %f %f %f\n",
-                (*it)->index_, (*it)->time_stamp_,
-                tmp_pose.t_(0), tmp_pose.t_(1), tmp_pose.t_(2),
-                tmp_pose.q_.x(), tmp_pose.q_.y(), tmp_pose.q_.z(), tmp_pose.q_.w(),
-                (*it)->loop_index_,
-                loop_info.t_(0), loop_info.t_(1), loop_info.t_(2),
-                loop_info.q_.x(), loop_info.q_.y(), loop_info.q_.z(), loop_info.q_.w());
-    }
-    fclose(pFile);
-    printf("[PoseGraph] save pose graph time: %fs\n", t_save_pose_graph.toc() / 1000);
+        m_keyframelist.unlock();
+        return;
+    }
+    pcl::PointCloud<pcl::PointXYZI> empty_cloud;
+    bool success = true;
+    for (auto it = keyframelist_.begin(); it != keyframelist_.end() && success; it++)
+    {
+        KeyFrameRecord record;
+        memset(&record, 0, sizeof(KeyFrameRecord));
+        record.index_ = it->index_;
+        record.loop_index_ = it->loop_index_;
+        record.sequence_ = it->sequence_;
+        record.time_stamp_ = it->time_stamp_;
+        const Pose &tmp_pose = it->pose_w_;
+        const Pose &loop_info = it->loop_info_; // the relative pose
+        for (int i = 0; i < 3; i++)
+        {
+            record.pose_w_[i] = tmp_pose.t_(i);
+            record.loop_info_[i] = loop_info.t_(i);
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            record.pose_w_[3 + i] = tmp_pose.q_.coeffs()(i);
+            record.loop_info_[3 + i] = loop_info.q_.coeffs()(i);
+        }
+        if (config_.loop_save_pcd_ && it->storage_)
+        {
+            success = writer.addKeyFrame(record, *it->storage_, it->storage_id_);
+        }
+        else
+        {
+            const pcl::PointCloud<pcl::PointXYZI> *clouds[NUM_CLOUD_TYPE] = {&empty_cloud, &empty_cloud, &empty_cloud, &empty_cloud};
+            if (config_.loop_save_pcd_)
+            {
+                clouds[CLOUD_SURF] = it->surf_cloud_.get();
+                clouds[CLOUD_CORNER] = it->corner_cloud_.get();
+                clouds[CLOUD_FULL] = it->full_cloud_.get();
+                clouds[CLOUD_OUTLIER] = it->outlier_cloud_.get();
+            }
+            success = writer.addKeyFrame(record, clouds);
+        }
+    }
+    success = writer.close() && success;
+    if (success && rename(tmp_file_path.c_str(), file_path.c_str()) == 0)
+        printf("[PoseGraph] save pose graph time: %fs, %fMB\n", t_save_pose_graph.toc() / 1000, writer.bytesWritten() / 1e6);
+    else
+        printf("[PoseGraph] save pose graph error: %s\n", file_path.c_str());
     m_keyframelist.unlock();
 }
 
 void PoseGraph::loadPoseGraph()
 {
     TicToc t_load_posegraph;
-    FILE * pFile;
-    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
+    string file_path = config_.pose_graph_save_path_ + "pose_graph.bin";
     printf("[PoseGraph] load pose graph from: %s \n", file_path.c_str());
     printf("[PoseGraph] pose graph loading...\n");
+    std::shared_ptr<PoseGraphReader> reader(new PoseGraphReader());
+    if (!reader->open(file_path))
+    {
+        // the pose graph saved as text and pcd files by the previous versions
+        loadPoseGraphText();
+        return;
+    }
+    for (size_t id = 0; id < reader->size(); id++)
+    {
+        const KeyFrameRecord &record = reader->getRecord(id);
+        Pose pose_w = Pose(Eigen::Quaterniond(record.pose_w_[6], record.pose_w_[3], record.pose_w_[4], record.pose_w_[5]),
+                           Eigen::Vector3d(record.pose_w_[0], record.pose_w_[1], record.pose_w_[2]));
+        Pose loop_info = Pose(Eigen::Quaterniond(record.loop_info_[6], record.loop_info_[3], record.loop_info_[4], record.loop_info_[5]),
+                              Eigen::Vector3d(record.loop_info_[0], record.loop_info_[1], record.loop_info_[2]));
+        if (record.loop_index_ != -1)
+        {
+            if (earliest_loop_index_ > record.loop_index_ || earliest_loop_index_ == -1)
+            {
+                earliest_loop_index_ = record.loop_index_;
+            }
+        }
+        KeyFrame keyframe(record.time_stamp_,
+                          record.index_,
+                          pose_w,
+                          reader,
+                          id,
+                          record.loop_index_,
+                          loop_info,
+                          record.sequence_);
+        loadKeyFrame(std::move(keyframe), 0);
+        if (id % 20 == 0)
+        {
+            publish();
+        }
+    }
+    printf("[PoseGraph] load pose graph time: %f s\n", t_load_posegraph.toc() / 1000);
+}
+
+void PoseGraph::loadPoseGraphText()
+{
+    TicToc t_load_posegraph;
+    FILE * pFile;
+    string file_path = config_.pose_graph_save_path_ + "pose_graph.txt";
+    printf("[PoseGraph] load pose graph from: %s \n", file_path.c_str());
     pFile = fopen(file_path.c_str(),"r");
     if (pFile == NULL)
     {
@@ -734,15 +1256,15 @@ void PoseGraph::loadPoseGraph()
         pcl::PointCloud<pcl::PointXYZI>::Ptr full_cloud(new pcl::PointCloud<pcl::PointXYZI>());
         pcl::PointCloud<pcl::PointXYZI>::Ptr outlier_cloud(new pcl::PointCloud<pcl::PointXYZI>());
         std::string pcd_path;
-        if (LOOP_SAVE_PCD)
+        if (config_.loop_save_pcd_)
         {
-            pcd_path = POSE_GRAPH_SAVE_PATH + to_string(index) + "_surf_cloud.pcd";
+            pcd_path = config_.pose_graph_save_path_ + to_string(index) + "_surf_cloud.pcd";
             pcd_reader_.read(pcd_path, *surf_cloud);
-            pcd_path = POSE_GRAPH_SAVE_PATH + to_string(index) + "_corner_cloud.pcd";
+            pcd_path = config_.pose_graph_save_path_ + to_string(index) + "_corner_cloud.pcd";
             pcd_reader_.read(pcd_path, *corner_cloud);
-            pcd_path = POSE_GRAPH_SAVE_PATH + to_string(index) + "_full_cloud.pcd";
+            pcd_path = config_.pose_graph_save_path_ + to_string(index) + "_full_cloud.pcd";
             pcd_reader_.read(pcd_path, *full_cloud);
-            pcd_path = POSE_GRAPH_SAVE_PATH + to_string(index) + "_outlier_cloud.pcd";
+            pcd_path = config_.pose_graph_save_path_ + to_string(index) + "_outlier_cloud.pcd";
             pcd_reader_.read(pcd_path, *outlier_cloud);
         }
         Pose pose_w = Pose(Eigen::Quaterniond(pose_w_qw, pose_w_qx, pose_w_qy, pose_w_qz),
@@ -759,17 +1281,17 @@ void PoseGraph::loadPoseGraph()
             }
         }
 
-        KeyFrame *keyframe = new KeyFrame(time_stamp,
-                                          index,
-                                          pose_w,
-                                          surf_cloud,
-                                          corner_cloud,
-                                          full_cloud,
-                                          outlier_cloud,
-                                          loop_index,
-                                          loop_info,
-                                          0);
-        loadKeyFrame(keyframe, 0);
+        KeyFrame keyframe(time_stamp,
+                          index,
+                          pose_w,
+                          surf_cloud,
+                          corner_cloud,
+                          full_cloud,
+                          outlier_cloud,
+                          loop_index,
+                          loop_info,
+                          0);
+        loadKeyFrame(std::move(keyframe), 0);
         if (cnt % 20 == 0)
         {
             publish();
@@ -783,26 +1305,25 @@ void PoseGraph::loadPoseGraph()
 void PoseGraph::updatePath()
 {
     m_keyframelist.lock();
-    list<KeyFrame *>::iterator it;
     pg_path_.poses.clear();
     posegraph_visualization->reset();
 
-    if (RESULT_SAVE)
+    if (config_.result_save_)
     {
-        ofstream loop_path_file_tmp(MLOAM_LOOP_PATH, ios::out);
+        ofstream loop_path_file_tmp(config_.loop_path_, ios::out);
         loop_path_file_tmp.close();
     }
 
-    for (it = keyframelist_.begin(); it != keyframelist_.end(); it++)
+    for (auto it = keyframelist_.begin(); it != keyframelist_.end(); it++)
     {
         Pose pose_w;
-        (*it)->getPose(pose_w);
+        it->getPose(pose_w);
 
         geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header.stamp = ros::Time((*it)->time_stamp_);
+        pose_stamped.header.stamp = ros::Time(it->time_stamp_);
         pose_stamped.header.frame_id = "/world";
-        pose_stamped.pose.position.x = pose_w.t_(0) + VISUALIZATION_SHIFT_X;
-        pose_stamped.pose.position.y = pose_w.t_(1) + VISUALIZATION_SHIFT_Y;
+        pose_stamped.pose.position.x = pose_w.t_(0) + config_.visualization_shift_x_;
+        pose_stamped.pose.position.y = pose_w.t_(1) + config_.visualization_shift_y_;
         pose_stamped.pose.position.z = pose_w.t_(2);
         pose_stamped.pose.orientation.x = pose_w.q_.x();
         pose_stamped.pose.orientation.y = pose_w.q_.y();
@@ -812,12 +1333,12 @@ void PoseGraph::updatePath()
         pg_path_.header = pose_stamped.header;
         posegraph_visualization->add_lidar_pose(pose_w.t_, pose_w.q_);
 
-        if (RESULT_SAVE)
+        if (config_.result_save_)
         {
-            ofstream loop_path_file(MLOAM_LOOP_PATH, ios::app);
+            ofstream loop_path_file(config_.loop_path_, ios::app);
             loop_path_file.setf(ios::fixed, ios::floatfield);
             loop_path_file.precision(15);
-            loop_path_file << (*it)->time_stamp_ << " ";
+            loop_path_file << it->time_stamp_ << " ";
             loop_path_file.precision(8);
             loop_path_file << pose_w.t_[0] << " "
                            << pose_w.t_[2] << " "
@@ -832,37 +1353,25 @@ void PoseGraph::updatePath()
 
         if (SHOW_S_EDGE)
         {
-            list<KeyFrame *>::reverse_iterator rit = keyframelist_.rbegin();
-            list<KeyFrame *>::reverse_iterator lrit;
-            for (; rit != keyframelist_.rend(); rit++)
+            for (int i = 1; i < 5; i++)
             {
-                if ((*rit)->index_ == (*it)->index_)
-                {
-                    lrit = rit;
-                    lrit++;
-                    for (int i = 0; i < 4; i++)
-                    {
-                        if (lrit == keyframelist_.rend())
-                            break;
-                        Pose connected_pose;
-                        (*lrit)->getPose(connected_pose);
-                        posegraph_visualization->add_edge(pose_w.t_, connected_pose.t_);
-                        lrit++;
-                    }
+                if (it->index_ - i < 0)
                     break;
-                }
+                Pose connected_pose;
+                keyframelist_[it->index_ - i].getPose(connected_pose);
+                posegraph_visualization->add_edge(pose_w.t_, connected_pose.t_);
             }
         }
         if (SHOW_L_EDGE)
         {
-            if ((*it)->has_loop_)
+            if (it->has_loop_)
             {
-                KeyFrame *connected_KF = getKeyFrame((*it)->loop_index_);
+                KeyFrame *connected_KF = getKeyFrame(it->loop_index_);
                 Pose connected_pose;
                 connected_KF->getPose(connected_pose);
                 Pose pose_0;
-                (*it)->getPose(pose_0);
-                posegraph_visualization->add_loopedge(pose_0.t_, connected_pose.t_ + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
+                it->getPose(pose_0);
+                posegraph_visualization->add_loopedge(pose_0.t_, connected_pose.t_ + Vector3d(config_.visualization_shift_x_, config_.visualization_shift_y_, 0));
             }
         }
     }
@@ -874,13 +1383,12 @@ void PoseGraph::publishLoopInfo()
 {
     m_keyframelist.lock();
     mloam_msgs::Keyframes kf_path;
-    list<KeyFrame *>::iterator it;
-    for (it = keyframelist_.begin(); it != keyframelist_.end(); it++)
+    for (auto it = keyframelist_.begin(); it != keyframelist_.end(); it++)
     {
         Pose pose_w;
-        (*it)->getPose(pose_w);
+        it->getPose(pose_w);
         geometry_msgs::PoseWithCovarianceStamped pose_stamped_cov;
-        pose_stamped_cov.header.stamp = ros::Time().fromSec((*it)->time_stamp_);
+        pose_stamped_cov.header.stamp = ros::Time().fromSec(it->time_stamp_);
         pose_stamped_cov.header.frame_id = "/world";
         pose_stamped_cov.pose.pose.position.x = pose_w.t_.x();
         pose_stamped_cov.pose.pose.position.y = pose_w.t_.y();
@@ -904,19 +1412,21 @@ void PoseGraph::publishLoopInfo()
         kf_path.status = 0;
     }
     pgo_flag_ = false;
-    pub_loop_info_.publish(kf_path);
+    if (pub_loop_info_) pub_loop_info_.publish(kf_path);
     printf("publish loop info\n");
     m_keyframelist.unlock();
 }
 
 void PoseGraph::publish()
 {
+    // not registered if the keyframes are replayed from a file
+    if (!pub_pg_path_) return;
     pub_pg_path_.publish(pg_path_);
     posegraph_visualization->publish_by(pub_pose_graph_, pg_path_.header);
 
-    if (VISUALIZE_IMAGE)
+    if (config_.visualize_image_ && !keyframelist_.empty())
     {
-        KeyFrame *keyframe = keyframelist_.back();
+        const KeyFrame *keyframe = &keyframelist_.back();
         cv::Mat sc_img = sc_manager_.getScanContextImage(keyframe->index_);
         cv_bridge::CvImage sc_msg;
         sc_msg.header.frame_id = "/world";
@@ -939,4 +1449,43 @@ void PoseGraph::publish()
 int PoseGraph::getKeyFrameSize()
 {
     return keyframelist_.size();
-}
\ No newline at end of file
+}
+
+int PoseGraph::getLoopQueueSize()
+{
+    std::lock_guard<std::mutex> lock(m_loop_buf);
+    return loop_buf_.size();
+}
+
+bool PoseGraph::isLoopClosureIdle()
+{
+    // a verified loop is pushed to optimize_buf_ before loop_verify_busy_ is decreased, so check the loop buffer first
+    {
+        std::lock_guard<std::mutex> lock(m_loop_buf);
+        if (!loop_buf_.empty() || loop_verify_busy_ > 0) return false;
+    }
+    std::lock_guard<std::mutex> lock(m_optimize_buf);
+    return optimize_buf_.empty() && !pgo_busy_;
+}
+
+void PoseGraph::printLoopStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_loop_buf);
+    printf("[PoseGraph] loop candidates verified: %d, accepted: %d, cancelled: %d, pending: %lu\n",
+           loop_verify_cnt_, loop_accept_cnt_, loop_cancel_cnt_, loop_buf_.size());
+    if (loop_verify_cnt_ > 0)
+        printf("[PoseGraph] loop verification latency mean: %fms, max: %fms\n",
+               loop_latency_sum_ / loop_verify_cnt_, loop_latency_max_);
+    const char *stage_name[NUM_LOOP_VERIFY_STAGE] = {"yaw prior", "global registration", "local registration"};
+    for (int i = 0; i < NUM_LOOP_VERIFY_STAGE; i++)
+    {
+        const LoopStageStatistics &stat = loop_stage_stat_[i];
+        if (stat.try_cnt_ > 0)
+            printf("[PoseGraph] loop verification stage %s accepted: %d/%d, time mean: %fms, max: %fms\n",
+                   stage_name[i], stat.accept_cnt_, stat.try_cnt_, stat.time_sum_ / stat.try_cnt_, stat.time_max_);
+    }
+    std::lock_guard<std::mutex> lock_submap(m_submap_cache);
+    printf("[PoseGraph] loop submap cache hit: %d, miss: %d\n", submap_hit_cnt_, submap_miss_cnt_);
+}
+
+} // namespace mloam_loop
\ No newline at end of file
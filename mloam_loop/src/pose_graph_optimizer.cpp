@@ -0,0 +1,111 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "mloam_loop/pose_graph_optimizer.hpp"
+
+namespace mloam_loop
+{
+
+PoseGraphOptimizer::PoseGraphOptimizer()
+    : loss_function_(new ceres::HuberLoss(1.0)),
+      local_parameterization_(new ceres::QuaternionParameterization())
+{
+    options_.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options_.max_num_iterations = 5;
+    reset(0);
+}
+
+void PoseGraphOptimizer::reset(const int &start_index)
+{
+    // the loss function and the local parameterization are shared by all problems
+    ceres::Problem::Options problem_options;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_.reset(new ceres::Problem(problem_options));
+    nodes_.clear();
+    start_index_ = start_index;
+}
+
+void PoseGraphOptimizer::addNode(const Pose &pose_w)
+{
+    nodes_.push_back(Node());
+    Node &node = nodes_.back();
+    node.t_[0] = pose_w.t_(0);
+    node.t_[1] = pose_w.t_(1);
+    node.t_[2] = pose_w.t_(2);
+    node.q_[0] = pose_w.q_.w();
+    node.q_[1] = pose_w.q_.x();
+    node.q_[2] = pose_w.q_.y();
+    node.q_[3] = pose_w.q_.z();
+    node.has_loop_edge_ = false;
+    problem_->AddParameterBlock(node.q_, 4, local_parameterization_.get());
+    problem_->AddParameterBlock(node.t_, 3);
+    if (nodes_.size() == 1)
+    {
+        problem_->SetParameterBlockConstant(node.q_);
+        problem_->SetParameterBlockConstant(node.t_);
+    }
+
+    // add edge between previous frames
+    int i = static_cast<int>(nodes_.size()) - 1;
+    Eigen::Quaterniond q_i(node.q_[0], node.q_[1], node.q_[2], node.q_[3]);
+    for (int j = 1; j <= NUM_SEQUENTIAL_EDGE; j++)
+    {
+        if (i - j < 0)
+            break;
+        Node &node_j = nodes_[i - j];
+        Eigen::Vector3d relative_t(node.t_[0] - node_j.t_[0], node.t_[1] - node_j.t_[1], node.t_[2] - node_j.t_[2]);
+        Eigen::Quaterniond q_i_j(node_j.q_[0], node_j.q_[1], node_j.q_[2], node_j.q_[3]);
+        relative_t = q_i_j.inverse() * relative_t;
+        Eigen::Quaterniond relative_q = q_i_j.inverse() * q_i;
+        ceres::CostFunction *f = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
+                                                         relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
+                                                         0.1, 0.01);
+        problem_->AddResidualBlock(f, NULL, node_j.q_, node_j.t_, node.q_, node.t_);
+    }
+}
+
+bool PoseGraphOptimizer::addLoopEdge(const int &index, const int &loop_index, const Pose &pose_relative)
+{
+    assert(hasNode(index) && hasNode(loop_index));
+    Node &node_i = nodes_[index - start_index_];
+    if (node_i.has_loop_edge_)
+        return false;
+    node_i.has_loop_edge_ = true;
+    Node &node_j = nodes_[loop_index - start_index_];
+    const Eigen::Vector3d &relative_t = pose_relative.t_;
+    const Eigen::Quaterniond &relative_q = pose_relative.q_;
+    ceres::CostFunction *loop_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
+                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
+                                                                 0.1, 0.01);
+    problem_->AddResidualBlock(loop_function, loss_function_.get(), node_j.q_, node_j.t_, node_i.q_, node_i.t_);
+    return true;
+}
+
+void PoseGraphOptimizer::optimize(ceres::Solver::Summary &summary)
+{
+    ceres::Solve(options_, problem_.get(), &summary);
+}
+
+Pose PoseGraphOptimizer::getPose(const int &index) const
+{
+    assert(hasNode(index));
+    const Node &node = nodes_[index - start_index_];
+    Eigen::Quaterniond q(node.q_[0], node.q_[1], node.q_[2], node.q_[3]);
+    Eigen::Vector3d t(node.t_[0], node.t_[1], node.t_[2]);
+    return Pose(q, t);
+}
+
+} // namespace mloam_loop
+
+//
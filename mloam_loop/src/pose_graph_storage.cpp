@@ -0,0 +1,407 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "mloam_loop/pose_graph_storage.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace mloam_loop
+{
+
+namespace
+{
+const char MAGIC[4] = {'M', 'L', 'P', 'G'};
+
+struct FileHeader
+{
+    char magic_[4];
+    uint32_t version_;
+    uint32_t codec_;
+    uint32_t num_keyframe_;
+    uint64_t index_offset_;
+    uint64_t reserved_;
+};
+
+const size_t POINT_FLOAT_NUM = 4;
+
+// return the encoded cloud in data and bytes, which point to buffer or compressed
+bool encodeCloud(const pcl::PointCloud<pcl::PointXYZI> &cloud,
+                 const int &codec,
+                 std::vector<float> &buffer,
+                 std::vector<char> &compressed,
+                 const char *&data,
+                 size_t &bytes)
+{
+    buffer.resize(cloud.size() * POINT_FLOAT_NUM);
+    for (size_t i = 0; i < cloud.size(); i++)
+    {
+        buffer[POINT_FLOAT_NUM * i] = cloud.points[i].x;
+        buffer[POINT_FLOAT_NUM * i + 1] = cloud.points[i].y;
+        buffer[POINT_FLOAT_NUM * i + 2] = cloud.points[i].z;
+        buffer[POINT_FLOAT_NUM * i + 3] = cloud.points[i].intensity;
+    }
+    data = reinterpret_cast<const char *>(buffer.data());
+    bytes = buffer.size() * sizeof(float);
+#ifdef WITH_LZ4
+    if (codec == CODEC_LZ4 && bytes > 0)
+    {
+        compressed.resize(LZ4_compressBound(static_cast<int>(bytes)));
+        int compressed_bytes = LZ4_compress_default(data, compressed.data(),
+                                                    static_cast<int>(bytes), static_cast<int>(compressed.size()));
+        if (compressed_bytes <= 0)
+        {
+            printf("[PoseGraphStorage] LZ4 compression error\n");
+            return false;
+        }
+        data = compressed.data();
+        bytes = compressed_bytes;
+    }
+#else
+    (void)codec;
+    (void)compressed;
+#endif
+    return true;
+}
+
+bool decodeCloud(const char *data,
+                 const size_t &encoded_bytes,
+                 const size_t &num_point,
+                 const int &codec,
+                 pcl::PointCloud<pcl::PointXYZI> &cloud)
+{
+    const size_t bytes = num_point * POINT_FLOAT_NUM * sizeof(float);
+    std::vector<char> buffer;
+    const char *points = data;
+    if (codec == CODEC_RAW)
+    {
+        if (encoded_bytes != bytes) return false;
+    }
+#ifdef WITH_LZ4
+    else if (codec == CODEC_LZ4)
+    {
+        buffer.resize(bytes);
+        if (bytes > 0)
+        {
+            int decompressed_bytes = LZ4_decompress_safe(data, buffer.data(),
+                                                         static_cast<int>(encoded_bytes), static_cast<int>(bytes));
+            if (decompressed_bytes != static_cast<int>(bytes)) return false;
+        }
+        points = buffer.data();
+    }
+#endif
+    else
+    {
+        return false;
+    }
+
+    // the blobs are not aligned to float in the file
+    float p[POINT_FLOAT_NUM];
+    cloud.resize(num_point);
+    for (size_t i = 0; i < num_point; i++)
+    {
+        memcpy(p, points + i * sizeof(p), sizeof(p));
+        cloud.points[i].x = p[0];
+        cloud.points[i].y = p[1];
+        cloud.points[i].z = p[2];
+        cloud.points[i].intensity = p[3];
+    }
+    return true;
+}
+}
+
+const uint32_t PoseGraphReader::VERSION;
+
+PoseGraphWriter::PoseGraphWriter() : fp_(NULL), codec_(CODEC_RAW), offset_(0) {}
+
+PoseGraphWriter::~PoseGraphWriter()
+{
+    if (fp_) fclose(fp_);
+}
+
+bool PoseGraphWriter::open(const std::string &file_path, const int &codec)
+{
+#ifndef WITH_LZ4
+    if (codec == CODEC_LZ4)
+    {
+        printf("[PoseGraphWriter] built without LZ4, cannot write %s\n", file_path.c_str());
+        return false;
+    }
+#endif
+    if (codec != CODEC_RAW && codec != CODEC_LZ4)
+    {
+        printf("[PoseGraphWriter] unknown codec: %d\n", codec);
+        return false;
+    }
+    fp_ = fopen(file_path.c_str(), "wb");
+    if (fp_ == NULL)
+    {
+        printf("[PoseGraphWriter] cannot create %s\n", file_path.c_str());
+        return false;
+    }
+    codec_ = codec;
+    records_.clear();
+    // the header is written again with the index offset in close()
+    FileHeader header;
+    memset(&header, 0, sizeof(FileHeader));
+    offset_ = 0;
+    return writeBlob(&header, sizeof(FileHeader));
+}
+
+bool PoseGraphWriter::writeBlob(const void *data, const size_t &bytes)
+{
+    if (bytes == 0) return true;
+    if (fwrite(data, 1, bytes, fp_) != bytes)
+    {
+        printf("[PoseGraphWriter] write error\n");
+        return false;
+    }
+    offset_ += bytes;
+    return true;
+}
+
+bool PoseGraphWriter::addKeyFrame(KeyFrameRecord record,
+                                  const pcl::PointCloud<pcl::PointXYZI> *clouds[NUM_CLOUD_TYPE])
+{
+    for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+    {
+        const char *data;
+        size_t bytes;
+        if (!encodeCloud(*clouds[type], codec_, buffer_, compressed_, data, bytes)) return false;
+        record.cloud_offset_[type] = offset_;
+        record.cloud_bytes_[type] = bytes;
+        record.cloud_size_[type] = clouds[type]->size();
+        if (!writeBlob(data, bytes)) return false;
+    }
+    records_.push_back(record);
+    return true;
+}
+
+bool PoseGraphWriter::addKeyFrame(KeyFrameRecord record, const KeyFrameCloudStorage &storage, const size_t &id)
+{
+    const PoseGraphReader *reader_ptr = dynamic_cast<const PoseGraphReader *>(&storage);
+    if (!reader_ptr || reader_ptr->codec() != codec_)
+    {
+        pcl::PointCloud<pcl::PointXYZI> clouds[NUM_CLOUD_TYPE];
+        const pcl::PointCloud<pcl::PointXYZI> *clouds_ptr[NUM_CLOUD_TYPE];
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+        {
+            if (!storage.readCloud(id, type, clouds[type])) return false;
+            clouds_ptr[type] = &clouds[type];
+        }
+        return addKeyFrame(record, clouds_ptr);
+    }
+    const PoseGraphReader &reader = *reader_ptr;
+    const KeyFrameRecord &src = reader.getRecord(id);
+    for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+    {
+        record.cloud_offset_[type] = offset_;
+        record.cloud_bytes_[type] = src.cloud_bytes_[type];
+        record.cloud_size_[type] = src.cloud_size_[type];
+        if (!writeBlob(reader.getBlob(id, type), src.cloud_bytes_[type])) return false;
+    }
+    records_.push_back(record);
+    return true;
+}
+
+bool PoseGraphWriter::close()
+{
+    if (fp_ == NULL) return false;
+    // keep the index aligned since the reader accesses it in place
+    const char padding[8] = {0};
+    bool success = writeBlob(padding, (8 - offset_ % 8) % 8);
+    FileHeader header;
+    memset(&header, 0, sizeof(FileHeader));
+    memcpy(header.magic_, MAGIC, sizeof(MAGIC));
+    header.version_ = PoseGraphReader::VERSION;
+    header.codec_ = codec_;
+    header.num_keyframe_ = records_.size();
+    header.index_offset_ = offset_;
+    success = success && writeBlob(records_.data(), records_.size() * sizeof(KeyFrameRecord));
+    success = success && (fseek(fp_, 0, SEEK_SET) == 0) && (fwrite(&header, sizeof(FileHeader), 1, fp_) == 1);
+    success = (fclose(fp_) == 0) && success;
+    fp_ = NULL;
+    if (!success) printf("[PoseGraphWriter] write error\n");
+    return success;
+}
+
+PoseGraphReader::PoseGraphReader()
+    : data_(NULL), file_size_(0), num_keyframe_(0), codec_(CODEC_RAW), records_(NULL) {}
+
+PoseGraphReader::~PoseGraphReader()
+{
+    if (data_) munmap(const_cast<char *>(data_), file_size_);
+}
+
+bool PoseGraphReader::open(const std::string &file_path)
+{
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader)))
+    {
+        ::close(fd);
+        printf("[PoseGraphReader] invalid file: %s\n", file_path.c_str());
+        return false;
+    }
+    file_size_ = st.st_size;
+    void *data = mmap(NULL, file_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        printf("[PoseGraphReader] mmap error: %s\n", file_path.c_str());
+        return false;
+    }
+    data_ = static_cast<const char *>(data);
+
+    FileHeader header;
+    memcpy(&header, data_, sizeof(FileHeader));
+    // the sizes are compared by subtraction, so that a corrupted offset cannot overflow the check
+    if (memcmp(header.magic_, MAGIC, sizeof(MAGIC)) != 0 || header.version_ != VERSION
+        || header.index_offset_ % 8 != 0 || header.index_offset_ > file_size_
+        || header.num_keyframe_ > (file_size_ - header.index_offset_) / sizeof(KeyFrameRecord))
+    {
+        printf("[PoseGraphReader] %s: not a pose graph of version %u\n", file_path.c_str(), VERSION);
+        return false;
+    }
+#ifndef WITH_LZ4
+    if (header.codec_ == CODEC_LZ4)
+    {
+        printf("[PoseGraphReader] %s is compressed by LZ4, but built without LZ4\n", file_path.c_str());
+        return false;
+    }
+#endif
+    codec_ = header.codec_;
+    num_keyframe_ = header.num_keyframe_;
+    records_ = reinterpret_cast<const KeyFrameRecord *>(data_ + header.index_offset_);
+    for (size_t id = 0; id < num_keyframe_; id++)
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+            if (records_[id].cloud_offset_[type] > header.index_offset_ ||
+                records_[id].cloud_bytes_[type] > header.index_offset_ - records_[id].cloud_offset_[type])
+            {
+                printf("[PoseGraphReader] %s: corrupted index\n", file_path.c_str());
+                num_keyframe_ = 0;
+                return false;
+            }
+    // the index is scanned at startup, the clouds are paged in on access
+    madvise(const_cast<char *>(data_), file_size_, MADV_RANDOM);
+    return true;
+}
+
+bool PoseGraphReader::readCloud(const size_t &id, const int &type, pcl::PointCloud<pcl::PointXYZI> &cloud) const
+{
+    const KeyFrameRecord &record = records_[id];
+    return decodeCloud(getBlob(id, type), record.cloud_bytes_[type], record.cloud_size_[type], codec_, cloud);
+}
+
+CloudSegmentFile::CloudSegmentFile() : fd_(-1), codec_(CODEC_RAW), offset_(0) {}
+
+CloudSegmentFile::~CloudSegmentFile()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        unlink(file_path_.c_str());
+    }
+}
+
+bool CloudSegmentFile::open(const std::string &file_path, const int &codec)
+{
+#ifndef WITH_LZ4
+    if (codec == CODEC_LZ4)
+    {
+        printf("[CloudSegmentFile] built without LZ4, cannot write %s\n", file_path.c_str());
+        return false;
+    }
+#endif
+    fd_ = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+    {
+        printf("[CloudSegmentFile] cannot create %s\n", file_path.c_str());
+        return false;
+    }
+    file_path_ = file_path;
+    codec_ = codec;
+    offset_ = 0;
+    return true;
+}
+
+int CloudSegmentFile::append(const pcl::PointCloud<pcl::PointXYZI> *clouds[NUM_CLOUD_TYPE])
+{
+    if (fd_ < 0) return -1;
+    std::lock_guard<std::mutex> lock_append(m_append_);
+    KeyFrameRecord record;
+    memset(&record, 0, sizeof(KeyFrameRecord));
+    uint64_t offset;
+    {
+        std::lock_guard<std::mutex> lock(m_records_);
+        offset = offset_;
+    }
+    // only one thread appends, the readers see the record after the clouds are written
+    for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+    {
+        const char *data;
+        size_t bytes;
+        if (!encodeCloud(*clouds[type], codec_, buffer_, compressed_, data, bytes)) return -1;
+        if (pwrite(fd_, data, bytes, offset) != static_cast<ssize_t>(bytes))
+        {
+            printf("[CloudSegmentFile] write error\n");
+            return -1;
+        }
+        record.cloud_offset_[type] = offset;
+        record.cloud_bytes_[type] = bytes;
+        record.cloud_size_[type] = clouds[type]->size();
+        offset += bytes;
+    }
+    std::lock_guard<std::mutex> lock(m_records_);
+    offset_ = offset;
+    records_.push_back(record);
+    return static_cast<int>(records_.size()) - 1;
+}
+
+bool CloudSegmentFile::readCloud(const size_t &id, const int &type, pcl::PointCloud<pcl::PointXYZI> &cloud) const
+{
+    KeyFrameRecord record;
+    {
+        std::lock_guard<std::mutex> lock(m_records_);
+        if (id >= records_.size()) return false;
+        record = records_[id];
+    }
+    std::vector<char> data(record.cloud_bytes_[type]);
+    if (!data.empty() && pread(fd_, data.data(), data.size(), record.cloud_offset_[type]) != static_cast<ssize_t>(data.size()))
+        return false;
+    return decodeCloud(data.data(), data.size(), record.cloud_size_[type], codec_, cloud);
+}
+
+size_t CloudSegmentFile::size() const
+{
+    std::lock_guard<std::mutex> lock(m_records_);
+    return records_.size();
+}
+
+size_t CloudSegmentFile::bytesWritten() const
+{
+    std::lock_guard<std::mutex> lock(m_records_);
+    return offset_;
+}
+
+} // namespace mloam_loop
+
+//
@@ -3,6 +3,9 @@
 // namespace SC2
 // {
 
+namespace mloam_loop
+{
+
 std::ostream &operator<<(std::ostream &out, const QueryResult &qr)
 {
     if (qr.match_index_ == -1)
@@ -70,6 +73,21 @@ MatrixXd circshift(MatrixXd &_mat, int _num_shift)
     return shifted_mat;
 } // circshift
 
+// divide each column by its norm, zero columns are kept zero and marked invalid
+void normalizeColumns(const MatrixXd &_mat, MatrixXd &_mat_normalized, RowVectorXd &_col_valid)
+{
+    _mat_normalized = _mat;
+    _col_valid = RowVectorXd::Zero(_mat.cols());
+    for (int col_idx = 0; col_idx < _mat.cols(); col_idx++)
+    {
+        double col_norm = _mat.col(col_idx).norm();
+        if (col_norm == 0)
+            continue;
+        _mat_normalized.col(col_idx) /= col_norm;
+        _col_valid(col_idx) = 1.0;
+    }
+} // normalizeColumns
+
 // matrix to vector
 std::vector<float> eig2stdvec(MatrixXd _eigmat)
 {
@@ -100,20 +118,45 @@ double SCManager::distDirectSC(MatrixXd &_sc1, MatrixXd &_sc2)
 
 } // distDirectSC
 
+// the same as distDirectSC(_sc1, circshift(_sc2, _num_shift)) on the column-normalized scan contexts:
+// shifted_sc2.col(c) = sc2.col(c - num_shift), so the columns are compared in two contiguous blocks
+double SCManager::distDirectSC(const MatrixXd &_sc1_normalized, const RowVectorXd &_col_valid1,
+                               const MatrixXd &_sc2_normalized, const RowVectorXd &_col_valid2,
+                               const int &_num_shift) const
+{
+    const int num_cols = _sc1_normalized.cols();
+    const int num_head = num_cols - _num_shift;
+    // the normalized invalid columns are zero, so they do not contribute to the sum of similarity
+    double sum_sector_similarity = 
+        _sc1_normalized.rightCols(num_head).cwiseProduct(_sc2_normalized.leftCols(num_head)).sum() +
+        _sc1_normalized.leftCols(_num_shift).cwiseProduct(_sc2_normalized.rightCols(_num_shift)).sum();
+    double num_eff_cols = 
+        _col_valid1.tail(num_head).dot(_col_valid2.head(num_head)) +
+        _col_valid1.head(_num_shift).dot(_col_valid2.tail(_num_shift));
+    if (num_eff_cols == 0)
+        return std::numeric_limits<double>::max();
+
+    double sc_sim = sum_sector_similarity / num_eff_cols;
+    return 1.0 - sc_sim;
+} // distDirectSC
+
 // shifting the matrix (i.e. go through each degree) for matching using F-norm matrix
-int SCManager::fastAlignUsingVkey(MatrixXd &_vkey1, MatrixXd &_vkey2)
+// |vkey1 - circshift(vkey2, s)|^2 = |vkey1|^2 + |vkey2|^2 - 2 * <vkey1, circshift(vkey2, s)>,
+// so only the circular cross-correlation is evaluated for each shift
+int SCManager::fastAlignUsingVkey(const MatrixXd &_vkey1, const MatrixXd &_vkey2)
 {
+    const int num_cols = _vkey1.cols();
     int argmin_vkey_shift = 0;
-    double min_veky_diff_norm = 10000000;
-    for (int shift_idx = 0; shift_idx < _vkey1.cols(); shift_idx++)
+    double max_vkey_corr = -std::numeric_limits<double>::max();
+    for (int shift_idx = 0; shift_idx < num_cols; shift_idx++)
     {
-        MatrixXd vkey2_shifted = circshift(_vkey2, shift_idx);
-        MatrixXd vkey_diff = _vkey1 - vkey2_shifted;
-        double cur_diff_norm = vkey_diff.norm();
-        if (cur_diff_norm < min_veky_diff_norm)
+        const int num_head = num_cols - shift_idx;
+        double cur_corr = _vkey1.rightCols(num_head).cwiseProduct(_vkey2.leftCols(num_head)).sum() +
+                          _vkey1.leftCols(shift_idx).cwiseProduct(_vkey2.rightCols(shift_idx)).sum();
+        if (cur_corr > max_vkey_corr)
         {
             argmin_vkey_shift = shift_idx;
-            min_veky_diff_norm = cur_diff_norm;
+            max_vkey_corr = cur_corr;
         }
     }
     return argmin_vkey_shift;
@@ -122,28 +165,30 @@ int SCManager::fastAlignUsingVkey(MatrixXd &_vkey1, MatrixXd &_vkey2)
 // shifting the sc1 with a limitted radius to get the best matching scan context
 std::pair<double, int> SCManager::distanceBtnScanContext(MatrixXd &_sc1, MatrixXd &_sc2)
 {
-    // 1. fast align using variant key (not in original IROS18)
-    MatrixXd vkey_sc1 = makeSectorkeyFromScancontext(_sc1);
-    MatrixXd vkey_sc2 = makeSectorkeyFromScancontext(_sc2);
-    int argmin_vkey_shift = fastAlignUsingVkey(vkey_sc1, vkey_sc2);
+    MatrixXd sc1_normalized, sc2_normalized;
+    RowVectorXd col_valid1, col_valid2;
+    normalizeColumns(_sc1, sc1_normalized, col_valid1);
+    normalizeColumns(_sc2, sc2_normalized, col_valid2);
+    return distanceBtnScanContext(sc1_normalized, col_valid1, makeSectorkeyFromScancontext(_sc1),
+                                  sc2_normalized, col_valid2, makeSectorkeyFromScancontext(_sc2));
+} // distanceBtnScanContext
 
-    const int SEARCH_RADIUS = round(0.5 * SEARCH_RATIO * _sc1.cols()); // a half of search range 0.05 * sc1.cols()
-    std::vector<int> shift_idx_search_space{argmin_vkey_shift}; // shifting the starting col num
-    for (int ii = 1; ii < SEARCH_RADIUS + 1; ii++)
-    {
-        shift_idx_search_space.push_back((argmin_vkey_shift + ii + _sc1.cols()) % _sc1.cols());
-        shift_idx_search_space.push_back((argmin_vkey_shift - ii + _sc1.cols()) % _sc1.cols());
-    }
-    std::sort(shift_idx_search_space.begin(), shift_idx_search_space.end());
+std::pair<double, int> SCManager::distanceBtnScanContext(const MatrixXd &_sc1_normalized, const RowVectorXd &_col_valid1, const MatrixXd &_vkey1,
+                                                         const MatrixXd &_sc2_normalized, const RowVectorXd &_col_valid2, const MatrixXd &_vkey2)
+{
+    // 1. fast align using variant key (not in original IROS18)
+    const int num_cols = _sc1_normalized.cols();
+    int argmin_vkey_shift = fastAlignUsingVkey(_vkey1, _vkey2);
 
-    // 2. fast columnwise diff
+    // 2. fast columnwise diff within the search radius around the vkey alignment
+    const int SEARCH_RADIUS = round(0.5 * SEARCH_RATIO * num_cols); // a half of search range 0.05 * sc1.cols()
     int argmin_shift = 0;
     double min_sc_dist = 10000000;
-    for (int num_shift : shift_idx_search_space)
+    for (int ii = -SEARCH_RADIUS; ii <= SEARCH_RADIUS; ii++)
     {
-        MatrixXd sc2_shifted = circshift(_sc2, num_shift); // TODO: the yaw shoud be for sc2 (the candidate)
-        double cur_sc_dist = distDirectSC(_sc1, sc2_shifted);
-        if (cur_sc_dist < min_sc_dist)
+        int num_shift = ((argmin_vkey_shift + ii) % num_cols + num_cols) % num_cols; // TODO: the yaw shoud be for sc2 (the candidate)
+        double cur_sc_dist = distDirectSC(_sc1_normalized, _col_valid1, _sc2_normalized, _col_valid2, num_shift);
+        if ((cur_sc_dist < min_sc_dist) || ((cur_sc_dist == min_sc_dist) && (num_shift < argmin_shift)))
         {
             argmin_shift = num_shift;
             min_sc_dist = cur_sc_dist;
@@ -223,8 +268,13 @@ void SCManager::makeAndSaveScancontextAndKeys(pcl::PointCloud<SCPointType> &scan
     Eigen::MatrixXd ringkey = makeRingkeyFromScancontext(sc);
     Eigen::MatrixXd sectorkey = makeSectorkeyFromScancontext(sc);
     std::vector<float> polarcontext_invkey_vec = eig2stdvec(ringkey);
+    Eigen::MatrixXd sc_normalized;
+    Eigen::RowVectorXd col_valid;
+    normalizeColumns(sc, sc_normalized, col_valid);
 
     polarcontexts_.push_back(sc);
+    polarcontexts_normalized_.push_back(sc_normalized);
+    polarcontext_col_valid_.push_back(col_valid);
     polarcontext_invkeys_.push_back(ringkey);
     polarcontext_vkeys_.push_back(sectorkey);
     polarcontext_invkeys_mat_.push_back(polarcontext_invkey_vec);
@@ -237,8 +287,7 @@ QueryResult SCManager::detectLoopClosureID(const int &que_index)
     assert(que_index < 0);
 
     int loop_id{-1}; // init with -1, -1 means no loop (== LeGO-LOAM's variable "closestHistoryFrameID")
-    auto curr_key = polarcontext_invkeys_mat_[que_index]; // current observation (query)
-    auto curr_desc = polarcontexts_[que_index];           // current observation (query)
+    const std::vector<float> &curr_key = polarcontext_invkeys_mat_[que_index]; // current observation (query)
 
     /* 
      * step 1: candidates from ringkey tree_
@@ -251,31 +300,27 @@ QueryResult SCManager::detectLoopClosureID(const int &que_index)
 
     TicToc t_find_candidates;
 
-    // tree_ reconstruction (not mandatory to make everytime)
-    if (tree_making_period_conter_ % TREE_MAKING_PERIOD == 0) // to save computation cost
-    {
-        // TicToc t_tree_construction;
-        polarcontext_invkeys_to_search_.clear();
-        polarcontext_invkeys_to_search_.assign(polarcontext_invkeys_mat_.begin(), polarcontext_invkeys_mat_.begin() + que_index - NUM_EXCLUDE_RECENT);
-        polarcontext_tree_.reset();
-        polarcontext_tree_ = std::make_unique<InvKeyTree>(PC_NUM_RING /* dim */,
-                                                          polarcontext_invkeys_to_search_,
-                                                          10 /* max leaf */);
-        // tree_ptr_->index->buildIndex(); // inernally called in the constructor of InvKeyTree (for detail, refer the nanoflann and KDtreeVectorOfVectorsAdaptor)
-        // t_tree_construction.toc("Tree construction");
-    }
-    tree_making_period_conter_++;
+    // append the keys out of the recent exclusion window to the tree (no copy and no rebuild)
+    const size_t num_eligible = que_index - NUM_EXCLUDE_RECENT;
+    polarcontext_tree_->addPointsUpTo(num_eligible);
+    // a re-query of an older keyframe also finds the keys indexed after it, which are dropped afterwards
+    const size_t num_ineligible = polarcontext_tree_->size() - std::min(num_eligible, polarcontext_tree_->size());
 
     double min_dist = 10000000; // init with somthing large
     int nn_align = 0;
     int nn_idx = -1;
 
     // knn search
-    std::vector<size_t> candidate_indexes(NUM_CANDIDATES_FROM_TREE);
-    std::vector<float> out_dists_sqr(NUM_CANDIDATES_FROM_TREE);
-    nanoflann::KNNResultSet<float> knnsearch_result(NUM_CANDIDATES_FROM_TREE);
-    knnsearch_result.init(&candidate_indexes[0], &out_dists_sqr[0]);
-    polarcontext_tree_->index->findNeighbors(knnsearch_result, &curr_key[0] /* query */, nanoflann::SearchParams(10));
+    std::vector<size_t> candidate_indexes(NUM_CANDIDATES_FROM_TREE + num_ineligible);
+    std::vector<float> out_dists_sqr(NUM_CANDIDATES_FROM_TREE + num_ineligible);
+    size_t num_found = polarcontext_tree_->query(&curr_key[0] /* query */, candidate_indexes.size(),
+                                                 &candidate_indexes[0], &out_dists_sqr[0]);
+    candidate_indexes.resize(num_found);
+    candidate_indexes.erase(std::remove_if(candidate_indexes.begin(), candidate_indexes.end(),
+                                           [&](const size_t &idx) { return idx >= num_eligible; }),
+                            candidate_indexes.end());
+    if (candidate_indexes.size() > static_cast<size_t>(NUM_CANDIDATES_FROM_TREE))
+        candidate_indexes.resize(NUM_CANDIDATES_FROM_TREE);
 
     // printf("find candidates using ringkey costs: %fms\n", t_find_candidates.toc());
 
@@ -283,12 +328,20 @@ QueryResult SCManager::detectLoopClosureID(const int &que_index)
      *  step 2: pairwise distance (find optimal columnwise best-fit using cosine distance)
      */
     TicToc t_calc_dist;
-    for (int candidate_iter_idx = 0; candidate_iter_idx < NUM_CANDIDATES_FROM_TREE; candidate_iter_idx++)
+    const int num_candidates = static_cast<int>(candidate_indexes.size());
+    std::vector<std::pair<double, int> > sc_dist_results(num_candidates);
+    #pragma omp parallel for num_threads(NUM_THREADS) schedule(dynamic)
+    for (int candidate_iter_idx = 0; candidate_iter_idx < num_candidates; candidate_iter_idx++)
     {
-        MatrixXd polarcontext_candidate = polarcontexts_[candidate_indexes[candidate_iter_idx]];
-        std::pair<double, int> sc_dist_result = distanceBtnScanContext(curr_desc, polarcontext_candidate);
-        double candidate_dist = sc_dist_result.first; // best align distance between reference sc and target sc
-        int candidate_align = sc_dist_result.second; // best align angle
+        const size_t &cand_index = candidate_indexes[candidate_iter_idx];
+        sc_dist_results[candidate_iter_idx] = 
+            distanceBtnScanContext(polarcontexts_normalized_[que_index], polarcontext_col_valid_[que_index], polarcontext_vkeys_[que_index],
+                                   polarcontexts_normalized_[cand_index], polarcontext_col_valid_[cand_index], polarcontext_vkeys_[cand_index]);
+    }
+    for (int candidate_iter_idx = 0; candidate_iter_idx < num_candidates; candidate_iter_idx++)
+    {
+        double candidate_dist = sc_dist_results[candidate_iter_idx].first; // best align distance between reference sc and target sc
+        int candidate_align = sc_dist_results[candidate_iter_idx].second; // best align angle
         if (candidate_dist < min_dist)
         {
             min_dist = candidate_dist;
@@ -380,3 +433,5 @@ size_t SCManager::getDataBaseSize()
     return polarcontext_invkeys_mat_.size();
 }
 
+} // namespace mloam_loop
+
@@ -9,6 +9,9 @@
 
 #include "mloam_loop/utility/CameraPoseVisualization.h"
 
+namespace mloam_loop
+{
+
 const Eigen::Vector3d CameraPoseVisualization::imlt = Eigen::Vector3d(-1.0, -0.5, 1.0);
 const Eigen::Vector3d CameraPoseVisualization::imrt = Eigen::Vector3d( 1.0, -0.5, 1.0);
 const Eigen::Vector3d CameraPoseVisualization::imlb = Eigen::Vector3d(-1.0,  0.5, 1.0);
@@ -343,3 +346,5 @@ void CameraPoseVisualization::add_image(const Eigen::Vector3d& T, const Eigen::M
     }
 }
 */
+
+} // namespace mloam_loop
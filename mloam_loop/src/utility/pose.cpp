@@ -13,6 +13,9 @@
 
 #include "mloam_loop/utility/pose.h"
 
+namespace mloam_loop
+{
+
 Pose::Pose()
 {
     q_ = Eigen::Quaterniond::Identity();
@@ -119,3 +122,5 @@ ostream & operator << (ostream &out, const Pose &pose)
     return out;
 }
 
+} // namespace mloam_loop
+
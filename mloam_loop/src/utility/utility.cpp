@@ -9,6 +9,9 @@
 
 #include "mloam_loop/utility/utility.h"
 
+namespace mloam_loop
+{
+
 Eigen::Matrix3d Utility::g2R(const Eigen::Vector3d &g)
 {
     Eigen::Matrix3d R0;
@@ -20,3 +23,5 @@ Eigen::Matrix3d Utility::g2R(const Eigen::Vector3d &g)
     // R0 = Utility::ypr2R(Eigen::Vector3d{-90, 0, 0}) * R0;
     return R0;
 }
+
+} // namespace mloam_loop
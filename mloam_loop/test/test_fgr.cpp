@@ -13,6 +13,8 @@
 #include "mloam_loop/utility/tic_toc.h"
 #include "../ThirdParty/FastGlobalRegistration/app.h"
 
+using namespace mloam_loop;
+
 #define DIV_FACTOR			1.4		// Division factor used for graduated non-convexity
 #define USE_ABSOLUTE_SCALE	1		// Measure distance in absolute scale (1) or in scale relative to the diameter of the model (0)
 #define MAX_CORR_DIST		0.025	// Maximum correspondence distance (also see comment of USE_ABSOLUTE_SCALE)
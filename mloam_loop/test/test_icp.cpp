@@ -14,6 +14,8 @@
 #include "mloam_loop/factor/lidar_map_plane_norm_factor.hpp"
 #include "mloam_loop/factor/impl_loss_function.hpp"
 
+using namespace mloam_loop;
+
 FeatureExtract f_extract;
 
 void WriteTrans(const std::string filepath, Eigen::Matrix4f transtemp)
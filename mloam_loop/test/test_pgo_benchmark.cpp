@@ -0,0 +1,129 @@
+// rosrun mloam_loop test_pgo_benchmark 50000 pgo_benchmark.txt
+// PGO latency vs. graph size on a simulated trajectory: a circle of LOOP_LENGTH keyframes driven repeatedly,
+// every LOOP_INTERVAL keyframes on a revisit are connected to the previous round with a loop edge.
+// incremental: the persistent graph is extended and solved at every loop (the setting of PoseGraph),
+//              the mean solver latency of the loops since the last checkpoint is reported
+// rebuild: a new graph over all keyframes is constructed and solved at the checkpoints
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/StdVector>
+#include <ceres/ceres.h>
+
+#include "mloam_loop/utility/tic_toc.h"
+#include "mloam_loop/utility/pose.h"
+#include "mloam_loop/pose_graph_optimizer.hpp"
+
+using namespace mloam_loop;
+
+#define LOOP_LENGTH 1000
+#define LOOP_INTERVAL 50
+#define RADIUS 150.0
+
+typedef std::vector<Pose, Eigen::aligned_allocator<Pose> > PoseVector;
+
+Pose groundTruth(const int &k)
+{
+    double yaw = 2 * M_PI * k / LOOP_LENGTH;
+    Eigen::Quaterniond q(Eigen::AngleAxisd(yaw + M_PI / 2, Eigen::Vector3d::UnitZ()));
+    Eigen::Vector3d t(RADIUS * cos(yaw), RADIUS * sin(yaw), 0.01 * k / LOOP_LENGTH);
+    return Pose(q, t);
+}
+
+// the odometry between the keyframe k-1 and k with noise
+Pose noisyOdometry(const int &k, std::mt19937 &gen)
+{
+    std::normal_distribution<double> noise_t(0.0, 0.02), noise_r(0.0, 0.002);
+    Pose pose_rel = groundTruth(k - 1).inverse() * groundTruth(k);
+    Eigen::Quaterniond dq = Eigen::AngleAxisd(noise_r(gen), Eigen::Vector3d::UnitZ())
+                          * Eigen::AngleAxisd(noise_r(gen), Eigen::Vector3d::UnitY())
+                          * Eigen::AngleAxisd(noise_r(gen), Eigen::Vector3d::UnitX());
+    Eigen::Vector3d dt(noise_t(gen), noise_t(gen), noise_t(gen));
+    return Pose(pose_rel.q_ * dq, pose_rel.t_ + dt);
+}
+
+bool isLoop(const int &k)
+{
+    return (k >= LOOP_LENGTH) && (k % LOOP_INTERVAL == 0);
+}
+
+double computeATE(const PoseGraphOptimizer &pgo, const int &num)
+{
+    double err = 0;
+    for (int k = 0; k < num; k++)
+        err += (pgo.getPose(k).t_ - groundTruth(k).t_).squaredNorm();
+    return sqrt(err / num);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_size = argc > 1 ? std::stoi(argv[1]) : 50000;
+    FILE *fp = argc > 2 ? fopen(argv[2], "w") : NULL;
+
+    std::vector<int> checkpoints;
+    for (int n : {1000, 2000, 5000, 10000, 20000, 50000})
+        if (n <= max_size) checkpoints.push_back(n);
+    if (checkpoints.empty() || checkpoints.back() != max_size) checkpoints.push_back(max_size);
+
+    std::mt19937 gen(0);
+    PoseVector odom(max_size);
+    for (int k = 1; k < max_size; k++) odom[k] = noisyOdometry(k, gen);
+
+    printf("%8s %8s %16s %16s %12s %12s\n", "size", "loops", "incremental[ms]", "rebuild[ms]", "ate_inc[m]", "ate_reb[m]");
+    if (fp) fprintf(fp, "size loops incremental_ms rebuild_ms ate_incremental ate_rebuild\n");
+
+    PoseGraphOptimizer pgo;
+    pgo.reset(0);
+    pgo.addNode(groundTruth(0));
+    int num_loop = 0;
+    double inc_time_sum = 0;
+    int inc_time_cnt = 0;
+    size_t cp = 0;
+    for (int k = 1; k < max_size; k++)
+    {
+        // the new keyframe is initialized with the odometry from the latest estimate
+        pgo.addNode(pgo.getPose(k - 1) * odom[k]);
+        if (isLoop(k))
+        {
+            Pose pose_relative = groundTruth(k - LOOP_LENGTH).inverse() * groundTruth(k);
+            pgo.addLoopEdge(k, k - LOOP_LENGTH, pose_relative);
+            num_loop++;
+            ceres::Solver::Summary summary;
+            TicToc t_inc;
+            pgo.optimize(summary);
+            inc_time_sum += t_inc.toc();
+            inc_time_cnt++;
+        }
+
+        if (k + 1 != checkpoints[cp]) continue;
+
+        PoseGraphOptimizer pgo_rebuild;
+        TicToc t_rebuild;
+        pgo_rebuild.reset(0);
+        pgo_rebuild.addNode(groundTruth(0));
+        for (int j = 1; j <= k; j++)
+        {
+            pgo_rebuild.addNode(pgo_rebuild.getPose(j - 1) * odom[j]);
+            if (isLoop(j))
+                pgo_rebuild.addLoopEdge(j, j - LOOP_LENGTH, groundTruth(j - LOOP_LENGTH).inverse() * groundTruth(j));
+        }
+        ceres::Solver::Summary summary;
+        pgo_rebuild.optimize(summary);
+        double rebuild_time = t_rebuild.toc();
+
+        double inc_time = inc_time_cnt > 0 ? inc_time_sum / inc_time_cnt : 0.0;
+        double ate_inc = computeATE(pgo, k + 1);
+        double ate_reb = computeATE(pgo_rebuild, k + 1);
+        printf("%8d %8d %16.3f %16.3f %12.3f %12.3f\n", k + 1, num_loop, inc_time, rebuild_time, ate_inc, ate_reb);
+        if (fp) fprintf(fp, "%d %d %f %f %f %f\n", k + 1, num_loop, inc_time, rebuild_time, ate_inc, ate_reb);
+        inc_time_sum = 0;
+        inc_time_cnt = 0;
+        if (++cp >= checkpoints.size()) break;
+    }
+    if (fp) fclose(fp);
+    return 0;
+}
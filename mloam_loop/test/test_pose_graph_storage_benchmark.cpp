@@ -0,0 +1,121 @@
+// rosrun mloam_loop test_pose_graph_storage_benchmark 1000 /tmp/pose_graph_benchmark/
+// save/load throughput of the keyframe clouds: 4 pcd files per keyframe vs. the pose_graph.bin container
+// pcd: the per-keyframe files written by pcl::PCDWriter (ascii as the previous savePoseGraph) and read one by one
+// bin: the container written by PoseGraphWriter, and read by PoseGraphReader
+//      open: the startup cost of mapping the file and checking the index, all clouds decoded lazily
+//      decode: decoding the clouds of all keyframes
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "mloam_loop/utility/tic_toc.h"
+#include "mloam_loop/pose_graph_storage.hpp"
+
+using namespace mloam_loop;
+
+const size_t CLOUD_SIZE[NUM_CLOUD_TYPE] = {3000, 500, 20000, 2000}; // surf, corner, full, outlier
+const std::string CLOUD_NAME[NUM_CLOUD_TYPE] = {"_surf_cloud.pcd", "_corner_cloud.pcd", "_full_cloud.pcd", "_outlier_cloud.pcd"};
+
+void generateCloud(const size_t &num, std::mt19937 &gen, pcl::PointCloud<pcl::PointXYZI> &cloud)
+{
+    std::uniform_real_distribution<float> coord(-80.0, 80.0), intensity(0.0, 255.0);
+    cloud.resize(num);
+    for (pcl::PointXYZI &point : cloud.points)
+    {
+        point.x = coord(gen);
+        point.y = coord(gen);
+        point.z = 0.05 * coord(gen);
+        point.intensity = intensity(gen);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int num_keyframe = argc > 1 ? std::stoi(argv[1]) : 1000;
+    std::string path = argc > 2 ? argv[2] : "/tmp/";
+    int codec = argc > 3 ? std::stoi(argv[3]) : CODEC_RAW;
+
+    // a few distinct clouds are shared by the keyframes to limit the memory
+    std::mt19937 gen(0);
+    const int num_sample = 10;
+    std::vector<pcl::PointCloud<pcl::PointXYZI> > clouds(num_sample * NUM_CLOUD_TYPE);
+    for (int i = 0; i < num_sample; i++)
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+            generateCloud(CLOUD_SIZE[type], gen, clouds[i * NUM_CLOUD_TYPE + type]);
+    double num_point = 0;
+    for (int type = 0; type < NUM_CLOUD_TYPE; type++) num_point += CLOUD_SIZE[type];
+    double mb = num_keyframe * num_point * 4 * sizeof(float) / 1e6; // (x, y, z, intensity)
+    printf("keyframes: %d, points of a keyframe: %.0f, payload: %.1fMB\n", num_keyframe, num_point, mb);
+
+    // pcd
+    pcl::PCDWriter pcd_writer;
+    pcl::PCDReader pcd_reader;
+    TicToc t_pcd_save;
+    for (int k = 0; k < num_keyframe; k++)
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+            pcd_writer.write(path + std::to_string(k) + CLOUD_NAME[type], clouds[(k % num_sample) * NUM_CLOUD_TYPE + type]);
+    double pcd_save_time = t_pcd_save.toc();
+
+    TicToc t_pcd_load;
+    pcl::PointCloud<pcl::PointXYZI> cloud;
+    for (int k = 0; k < num_keyframe; k++)
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+            pcd_reader.read(path + std::to_string(k) + CLOUD_NAME[type], cloud);
+    double pcd_load_time = t_pcd_load.toc();
+
+    // bin
+    std::string file_path = path + "pose_graph.bin";
+    TicToc t_bin_save;
+    PoseGraphWriter writer;
+    if (!writer.open(file_path, codec)) return 1;
+    for (int k = 0; k < num_keyframe; k++)
+    {
+        KeyFrameRecord record;
+        memset(&record, 0, sizeof(KeyFrameRecord));
+        record.index_ = k;
+        record.loop_index_ = -1;
+        record.pose_w_[6] = 1.0;
+        record.loop_info_[6] = 1.0;
+        const pcl::PointCloud<pcl::PointXYZI> *kf_clouds[NUM_CLOUD_TYPE];
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+            kf_clouds[type] = &clouds[(k % num_sample) * NUM_CLOUD_TYPE + type];
+        writer.addKeyFrame(record, kf_clouds);
+    }
+    writer.close();
+    double bin_save_time = t_bin_save.toc();
+
+    TicToc t_bin_open;
+    PoseGraphReader reader;
+    if (!reader.open(file_path)) return 1;
+    double bin_open_time = t_bin_open.toc();
+    TicToc t_bin_decode;
+    for (size_t k = 0; k < reader.size(); k++)
+    {
+        for (int type = 0; type < NUM_CLOUD_TYPE; type++)
+        {
+            reader.readCloud(k, type, cloud);
+            const pcl::PointCloud<pcl::PointXYZI> &gt = clouds[(k % num_sample) * NUM_CLOUD_TYPE + type];
+            if (cloud.size() != gt.size() || (cloud.size() > 0 && cloud.points.back().x != gt.points.back().x))
+            {
+                printf("wrong cloud: keyframe %lu, type %d\n", k, type);
+                return 1;
+            }
+        }
+    }
+    double bin_decode_time = t_bin_decode.toc();
+
+    printf("%6s %12s %12s %12s %12s %12s\n", "", "save[ms]", "save[MB/s]", "open[ms]", "load[ms]", "load[MB/s]");
+    printf("%6s %12.1f %12.1f %12s %12.1f %12.1f\n", "pcd", pcd_save_time, mb / pcd_save_time * 1e3, "-",
+           pcd_load_time, mb / pcd_load_time * 1e3);
+    printf("%6s %12.1f %12.1f %12.3f %12.1f %12.1f\n", "bin", bin_save_time, mb / bin_save_time * 1e3, bin_open_time,
+           bin_open_time + bin_decode_time, mb / (bin_open_time + bin_decode_time) * 1e3);
+    printf("bin file: %.1fMB\n", writer.bytesWritten() / 1e6);
+    return 0;
+}
@@ -0,0 +1,142 @@
+// rosrun mloam_loop test_sc_index_benchmark 50000
+// ring-key index of SCManager: the static tree remade every TREE_MAKING_PERIOD queries vs. the dynamic tree
+// the keys are simulated on a route driven repeatedly, so that the queries have true neighbors in the database.
+// time: the mean cost per query (including the amortized rebuild or insertion),
+// recall: the fraction of the brute-force NUM_CANDIDATES nearest eligible keys returned by the index
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <memory>
+
+#include "mloam_loop/utility/tic_toc.h"
+#include "mloam_loop/scan_context/KDTreeVectorOfVectorsAdaptor.hpp"
+#include "mloam_loop/scan_context/KDTreeVectorOfVectorsDynamicAdaptor.hpp"
+
+using namespace mloam_loop;
+
+#define PC_NUM_RING 20
+#define NUM_EXCLUDE_RECENT 50
+#define NUM_CANDIDATES 50
+#define TREE_MAKING_PERIOD 10
+#define ROUTE_LENGTH 2000
+#define RECALL_SAMPLE 100 // evaluate the recall every RECALL_SAMPLE queries
+
+typedef std::vector<std::vector<float> > KeyMat;
+typedef KDTreeVectorOfVectorsAdaptor<KeyMat, float> StaticTree;
+typedef KDTreeVectorOfVectorsDynamicAdaptor<KeyMat, float> DynamicTree;
+
+std::vector<size_t> bruteForce(const KeyMat &keys, const size_t &num_eligible, const std::vector<float> &query)
+{
+    std::vector<std::pair<float, size_t> > dist(num_eligible);
+    for (size_t i = 0; i < num_eligible; i++)
+    {
+        float d = 0;
+        for (int j = 0; j < PC_NUM_RING; j++) d += (keys[i][j] - query[j]) * (keys[i][j] - query[j]);
+        dist[i] = std::make_pair(d, i);
+    }
+    size_t k = std::min(num_eligible, (size_t)NUM_CANDIDATES);
+    std::partial_sort(dist.begin(), dist.begin() + k, dist.end());
+    std::vector<size_t> result(k);
+    for (size_t i = 0; i < k; i++) result[i] = dist[i].second;
+    return result;
+}
+
+double computeRecall(const std::vector<size_t> &result, const std::vector<size_t> &gt)
+{
+    if (gt.empty()) return 1.0;
+    size_t cnt = 0;
+    for (const size_t &idx : result)
+        if (std::find(gt.begin(), gt.end(), idx) != gt.end()) cnt++;
+    return 1.0 * cnt / gt.size();
+}
+
+int main(int argc, char *argv[])
+{
+    int max_size = argc > 1 ? std::stoi(argv[1]) : 50000;
+
+    // ring keys of a route: the place profile plus the noise of each visit
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> place(0.0, 3.0);
+    std::normal_distribution<float> noise(0.0, 0.1);
+    KeyMat route(ROUTE_LENGTH, std::vector<float>(PC_NUM_RING));
+    for (int i = 0; i < ROUTE_LENGTH; i++)
+        for (int j = 0; j < PC_NUM_RING; j++)
+            route[i][j] = (i > 0 ? 0.9f * route[i - 1][j] : 0.0f) + place(gen);
+    KeyMat keys;
+    keys.reserve(max_size);
+
+    std::vector<int> checkpoints;
+    for (int n : {1000, 2000, 5000, 10000, 20000, 50000})
+        if (n <= max_size) checkpoints.push_back(n);
+    if (checkpoints.empty() || checkpoints.back() != max_size) checkpoints.push_back(max_size);
+
+    printf("%8s %16s %16s %14s %14s %14s\n", "size", "static[ms]", "dynamic[ms]", "rebuild[ms]", "recall_static", "recall_dyn");
+
+    KeyMat keys_to_search;
+    std::unique_ptr<StaticTree> static_tree;
+    DynamicTree dynamic_tree(PC_NUM_RING, keys, 10);
+    double static_time = 0, dynamic_time = 0, rebuild_time = 0;
+    double static_recall = 0, dynamic_recall = 0;
+    int num_query = 0, num_rebuild = 0, num_recall = 0, tree_making_period_conter = 0;
+    size_t cp = 0;
+    std::vector<size_t> indices(NUM_CANDIDATES);
+    std::vector<float> dists(NUM_CANDIDATES);
+    for (int k = 0; k < max_size; k++)
+    {
+        std::vector<float> key = route[k % ROUTE_LENGTH];
+        for (float &v : key) v += noise(gen);
+        keys.push_back(key);
+        if (k >= NUM_EXCLUDE_RECENT + 1)
+        {
+            const size_t num_eligible = k - NUM_EXCLUDE_RECENT;
+            num_query++;
+
+            // the static tree remade periodically as in the previous SCManager
+            TicToc t_static;
+            if (tree_making_period_conter % TREE_MAKING_PERIOD == 0)
+            {
+                TicToc t_rebuild;
+                keys_to_search.assign(keys.begin(), keys.begin() + num_eligible);
+                static_tree.reset(new StaticTree(PC_NUM_RING, keys_to_search, 10));
+                rebuild_time += t_rebuild.toc();
+                num_rebuild++;
+            }
+            tree_making_period_conter++;
+            size_t num_static = std::min(keys_to_search.size(), (size_t)NUM_CANDIDATES);
+            static_tree->query(&key[0], num_static, &indices[0], &dists[0]);
+            std::vector<size_t> static_result(indices.begin(), indices.begin() + num_static);
+            static_time += t_static.toc();
+
+            // the dynamic tree
+            TicToc t_dynamic;
+            dynamic_tree.addPointsUpTo(num_eligible);
+            size_t num_dynamic = dynamic_tree.query(&key[0], NUM_CANDIDATES, &indices[0], &dists[0]);
+            std::vector<size_t> dynamic_result(indices.begin(), indices.begin() + num_dynamic);
+            dynamic_time += t_dynamic.toc();
+
+            if (num_query % RECALL_SAMPLE == 0)
+            {
+                std::vector<size_t> gt = bruteForce(keys, num_eligible, key);
+                static_recall += computeRecall(static_result, gt);
+                dynamic_recall += computeRecall(dynamic_result, gt);
+                num_recall++;
+            }
+        }
+
+        if (k + 1 != checkpoints[cp]) continue;
+        printf("%8d %16.4f %16.4f %14.4f %14.3f %14.3f\n", k + 1,
+               num_query > 0 ? static_time / num_query : 0.0,
+               num_query > 0 ? dynamic_time / num_query : 0.0,
+               num_rebuild > 0 ? rebuild_time / num_rebuild : 0.0,
+               num_recall > 0 ? static_recall / num_recall : 1.0,
+               num_recall > 0 ? dynamic_recall / num_recall : 1.0);
+        static_time = dynamic_time = rebuild_time = 0;
+        static_recall = dynamic_recall = 0;
+        num_query = num_rebuild = num_recall = 0;
+        if (++cp >= checkpoints.size()) break;
+    }
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include "mloam_loop/parameters.hpp"
 
 using namespace std;
+using namespace mloam_loop;
 
 int LOOP_KEYFRAME_INTERVAL;
 int LOOP_HISTORY_SEARCH_NUM;
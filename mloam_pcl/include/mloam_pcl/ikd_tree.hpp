@@ -0,0 +1,541 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#ifndef IKD_TREE_HPP
+#define IKD_TREE_HPP
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <utility>
+
+#include <boost/shared_ptr.hpp>
+
+#include <eigen3/Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+
+// Incremental kd-tree (ikd-tree style, Cai et al., "ikd-Tree: An Incremental K-D Tree for Robotic Applications").
+// Points live in an append-only pool (getCloud()), so the indices returned by nearestKSearch can be used
+// exactly as the indices of pcl::KdTreeFLANN on the input cloud. Deleted points are only marked;
+// unbalanced or mostly-deleted subtrees are rebuilt, and the pool is compacted when most of it is invalid.
+// Unlike the original ikd-tree, rebuilds run on the calling thread.
+namespace pcl
+{
+    template <typename PointT>
+    class IKdTree
+    {
+    public:
+        typedef boost::shared_ptr<IKdTree<PointT> > Ptr;
+        typedef boost::shared_ptr<const IKdTree<PointT> > ConstPtr;
+        typedef pcl::PointCloud<PointT> PointCloud;
+
+        /** \param[in] delete_param rebuild a subtree if more than delete_param of its points are deleted
+          * \param[in] balance_param rebuild a subtree if one child holds more than balance_param of its points
+          * \param[in] downsample_size the box size of on-tree downsampling (<= 0: disable)
+          */
+        IKdTree(const float &delete_param = 0.5f, const float &balance_param = 0.7f, const float &downsample_size = 0.0f)
+            : delete_param_(delete_param), balance_param_(balance_param), downsample_size_(downsample_size),
+              root_(-1), cloud_(new PointCloud()) {}
+
+        void setDownsampleSize(const float &downsample_size) { downsample_size_ = downsample_size; }
+
+        void clear()
+        {
+            nodes_.clear();
+            free_nodes_.clear();
+            cloud_->clear();
+            root_ = -1;
+        }
+
+        // build a balanced tree from scratch
+        void build(const PointCloud &cloud)
+        {
+            clear();
+            *cloud_ = cloud;
+            std::vector<int> point_idx(cloud_->size());
+            for (size_t i = 0; i < point_idx.size(); i++) point_idx[i] = i;
+            root_ = buildRec(point_idx, 0, point_idx.size(), -1);
+        }
+
+        /** \brief Insert points, optionally keeping only the point nearest to the center of each downsample box.
+          * \return the number of points actually inserted
+          */
+        size_t addPoints(const PointCloud &cloud, const bool &downsample = false)
+        {
+            size_t num_insert = 0;
+            for (const PointT &point : cloud)
+            {
+                if (downsample && downsample_size_ > 0)
+                {
+                    Eigen::Vector3f box_min, box_max, center;
+                    for (int d = 0; d < 3; d++)
+                    {
+                        box_min[d] = std::floor(coord(point, d) / downsample_size_) * downsample_size_;
+                        box_max[d] = box_min[d] + downsample_size_;
+                        center[d] = 0.5f * (box_min[d] + box_max[d]);
+                    }
+                    std::vector<int> box_idx;
+                    boxSearch(box_min, box_max, box_idx);
+                    float sq_dis_new = sqDis(point, center);
+                    bool need_insert = true;
+                    for (const int &idx : box_idx)
+                    {
+                        if (sqDis(cloud_->points[idx], center) <= sq_dis_new)
+                        {
+                            need_insert = false;
+                            break;
+                        }
+                    }
+                    if (!need_insert) continue;
+                    if (!box_idx.empty()) deleteBox(box_min, box_max);
+                }
+                insertPoint(point);
+                num_insert++;
+            }
+            if (needCompact()) compact();
+            return num_insert;
+        }
+
+        /** \brief Delete all points inside the axis-aligned box [box_min, box_max).
+          * \return the number of deleted points
+          */
+        size_t deleteBox(const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max)
+        {
+            if (root_ < 0) return 0;
+            size_t num_delete = deleteBoxRec(root_, box_min, box_max);
+            int scapegoat = -1;
+            findScapegoat(root_, box_min, box_max, scapegoat);
+            if (scapegoat >= 0) rebuild(scapegoat);
+            if (needCompact()) compact();
+            return num_delete;
+        }
+
+        /** \brief Delete all points inside any of the boxes [first, second) in a single traversal
+          * (Delete_Point_Boxes of the original ikd-tree): each subtree is visited once with the boxes it intersects,
+          * and only the highest unbalanced subtrees are rebuilt afterwards.
+          * \return the number of deleted points
+          */
+        size_t deleteBoxes(const std::vector<std::pair<Eigen::Vector3f, Eigen::Vector3f> > &boxes)
+        {
+            if (root_ < 0 || boxes.empty()) return 0;
+            std::vector<int> box_idx(boxes.size());
+            for (size_t i = 0; i < boxes.size(); i++) box_idx[i] = i;
+            std::vector<int> scapegoats;
+            size_t num_delete = deleteBoxesRec(root_, boxes, box_idx, 0, box_idx.size(), scapegoats);
+            for (const int &id : scapegoats) rebuild(id); // disjoint subtrees
+            if (needCompact()) compact();
+            return num_delete;
+        }
+
+        // the indices of valid points inside the box [box_min, box_max)
+        void boxSearch(const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max, std::vector<int> &point_idx) const
+        {
+            point_idx.clear();
+            if (root_ >= 0) boxSearchRec(root_, box_min, box_max, point_idx);
+        }
+
+        /** \brief Search for the k nearest valid points, sorted by increasing distance.
+          * \return the number of neighbors found
+          */
+        int nearestKSearch(const PointT &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const
+        {
+            k_indices.clear();
+            k_sqr_distances.clear();
+            if (root_ < 0 || k <= 0) return 0;
+            std::priority_queue<std::pair<float, int> > heap; // max-heap on the squared distance
+            nearestKSearchRec(root_, point, k, heap);
+            size_t num_found = heap.size();
+            k_indices.resize(num_found);
+            k_sqr_distances.resize(num_found);
+            for (int i = num_found - 1; i >= 0; i--)
+            {
+                k_sqr_distances[i] = heap.top().first;
+                k_indices[i] = heap.top().second;
+                heap.pop();
+            }
+            return num_found;
+        }
+
+        // the point pool which the search indices refer to
+        const PointCloud &getCloud() const { return *cloud_; }
+
+        size_t size() const { return root_ < 0 ? 0 : nodes_[root_].size_ - nodes_[root_].invalid_num_; }
+
+        size_t poolSize() const { return cloud_->size(); }
+
+    private:
+        struct Node
+        {
+            int point_idx_;
+            int left_, right_, parent_;
+            int axis_;
+            int size_;         // number of nodes in the subtree, including deleted ones
+            int invalid_num_;  // number of deleted nodes in the subtree
+            bool deleted_;
+            float box_min_[3], box_max_[3];
+        };
+
+        static float coord(const PointT &p, const int &d) { return d == 0 ? p.x : (d == 1 ? p.y : p.z); }
+
+        static float sqDis(const PointT &p, const Eigen::Vector3f &q)
+        {
+            return (p.x - q[0]) * (p.x - q[0]) + (p.y - q[1]) * (p.y - q[1]) + (p.z - q[2]) * (p.z - q[2]);
+        }
+
+        static float sqDis(const PointT &p, const PointT &q)
+        {
+            return (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y) + (p.z - q.z) * (p.z - q.z);
+        }
+
+        int newNode(const int &point_idx, const int &parent)
+        {
+            int id;
+            if (!free_nodes_.empty())
+            {
+                id = free_nodes_.back();
+                free_nodes_.pop_back();
+            }
+            else
+            {
+                id = nodes_.size();
+                nodes_.push_back(Node());
+            }
+            Node &node = nodes_[id];
+            node.point_idx_ = point_idx;
+            node.left_ = node.right_ = -1;
+            node.parent_ = parent;
+            node.axis_ = 0;
+            node.size_ = 1;
+            node.invalid_num_ = 0;
+            node.deleted_ = false;
+            const PointT &p = cloud_->points[point_idx];
+            for (int d = 0; d < 3; d++) node.box_min_[d] = node.box_max_[d] = coord(p, d);
+            return id;
+        }
+
+        // recompute size, invalid_num and bounding box of a node from its children
+        void pullUp(const int &id)
+        {
+            Node &node = nodes_[id];
+            node.size_ = 1;
+            node.invalid_num_ = node.deleted_ ? 1 : 0;
+            const PointT &p = cloud_->points[node.point_idx_];
+            for (int d = 0; d < 3; d++) node.box_min_[d] = node.box_max_[d] = coord(p, d);
+            for (const int &c : {node.left_, node.right_})
+            {
+                if (c < 0) continue;
+                const Node &child = nodes_[c];
+                node.size_ += child.size_;
+                node.invalid_num_ += child.invalid_num_;
+                for (int d = 0; d < 3; d++)
+                {
+                    node.box_min_[d] = std::min(node.box_min_[d], child.box_min_[d]);
+                    node.box_max_[d] = std::max(node.box_max_[d], child.box_max_[d]);
+                }
+            }
+        }
+
+        int buildRec(std::vector<int> &point_idx, const size_t &begin, const size_t &end, const int &parent)
+        {
+            if (begin >= end) return -1;
+            // split along the axis of the largest spread
+            float min_v[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, max_v[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (size_t i = begin; i < end; i++)
+            {
+                const PointT &p = cloud_->points[point_idx[i]];
+                for (int d = 0; d < 3; d++)
+                {
+                    min_v[d] = std::min(min_v[d], coord(p, d));
+                    max_v[d] = std::max(max_v[d], coord(p, d));
+                }
+            }
+            int axis = 0;
+            for (int d = 1; d < 3; d++)
+                if (max_v[d] - min_v[d] > max_v[axis] - min_v[axis]) axis = d;
+
+            size_t mid = (begin + end) / 2;
+            std::nth_element(point_idx.begin() + begin, point_idx.begin() + mid, point_idx.begin() + end,
+                             [&](const int &a, const int &b) { return coord(cloud_->points[a], axis) < coord(cloud_->points[b], axis); });
+            int id = newNode(point_idx[mid], parent);
+            nodes_[id].axis_ = axis;
+            int left = buildRec(point_idx, begin, mid, id);
+            int right = buildRec(point_idx, mid + 1, end, id);
+            nodes_[id].left_ = left;
+            nodes_[id].right_ = right;
+            pullUp(id);
+            return id;
+        }
+
+        void collectValid(const int &id, std::vector<int> &point_idx) const
+        {
+            if (id < 0) return;
+            const Node &node = nodes_[id];
+            if (node.invalid_num_ == node.size_) return;
+            if (!node.deleted_) point_idx.push_back(node.point_idx_);
+            collectValid(node.left_, point_idx);
+            collectValid(node.right_, point_idx);
+        }
+
+        void releaseRec(const int &id)
+        {
+            if (id < 0) return;
+            int left = nodes_[id].left_, right = nodes_[id].right_;
+            nodes_[id].left_ = nodes_[id].right_ = -1;
+            releaseRec(left);
+            releaseRec(right);
+            free_nodes_.push_back(id);
+        }
+
+        // rebuild the subtree rooted at id, dropping the deleted points
+        void rebuild(const int &id)
+        {
+            int parent = nodes_[id].parent_;
+            bool is_left = (parent >= 0) && (nodes_[parent].left_ == id);
+            std::vector<int> point_idx;
+            point_idx.reserve(nodes_[id].size_);
+            collectValid(id, point_idx);
+            releaseRec(id);
+            int new_id = buildRec(point_idx, 0, point_idx.size(), parent);
+            if (parent < 0)
+            {
+                root_ = new_id;
+            }
+            else
+            {
+                if (is_left)
+                    nodes_[parent].left_ = new_id;
+                else
+                    nodes_[parent].right_ = new_id;
+                for (int p = parent; p >= 0; p = nodes_[p].parent_) pullUp(p);
+            }
+        }
+
+        bool isUnbalanced(const int &id) const
+        {
+            const Node &node = nodes_[id];
+            if (node.size_ < MIN_REBUILD_SIZE) return false;
+            if (node.invalid_num_ > delete_param_ * node.size_) return true;
+            int left_size = node.left_ < 0 ? 0 : nodes_[node.left_].size_;
+            int right_size = node.right_ < 0 ? 0 : nodes_[node.right_].size_;
+            return std::max(left_size, right_size) > balance_param_ * (node.size_ - 1);
+        }
+
+        void insertPoint(const PointT &point)
+        {
+            cloud_->push_back(point);
+            int point_idx = cloud_->size() - 1;
+            if (root_ < 0)
+            {
+                root_ = newNode(point_idx, -1);
+                return;
+            }
+            // descend to a leaf
+            int id = root_;
+            while (true)
+            {
+                Node &node = nodes_[id];
+                bool go_left = coord(point, node.axis_) < coord(cloud_->points[node.point_idx_], node.axis_);
+                int child = go_left ? node.left_ : node.right_;
+                if (child < 0)
+                {
+                    int new_id = newNode(point_idx, id);
+                    nodes_[new_id].axis_ = (nodes_[id].axis_ + 1) % 3;
+                    if (go_left)
+                        nodes_[id].left_ = new_id;
+                    else
+                        nodes_[id].right_ = new_id;
+                    break;
+                }
+                id = child;
+            }
+            // update the path and rebuild the highest unbalanced node (the scapegoat)
+            int scapegoat = -1;
+            for (int p = id; p >= 0; p = nodes_[p].parent_)
+            {
+                pullUp(p);
+                if (isUnbalanced(p)) scapegoat = p;
+            }
+            if (scapegoat >= 0) rebuild(scapegoat);
+        }
+
+        static bool boxIntersect(const Node &node, const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max)
+        {
+            for (int d = 0; d < 3; d++)
+                if (node.box_max_[d] < box_min[d] || node.box_min_[d] >= box_max[d]) return false;
+            return true;
+        }
+
+        static bool inBox(const PointT &p, const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max)
+        {
+            for (int d = 0; d < 3; d++)
+                if (coord(p, d) < box_min[d] || coord(p, d) >= box_max[d]) return false;
+            return true;
+        }
+
+        size_t deleteBoxRec(const int &id, const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max)
+        {
+            if (id < 0) return 0;
+            Node &node = nodes_[id];
+            if (node.invalid_num_ == node.size_ || !boxIntersect(node, box_min, box_max)) return 0;
+            size_t num_delete = 0;
+            if (!node.deleted_ && inBox(cloud_->points[node.point_idx_], box_min, box_max))
+            {
+                node.deleted_ = true;
+                num_delete++;
+            }
+            num_delete += deleteBoxRec(node.left_, box_min, box_max);
+            num_delete += deleteBoxRec(node.right_, box_min, box_max);
+            if (num_delete > 0) pullUp(id);
+            return num_delete;
+        }
+
+        // box_idx[begin, end): the boxes intersecting the parent, those intersecting this node are appended
+        // behind them for the children and dropped on return
+        size_t deleteBoxesRec(const int &id, const std::vector<std::pair<Eigen::Vector3f, Eigen::Vector3f> > &boxes,
+                              std::vector<int> &box_idx, const size_t &begin, const size_t &end, std::vector<int> &scapegoats)
+        {
+            if (id < 0) return 0;
+            if (nodes_[id].invalid_num_ == nodes_[id].size_) return 0;
+            const size_t sub_begin = box_idx.size();
+            for (size_t i = begin; i < end; i++)
+            {
+                const int b = box_idx[i];
+                if (boxIntersect(nodes_[id], boxes[b].first, boxes[b].second)) box_idx.push_back(b);
+            }
+            const size_t sub_end = box_idx.size();
+            if (sub_begin == sub_end) return 0;
+
+            size_t num_delete = 0;
+            if (!nodes_[id].deleted_)
+            {
+                const PointT &p = cloud_->points[nodes_[id].point_idx_];
+                for (size_t i = sub_begin; i < sub_end; i++)
+                {
+                    if (!inBox(p, boxes[box_idx[i]].first, boxes[box_idx[i]].second)) continue;
+                    nodes_[id].deleted_ = true;
+                    num_delete++;
+                    break;
+                }
+            }
+            const size_t num_scapegoat = scapegoats.size();
+            num_delete += deleteBoxesRec(nodes_[id].left_, boxes, box_idx, sub_begin, sub_end, scapegoats);
+            num_delete += deleteBoxesRec(nodes_[id].right_, boxes, box_idx, sub_begin, sub_end, scapegoats);
+            box_idx.resize(sub_begin);
+            if (num_delete > 0)
+            {
+                pullUp(id);
+                if (isUnbalanced(id)) // supersedes the scapegoats found below
+                {
+                    scapegoats.resize(num_scapegoat);
+                    scapegoats.push_back(id);
+                }
+            }
+            return num_delete;
+        }
+
+        // the highest unbalanced node among those touched by the box
+        void findScapegoat(const int &id, const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max, int &scapegoat) const
+        {
+            if (id < 0 || !boxIntersect(nodes_[id], box_min, box_max)) return;
+            if (isUnbalanced(id))
+            {
+                scapegoat = id;
+                return;
+            }
+            findScapegoat(nodes_[id].left_, box_min, box_max, scapegoat);
+            if (scapegoat < 0) findScapegoat(nodes_[id].right_, box_min, box_max, scapegoat);
+        }
+
+        void boxSearchRec(const int &id, const Eigen::Vector3f &box_min, const Eigen::Vector3f &box_max, std::vector<int> &point_idx) const
+        {
+            if (id < 0) return;
+            const Node &node = nodes_[id];
+            if (node.invalid_num_ == node.size_ || !boxIntersect(node, box_min, box_max)) return;
+            if (!node.deleted_ && inBox(cloud_->points[node.point_idx_], box_min, box_max)) point_idx.push_back(node.point_idx_);
+            boxSearchRec(node.left_, box_min, box_max, point_idx);
+            boxSearchRec(node.right_, box_min, box_max, point_idx);
+        }
+
+        // squared distance between the point and the bounding box of a node
+        float boxSqDis(const Node &node, const PointT &point) const
+        {
+            float sq_dis = 0;
+            for (int d = 0; d < 3; d++)
+            {
+                float v = coord(point, d);
+                if (v < node.box_min_[d]) sq_dis += (node.box_min_[d] - v) * (node.box_min_[d] - v);
+                else if (v > node.box_max_[d]) sq_dis += (v - node.box_max_[d]) * (v - node.box_max_[d]);
+            }
+            return sq_dis;
+        }
+
+        void nearestKSearchRec(const int &id, const PointT &point, const int &k, std::priority_queue<std::pair<float, int> > &heap) const
+        {
+            if (id < 0) return;
+            const Node &node = nodes_[id];
+            if (node.invalid_num_ == node.size_) return;
+            if (int(heap.size()) == k && boxSqDis(node, point) >= heap.top().first) return;
+            if (!node.deleted_)
+            {
+                float sq_dis = sqDis(cloud_->points[node.point_idx_], point);
+                if (int(heap.size()) < k)
+                {
+                    heap.push(std::make_pair(sq_dis, node.point_idx_));
+                }
+                else if (sq_dis < heap.top().first)
+                {
+                    heap.pop();
+                    heap.push(std::make_pair(sq_dis, node.point_idx_));
+                }
+            }
+            // visit the nearer child first
+            int first = node.left_, second = node.right_;
+            if (node.left_ >= 0 && node.right_ >= 0 && boxSqDis(nodes_[node.right_], point) < boxSqDis(nodes_[node.left_], point))
+                std::swap(first, second);
+            nearestKSearchRec(first, point, k, heap);
+            nearestKSearchRec(second, point, k, heap);
+        }
+
+        bool needCompact() const
+        {
+            return cloud_->size() > MIN_REBUILD_SIZE && size() < (1.0f - delete_param_) * cloud_->size();
+        }
+
+        // drop the deleted points from the pool and rebuild the whole tree; invalidates previous indices
+        void compact()
+        {
+            typename PointCloud::Ptr cloud_valid(new PointCloud());
+            cloud_valid->reserve(size());
+            std::vector<int> point_idx;
+            if (root_ >= 0) collectValid(root_, point_idx);
+            for (const int &idx : point_idx) cloud_valid->push_back(cloud_->points[idx]);
+            build(*cloud_valid);
+        }
+
+        static const int MIN_REBUILD_SIZE = 10;
+
+        float delete_param_;
+        float balance_param_;
+        float downsample_size_;
+
+        int root_;
+        std::vector<Node> nodes_;
+        std::vector<int> free_nodes_;
+        typename PointCloud::Ptr cloud_;
+    };
+}
+
+#endif
@@ -0,0 +1,73 @@
+// rosrun mloam_test test_timing_benchmark [iterations] [threads]
+// measure the overhead of the common::timing timers per Start/Stop pair
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "common/timing.hpp"
+
+using namespace common;
+
+// the ns per iteration of func
+template <typename Func>
+double measure(const size_t &num_iter, Func func)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_iter; i++) func(i);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / num_iter;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t num_iter = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 10000000;
+    size_t num_thread = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 4;
+
+    volatile double sink = 0;
+    double t_empty = measure(num_iter, [&](size_t i) { sink = sink + i; });
+    double t_clock = measure(num_iter, [&](size_t) {
+        sink = sink + std::chrono::steady_clock::now().time_since_epoch().count();
+    });
+    double t_tag = measure(num_iter, [&](size_t) {
+        timing::Timer timer("bench_tag");
+        sink = sink + timer.Stop();
+    });
+    double t_handle = measure(num_iter, [&](size_t) {
+        timing::Timer timer(TIMING_HANDLE("bench_handle"));
+        sink = sink + timer.Stop();
+    });
+    timing::Timer count_timer(TIMING_HANDLE("bench_count"));
+    double t_count = measure(num_iter, [&](size_t) { sink = sink + count_timer.GetCountTime(); });
+    count_timer.Stop();
+
+    // every thread records the same handle into its own accumulators, the wall time per pair of all threads
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < num_thread; k++)
+    {
+        threads.push_back(std::thread([&]() {
+            measure(num_iter, [&](size_t) {
+                timing::Timer timer(TIMING_HANDLE("bench_thread"));
+                timer.Stop();
+            });
+        }));
+    }
+    for (std::thread &t : threads) t.join();
+    double t_thread = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                      (num_iter * num_thread);
+
+    printf("MLOAM_ENABLE_TIMING: %d, iterations: %lu\n", MLOAM_ENABLE_TIMING, num_iter);
+    printf("empty loop:                     %7.2f ns\n", t_empty);
+    printf("steady_clock::now():            %7.2f ns\n", t_clock);
+    printf("Timer(tag) + Stop():            %7.2f ns\n", t_tag);
+    printf("Timer(TIMING_HANDLE) + Stop():  %7.2f ns\n", t_handle);
+    printf("GetCountTime():                 %7.2f ns\n", t_count);
+    printf("Timer(TIMING_HANDLE) + Stop() in %lu threads: %7.2f ns\n", num_thread, t_thread);
+    printf("samples of bench_thread: %lu (expected %lu)\n",
+           timing::Timing::GetNumSamples("bench_thread"), num_iter * num_thread);
+    timing::Timing::Print(std::cout);
+    return 0;
+}